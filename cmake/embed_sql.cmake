@@ -0,0 +1,26 @@
+# Генерирует C-файл со встроенными SQL-скриптами (вызывается при сборке).
+# Usage: cmake -DOUTPUT=<file.c> -DSCRIPTS="<symbol>=<path>|..." -P embed_sql.cmake
+# Every script becomes a NUL-terminated `const char <symbol>[]`.
+
+set(content "// Generated by cmake/embed_sql.cmake from docs/*.sql. Do not edit.\n\n#include \"embedded_sql.h\"\n\n")
+string(REPLACE "|" ";" SCRIPTS "${SCRIPTS}")
+foreach(entry IN LISTS SCRIPTS)
+    string(FIND "${entry}" "=" eq)
+    string(SUBSTRING "${entry}" 0 ${eq} symbol)
+    math(EXPR path_start "${eq} + 1")
+    string(SUBSTRING "${entry}" ${path_start} -1 path)
+
+    file(READ "${path}" hex HEX)
+    # The cast keeps bytes above 0x7f (UTF-8 comments) valid for a signed char
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "(char)0x\\1," bytes "${hex}")
+    string(APPEND content "// ${path}\nconst char ${symbol}[] = {${bytes}0x00};\n\n")
+endforeach()
+
+# Rewrite only on change so dependent objects are not rebuilt needlessly
+set(previous "")
+if(EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if(NOT previous STREQUAL content)
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
@@ -1,3 +1,6 @@
+-- Baseline schema (version 1). Later changes are migrations in
+-- src/migrations.c; this file is not edited once released.
+
 -- Enable foreign key support
 PRAGMA foreign_keys = ON;
 
@@ -0,0 +1,44 @@
+#ifndef AGGREGATES_H
+#define AGGREGATES_H
+
+#include <sqlite3.h>
+#include <stdio.h>
+
+// Maintained aggregates over Deals: BrokerStats (per broker), GoodStats and
+// TypeStats (per good and type, behind the leaderboards) and DailySales (per
+// deal_date and good, behind the period sales summary). Every mutation
+// of Deals applies only its own delta here, inside the caller's transaction,
+// instead of re-aggregating the whole Deals table. Revenue comes from the
+// unit_price recorded on each deal, so price changes do not affect them.
+
+/**
+ * @brief Adds (sign = +1) or subtracts (sign = -1) the deals with
+ * deal_id in [first_id, last_id] to/from the maintained aggregates.
+ * Call after inserting the deals, or before deleting them.
+ * @return 0 on success, SQLite error code on failure.
+ */
+int aggregates_apply_deal_range(sqlite3_int64 first_id, sqlite3_int64 last_id,
+                                int sign);
+
+/**
+ * @brief Subtracts all deals with deal_date <= day (Task 5 purge).
+ * Call before the deals are deleted.
+ * @param day Day number (see dates.h).
+ * @return 0 on success, SQLite error code on failure.
+ */
+int aggregates_apply_purge(int day);
+
+/**
+ * @brief Rebuilds every maintained aggregate from Deals from scratch.
+ * @return 0 on success, SQLite error code on failure.
+ */
+int aggregates_rebuild(void);
+
+/**
+ * @brief Compares the maintained aggregates with a full recomputation and
+ * prints every mismatch to out. With repair != 0, rebuilds on mismatch.
+ * @return Number of mismatching rows (0 = consistent), or -1 on error.
+ */
+int aggregates_verify(int repair, FILE *out);
+
+#endif // AGGREGATES_H
@@ -0,0 +1,75 @@
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// --- In-memory columnar engine for the Task 2 reports ---
+// An optional copy of Deals as a struct of arrays: day number, good, type,
+// quantity, unit price, broker and buyer, one contiguous array each. Names
+// are dictionary-encoded: the integer keys of Deals index lookup arrays of
+// dictionary codes, so the reports group and filter on integers and compare
+// strings only to order the output. The reports run as tight block loops
+// over these arrays and print the same tables as their SQL counterparts in
+// queries.c (analytics_cross_check compares the two).
+//
+// The store follows the calling thread's connection: every report first
+// calls analytics_sync(), which appends the deals and lookup rows added since
+// the last sync (new ids are always larger) and reloads everything if rows
+// were deleted. With nothing committed in between, the check costs one
+// PRAGMA data_version. Deals rows are never updated in place.
+
+typedef struct AnalyticsStore AnalyticsStore;
+
+/**
+ * @brief Creates an empty store; the first analytics_sync() loads it.
+ * @return The store, or NULL on allocation failure.
+ */
+AnalyticsStore *analytics_create(void);
+
+/**
+ * @brief Brings the store up to date with the calling thread's connection.
+ * @return SQLITE_OK on success, SQLite error code on failure (the store is
+ * then empty and the next sync reloads it).
+ */
+int analytics_sync(AnalyticsStore *store);
+
+/**
+ * @brief Returns the number of deals held by the store.
+ */
+size_t analytics_deal_count(const AnalyticsStore *store);
+
+/**
+ * @brief Frees the store. Accepts NULL.
+ */
+void analytics_destroy(AnalyticsStore *store);
+
+// --- Reports: same columns, rows and order as the SQL reports; each
+// prints a table to out and returns SQLITE_OK or an SQLite error code.
+int analytics_sales_summary(AnalyticsStore *store, const char *start_date,
+                            const char *end_date, FILE *out);
+int analytics_buyers_by_good(AnalyticsStore *store,
+                             const char *good_name_filter, FILE *out);
+int analytics_most_popular_type(AnalyticsStore *store, FILE *out);
+int analytics_top_broker(AnalyticsStore *store, FILE *out);
+int analytics_supplier_brokers(AnalyticsStore *store,
+                               const char *supplier_filter, FILE *out);
+
+/**
+ * @brief All Task 2 reports from one sync, with the titles and order of
+ * query_report_bundle() (buyers and suppliers unfiltered).
+ * @return SQLITE_OK if every report succeeded, otherwise the first error.
+ */
+int analytics_report_bundle(AnalyticsStore *store, const char *start_date,
+                            const char *end_date, FILE *out);
+
+/**
+ * @brief Runs every report of the bundle through both the store and SQL and
+ * compares the printed tables. Differing reports are named on out (may be
+ * NULL) with both tables.
+ * @return Number of differing reports (0 = identical), or -1 on error.
+ */
+int analytics_cross_check(AnalyticsStore *store, const char *start_date,
+                          const char *end_date, FILE *out);
+
+#endif // ANALYTICS_H
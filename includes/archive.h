@@ -0,0 +1,85 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "db.h"
+
+// --- Per-month archive of purged deals ---
+// The archival Task 5 purge (archive_deals_up_to in queries.c) moves old
+// deals into one SQLite file per calendar month, <archive_dir>/deals_YYYY-MM.db
+// (ArchiveSettings), attached to the main connection while that month is
+// written. Archived rows keep the DealDetails columns, names instead of keys,
+// so they stay readable after the goods, brokers or buyers they name are
+// gone. The manifest table DealArchive in the main database lists every
+// month file with its day range and totals; reports that include the archive
+// copy the months they need into temp.ArchivedDeals (same columns).
+
+typedef struct {
+  char dir[256];  // archive_dir: where the month files live
+  int chunk_size; // archive_chunk_size: most deals moved per transaction
+} ArchiveSettings;
+
+extern const DbSettingKey archive_setting_keys[];
+
+/**
+ * @brief Returns the settings in effect ("archive", 10000 until set).
+ */
+const ArchiveSettings *archive_get_settings(void);
+
+/**
+ * @brief Replaces the settings in effect.
+ */
+void archive_set_settings(const ArchiveSettings *settings);
+
+/**
+ * @brief Attaches the archive file of the month containing day as schema
+ * "archive_month", creating the directory, file and table if needed.
+ * Must be called outside a transaction.
+ * @return SQLITE_OK on success, SQLite error code on failure.
+ */
+int archive_attach_month(int day);
+
+/**
+ * @brief Detaches the month attached by archive_attach_month().
+ * @return SQLITE_OK on success, SQLite error code on failure.
+ */
+int archive_detach_month(void);
+
+/**
+ * @brief Copies the deals with deal_date in [first_day, last_day] into the
+ * attached month (INSERT OR REPLACE on deal_id, so copying again is
+ * harmless). Run it in a transaction of its own and commit it before any
+ * deal is deleted: a WAL commit is atomic per file only, and SQLite commits
+ * main before the attached file. The range must lie within the attached
+ * month.
+ * @param copied Receives the number of deals copied; may be NULL.
+ * @return SQLITE_OK on success, SQLite error code on failure.
+ */
+int archive_copy_deals(int first_day, int last_day, int *copied);
+
+/**
+ * @brief Second step, inside the transaction that deletes the deals: counts
+ * the deals of Deals dated up to last_day that the attached month does not
+ * hold (recorded since the copy). If there are none, adds
+ * [first_day, last_day] to the manifest; otherwise the caller must roll back
+ * and copy again.
+ * @param missing Receives the number of such deals.
+ * @return SQLITE_OK on success, SQLite error code on failure.
+ */
+int archive_confirm_deals(int first_day, int last_day, int *missing);
+
+/**
+ * @brief Fills temp.ArchivedDeals with the archived deals dated within
+ * [first_day, last_day], reading only the month files that overlap it.
+ * Must be called outside a transaction.
+ * @return SQLITE_OK on success (also with nothing archived), SQLite error
+ * code on failure, SQLITE_CANTOPEN if a listed month file is missing.
+ */
+int archive_load_range(int first_day, int last_day);
+
+/**
+ * @brief Returns the number of archived months in the manifest, or -1 on
+ * error.
+ */
+int archive_month_count(void);
+
+#endif // ARCHIVE_H
@@ -1,12 +1,14 @@
 #ifndef AUTH_H
 #define AUTH_H
 
+#include "db.h"
 #include <stddef.h> // For size_t
 
 #define MAX_USERNAME_LEN 50
 #define MAX_ROLE_LEN 10
 #define MAX_BROKER_SURNAME_LEN 100
 #define MAX_PASSWORD_LEN 100 // Макс. длина пароля
+#define AUTH_HASH_SIZE 128   // Buffer for a stored password hash
 
 // Structure to hold logged-in user info
 typedef struct {
@@ -14,13 +16,50 @@ typedef struct {
   char role[MAX_ROLE_LEN];                     // "admin" or "broker"
   char broker_surname[MAX_BROKER_SURNAME_LEN]; // Filled if role is "broker"
   int is_authenticated;
-  // Временное поле для хранения введенного пароля для проверки
-  char current_password_attempt[MAX_PASSWORD_LEN];
 } UserSession;
 
+// --- Password hashes ---
+// Stored as "pbkdf2-sha256$<iterations>$<salt, 32 hex>$<key, 64 hex>":
+// PBKDF2-HMAC-SHA256 (sha256.h) with a random 16-byte salt per user. New
+// hashes use password_iterations (AuthSettings); a stored hash is checked with
+// its own count, and login_user() rehashes it after a successful login when
+// the count differs (or it is a legacy unsalted "hashed_<password>" value).
+//
+// A successful login is remembered in this process for login_cache_ttl_s
+// (AuthSettings): the same user and password are then accepted without running
+// PBKDF2 while the stored hash is unchanged. Entries hold an HMAC of the
+// password under a random per-process key, never the password itself. Failed
+// logins always pay the full hash; an unknown username is hashed against a
+// fixed dummy salt, so the response time does not tell whether it exists.
+
+typedef struct {
+  int password_iterations; // PBKDF2 cost of new password hashes (100000)
+  int login_cache_ttl_s;   // Verified logins remembered (300); 0 = off
+} AuthSettings;
+
+extern const DbSettingKey auth_setting_keys[];
+
+/**
+ * @brief Returns the settings in effect.
+ */
+const AuthSettings *auth_get_settings(void);
+
+/**
+ * @brief Replaces the settings in effect.
+ */
+void auth_set_settings(const AuthSettings *settings);
+
+// Login counters of the process
+typedef struct {
+  unsigned long long hashes;     // PBKDF2 computations (verify and hash)
+  unsigned long long cache_hits; // Logins accepted from the login cache
+  unsigned long long rehashes;   // Stored hashes upgraded on login
+} AuthStats;
+
 /**
- * @brief Attempts to authenticate a user.
- * Uses placeholder hashing/verification.
+ * @brief Attempts to authenticate a user. The user row is read with a cached
+ * prepared statement; the password is checked against the login cache, then
+ * with verify_password().
  * @param username Input username.
  * @param password Input password (plaintext).
  * @param session Pointer to UserSession structure to fill on success.
@@ -30,18 +69,45 @@ int login_user(const char *username, const char *password,
                UserSession *session);
 
 /**
- * @brief Placeholder for password hashing (replace with actual hashing).
+ * @brief Hashes a password for storage with password_iterations and a fresh
+ * salt.
+ * @param hashed_output Receives the hash; at least AUTH_HASH_SIZE bytes (an
+ * empty string if smaller).
  */
 void hash_password(const char *password, char *hashed_output,
                    size_t output_size);
 
 /**
- * @brief Placeholder for password verification (replace with actual hash
- * comparison). Compares hash(password) with hash_from_db.
+ * @brief Checks a password against a stored hash (PBKDF2 or legacy), in time
+ * independent of where the values differ.
  * @param password The plaintext password attempt.
  * @param hash_from_db The hash stored in the database.
- * @return 1 if match, 0 otherwise.
+ * @return 1 if match, 0 otherwise (also for an unknown hash format).
  */
 int verify_password(const char *password, const char *hash_from_db);
 
-#endif // AUTH_H
\ No newline at end of file
+/**
+ * @brief Whether a stored hash should be replaced: legacy format, or another
+ * iteration count than password_iterations.
+ * @return 1 if so, 0 otherwise.
+ */
+int password_needs_rehash(const char *hash_from_db);
+
+/**
+ * @brief Replaces every legacy "hashed_<password>" value in Users with a
+ * PBKDF2 hash of the password it contains (schema migration 9).
+ * @return SQLITE_OK on success, SQLite error code on failure.
+ */
+int auth_upgrade_legacy_hashes(void);
+
+/**
+ * @brief Forgets every remembered login.
+ */
+void auth_login_cache_clear(void);
+
+/**
+ * @brief Copies the login counters of the process.
+ */
+void auth_get_stats(AuthStats *stats);
+
+#endif // AUTH_H
@@ -0,0 +1,74 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include "auth.h"
+#include "queries.h"
+#include <stdio.h>
+
+// --- Non-interactive batch mode ---
+// The menu operations as subcommands, e.g.
+//   report sales --from 2024-01-01 --to 2024-12-31
+//   add deal --date 2024-05-01 --good "Eau de Lune" --supplier ... --quantity 2
+// run on the connection the caller has opened, with the role checks of the
+// menus (a broker may run what the broker menu offers, on their own deals).
+// A script holds one command per line, so many reports and mutations share
+// one process, connection and warmed statement and report caches.
+// "help" lists the commands.
+
+#define CLI_MAX_WORDS 32 // Words of one command line
+
+/**
+ * @brief Logs in without prompts. Credentials are read from the file
+ * credentials_path ("user = NAME" and "password = SECRET" lines, '#' starts
+ * a comment; warns if others may read it) or, if it is NULL, from
+ * PERFUME_CREDENTIALS (a file path) or PERFUME_USER and PERFUME_PASSWORD.
+ * @return 0 on success, 1 on bad or missing credentials, -1 on error.
+ */
+int cli_login(const char *credentials_path, UserSession *session);
+
+/**
+ * @brief Runs one command given as words (argv[0] is the group, e.g.
+ * "report"). Tables and messages go to out, argument and role errors to err
+ * (the same stream is fine); database errors and DEBUG lines still go to
+ * stdout and stderr.
+ * @return 0 on success, 2 for an unknown command or invalid arguments, 3 if
+ * the role may not run it, 1 if it failed.
+ */
+int cli_run_command(const UserSession *session, int argc, char **argv,
+                    FILE *out, FILE *err);
+
+/**
+ * @brief Parses an "add deal" command like cli_run_command() would, without
+ * recording the deal: for callers that record it elsewhere (the group commit
+ * of the server, deal_writer.h). deal points into argv.
+ * @return -1 if argv is another command; otherwise 0, or the usage or role
+ * error code with its message printed to err.
+ */
+int cli_parse_deal(const UserSession *session, int argc, char **argv,
+                   DealInput *deal, FILE *err);
+
+/**
+ * @brief Prints the outcome of a deal to out as "add deal" does.
+ * @return 0 for a recorded deal, otherwise 1.
+ */
+int cli_report_deal(const DealInput *deal, DealResult result, FILE *out);
+
+/**
+ * @brief Splits a script line into words in place: whitespace separates
+ * words, "double quotes" keep spaces (\" and \\ escape inside them), '#'
+ * outside quotes starts a comment.
+ * @return Number of words, or -1 for an unterminated quote or too many
+ * words.
+ */
+int cli_split_line(char *line, char **words, int max_words);
+
+/**
+ * @brief Runs every command of a script; name is used in messages. Stops at
+ * the first failing command unless keep_going.
+ * @return 0 if all commands succeeded, otherwise the code of the last
+ * failure (see cli_run_command).
+ */
+int cli_run_script(const UserSession *session, FILE *in, const char *name,
+                   int keep_going);
+
+#endif // CLI_H
@@ -0,0 +1,29 @@
+#ifndef DATES_H
+#define DATES_H
+
+// Calendar dates are stored as day numbers: days since 1970-01-01 in the
+// proleptic Gregorian calendar, in columns declared DATE (Deals.deal_date,
+// Goods.expiry_date, DailySales.sale_date). The 'YYYY-MM-DD' text form exists
+// only at the input/output boundary.
+
+#define DATE_TEXT_SIZE 11 // "YYYY-MM-DD" + NUL
+
+/**
+ * @brief Parses a strict 'YYYY-MM-DD' (year 0001-9999, a real calendar day,
+ * nothing before or after).
+ * @param days Receives the day number; may be NULL to only validate.
+ * @return 0 on success, -1 if text is not such a date.
+ */
+int date_parse(const char *text, int *days);
+
+/**
+ * @brief Formats a day number as 'YYYY-MM-DD'.
+ */
+void date_format(int days, char out[DATE_TEXT_SIZE]);
+
+/**
+ * @brief Day numbers of the first and last day of the month containing days.
+ */
+void date_month_range(int days, int *first_day, int *last_day);
+
+#endif // DATES_H
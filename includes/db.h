@@ -2,19 +2,178 @@
 #define DB_H
 
 #include <sqlite3.h>
+#include <stdio.h> // For FILE in db_cursor_print
 
-// Global database handle (consider alternatives for larger apps)
-extern sqlite3 *db;
+// Database handle of the calling thread (consider alternatives for larger
+// apps). The main thread owns the writer opened by open_db(); report workers
+// each open their own read-only handle with open_db_readonly().
+extern _Thread_local sqlite3 *db;
+
+// --- Typed bind parameters (replace snprintf interpolation) ---
+typedef enum {
+  DB_PARAM_NULL = 0,
+  DB_PARAM_INT,
+  DB_PARAM_DOUBLE,
+  DB_PARAM_TEXT
+} DbParamType;
+
+typedef struct {
+  DbParamType type;
+  union {
+    sqlite3_int64 i;
+    double d;
+    const char *s; // Not copied: must stay valid until the statement runs
+  } value;
+} DbParam;
+
+#define DB_NULL() ((DbParam){.type = DB_PARAM_NULL})
+#define DB_INT(x) ((DbParam){.type = DB_PARAM_INT, .value.i = (x)})
+#define DB_DOUBLE(x) ((DbParam){.type = DB_PARAM_DOUBLE, .value.d = (x)})
+#define DB_TEXT(x) ((DbParam){.type = DB_PARAM_TEXT, .value.s = (x)})
+// Number of elements in a DbParam array literal
+#define DB_PARAM_COUNT(arr) ((int)(sizeof(arr) / sizeof((arr)[0])))
+
+// Counters of the prepared-statement cache
+typedef struct {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  int entries;
+} StmtCacheStats;
+
+// --- Streaming cursor over a SELECT ---
+// Rows are stepped one at a time straight from the prepared statement, so
+// memory use is constant regardless of the result size. Column accessors do
+// not copy: text pointers stay valid until the next db_cursor_next() or
+// db_cursor_close().
+typedef struct {
+  sqlite3_stmt *stmt;
+  int column_count;
+  int rc; // Result of the last step (SQLITE_ROW, SQLITE_DONE or an error)
+} DbCursor;
+
+// --- Forced join order ---
+// Joins Deals to the next table without letting the planner reorder them
+// (SQLite never moves the left operand of CROSS JOIN inward). For the
+// statements that read a deal_date range or all of Deals and join Goods or
+// Brokers: left alone, the planner scans the lookup table and probes
+// idx_deals_good or idx_deals_broker_date once per row, reading Deals out of
+// rowid order. ANALYZE (sqlite_stat1) does not change that plan.
+#define SQL_DEALS_OUTER_JOIN " CROSS JOIN "
+
+// --- Connection profile (PRAGMAs applied by open_db) ---
+// Values equal to DB_PROFILE_UNSET leave the SQLite default untouched.
+#define DB_PROFILE_UNSET -1
+#define DB_PROFILE_DEFAULT_FILE "perfume.conf"
+
+typedef struct {
+  char journal_mode[16];   // DELETE, TRUNCATE, PERSIST, MEMORY, WAL, OFF; ""
+  int synchronous;         // 0=OFF, 1=NORMAL, 2=FULL, 3=EXTRA
+  int cache_size;          // PRAGMA cache_size (negative = KiB); 0 = unset
+  sqlite3_int64 mmap_size; // Bytes mapped for reads
+  int temp_store;          // 0=DEFAULT, 1=FILE, 2=MEMORY
+  int page_size;           // Only applied when the database file is new
+  int busy_timeout_ms;     // Wait on locks instead of failing with SQLITE_BUSY
+  int read_pool_size;      // Read-only connections for parallel reports;
+                           // 0 = one per online CPU
+  int sql_profiler;        // 1 = trace every statement (db_profiler_*)
+  char sql_profile_file[256]; // Dumped by close_db() if profiling; "" = no
+} DbProfile;
+
+/**
+ * @brief Fills the profile with the built-in defaults (WAL, synchronous=FULL,
+ * 16 MiB page cache, 5 s busy timeout; everything else left to SQLite).
+ */
+void db_profile_defaults(DbProfile *profile);
+
+/**
+ * @brief Sets one key from its text value: a connection key of the profile
+ * ("journal_mode", "synchronous", "cache_size", "mmap_size", "temp_store",
+ * "page_size", "busy_timeout", "read_pool_size", "sql_profiler",
+ * "sql_profile_file"), or a module key of db_setting_tables, which goes
+ * straight to that module's settings.
+ * Symbolic values (WAL, NORMAL, MEMORY, ...) and numbers are accepted.
+ * @return 0 on success, -1 for an unknown key or invalid value.
+ */
+int db_profile_set(DbProfile *profile, const char *key, const char *value);
+
+/**
+ * @brief Reads "key = value" lines ('#' starts a comment) with
+ * db_profile_set().
+ * @return 0 on success, 1 if the file does not exist, -1 on a bad line.
+ */
+int db_profile_load_file(DbProfile *profile, const char *path);
+
+/**
+ * @brief Applies PERFUME_DB_<KEY> environment overrides of every key (e.g.
+ * PERFUME_DB_JOURNAL_MODE=WAL, PERFUME_DB_ARCHIVE_DIR=/srv/archive).
+ * @return 0 on success, -1 if any variable holds an invalid value.
+ */
+int db_profile_load_env(DbProfile *profile);
+
+/**
+ * @brief Builds the effective profile and module settings: defaults, then the
+ * config file (PERFUME_DB_CONFIG or DB_PROFILE_DEFAULT_FILE if present), then
+ * environment.
+ * @return 0 on success, -1 on an invalid file or variable.
+ */
+int db_profile_load(DbProfile *profile);
+
+/**
+ * @brief Selects the profile used by subsequent open_db() calls.
+ */
+void db_set_profile(const DbProfile *profile);
+
+/**
+ * @brief Returns the profile used by open_db().
+ */
+const DbProfile *db_get_profile(void);
+
+// --- Module settings (perfume.conf keys outside the connection profile) ---
+// Each module keeps its own settings (built-in defaults until a key is set)
+// and lists the keys it reads from the config file and PERFUME_DB_* in a
+// table ending with {NULL, NULL}. The tables are registered in
+// db_setting_tables (settings.c).
+typedef struct {
+  const char *key;
+  int (*set)(const char *value); // 0 on success, -1 for an invalid value
+} DbSettingKey;
+
+extern const DbSettingKey *const db_setting_tables[]; // NULL-terminated
+
+/**
+ * @brief Parses a decimal integer within [min, max] for a setting handler.
+ * @return 0 on success, -1 if value is not such a number.
+ */
+int db_setting_int(const char *value, long long min, long long max,
+                   long long *out);
+
+/**
+ * @brief Copies a text setting of at most size - 1 bytes (allow_empty = 0
+ * rejects "").
+ * @return 0 on success, -1 if value does not fit or is empty.
+ */
+int db_setting_text(const char *value, char *out, size_t size,
+                    int allow_empty);
 
 /**
  * @brief Opens the SQLite database file.
+ * Enables foreign keys and applies the connection profile (db_set_profile).
  * @param filename Path to the database file.
  * @return 0 on success, non-zero on failure.
  */
 int open_db(const char *filename);
 
 /**
- * @brief Closes the database connection.
+ * @brief Opens a read-only handle for the calling thread. Only the read-side
+ * profile settings (cache_size, mmap_size, temp_store, busy_timeout) apply.
+ * @param filename Path to an existing database file.
+ * @return 0 on success, non-zero on failure.
+ */
+int open_db_readonly(const char *filename);
+
+/**
+ * @brief Closes the calling thread's database connection.
  */
 void close_db();
 
@@ -28,12 +187,242 @@ int execute_non_query(const char *query);
 
 /**
  * @brief Executes an SQL query that returns results (SELECT).
- * Uses the default callback to print results. Prints errors to stderr.
+ * Prints the rows as a table via db_cursor_print. Prints errors to stderr.
  * @param query The SQL query string.
  * @return 0 on success, non-zero on failure.
  */
 int execute_select_query(const char *query);
 
+/**
+ * @brief Executes a non-SELECT statement with bound parameters.
+ * The statement is taken from the statement cache keyed by the SQL text,
+ * so the same template is parsed only once per connection.
+ * @param sql SQL template with '?' placeholders.
+ * @param params Parameters for the placeholders (may be NULL if count is 0).
+ * @param param_count Number of parameters.
+ * @return 0 on success, SQLite error code on failure.
+ */
+int execute_non_query_params(const char *sql, const DbParam *params,
+                             int param_count);
+
+/**
+ * @brief Executes a SELECT with bound parameters and prints the rows as a
+ * table via db_cursor_print.
+ * @param sql SQL template with '?' placeholders.
+ * @param params Parameters for the placeholders (may be NULL if count is 0).
+ * @param param_count Number of parameters.
+ * @return 0 on success, SQLite error code on failure.
+ */
+int execute_select_query_params(const char *sql, const DbParam *params,
+                                int param_count);
+
+/**
+ * @brief Returns a ready-to-bind statement for the SQL text from the cache,
+ * preparing and caching it on first use. Must be paired with
+ * db_release_stmt(). If the cached copy is already in use (nested use of the
+ * same template), an uncached statement is returned instead.
+ * @param sql SQL text (single statement).
+ * @param out_stmt Receives the statement (NULL for comment-only SQL).
+ * @return SQLITE_OK on success, SQLite error code on failure.
+ */
+int db_prepare_cached(const char *sql, sqlite3_stmt **out_stmt);
+
+/**
+ * @brief Returns a statement obtained from db_prepare_cached() to the cache
+ * (reset + cleared bindings), or finalizes it if it was not cached.
+ */
+void db_release_stmt(sqlite3_stmt *stmt);
+
+/**
+ * @brief Binds typed parameters to positions 1..param_count.
+ * @return SQLITE_OK on success, SQLite error code on failure.
+ */
+int db_bind_params(sqlite3_stmt *stmt, const DbParam *params,
+                   int param_count);
+
+/**
+ * @brief Finalizes every cached statement (called by close_db).
+ */
+void db_stmt_cache_clear(void);
+
+/**
+ * @brief Copies the statement cache counters into stats.
+ */
+void db_stmt_cache_get_stats(StmtCacheStats *stats);
+
+// --- SQL profiler (sqlite3_trace_v2) ---
+// Per normalized statement (literals replaced by '?'): calls, total/mean/p99
+// wall time, rows returned and VM steps, across all connections.
+
+/**
+ * @brief Turns profiling on or off for the calling thread's connection and
+ * for every connection opened afterwards (the "sql_profiler" profile key
+ * sets the initial state).
+ */
+void db_profiler_enable(int enabled);
+
+/**
+ * @brief Returns 1 while profiling is on.
+ */
+int db_profiler_is_enabled(void);
+
+/**
+ * @brief Discards all collected statistics.
+ */
+void db_profiler_reset(void);
+
+/**
+ * @brief Prints the statistics sorted by total time.
+ * @param limit Maximum number of statements (0 = all).
+ * @param sql_width Characters of SQL per line (0 = full text).
+ * @return 0 on success, -1 on allocation failure.
+ */
+int db_profiler_print(FILE *out, int limit, int sql_width);
+
+/**
+ * @brief Writes the full statistics to a file (also done by close_db() for
+ * the writer connection when the profile enables it).
+ * @return 0 on success, -1 on failure.
+ */
+int db_profiler_dump(const char *path);
+
+// --- Query budgets and cancellation (sqlite3_progress_handler) ---
+// A read-only statement run through a cursor or execute_non_query_params()
+// fails with SQLITE_INTERRUPT once it runs longer than query_time_limit_ms
+// or more than query_step_limit VM steps (checked every 10000 steps), and
+// reports its progress on stderr every query_progress_ms. The message names
+// the limit. Write statements are never limited, only cancelled.
+
+typedef struct {
+  int time_limit_ms;    // query_time_limit_ms; 0 = unlimited
+  long long step_limit; // query_step_limit; 0 = unlimited
+  int progress_ms;      // query_progress_ms; 0 = no progress lines
+} DbQueryLimits;
+
+extern const DbSettingKey db_query_limit_keys[];
+
+/**
+ * @brief Returns the limits in effect (none until set).
+ */
+const DbQueryLimits *db_get_query_limits(void);
+
+/**
+ * @brief Replaces the limits for the statements armed from now on.
+ */
+void db_set_query_limits(const DbQueryLimits *limits);
+
+typedef enum {
+  DB_STOP_NONE,
+  DB_STOP_TIME_LIMIT,
+  DB_STOP_STEP_LIMIT,
+  DB_STOP_CANCELLED
+} DbStopReason;
+
+/**
+ * @brief Stops the statements running on all connections (they fail with
+ * SQLITE_INTERRUPT, via sqlite3_interrupt on the calling thread's one).
+ * Async-signal-safe: meant for a SIGINT handler.
+ * @return 1 if a statement was running, 0 if none was.
+ */
+int db_cancel_running(void);
+
+/**
+ * @brief Why the calling thread's last statement was stopped.
+ */
+DbStopReason db_last_stop_reason(void);
+
+/**
+ * @brief Opens a cursor over a SELECT with bound parameters. The statement
+ * comes from the statement cache and goes back to it on db_cursor_close().
+ * @return SQLITE_OK on success, SQLite error code on failure (the cursor is
+ * then closed and safe to pass to db_cursor_close()).
+ */
+int db_cursor_open(DbCursor *cur, const char *sql, const DbParam *params,
+                   int param_count);
+
+/**
+ * @brief Advances to the next row.
+ * @return SQLITE_ROW if a row is available, SQLITE_DONE at the end, or an
+ * SQLite error code.
+ */
+int db_cursor_next(DbCursor *cur);
+
+/**
+ * @brief Typed accessors for column i (0-based) of the current row.
+ * db_cursor_type() returns SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT,
+ * SQLITE_BLOB or SQLITE_NULL. db_cursor_text() returns NULL for SQL NULL and
+ * stores the byte length in *len if len is not NULL.
+ */
+int db_cursor_type(const DbCursor *cur, int i);
+const char *db_cursor_name(const DbCursor *cur, int i);
+sqlite3_int64 db_cursor_int64(const DbCursor *cur, int i);
+double db_cursor_double(const DbCursor *cur, int i);
+const char *db_cursor_text(const DbCursor *cur, int i, int *len);
+
+/**
+ * @brief Releases the cursor's statement. Safe to call more than once.
+ */
+void db_cursor_close(DbCursor *cur);
+
+/**
+ * @brief Drains the remaining rows of the cursor as a text table (header
+ * plus one line per row, written with a single call per row).
+ * @return SQLITE_OK after the last row, or the SQLite error code.
+ */
+int db_cursor_print(DbCursor *cur, FILE *out);
+
+/**
+ * @brief Like db_cursor_print, but stops after max_rows rows (all of them if
+ * max_rows is negative). The last printed row stays the current row, so its
+ * columns can still be read, and the next db_cursor_next() continues after it.
+ * @return SQLITE_ROW if it stopped at max_rows, SQLITE_OK after the last row,
+ * or the SQLite error code.
+ */
+int db_cursor_print_rows(DbCursor *cur, FILE *out, long max_rows);
+
+// --- Text tables in the layout of db_cursor_print ---
+// For rows that do not come from a cursor (e.g. the analytics engine), so
+// both produce byte-identical tables: text left-aligned in 20 columns,
+// numbers right-aligned in 12, doubles with two decimals.
+#define DB_VALUE_DATE (-1) // Day number shown as YYYY-MM-DD (dates.h)
+
+typedef struct {
+  int type; // SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, SQLITE_NULL or
+            // DB_VALUE_DATE
+  sqlite3_int64 i;
+  double d;
+  const char *s; // Not copied
+  int len;       // Byte length of s; -1 = NUL-terminated
+} DbValue;
+
+typedef struct {
+  FILE *out;
+  char *data; // Line buffer
+  size_t len;
+  size_t cap;
+  long rows;
+} DbTableWriter;
+
+/**
+ * @brief Starts a table written to out.
+ */
+void db_table_begin(DbTableWriter *table, FILE *out);
+
+/**
+ * @brief Writes one row (preceded by the header line before the first row).
+ * @param names Column names; only read for the first row.
+ * @return SQLITE_OK on success, SQLITE_NOMEM on allocation failure.
+ */
+int db_table_row(DbTableWriter *table, const char *const *names,
+                 const DbValue *values, int count);
+
+/**
+ * @brief Writes the "(N rows)" footer if rc is SQLITE_OK and frees the line
+ * buffer.
+ * @return rc.
+ */
+int db_table_end(DbTableWriter *table, int rc);
+
 /**
  * @brief Default callback function for sqlite3_exec to print results.
  */
@@ -47,10 +436,29 @@ int default_callback(void *NotUsed, int argc, char **argv, char **azColName);
 int execute_sql_from_file(const char *filename);
 
 /**
- * @brief Initializes database tables by executing schema script if tables don't exist.
- * @param schema_file Path to the SQL schema file (e.g., "database_schema.sql").
+ * @brief Executes every statement of an in-memory SQL script in order,
+ * preparing each one only when the previous one has finished.
+ * @param sql NUL-terminated script (e.g., embedded_schema_sql).
+ * @param name Script name for diagnostics.
+ * @return SQLITE_OK on success, SQLite error code of the failing statement.
+ */
+int execute_sql_script(const char *sql, const char *name);
+
+/**
+ * @brief Brings the schema to the latest version (see migrations.h): creates
+ * and seeds an empty database from the scripts, upgrades an older one, and
+ * returns after one PRAGMA user_version read when it is already current.
+ * @param schema_file NULL for the schema and seed data built into the
+ * program, or a schema file to use instead (seeded from "seed_data.sql" in
+ * the current directory, if present).
  * @return 0 on success, non-zero on failure.
  */
 int init_tables_if_needed(const char *schema_file);
 
+/**
+ * @brief Checks whether a table exists in the main schema.
+ * @return 1 if found, 0 if not, -1 on error.
+ */
+int table_exists(const char *table_name);
+
 #endif // DB_H
@@ -0,0 +1,93 @@
+#ifndef DB_MEMORY_H
+#define DB_MEMORY_H
+
+#include "db.h"
+#include <stdio.h>
+
+// --- SQLite memory configuration and accounting ---
+// Set up once, before the first connection (sqlite3_config only works
+// before sqlite3_initialize), from these settings:
+// - page_cache_kb: one arena for the page caches of all connections
+//   (SQLITE_CONFIG_PAGECACHE); pages that do not fit come from the heap and
+//   show up as overflow.
+// - mem_pool_kb: SQLite's allocator (SQLITE_CONFIG_MALLOC) serves blocks of
+//   up to 512 bytes (statements, cursors, records) from free lists over an
+//   arena in four size classes, instead of malloc/free. A full class falls
+//   back to the system allocator. This stands in for the lookaside when
+//   SQLite is built without one (SQLITE_OMIT_LOOKASIDE). Off by default: one
+//   mutex guards all classes, so threads on other cores (report pool, deal
+//   writer) would contend for it.
+// - lookaside_slot_size x lookaside_slots: SQLITE_CONFIG_LOOKASIDE.
+// The allocator counts its calls whether or not the pool is on. The soft heap
+// limit (soft_heap_limit_kb) is applied on every open, so it can change.
+
+typedef struct {
+  int page_cache_kb;       // Page cache arena shared by all connections;
+                           // 0 = pages from the heap
+  int mem_pool_kb;         // Arena for SQLite's small blocks; 0 = off
+  int lookaside_slot_size; // Default lookaside of each connection;
+  int lookaside_slots;     // 0 = SQLite's own default
+  int soft_heap_limit_kb;  // sqlite3_soft_heap_limit64; 0 = no limit
+} DbMemorySettings;
+
+extern const DbSettingKey db_memory_setting_keys[];
+
+/**
+ * @brief Returns the settings in effect (all 0 until set).
+ */
+const DbMemorySettings *db_memory_get_settings(void);
+
+/**
+ * @brief Replaces the settings that the next db_memory_configure() call of
+ * open_db applies.
+ */
+void db_memory_set_settings(const DbMemorySettings *settings);
+
+// Memory counters of the whole process
+typedef struct {
+  sqlite3_int64 heap_used;       // SQLITE_STATUS_MEMORY_USED, bytes
+  sqlite3_int64 heap_peak;
+  sqlite3_int64 allocations;     // Outstanding (SQLITE_STATUS_MALLOC_COUNT)
+  sqlite3_int64 largest_request; // SQLITE_STATUS_MALLOC_SIZE high-water mark
+  sqlite3_int64 page_slots;      // Slots in the page cache arena
+  sqlite3_int64 page_slots_used; // SQLITE_STATUS_PAGECACHE_USED
+  sqlite3_int64 page_slots_peak;
+  sqlite3_int64 page_overflow;   // Page bytes from the heap (overflow)
+  sqlite3_int64 page_overflow_peak;
+  sqlite3_int64 soft_heap_limit; // Bytes, 0 = none
+  // Allocator calls since the start (monotonic, for deltas per operation)
+  unsigned long long mallocs;
+  unsigned long long reallocs;
+  unsigned long long frees;
+  unsigned long long bytes_requested; // By malloc and realloc
+  unsigned long long pool_hits;       // Blocks served by the pool
+  unsigned long long pool_misses;     // Small blocks the full pool declined
+  unsigned long long heap_calls;      // malloc/realloc/free that reached the
+                                      // system allocator
+  sqlite3_int64 pool_blocks;          // Blocks in the pool arena
+  sqlite3_int64 pool_blocks_used;
+  sqlite3_int64 pool_blocks_peak;
+} DbMemoryStats;
+
+/**
+ * @brief Installs the allocator, page cache arena and lookaside of the
+ * settings the first time it is called (open_db does), then applies the soft
+ * heap limit. Without effect, apart from the limit, if SQLite was already
+ * initialized. Page cache slots are sized for the profile's page_size.
+ * @return 0 on success, -1 if the arenas could not be set up (SQLite then
+ * keeps its defaults).
+ */
+int db_memory_configure(const DbMemorySettings *settings);
+
+/**
+ * @brief Fills stats from sqlite3_status64 and the allocator's counters.
+ */
+void db_memory_get_stats(DbMemoryStats *stats);
+
+/**
+ * @brief Prints the memory report: heap, page cache arena, pool, allocator
+ * calls, and the calling thread's connection (sqlite3_db_status).
+ */
+void db_memory_print(FILE *out);
+
+#endif // DB_MEMORY_H
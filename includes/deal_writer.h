@@ -0,0 +1,76 @@
+#ifndef DEAL_WRITER_H
+#define DEAL_WRITER_H
+
+#include "queries.h"
+
+// --- Group commit for deal inserts ---
+// One writer thread with its own connection takes deals from a submission
+// queue and records a batch of them in one transaction: it waits up to
+// window_ms after the first queued deal for others to join, or until
+// max_batch are queued, and deals submitted while a batch commits form the
+// next one. Every deal runs insert_deal() inside the batch's transaction, so
+// it gets its own result ("insufficient quantity" rolls back only that deal)
+// while the whole batch shares one commit and one sync.
+
+typedef struct DealWriter DealWriter;
+
+/**
+ * @brief Called on the writer thread once the deal's batch has committed (or
+ * failed to). The submission may be freed from here on.
+ */
+typedef void (*DealWriterDone)(void *ctx, DealResult result);
+
+// One queued deal, owned by the submitter; deal and the node must stay valid
+// until done is called (or deal_writer_insert() returns)
+typedef struct DealSubmission {
+  const DealInput *deal;
+  DealWriterDone done; // NULL for deal_writer_insert()
+  void *ctx;
+  // Filled in by the writer
+  DealResult result;
+  int finished;
+  struct DealSubmission *next;
+} DealSubmission;
+
+typedef struct {
+  unsigned long deals;          // Deals recorded or rejected
+  unsigned long batches;        // Transactions committed or attempted
+  unsigned long largest_batch;
+  unsigned long failed_batches; // BEGIN or COMMIT failed: all deals failed
+} DealWriterStats;
+
+/**
+ * @brief Starts the writer thread with its own connection to db_path (must be
+ * a file database, normally in WAL mode).
+ * @param max_batch Most deals per transaction (at least 1).
+ * @param window_ms Time to wait for more deals after the first one.
+ * @return The writer, or NULL if the connection or thread failed.
+ */
+DealWriter *deal_writer_create(const char *db_path, int max_batch,
+                               int window_ms);
+
+/**
+ * @brief Queues a deal; sub->done is called on the writer thread with its
+ * result.
+ * @return 0 on success, -1 if the writer is shutting down.
+ */
+int deal_writer_submit(DealWriter *writer, DealSubmission *sub);
+
+/**
+ * @brief Queues a deal and waits for its batch.
+ * @return The deal's result, as insert_deal() would give it.
+ */
+DealResult deal_writer_insert(DealWriter *writer, const DealInput *deal);
+
+/**
+ * @brief Copies the counters since deal_writer_create().
+ */
+void deal_writer_get_stats(DealWriter *writer, DealWriterStats *stats);
+
+/**
+ * @brief Records the deals still queued, then stops the thread and closes
+ * its connection. Accepts NULL.
+ */
+void deal_writer_destroy(DealWriter *writer);
+
+#endif // DEAL_WRITER_H
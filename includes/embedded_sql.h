@@ -0,0 +1,10 @@
+#ifndef EMBEDDED_SQL_H
+#define EMBEDDED_SQL_H
+
+// SQL scripts compiled into the library at build time from docs/*.sql
+// (see cmake/embed_sql.cmake). Both are NUL-terminated.
+
+extern const char embedded_schema_sql[]; // docs/database_schema.sql
+extern const char embedded_seed_sql[];   // docs/seed_data.sql
+
+#endif // EMBEDDED_SQL_H
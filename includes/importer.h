@@ -0,0 +1,64 @@
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include <stdio.h>
+
+// Input formats accepted by the bulk deal importer
+typedef enum {
+  IMPORT_FORMAT_AUTO = 0, // By file extension (.jsonl/.json -> JSONL, else CSV)
+  IMPORT_FORMAT_CSV,      // date,good,supplier,type,quantity,broker,buyer
+  IMPORT_FORMAT_JSONL     // One flat JSON object per line
+} ImportFormat;
+
+typedef struct {
+  ImportFormat format;
+  int batch_size;          // Rows per transaction
+  const char *reject_path; // Rejected lines with reasons; NULL = discard
+  long max_rejects;        // Abort after this many rejects; 0 = unlimited
+  long progress_every;     // Print a progress line every N rows; 0 = off
+  FILE *progress_out;      // Progress destination (stderr by default)
+} ImportOptions;
+
+typedef struct {
+  long rows_read;
+  long rows_imported;
+  long rows_rejected;
+  long batches;
+  long goods_updates; // Goods.quantity UPDATEs (one per good per batch)
+  double seconds;
+} ImportStats;
+
+/**
+ * @brief Fills options with defaults (auto format, 50000-row batches,
+ * progress every 1000000 rows to stderr, no reject file).
+ */
+void import_options_defaults(ImportOptions *options);
+
+/**
+ * @brief Streams deals from `in` into the Deals table of the open database.
+ * Each row is validated (calendar date, positive quantity, existing good,
+ * broker and buyer, enough stock) against reference data loaded once into
+ * memory; foreign keys stay on, so a row whose broker, buyer or good was
+ * deleted by another connection since then is rejected. Valid rows are
+ * inserted with one reused prepared statement inside batched transactions;
+ * Goods.quantity is decremented once per touched good per batch. Invalid rows go to the reject file and do not stop the import.
+ * CSV: deal_date,good_name,supplier,type_of_good,sell_quantity,broker,buyer
+ * (optional header; empty type = the good's type).
+ * JSONL: the same keys ("date", "type", "quantity" are accepted as aliases).
+ * @param in Input stream.
+ * @param format IMPORT_FORMAT_CSV or IMPORT_FORMAT_JSONL.
+ * @param options Import options (NULL = defaults).
+ * @param stats Receives counters (may be NULL).
+ * @return 0 on success, non-zero if the import was aborted.
+ */
+int import_deals_stream(FILE *in, ImportFormat format,
+                        const ImportOptions *options, ImportStats *stats);
+
+/**
+ * @brief Opens `path` ("-" = stdin) and calls import_deals_stream().
+ * @return 0 on success, non-zero on failure.
+ */
+int import_deals_file(const char *path, const ImportOptions *options,
+                      ImportStats *stats);
+
+#endif // IMPORTER_H
@@ -0,0 +1,37 @@
+#ifndef MIGRATIONS_H
+#define MIGRATIONS_H
+
+// Versioned schema migrations. The schema version lives in the database
+// header (PRAGMA user_version): version 1 is the baseline created by the
+// schema script, every later version is one entry of the migration list in
+// migrations.c, applied in order, each in its own transaction.
+
+/**
+ * @brief Returns the schema version this build expects.
+ */
+int migrations_latest_version(void);
+
+/**
+ * @brief Reads PRAGMA user_version of the open database.
+ * @return The version (0 = never migrated), -1 on error.
+ */
+int migrations_current_version(void);
+
+/**
+ * @brief Brings the open database to the latest schema version.
+ * A current database costs a single PRAGMA user_version read. An empty one
+ * gets the baseline from the schema script (and the seed data, if asked);
+ * a database created before versioning existed is adopted as the baseline.
+ * Each pending migration and its version bump commit atomically, so an
+ * interrupted upgrade resumes from the last applied version.
+ * @param schema_file Baseline schema file, or NULL for the embedded
+ * docs/database_schema.sql.
+ * @param seed 1 = load the initial data into a new database: the embedded
+ * docs/seed_data.sql, or "seed_data.sql" from the current directory when a
+ * schema file is given.
+ * @return 0 on success, non-zero on failure (also when the database is
+ * newer than this build).
+ */
+int migrations_apply(const char *schema_file, int seed);
+
+#endif // MIGRATIONS_H
@@ -1,11 +1,17 @@
 #ifndef QUERIES_H
 #define QUERIES_H
 
-#include <stddef.h> // Needed for size_t in safe_scanf declaration
+#include "analytics.h"   // AnalyticsStore for the in-memory reports
+#include "db.h"          // DbCursor for the report cursors
+#include "report_pool.h" // ReportPool for the parallel report bundle
+#include <stddef.h>      // Needed for size_t in safe_scanf declaration
 
 // +++ Add Declarations for helper functions +++
 void safe_scanf(const char *prompt, char *buffer, size_t buffer_size);
 int safe_scanf_int(const char *prompt);
+// YYYY-MM-DD; re-prompts on invalid input (empty accepted if allow_empty)
+void safe_scanf_date(const char *prompt, char *buffer, size_t buffer_size,
+                     int allow_empty);
 // +++ End Additions +++
 
 // --- Task 2 Queries ---
@@ -14,6 +20,10 @@ void run_buyers_by_good();
 void run_most_popular_type_info();
 void run_top_broker_info();
 void run_supplier_brokers_info();
+void run_leaderboard(); // Top N brokers, goods or types (maintained counters)
+void run_report_bundle(ReportPool *pool); // All of the above; pool may be NULL
+void run_analytics_report_bundle(AnalyticsStore *store); // Same, from memory
+void run_analytics_cross_check(AnalyticsStore *store); // Engine against SQL
 
 // --- Task 3 CRUD Operations ---
 void add_new_broker();
@@ -24,9 +34,135 @@ void delete_deal_by_id();
 // Add more CRUD as needed (Suppliers, Buyers, Users?)
 
 // --- Task 4, 5, 6 Functions ---
-void recalculate_broker_stats(); // Renamed from update_broker_stats for clarity
+void recalculate_broker_stats(); // Full rebuild; normally kept incrementally
+void verify_broker_stats();      // Compare with Deals, offer a rebuild
+void show_sql_profile();         // Report cache counters, db_profiler summary
 void update_goods_quantity_and_clear_deals();
+void archive_old_deals(); // Task 5 purge that moves the deals to the archive
 void show_deals_on_date();
 void show_broker_deals(const char *broker_surname); // For broker role
 
+// --- Parameterized cores (no stdin prompts, values are bound, not
+// interpolated). The interactive functions above collect input and call these.
+// Report functions return 0 on success or an SQLite error code.
+int query_sales_summary_by_period(const char *start_date, const char *end_date,
+                                  FILE *out);
+int query_buyers_by_good(const char *good_name_filter,
+                         FILE *out); // NULL/"" = all goods
+int query_most_popular_type_info(FILE *out);
+int query_top_broker_info(FILE *out);
+int query_supplier_brokers_info(const char *supplier_filter,
+                                FILE *out); // NULL/"" = all
+int query_deals_on_date(const char *date, FILE *out);
+// The same two reports with the archived deals (archive.h) of the period
+// added back in
+int query_sales_summary_with_archive(const char *start_date,
+                                     const char *end_date, FILE *out);
+int query_deals_on_date_with_archive(const char *date, FILE *out);
+
+// Rankings served by the counters of aggregates.c, highest first
+typedef enum {
+  LEADERBOARD_BROKERS_BY_DEALS = 0, // Ties by surname
+  LEADERBOARD_BROKERS_BY_UNITS,     // Ties by surname
+  LEADERBOARD_GOODS_BY_UNITS,       // Ties by good_id
+  LEADERBOARD_TYPES_BY_UNITS,       // Ties by type_id
+  LEADERBOARD_COUNT
+} Leaderboard;
+int query_leaderboard(Leaderboard board, int limit, FILE *out); // limit > 0
+
+// Keyset pagination of the deal listings: a page continues after the sort
+// key of the previous page's last row (no OFFSET), so any page, the first
+// included, costs the same however long the history is
+typedef struct {
+  int deal_date; // Day number (dates.h)
+  sqlite3_int64 deal_id;
+} DealKey;
+
+typedef struct {
+  int has_more; // Another page follows
+  DealKey last; // Key of the last row shown, when has_more: the next "after"
+} DealPage;
+
+// Settings of the query module (perfume.conf / PERFUME_DB_* keys)
+typedef struct {
+  int list_page_size; // Rows per page of the paged deal listings (50)
+} QuerySettings;
+extern const DbSettingKey query_setting_keys[];
+const QuerySettings *query_get_settings(void);
+void query_set_settings(const QuerySettings *settings);
+
+// One page of page_size rows after key "after" (NULL = first page), printed
+// as a table. Deals on a date by deal_id; a broker's deals newest first, by
+// (deal_date, deal_id) descending.
+int query_deals_on_date_page(const char *date, const DealKey *after,
+                             int page_size, DealPage *page, FILE *out);
+int query_broker_deals_page(const char *broker_surname, const DealKey *after,
+                            int page_size, DealPage *page, FILE *out);
+// All Task 2 reports (buyers/suppliers unfiltered) run in parallel on the pool
+// against one snapshot and printed in a fixed order; NULL pool = serially
+int query_report_bundle(ReportPool *pool, const char *start_date,
+                        const char *end_date, FILE *out);
+// Titles of the bundle reports, in bundle order
+#define REPORT_BUNDLE_SIZE 5
+extern const char *const report_bundle_titles[REPORT_BUNDLE_SIZE];
+
+// --- Report cursors: the same reports as streaming typed rows for
+// programmatic consumers. Close with db_cursor_close() in every case.
+int open_sales_summary_cursor(DbCursor *cur, const char *start_date,
+                              const char *end_date);
+int open_buyers_by_good_cursor(DbCursor *cur, const char *good_name_filter);
+int open_most_popular_type_cursor(DbCursor *cur);
+int open_top_broker_cursor(DbCursor *cur);
+int open_supplier_brokers_cursor(DbCursor *cur, const char *supplier_filter);
+int open_deals_on_date_cursor(DbCursor *cur, const char *date);
+int open_sales_summary_with_archive_cursor(DbCursor *cur,
+                                           const char *start_date,
+                                           const char *end_date);
+int open_deals_on_date_with_archive_cursor(DbCursor *cur, const char *date);
+int open_broker_deals_cursor(DbCursor *cur, const char *broker_surname);
+// Pages of the two listings above; yield up to page_size + 1 rows, the extra
+// one only telling that another page follows
+int open_deals_on_date_page_cursor(DbCursor *cur, const char *date,
+                                   const DealKey *after, int page_size);
+int open_broker_deals_page_cursor(DbCursor *cur, const char *broker_surname,
+                                  const DealKey *after, int page_size);
+int open_leaderboard_cursor(DbCursor *cur, Leaderboard board, int limit);
+
+// Input of a single deal (Deals row)
+typedef struct {
+  const char *date; // YYYY-MM-DD
+  const char *good_name;
+  const char *supplier;
+  const char *type;
+  int quantity;
+  const char *broker;
+  const char *buyer;
+} DealInput;
+
+// Outcome of insert_deal()
+typedef enum {
+  DEAL_RESULT_OK = 0,
+  DEAL_RESULT_NO_STOCK, // Good not found or insufficient quantity
+  DEAL_RESULT_ERROR     // Constraint violation or database error
+} DealResult;
+
+int insert_broker(const char *surname, const char *address, int birth_year);
+int insert_good(const char *name, const char *type, double price,
+                const char *supplier, const char *expiry_date, int quantity);
+// Commits on its own, or joins the caller's open transaction; either way a
+// failed deal leaves no trace
+DealResult insert_deal(const DealInput *deal);
+// Return the number of affected rows (0 = not found), or -1 on error
+int set_good_price(const char *name, const char *supplier, double new_price);
+int remove_deal(int deal_id);
+// Returns 0 on success; counters may be NULL
+int clear_deals_up_to(const char *date, int *goods_updated,
+                      int *deals_deleted);
+// Same effect on stock and aggregates, but the deals are first copied to
+// per-month archive files (archive.h), chunk_size deals (whole days) per
+// transaction; chunk_size <= 0 = archive_chunk_size (ArchiveSettings). Chunks
+// committed before an error stay archived. Counters may be NULL.
+int archive_deals_up_to(const char *date, int chunk_size, int *deals_archived,
+                        int *chunks);
+
 #endif // QUERIES_H
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef REPORT_CACHE_H
+#define REPORT_CACHE_H
+
+#include "db.h"
+#include <stddef.h>
+#include <stdio.h>
+
+// --- Cache of printed report results ---
+// The menus re-run the same reports between deals, and most runs recompute
+// an unchanged answer. The formatted table of each report is kept under its
+// expanded SQL (template plus bound values, so report and parameters) and
+// served again while the database is unchanged. Any commit empties the
+// cache: one of this connection (SQLITE_FCNTL_DATA_VERSION of "main", which
+// ignores temp tables) or of another connection or process
+// (PRAGMA data_version). One cache per thread, like the connection it
+// belongs to. Its size is report_cache_kb (0 = off).
+
+typedef struct {
+  int size_kb; // report_cache_kb: text kept per thread (4096); 0 = off
+} ReportCacheSettings;
+
+extern const DbSettingKey report_cache_setting_keys[];
+
+/**
+ * @brief Returns the settings in effect.
+ */
+const ReportCacheSettings *report_cache_get_settings(void);
+
+/**
+ * @brief Replaces the settings; the next report_cache_print() of every
+ * thread uses the new size.
+ */
+void report_cache_set_settings(const ReportCacheSettings *settings);
+
+// Counters of the report cache
+typedef struct {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long invalidations; // Times a data change emptied the cache
+  unsigned long evictions;     // Entries dropped to stay within the size
+  int entries;
+  size_t bytes; // Text held by the entries
+} ReportCacheStats;
+
+/**
+ * @brief Prints an open, not yet stepped report cursor like
+ * db_cursor_print, from the cache if the same report ran on unchanged data.
+ * Otherwise prints the rows and keeps the text. Inside an open transaction
+ * or with the cache off the rows are printed uncached. The caller still
+ * closes the cursor.
+ * @return SQLITE_OK on success, or the SQLite error code.
+ */
+int report_cache_print(DbCursor *cur, FILE *out);
+
+/**
+ * @brief Drops every cached report of the calling thread.
+ */
+void report_cache_clear(void);
+
+/**
+ * @brief Copies the counters of the calling thread's cache.
+ */
+void report_cache_get_stats(ReportCacheStats *stats);
+
+#endif // REPORT_CACHE_H
@@ -0,0 +1,89 @@
+#ifndef REPORT_POOL_H
+#define REPORT_POOL_H
+
+#include "db.h"
+#include <stddef.h>
+#include <stdio.h>
+
+// --- Parallel report executor over read-only connections ---
+// Each worker thread owns one read-only handle (open_db_readonly), so the
+// cursor openers from queries.h run unchanged on it. All jobs of one run read
+// the same committed state while the writer keeps committing deals (WAL):
+// the pool takes the write lock on its own connection until every worker has
+// begun its read transaction.
+
+/**
+ * @brief Opens the report cursor on the worker's connection (the global db
+ * of the calling thread).
+ * @return SQLITE_OK on success, SQLite error code on failure.
+ */
+typedef int (*ReportOpenFn)(DbCursor *cur, const void *arg);
+
+typedef struct {
+  const char *title; // Printed above the table; may be NULL
+  ReportOpenFn open;
+  const void *arg;
+  // Filled in by the executor
+  char *output;      // Formatted table (db_cursor_print), free with
+  size_t output_len; // report_jobs_release()
+  int rc;            // SQLITE_OK on success
+  double seconds;    // Time spent in the job
+} ReportJob;
+
+typedef struct ReportPool ReportPool;
+
+/**
+ * @brief Starts the worker threads, each with its own read-only connection
+ * to db_path (must be a file database, normally in WAL mode), plus one
+ * read-write connection used only to hold the lock in report_pool_start().
+ * @param threads Number of workers; 0 = one per online CPU (at most 8).
+ * @return The pool, or NULL if a connection or thread could not be created.
+ */
+ReportPool *report_pool_create(const char *db_path, int threads);
+
+/**
+ * @brief Hands the jobs to the workers and returns once every worker has
+ * started its read transaction; the jobs then see that state even if the
+ * caller commits more writes before report_pool_wait(). Writers wait (busy
+ * timeout) while the workers begin, so the calling thread must not be inside
+ * a write transaction. The jobs array must stay valid until
+ * report_pool_wait() returns.
+ * @return 0 on success, -1 if a run is already in progress or the database
+ * could not be locked.
+ */
+int report_pool_start(ReportPool *pool, ReportJob *jobs, size_t count);
+
+/**
+ * @brief Blocks until every job of the current run has finished.
+ * @return 0 if all jobs succeeded, otherwise the first failing job's rc.
+ */
+int report_pool_wait(ReportPool *pool);
+
+/**
+ * @brief report_pool_start() + report_pool_wait(). With pool == NULL the
+ * jobs run one after another on the calling thread's connection.
+ * @return 0 if all jobs succeeded, otherwise the first failing job's rc.
+ */
+int report_pool_run(ReportPool *pool, ReportJob *jobs, size_t count);
+
+/**
+ * @brief Returns the number of worker threads.
+ */
+int report_pool_size(const ReportPool *pool);
+
+/**
+ * @brief Stops the workers and closes their connections. Accepts NULL.
+ */
+void report_pool_destroy(ReportPool *pool);
+
+/**
+ * @brief Writes the outputs of the jobs to out in job order.
+ */
+void report_jobs_print(const ReportJob *jobs, size_t count, FILE *out);
+
+/**
+ * @brief Frees the job outputs (the jobs can then be run again).
+ */
+void report_jobs_release(ReportJob *jobs, size_t count);
+
+#endif // REPORT_POOL_H
@@ -0,0 +1,59 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "db.h"
+
+// --- Server mode over a local UNIX-domain socket ---
+// One process keeps the database open and serves many admin and broker
+// clients. A single epoll loop multiplexes the connections and runs their
+// requests one at a time on the process's connection: no file lock contention
+// between clients, one warm page cache, statement cache and report cache.
+//
+// Protocol (pipelining allowed): a request is one line of at most
+// SERVER_LINE_SIZE bytes in the batch language of cli.h, plus
+//   login USER PASSWORD   authenticate the connection (login_user)
+//   logout                forget the session
+//   ping                  answer "pong"
+//   quit                  close after the answer
+// Every command but these needs a login. A response is a header line
+// "<code> <length>\n" followed by exactly <length> bytes of output (tables,
+// messages and argument errors as the batch mode prints them; database errors
+// and DEBUG lines go to the server's log). <code> is the exit code of
+// cli_run_command(): 0 ok, 1 failed, 2 usage, 3 denied or not logged in.
+//
+// With group_commit_batch > 0 (ServerSettings) "add deal" is handed to a deal
+// writer thread (deal_writer.h) and answered once its batch has committed;
+// the loop serves other clients meanwhile, and that client's next requests
+// wait for the answer.
+// "login" is checked the same way on a login thread with its own connection,
+// so the password hash (AuthSettings) does not stall the other clients.
+
+#define SERVER_LINE_SIZE 4096
+
+typedef struct {
+  int group_commit_batch;     // Most deals per deal writer transaction (128);
+                              // 0 = the loop commits each deal itself
+  int group_commit_window_ms; // Wait for more deals after the first one (0)
+} ServerSettings;
+
+extern const DbSettingKey server_setting_keys[];
+
+/**
+ * @brief Returns the settings in effect.
+ */
+const ServerSettings *server_get_settings(void);
+
+/**
+ * @brief Replaces the settings used by the next server_run().
+ */
+void server_set_settings(const ServerSettings *settings);
+
+/**
+ * @brief Serves clients on a UNIX-domain socket at socket_path, using the
+ * open database, until SIGINT or SIGTERM. A stale socket file is replaced;
+ * the file is removed on exit.
+ * @return 0 after a clean shutdown, -1 if the server could not start.
+ */
+int server_run(const char *socket_path);
+
+#endif // SERVER_H
@@ -0,0 +1,40 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- SHA-256, HMAC-SHA256 and PBKDF2-HMAC-SHA256 ---
+// FIPS 180-4, RFC 2104 and RFC 8018, for password hashing in auth.c.
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t length; // Bytes hashed so far
+  unsigned char block[SHA256_BLOCK_SIZE];
+  size_t used; // Bytes waiting in block
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const void *data, size_t len);
+void sha256_final(Sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief HMAC-SHA256 of msg under key.
+ */
+void hmac_sha256(const void *key, size_t key_len, const void *msg,
+                 size_t msg_len, unsigned char mac[SHA256_DIGEST_SIZE]);
+
+/**
+ * @brief Derives out_len bytes from a password with PBKDF2-HMAC-SHA256.
+ * Every iteration costs two SHA-256 compressions.
+ * @param iterations At least 1.
+ */
+void pbkdf2_hmac_sha256(const void *password, size_t password_len,
+                        const void *salt, size_t salt_len,
+                        unsigned long iterations, unsigned char *out,
+                        size_t out_len);
+
+#endif // SHA256_H
@@ -0,0 +1,320 @@
+#include "../includes/aggregates.h"
+#include "../includes/db.h"
+#include <stdio.h>
+
+// --- BrokerStats deltas ---
+// Revenue is sell_quantity * unit_price, both recorded on the deal, so the
+// aggregates read Deals alone and a later price change never touches them.
+// Deals are grouped by broker_id; the surname that keys BrokerStats is looked
+// up once per group.
+static const char *SQL_BROKER_STATS_APPLY_RANGE =
+    "INSERT INTO BrokerStats (broker_surname_fk, deal_count, "
+    "total_sold_units, total_deal_sum, last_updated) "
+    "SELECT b.surname, ?3 * COUNT(*), ?3 * SUM(d.sell_quantity), "
+    "?3 * SUM(d.sell_quantity * d.unit_price), datetime('now', 'localtime') "
+    "FROM Deals d JOIN Brokers b ON b.broker_id = d.broker_id "
+    "WHERE d.deal_id BETWEEN ?1 AND ?2 "
+    "GROUP BY d.broker_id "
+    "ON CONFLICT(broker_surname_fk) DO UPDATE SET "
+    "deal_count = deal_count + excluded.deal_count, "
+    "total_sold_units = total_sold_units + excluded.total_sold_units, "
+    "total_deal_sum = total_deal_sum + excluded.total_deal_sum, "
+    "last_updated = excluded.last_updated;";
+
+// The purged deals are read through idx_deals_date, named explicitly: the
+// planner would rather skip-scan idx_deals_broker_date in group order to save
+// the GROUP BY sort, which makes a small purge cost as much as a full one.
+static const char *SQL_BROKER_STATS_APPLY_PURGE =
+    "UPDATE BrokerStats SET "
+    "deal_count = deal_count - p.deals, "
+    "total_sold_units = total_sold_units - p.units, "
+    "total_deal_sum = total_deal_sum - p.revenue, "
+    "last_updated = datetime('now', 'localtime') "
+    "FROM (SELECT b.surname AS broker, COUNT(*) AS deals, "
+    "      SUM(d.sell_quantity) AS units, "
+    "      SUM(d.sell_quantity * d.unit_price) AS revenue "
+    "      FROM Deals d INDEXED BY idx_deals_date "
+    "      JOIN Brokers b ON b.broker_id = d.broker_id "
+    "      WHERE d.deal_date <= ? GROUP BY d.broker_id) AS p "
+    "WHERE BrokerStats.broker_surname_fk = p.broker;";
+
+static const char *SQL_BROKER_STATS_REBUILD =
+    "INSERT INTO BrokerStats (broker_surname_fk, deal_count, "
+    "total_sold_units, total_deal_sum, last_updated) "
+    "SELECT "
+    "  b.surname, "
+    "  COUNT(*), "
+    "  SUM(d.sell_quantity), "
+    "  SUM(d.sell_quantity * d.unit_price), "
+    "  datetime('now', 'localtime') "
+    "FROM Deals d JOIN Brokers b ON b.broker_id = d.broker_id "
+    "GROUP BY d.broker_id;";
+
+// Stored rows that differ from a full recomputation, as (key, deals,
+// expected deals, units, expected units, sum, expected sum). Keys whose
+// deals are all gone may keep a zero row; that is treated as consistent.
+static const char *SQL_BROKER_STATS_VERIFY =
+    "WITH calc AS ("
+    "  SELECT b.surname AS broker, COUNT(*) AS deals, "
+    "  SUM(d.sell_quantity) AS units, "
+    "  SUM(d.sell_quantity * d.unit_price) AS revenue "
+    "  FROM Deals d JOIN Brokers b ON b.broker_id = d.broker_id "
+    "  GROUP BY d.broker_id) "
+    "SELECT c.broker, IFNULL(s.deal_count, 0), c.deals, "
+    "IFNULL(s.total_sold_units, 0), c.units, "
+    "IFNULL(s.total_deal_sum, 0), c.revenue "
+    "FROM calc c LEFT JOIN BrokerStats s ON s.broker_surname_fk = c.broker "
+    "WHERE s.broker_surname_fk IS NULL OR s.deal_count != c.deals "
+    "OR s.total_sold_units != c.units "
+    "OR ABS(s.total_deal_sum - c.revenue) > 0.005 + 1e-9 * ABS(c.revenue) "
+    "UNION ALL "
+    "SELECT s.broker_surname_fk, s.deal_count, 0, s.total_sold_units, 0, "
+    "s.total_deal_sum, 0 "
+    "FROM BrokerStats s WHERE NOT EXISTS "
+    "(SELECT 1 FROM calc c WHERE c.broker = s.broker_surname_fk) "
+    "AND (s.deal_count != 0 OR s.total_sold_units != 0 "
+    "OR ABS(s.total_deal_sum) > 0.005);";
+
+// --- GoodStats and TypeStats deltas ---
+// The leaderboard counters: same shape, keyed by good_id and type_id (deals
+// without a type are not counted). Their descending indexes on units keep
+// the "top N" reads of queries.c to N index entries.
+static const char *SQL_GOOD_STATS_APPLY_RANGE =
+    "INSERT INTO GoodStats (good_id, deal_count, units, revenue) "
+    "SELECT good_id, ?3 * COUNT(*), ?3 * SUM(sell_quantity), "
+    "?3 * SUM(sell_quantity * unit_price) "
+    "FROM Deals WHERE deal_id BETWEEN ?1 AND ?2 "
+    "GROUP BY good_id "
+    "ON CONFLICT(good_id) DO UPDATE SET "
+    "deal_count = deal_count + excluded.deal_count, "
+    "units = units + excluded.units, revenue = revenue + excluded.revenue;";
+
+static const char *SQL_TYPE_STATS_APPLY_RANGE =
+    "INSERT INTO TypeStats (type_id, deal_count, units, revenue) "
+    "SELECT type_id, ?3 * COUNT(*), ?3 * SUM(sell_quantity), "
+    "?3 * SUM(sell_quantity * unit_price) "
+    "FROM Deals WHERE deal_id BETWEEN ?1 AND ?2 AND type_id IS NOT NULL "
+    "GROUP BY type_id "
+    "ON CONFLICT(type_id) DO UPDATE SET "
+    "deal_count = deal_count + excluded.deal_count, "
+    "units = units + excluded.units, revenue = revenue + excluded.revenue;";
+
+static const char *SQL_GOOD_STATS_APPLY_PURGE =
+    "UPDATE GoodStats SET deal_count = GoodStats.deal_count - p.deals, "
+    "units = GoodStats.units - p.units, "
+    "revenue = GoodStats.revenue - p.revenue "
+    "FROM (SELECT good_id, COUNT(*) AS deals, SUM(sell_quantity) AS units, "
+    "      SUM(sell_quantity * unit_price) AS revenue "
+    "      FROM Deals INDEXED BY idx_deals_date "
+    "      WHERE deal_date <= ? GROUP BY good_id) AS p "
+    "WHERE GoodStats.good_id = p.good_id;";
+
+static const char *SQL_TYPE_STATS_APPLY_PURGE =
+    "UPDATE TypeStats SET deal_count = TypeStats.deal_count - p.deals, "
+    "units = TypeStats.units - p.units, "
+    "revenue = TypeStats.revenue - p.revenue "
+    "FROM (SELECT type_id, COUNT(*) AS deals, SUM(sell_quantity) AS units, "
+    "      SUM(sell_quantity * unit_price) AS revenue "
+    "      FROM Deals INDEXED BY idx_deals_date "
+    "      WHERE deal_date <= ? AND type_id IS NOT NULL "
+    "      GROUP BY type_id) AS p "
+    "WHERE TypeStats.type_id = p.type_id;";
+
+static const char *SQL_GOOD_STATS_REBUILD =
+    "INSERT INTO GoodStats (good_id, deal_count, units, revenue) "
+    "SELECT good_id, COUNT(*), SUM(sell_quantity), "
+    "SUM(sell_quantity * unit_price) FROM Deals GROUP BY good_id;";
+
+static const char *SQL_TYPE_STATS_REBUILD =
+    "INSERT INTO TypeStats (type_id, deal_count, units, revenue) "
+    "SELECT type_id, COUNT(*), SUM(sell_quantity), "
+    "SUM(sell_quantity * unit_price) FROM Deals "
+    "WHERE type_id IS NOT NULL GROUP BY type_id;";
+
+static const char *SQL_GOOD_STATS_VERIFY =
+    "WITH calc AS ("
+    "  SELECT good_id AS good, COUNT(*) AS deals, "
+    "  SUM(sell_quantity) AS units, "
+    "  SUM(sell_quantity * unit_price) AS revenue "
+    "  FROM Deals GROUP BY good_id), "
+    "mismatch AS ("
+    "  SELECT c.good, IFNULL(s.deal_count, 0) AS deals, c.deals AS exp_deals, "
+    "  IFNULL(s.units, 0) AS units, c.units AS exp_units, "
+    "  IFNULL(s.revenue, 0) AS revenue, c.revenue AS exp_revenue "
+    "  FROM calc c LEFT JOIN GoodStats s ON s.good_id = c.good "
+    "  WHERE s.good_id IS NULL OR s.deal_count != c.deals "
+    "  OR s.units != c.units "
+    "  OR ABS(s.revenue - c.revenue) > 0.005 + 1e-9 * ABS(c.revenue) "
+    "  UNION ALL "
+    "  SELECT s.good_id, s.deal_count, 0, s.units, 0, s.revenue, 0 "
+    "  FROM GoodStats s WHERE NOT EXISTS "
+    "  (SELECT 1 FROM calc c WHERE c.good = s.good_id) "
+    "  AND (s.deal_count != 0 OR s.units != 0 OR ABS(s.revenue) > 0.005)) "
+    "SELECT IFNULL(g.name || ' / ' || g.supplier_name_fk, "
+    "'good_id ' || m.good), m.deals, m.exp_deals, m.units, m.exp_units, "
+    "m.revenue, m.exp_revenue "
+    "FROM mismatch m LEFT JOIN Goods g ON g.good_id = m.good;";
+
+static const char *SQL_TYPE_STATS_VERIFY =
+    "WITH calc AS ("
+    "  SELECT type_id AS type, COUNT(*) AS deals, "
+    "  SUM(sell_quantity) AS units, "
+    "  SUM(sell_quantity * unit_price) AS revenue "
+    "  FROM Deals WHERE type_id IS NOT NULL GROUP BY type_id), "
+    "mismatch AS ("
+    "  SELECT c.type, IFNULL(s.deal_count, 0) AS deals, c.deals AS exp_deals, "
+    "  IFNULL(s.units, 0) AS units, c.units AS exp_units, "
+    "  IFNULL(s.revenue, 0) AS revenue, c.revenue AS exp_revenue "
+    "  FROM calc c LEFT JOIN TypeStats s ON s.type_id = c.type "
+    "  WHERE s.type_id IS NULL OR s.deal_count != c.deals "
+    "  OR s.units != c.units "
+    "  OR ABS(s.revenue - c.revenue) > 0.005 + 1e-9 * ABS(c.revenue) "
+    "  UNION ALL "
+    "  SELECT s.type_id, s.deal_count, 0, s.units, 0, s.revenue, 0 "
+    "  FROM TypeStats s WHERE NOT EXISTS "
+    "  (SELECT 1 FROM calc c WHERE c.type = s.type_id) "
+    "  AND (s.deal_count != 0 OR s.units != 0 OR ABS(s.revenue) > 0.005)) "
+    "SELECT IFNULL(t.name, 'type_id ' || m.type), m.deals, m.exp_deals, "
+    "m.units, m.exp_units, m.revenue, m.exp_revenue "
+    "FROM mismatch m LEFT JOIN GoodTypes t ON t.type_id = m.type;";
+
+// --- DailySales deltas ---
+// One row per deal_date x good_id; the key holds deal_date verbatim, so any
+// BETWEEN over it selects exactly the days the same predicate on Deals would.
+static const char *SQL_DAILY_SALES_APPLY_RANGE =
+    "INSERT INTO DailySales (sale_date, good_id, units, revenue) "
+    "SELECT deal_date, good_id, "
+    "?3 * SUM(sell_quantity), ?3 * SUM(sell_quantity * unit_price) "
+    "FROM Deals WHERE deal_id BETWEEN ?1 AND ?2 "
+    "GROUP BY deal_date, good_id "
+    "ON CONFLICT(sale_date, good_id) DO UPDATE SET "
+    "units = units + excluded.units, revenue = revenue + excluded.revenue;";
+
+// The purge removes every deal of those days, so their rows simply go
+static const char *SQL_DAILY_SALES_APPLY_PURGE =
+    "DELETE FROM DailySales WHERE sale_date <= ?;";
+
+static const char *SQL_DAILY_SALES_REBUILD =
+    "INSERT INTO DailySales (sale_date, good_id, units, revenue) "
+    "SELECT deal_date, good_id, "
+    "SUM(sell_quantity), SUM(sell_quantity * unit_price) "
+    "FROM Deals GROUP BY deal_date, good_id;";
+
+// Same rules as SQL_BROKER_STATS_VERIFY, per day and good (no deal count)
+static const char *SQL_DAILY_SALES_VERIFY =
+    "WITH calc AS ("
+    "  SELECT deal_date AS day, good_id AS good, "
+    "  SUM(sell_quantity) AS units, "
+    "  SUM(sell_quantity * unit_price) AS revenue "
+    "  FROM Deals GROUP BY deal_date, good_id), "
+    "mismatch AS ("
+    "  SELECT c.day, c.good, IFNULL(s.units, 0) AS units, "
+    "  c.units AS expected_units, IFNULL(s.revenue, 0) AS revenue, "
+    "  c.revenue AS expected_revenue "
+    "  FROM calc c LEFT JOIN DailySales s ON s.sale_date = c.day AND "
+    "  s.good_id = c.good "
+    "  WHERE s.sale_date IS NULL OR s.units != c.units "
+    "  OR ABS(s.revenue - c.revenue) > 0.005 + 1e-9 * ABS(c.revenue) "
+    "  UNION ALL "
+    "  SELECT s.sale_date, s.good_id, s.units, 0, s.revenue, 0 "
+    "  FROM DailySales s WHERE NOT EXISTS "
+    "  (SELECT 1 FROM calc c WHERE c.day = s.sale_date AND "
+    "  c.good = s.good_id) "
+    "  AND (s.units != 0 OR ABS(s.revenue) > 0.005)) "
+    "SELECT date(m.day * 86400, 'unixepoch') || ' ' || "
+    "IFNULL(g.name || ' / ' || g.supplier_name_fk, "
+    "'good_id ' || m.good), NULL, NULL, m.units, m.expected_units, "
+    "m.revenue, m.expected_revenue "
+    "FROM mismatch m LEFT JOIN Goods g ON g.good_id = m.good;";
+
+// Runs each statement with the same parameters, stopping at the first error
+static int execute_each(const char *const *sql, int count,
+                        const DbParam *params, int param_count) {
+  int rc = SQLITE_OK;
+  for (int i = 0; i < count && rc == SQLITE_OK; i++) {
+    rc = execute_non_query_params(sql[i], params, param_count);
+  }
+  return rc;
+}
+
+// --- aggregates_apply_deal_range ---
+int aggregates_apply_deal_range(sqlite3_int64 first_id, sqlite3_int64 last_id,
+                                int sign) {
+  DbParam params[] = {DB_INT(first_id), DB_INT(last_id),
+                      DB_INT(sign < 0 ? -1 : 1)};
+  const char *const sql[] = {
+      SQL_BROKER_STATS_APPLY_RANGE, SQL_DAILY_SALES_APPLY_RANGE,
+      SQL_GOOD_STATS_APPLY_RANGE, SQL_TYPE_STATS_APPLY_RANGE};
+  return execute_each(sql, 4, params, DB_PARAM_COUNT(params));
+}
+
+// --- aggregates_apply_purge ---
+int aggregates_apply_purge(int day) {
+  DbParam params[] = {DB_INT(day)};
+  const char *const sql[] = {
+      SQL_BROKER_STATS_APPLY_PURGE, SQL_DAILY_SALES_APPLY_PURGE,
+      SQL_GOOD_STATS_APPLY_PURGE, SQL_TYPE_STATS_APPLY_PURGE};
+  return execute_each(sql, 4, params, DB_PARAM_COUNT(params));
+}
+
+// --- aggregates_rebuild ---
+int aggregates_rebuild(void) {
+  const char *const sql[] = {
+      "DELETE FROM BrokerStats;", SQL_BROKER_STATS_REBUILD,
+      "DELETE FROM DailySales;",  SQL_DAILY_SALES_REBUILD,
+      "DELETE FROM GoodStats;",   SQL_GOOD_STATS_REBUILD,
+      "DELETE FROM TypeStats;",   SQL_TYPE_STATS_REBUILD};
+  int rc = execute_non_query("BEGIN IMMEDIATE;");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  rc = execute_each(sql, 8, NULL, 0);
+  if (rc != SQLITE_OK) {
+    execute_non_query("ROLLBACK;");
+    return rc;
+  }
+  return execute_non_query("COMMIT;");
+}
+
+// Prints the rows of one verify query (key, stored deals, expected deals,
+// stored units, expected units, stored sum, expected sum; the deal counts
+// are NULL where not kept); returns their count, or -1 on error
+static int report_mismatches(const char *table, const char *sql, FILE *out) {
+  DbCursor cur;
+  int rc = db_cursor_open(&cur, sql, NULL, 0);
+  int mismatches = 0;
+  while (rc == SQLITE_OK && (rc = db_cursor_next(&cur)) == SQLITE_ROW) {
+    if (out) {
+      fprintf(out, "%s mismatch: %s ", table, db_cursor_text(&cur, 0, NULL));
+      if (db_cursor_type(&cur, 1) != SQLITE_NULL) {
+        fprintf(out, "deals %lld (expected %lld), ",
+                (long long)db_cursor_int64(&cur, 1),
+                (long long)db_cursor_int64(&cur, 2));
+      }
+      fprintf(out, "units %lld (expected %lld), sum %.2f (expected %.2f)\n",
+              (long long)db_cursor_int64(&cur, 3),
+              (long long)db_cursor_int64(&cur, 4), db_cursor_double(&cur, 5),
+              db_cursor_double(&cur, 6));
+    }
+    mismatches++;
+    rc = SQLITE_OK;
+  }
+  db_cursor_close(&cur);
+  return rc == SQLITE_DONE ? mismatches : -1;
+}
+
+// --- aggregates_verify ---
+int aggregates_verify(int repair, FILE *out) {
+  int brokers = report_mismatches("BrokerStats", SQL_BROKER_STATS_VERIFY, out);
+  int days = report_mismatches("DailySales", SQL_DAILY_SALES_VERIFY, out);
+  int goods = report_mismatches("GoodStats", SQL_GOOD_STATS_VERIFY, out);
+  int types = report_mismatches("TypeStats", SQL_TYPE_STATS_VERIFY, out);
+  if (brokers < 0 || days < 0 || goods < 0 || types < 0) {
+    return -1;
+  }
+  int mismatches = brokers + days + goods + types;
+  if (mismatches > 0 && repair && aggregates_rebuild() != SQLITE_OK) {
+    return -1;
+  }
+  return mismatches;
+}
@@ -0,0 +1,1124 @@
+#define _POSIX_C_SOURCE 200809L // open_memstream
+
+#include "../includes/analytics.h"
+#include "../includes/dates.h"
+#include "../includes/db.h"
+#include "../includes/queries.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Deals are processed in blocks: a first pass over each block computes the
+// filtered quantities and revenues into small local arrays (branch-free over
+// contiguous columns, so the compiler vectorizes it), a second pass adds
+// them to the groups.
+#define ANALYTICS_BLOCK 1024
+// Ids index the lookup arrays directly; larger ids are not supported
+#define ANALYTICS_MAX_ID (1 << 28)
+
+// --- Dictionaries ---
+// Interned strings; a code is the insertion index. Ranks (code -> position
+// in BINARY order, as SQLite sorts TEXT) are recomputed when needed after
+// new strings were added.
+typedef struct {
+  char **text;
+  uint32_t count;
+  uint32_t cap;
+  uint32_t *slots; // Open addressing: code + 1, 0 = empty
+  uint32_t slot_cap;
+  uint32_t *rank;
+  int rank_valid;
+} StrDict;
+
+static uint32_t hash_text(const char *text) {
+  uint32_t h = 2166136261u; // FNV-1a
+  for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+    h = (h ^ *p) * 16777619u;
+  }
+  return h;
+}
+
+static void dict_free(StrDict *dict) {
+  for (uint32_t i = 0; i < dict->count; i++) {
+    free(dict->text[i]);
+  }
+  free(dict->text);
+  free(dict->slots);
+  free(dict->rank);
+  memset(dict, 0, sizeof(*dict));
+}
+
+static int dict_grow_slots(StrDict *dict) {
+  uint32_t cap = dict->slot_cap ? dict->slot_cap * 2 : 64;
+  uint32_t *slots = calloc(cap, sizeof(*slots));
+  if (!slots) {
+    return -1;
+  }
+  for (uint32_t code = 0; code < dict->count; code++) {
+    uint32_t i = hash_text(dict->text[code]) & (cap - 1);
+    while (slots[i]) {
+      i = (i + 1) & (cap - 1);
+    }
+    slots[i] = code + 1;
+  }
+  free(dict->slots);
+  dict->slots = slots;
+  dict->slot_cap = cap;
+  return 0;
+}
+
+// Returns the code of text, or -1 if it is not in the dictionary
+static int32_t dict_find(const StrDict *dict, const char *text) {
+  if (!dict->slot_cap) {
+    return -1;
+  }
+  uint32_t i = hash_text(text) & (dict->slot_cap - 1);
+  while (dict->slots[i]) {
+    uint32_t code = dict->slots[i] - 1;
+    if (strcmp(dict->text[code], text) == 0) {
+      return (int32_t)code;
+    }
+    i = (i + 1) & (dict->slot_cap - 1);
+  }
+  return -1;
+}
+
+// Returns the code of text, adding it if needed; -1 on allocation failure
+static int32_t dict_intern(StrDict *dict, const char *text) {
+  int32_t found = dict_find(dict, text);
+  if (found >= 0) {
+    return found;
+  }
+  if ((dict->count + 1) * 2 > dict->slot_cap && dict_grow_slots(dict) != 0) {
+    return -1;
+  }
+  if (dict->count == dict->cap) {
+    uint32_t cap = dict->cap ? dict->cap * 2 : 64;
+    char **grown = realloc(dict->text, cap * sizeof(*grown));
+    if (!grown) {
+      return -1;
+    }
+    dict->text = grown;
+    dict->cap = cap;
+  }
+  size_t len = strlen(text) + 1;
+  char *copy = malloc(len);
+  if (!copy) {
+    return -1;
+  }
+  memcpy(copy, text, len);
+  uint32_t code = dict->count++;
+  dict->text[code] = copy;
+  uint32_t i = hash_text(text) & (dict->slot_cap - 1);
+  while (dict->slots[i]) {
+    i = (i + 1) & (dict->slot_cap - 1);
+  }
+  dict->slots[i] = code + 1;
+  dict->rank_valid = 0;
+  return (int32_t)code;
+}
+
+static const StrDict *sort_dict; // qsort has no context argument
+
+static int compare_codes(const void *a, const void *b) {
+  return strcmp(sort_dict->text[*(const uint32_t *)a],
+                sort_dict->text[*(const uint32_t *)b]);
+}
+
+static int dict_rank(StrDict *dict) {
+  if (dict->rank_valid) {
+    return 0;
+  }
+  uint32_t *order = malloc((dict->count ? dict->count : 1) * sizeof(*order));
+  uint32_t *rank = realloc(dict->rank, (dict->cap ? dict->cap : 1) *
+                                           sizeof(*rank));
+  if (!order || !rank) {
+    free(order);
+    if (rank) {
+      dict->rank = rank;
+    }
+    return -1;
+  }
+  dict->rank = rank;
+  for (uint32_t i = 0; i < dict->count; i++) {
+    order[i] = i;
+  }
+  sort_dict = dict;
+  qsort(order, dict->count, sizeof(*order), compare_codes);
+  for (uint32_t i = 0; i < dict->count; i++) {
+    rank[order[i]] = i;
+  }
+  free(order);
+  dict->rank_valid = 1;
+  return 0;
+}
+
+// --- Lookup tables ---
+// Row id (INTEGER PRIMARY KEY) -> dictionary code of its name; Goods also
+// keep the supplier code in `extra`.
+typedef struct {
+  int32_t *code; // -1 = no row with this id
+  int32_t *extra;
+  size_t cap; // Ids below cap are addressable
+  sqlite3_int64 max_id;
+  sqlite3_int64 rows;
+} Lookup;
+
+static void lookup_free(Lookup *lookup) {
+  free(lookup->code);
+  free(lookup->extra);
+  memset(lookup, 0, sizeof(*lookup));
+}
+
+static int lookup_reserve(Lookup *lookup, sqlite3_int64 id, int with_extra) {
+  if ((size_t)id < lookup->cap) {
+    return 0;
+  }
+  size_t cap = lookup->cap ? lookup->cap : 256;
+  while ((size_t)id >= cap) {
+    cap *= 2;
+  }
+  int32_t *code = realloc(lookup->code, cap * sizeof(*code));
+  if (!code) {
+    return -1;
+  }
+  lookup->code = code;
+  if (with_extra) {
+    int32_t *extra = realloc(lookup->extra, cap * sizeof(*extra));
+    if (!extra) {
+      return -1;
+    }
+    lookup->extra = extra;
+  }
+  for (size_t i = lookup->cap; i < cap; i++) {
+    code[i] = -1;
+    if (with_extra) {
+      lookup->extra[i] = -1;
+    }
+  }
+  lookup->cap = cap;
+  return 0;
+}
+
+struct AnalyticsStore {
+  // Deals, in deal_id order
+  size_t count;
+  size_t cap;
+  int32_t *day; // Day number (dates.h)
+  int32_t *good;
+  int32_t *type; // 0 = no type
+  int32_t *quantity;
+  double *price; // Unit price recorded on the deal
+  int32_t *broker;
+  int32_t *buyer;
+  sqlite3_int64 last_deal_id;
+
+  Lookup goods; // code: good name, extra: supplier
+  Lookup buyers;
+  Lookup brokers;
+  Lookup types;
+  StrDict good_names;
+  StrDict suppliers;
+  StrDict buyer_names;
+  StrDict broker_names;
+  StrDict type_names;
+
+  // State of the connection at the last sync
+  sqlite3 *conn;
+  sqlite3_int64 data_version;
+  int total_changes;
+  int loaded;
+};
+
+static void store_clear(AnalyticsStore *store) {
+  free(store->day);
+  free(store->good);
+  free(store->type);
+  free(store->quantity);
+  free(store->price);
+  free(store->broker);
+  free(store->buyer);
+  lookup_free(&store->goods);
+  lookup_free(&store->buyers);
+  lookup_free(&store->brokers);
+  lookup_free(&store->types);
+  dict_free(&store->good_names);
+  dict_free(&store->suppliers);
+  dict_free(&store->buyer_names);
+  dict_free(&store->broker_names);
+  dict_free(&store->type_names);
+  memset(store, 0, sizeof(*store));
+}
+
+static int deals_reserve(AnalyticsStore *store) {
+  if (store->count < store->cap) {
+    return 0;
+  }
+  size_t cap = store->cap ? store->cap * 2 : 4096;
+  int32_t **columns[] = {&store->day,      &store->good,   &store->type,
+                         &store->quantity, &store->broker, &store->buyer};
+  for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+    int32_t *grown = realloc(*columns[i], cap * sizeof(int32_t));
+    if (!grown) {
+      return -1;
+    }
+    *columns[i] = grown;
+  }
+  double *price = realloc(store->price, cap * sizeof(*price));
+  if (!price) {
+    return -1;
+  }
+  store->price = price;
+  store->cap = cap;
+  return 0;
+}
+
+// --- Loading ---
+static int id_in_range(sqlite3_int64 id) {
+  if (id < 1 || id >= ANALYTICS_MAX_ID) {
+    fprintf(stderr, "!!! analytics: id %lld is out of the supported range.\n",
+            (long long)id);
+    return 0;
+  }
+  return 1;
+}
+
+// Appends rows "id, name[, extra]" with id above the last one loaded
+static int load_lookup(Lookup *lookup, StrDict *names, StrDict *extras,
+                       const char *sql) {
+  DbCursor cur;
+  DbParam params[] = {DB_INT(lookup->max_id)};
+  int rc = db_cursor_open(&cur, sql, params, DB_PARAM_COUNT(params));
+  while (rc == SQLITE_OK && db_cursor_next(&cur) == SQLITE_ROW) {
+    sqlite3_int64 id = db_cursor_int64(&cur, 0);
+    const char *name = db_cursor_text(&cur, 1, NULL);
+    const char *extra = extras ? db_cursor_text(&cur, 2, NULL) : NULL;
+    if (!id_in_range(id)) {
+      rc = SQLITE_RANGE;
+      break;
+    }
+    if (lookup_reserve(lookup, id, extras != NULL) != 0) {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    lookup->code[id] = dict_intern(names, name ? name : "");
+    if (extras) {
+      lookup->extra[id] = dict_intern(extras, extra ? extra : "");
+    }
+    if (lookup->code[id] < 0 || (extras && lookup->extra[id] < 0)) {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    if (id > lookup->max_id) {
+      lookup->max_id = id;
+    }
+    lookup->rows++;
+  }
+  if (rc == SQLITE_OK && cur.rc != SQLITE_DONE) {
+    rc = cur.rc;
+  }
+  db_cursor_close(&cur);
+  return rc;
+}
+
+static int load_deals(AnalyticsStore *store) {
+  DbCursor cur;
+  DbParam params[] = {DB_INT(store->last_deal_id)};
+  int rc = db_cursor_open(
+      &cur,
+      "SELECT deal_id, deal_date, good_id, type_id, sell_quantity, "
+      "unit_price, broker_id, buyer_id FROM Deals WHERE deal_id > ? "
+      "ORDER BY deal_id;",
+      params, DB_PARAM_COUNT(params));
+  while (rc == SQLITE_OK && db_cursor_next(&cur) == SQLITE_ROW) {
+    if (deals_reserve(store) != 0) {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    sqlite3_int64 good = db_cursor_int64(&cur, 2);
+    sqlite3_int64 type = db_cursor_int64(&cur, 3); // NULL reads as 0
+    sqlite3_int64 broker = db_cursor_int64(&cur, 6);
+    sqlite3_int64 buyer = db_cursor_int64(&cur, 7);
+    if (!id_in_range(good) || !id_in_range(broker) || !id_in_range(buyer) ||
+        (type != 0 && !id_in_range(type))) {
+      rc = SQLITE_RANGE;
+      break;
+    }
+    size_t i = store->count++;
+    store->day[i] = (int32_t)db_cursor_int64(&cur, 1);
+    store->good[i] = (int32_t)good;
+    store->type[i] = (int32_t)type;
+    store->quantity[i] = (int32_t)db_cursor_int64(&cur, 4);
+    store->price[i] = db_cursor_double(&cur, 5);
+    store->broker[i] = (int32_t)broker;
+    store->buyer[i] = (int32_t)buyer;
+    store->last_deal_id = db_cursor_int64(&cur, 0);
+  }
+  if (rc == SQLITE_OK && cur.rc != SQLITE_DONE) {
+    rc = cur.rc;
+  }
+  db_cursor_close(&cur);
+  return rc;
+}
+
+// Appends everything added since the last load
+static int load_increment(AnalyticsStore *store) {
+  int rc = load_lookup(&store->goods, &store->good_names, &store->suppliers,
+                       "SELECT good_id, name, supplier_name_fk FROM Goods "
+                       "WHERE good_id > ?;");
+  if (rc == SQLITE_OK) {
+    rc = load_lookup(&store->buyers, &store->buyer_names, NULL,
+                     "SELECT buyer_id, buyer_name FROM Buyers "
+                     "WHERE buyer_id > ?;");
+  }
+  if (rc == SQLITE_OK) {
+    rc = load_lookup(&store->brokers, &store->broker_names, NULL,
+                     "SELECT broker_id, surname FROM Brokers "
+                     "WHERE broker_id > ?;");
+  }
+  if (rc == SQLITE_OK) {
+    rc = load_lookup(&store->types, &store->type_names, NULL,
+                     "SELECT type_id, name FROM GoodTypes "
+                     "WHERE type_id > ?;");
+  }
+  if (rc == SQLITE_OK) {
+    rc = load_deals(store);
+  }
+  return rc;
+}
+
+// Deleted rows never come back through load_increment: if any table holds
+// fewer rows than loaded, the store is stale
+static int store_matches_counts(const AnalyticsStore *store, int *matches) {
+  DbCursor cur;
+  int rc = db_cursor_open(&cur,
+                          "SELECT (SELECT COUNT(*) FROM Deals), "
+                          "(SELECT COUNT(*) FROM Goods), "
+                          "(SELECT COUNT(*) FROM Buyers), "
+                          "(SELECT COUNT(*) FROM Brokers), "
+                          "(SELECT COUNT(*) FROM GoodTypes);",
+                          NULL, 0);
+  if (rc == SQLITE_OK && db_cursor_next(&cur) == SQLITE_ROW) {
+    *matches = db_cursor_int64(&cur, 0) == (sqlite3_int64)store->count &&
+               db_cursor_int64(&cur, 1) == store->goods.rows &&
+               db_cursor_int64(&cur, 2) == store->buyers.rows &&
+               db_cursor_int64(&cur, 3) == store->brokers.rows &&
+               db_cursor_int64(&cur, 4) == store->types.rows;
+  } else if (rc == SQLITE_OK) {
+    rc = cur.rc == SQLITE_DONE ? SQLITE_ERROR : cur.rc;
+  }
+  db_cursor_close(&cur);
+  return rc;
+}
+
+static int read_data_version(sqlite3_int64 *version) {
+  DbCursor cur;
+  int rc = db_cursor_open(&cur, "PRAGMA data_version;", NULL, 0);
+  if (rc == SQLITE_OK && db_cursor_next(&cur) == SQLITE_ROW) {
+    *version = db_cursor_int64(&cur, 0);
+  } else if (rc == SQLITE_OK) {
+    rc = cur.rc == SQLITE_DONE ? SQLITE_ERROR : cur.rc;
+  }
+  db_cursor_close(&cur);
+  return rc;
+}
+
+// --- analytics_create ---
+AnalyticsStore *analytics_create(void) {
+  return calloc(1, sizeof(AnalyticsStore));
+}
+
+// --- analytics_sync ---
+int analytics_sync(AnalyticsStore *store) {
+  if (!db) {
+    fprintf(stderr, "!!! analytics: Database not open.\n");
+    return SQLITE_ERROR;
+  }
+  // data_version moves on commits of other connections, total_changes on
+  // writes of this one
+  sqlite3_int64 version = 0;
+  int rc = read_data_version(&version);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  int changes = sqlite3_total_changes(db);
+  if (store->loaded && store->conn == db && store->data_version == version &&
+      store->total_changes == changes) {
+    return SQLITE_OK;
+  }
+
+  // One read transaction, so the deals and their lookup rows match
+  rc = execute_non_query("SAVEPOINT analytics_sync;");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  int matches = 0;
+  if (store->conn != db) {
+    store_clear(store);
+  }
+  rc = load_increment(store);
+  if (rc == SQLITE_OK) {
+    rc = store_matches_counts(store, &matches);
+  }
+  if (rc == SQLITE_OK && !matches) {
+    printf("DEBUG: analytics: rows were deleted, reloading.\n");
+    store_clear(store);
+    rc = load_increment(store);
+  }
+  execute_non_query("RELEASE analytics_sync;");
+  if (rc != SQLITE_OK) {
+    store_clear(store);
+    return rc;
+  }
+  store->conn = db;
+  store->data_version = version;
+  store->total_changes = changes;
+  store->loaded = 1;
+  return SQLITE_OK;
+}
+
+// --- analytics_deal_count ---
+size_t analytics_deal_count(const AnalyticsStore *store) {
+  return store->count;
+}
+
+// --- analytics_destroy ---
+void analytics_destroy(AnalyticsStore *store) {
+  if (!store) {
+    return;
+  }
+  store_clear(store);
+  free(store);
+}
+
+// --- Grouping ---
+// Hash table of (code, code) pairs packed into one key, for the reports
+// grouped by two names
+typedef struct {
+  uint64_t key;
+  long long units;
+  double sum;
+} Group;
+
+typedef struct {
+  Group *slots;
+  unsigned char *used;
+  size_t cap; // Power of two
+  size_t count;
+} GroupTable;
+
+static uint64_t pair_key(int32_t a, int32_t b) {
+  return (uint64_t)(uint32_t)a << 32 | (uint32_t)b;
+}
+
+static size_t group_slot(uint64_t key, size_t cap) {
+  return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (cap - 1);
+}
+
+static int group_grow(GroupTable *table) {
+  size_t cap = table->cap ? table->cap * 2 : 1024;
+  Group *slots = malloc(cap * sizeof(*slots));
+  unsigned char *used = calloc(cap, 1);
+  if (!slots || !used) {
+    free(slots);
+    free(used);
+    return -1;
+  }
+  for (size_t i = 0; i < table->cap; i++) {
+    if (table->used[i]) {
+      size_t j = group_slot(table->slots[i].key, cap);
+      while (used[j]) {
+        j = (j + 1) & (cap - 1);
+      }
+      slots[j] = table->slots[i];
+      used[j] = 1;
+    }
+  }
+  free(table->slots);
+  free(table->used);
+  table->slots = slots;
+  table->used = used;
+  table->cap = cap;
+  return 0;
+}
+
+static int group_add(GroupTable *table, uint64_t key, long long units,
+                     double sum) {
+  if ((table->count + 1) * 2 > table->cap && group_grow(table) != 0) {
+    return -1;
+  }
+  size_t i = group_slot(key, table->cap);
+  while (table->used[i] && table->slots[i].key != key) {
+    i = (i + 1) & (table->cap - 1);
+  }
+  if (!table->used[i]) {
+    table->used[i] = 1;
+    table->slots[i] = (Group){key, 0, 0.0};
+    table->count++;
+  }
+  table->slots[i].units += units;
+  table->slots[i].sum += sum;
+  return 0;
+}
+
+static int compare_groups(const void *a, const void *b) {
+  uint64_t x = ((const Group *)a)->key, y = ((const Group *)b)->key;
+  return (x > y) - (x < y);
+}
+
+// Moves the groups to the front of the table, re-keyed by the ranks of both
+// codes, and sorts them: the output order of ORDER BY name_a, name_b
+static int group_sort(GroupTable *table, StrDict *first, StrDict *second) {
+  if (dict_rank(first) != 0 || dict_rank(second) != 0) {
+    return -1;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < table->cap; i++) {
+    if (table->used[i]) {
+      Group group = table->slots[i];
+      group.key = pair_key((int32_t)first->rank[group.key >> 32],
+                           (int32_t)second->rank[group.key & 0xFFFFFFFFu]);
+      table->slots[n++] = group;
+    }
+  }
+  qsort(table->slots, n, sizeof(Group), compare_groups);
+  return 0;
+}
+
+static void group_free(GroupTable *table) {
+  free(table->slots);
+  free(table->used);
+}
+
+// Rank -> code, to print groups re-keyed by group_sort
+static uint32_t *dict_codes_by_rank(const StrDict *dict) {
+  uint32_t *codes = malloc((dict->count ? dict->count : 1) * sizeof(*codes));
+  if (codes) {
+    for (uint32_t code = 0; code < dict->count; code++) {
+      codes[dict->rank[code]] = code;
+    }
+  }
+  return codes;
+}
+
+// Prints the sorted groups as "name_a, name_b, units, sum"
+static int print_groups(const GroupTable *table, const StrDict *first,
+                        const StrDict *second, const char *const names[4],
+                        FILE *out) {
+  uint32_t *first_codes = dict_codes_by_rank(first);
+  uint32_t *second_codes = dict_codes_by_rank(second);
+  DbTableWriter writer;
+  db_table_begin(&writer, out);
+  int rc = first_codes && second_codes ? SQLITE_OK : SQLITE_NOMEM;
+  for (size_t i = 0; i < table->count && rc == SQLITE_OK; i++) {
+    const Group *group = &table->slots[i];
+    DbValue values[4] = {
+        {SQLITE_TEXT, 0, 0.0, first->text[first_codes[group->key >> 32]], -1},
+        {SQLITE_TEXT, 0, 0.0,
+         second->text[second_codes[group->key & 0xFFFFFFFFu]], -1},
+        {SQLITE_INTEGER, group->units, 0.0, NULL, 0},
+        {SQLITE_FLOAT, 0, group->sum, NULL, 0}};
+    rc = db_table_row(&writer, names, values, 4);
+  }
+  free(first_codes);
+  free(second_codes);
+  return db_table_end(&writer, rc);
+}
+
+// --- Report kernels (store already synced) ---
+
+// Units and revenue of the deals in [first, first + n) that pass `keep`
+// (NULL = all), branch-free
+static void block_measures(const AnalyticsStore *store, size_t first,
+                           size_t n, const unsigned char *keep,
+                           int32_t *units, double *revenue) {
+  const int32_t *quantity = store->quantity + first;
+  const double *price = store->price + first;
+  for (size_t j = 0; j < n; j++) {
+    units[j] = quantity[j];
+    revenue[j] = quantity[j] * price[j];
+  }
+  if (keep) {
+    for (size_t j = 0; j < n; j++) {
+      units[j] *= keep[j];
+      revenue[j] *= keep[j];
+    }
+  }
+}
+
+static int report_sales_summary(AnalyticsStore *store, int start, int end,
+                                FILE *out) {
+  size_t goods = store->goods.cap;
+  long long *units = calloc(goods ? goods : 1, sizeof(*units));
+  double *revenue = calloc(goods ? goods : 1, sizeof(*revenue));
+  int rc = units && revenue ? SQLITE_OK : SQLITE_NOMEM;
+
+  for (size_t first = 0; rc == SQLITE_OK && first < store->count;
+       first += ANALYTICS_BLOCK) {
+    size_t n = store->count - first < ANALYTICS_BLOCK ? store->count - first
+                                                      : ANALYTICS_BLOCK;
+    unsigned char keep[ANALYTICS_BLOCK];
+    int32_t block_units[ANALYTICS_BLOCK];
+    double block_revenue[ANALYTICS_BLOCK];
+    const int32_t *day = store->day + first;
+    for (size_t j = 0; j < n; j++) {
+      keep[j] = (unsigned char)((day[j] >= start) & (day[j] <= end));
+    }
+    block_measures(store, first, n, keep, block_units, block_revenue);
+    const int32_t *good = store->good + first;
+    for (size_t j = 0; j < n; j++) {
+      units[good[j]] += block_units[j];
+      revenue[good[j]] += block_revenue[j];
+    }
+  }
+
+  // Goods of the same name from different suppliers form one row
+  StrDict *names = &store->good_names;
+  long long *name_units = NULL;
+  double *name_revenue = NULL;
+  if (rc == SQLITE_OK) {
+    name_units = calloc(names->count ? names->count : 1, sizeof(*name_units));
+    name_revenue =
+        calloc(names->count ? names->count : 1, sizeof(*name_revenue));
+    if (!name_units || !name_revenue || dict_rank(names) != 0) {
+      rc = SQLITE_NOMEM;
+    }
+  }
+  uint32_t *codes = rc == SQLITE_OK ? dict_codes_by_rank(names) : NULL;
+  if (rc == SQLITE_OK && !codes) {
+    rc = SQLITE_NOMEM;
+  }
+  if (rc == SQLITE_OK) {
+    for (size_t id = 0; id < goods; id++) {
+      if (units[id] > 0) {
+        name_units[store->goods.code[id]] += units[id];
+        name_revenue[store->goods.code[id]] += revenue[id];
+      }
+    }
+    static const char *const columns[] = {"GoodName", "TotalSold",
+                                          "TotalIncome"};
+    DbTableWriter writer;
+    db_table_begin(&writer, out);
+    for (uint32_t r = 0; r < names->count && rc == SQLITE_OK; r++) {
+      uint32_t code = codes[r];
+      if (name_units[code] > 0) {
+        DbValue values[3] = {
+            {SQLITE_TEXT, 0, 0.0, names->text[code], -1},
+            {SQLITE_INTEGER, name_units[code], 0.0, NULL, 0},
+            {SQLITE_FLOAT, 0, name_revenue[code], NULL, 0}};
+        rc = db_table_row(&writer, columns, values, 3);
+      }
+    }
+    rc = db_table_end(&writer, rc);
+  }
+  free(codes);
+  free(name_units);
+  free(name_revenue);
+  free(units);
+  free(revenue);
+  return rc;
+}
+
+// Goods whose name (or supplier) has the given code: per-id filter flags
+static unsigned char *select_goods(const Lookup *goods, int by_supplier,
+                                   int32_t code) {
+  unsigned char *selected = calloc(goods->cap ? goods->cap : 1, 1);
+  if (selected) {
+    const int32_t *codes = by_supplier ? goods->extra : goods->code;
+    for (size_t id = 0; id < goods->cap; id++) {
+      selected[id] = (unsigned char)(codes[id] == code && code >= 0);
+    }
+  }
+  return selected;
+}
+
+// Shared by the buyers and supplier reports: group the deals (optionally
+// only those of the selected goods) by a good-side and a deal-side name
+static int report_pairs(AnalyticsStore *store, int by_supplier,
+                        const char *filter, const char *const columns[4],
+                        FILE *out) {
+  StrDict *first = by_supplier ? &store->suppliers : &store->good_names;
+  StrDict *second = by_supplier ? &store->broker_names : &store->buyer_names;
+  const int32_t *first_of_good =
+      by_supplier ? store->goods.extra : store->goods.code;
+  const Lookup *second_lookup = by_supplier ? &store->brokers : &store->buyers;
+  const int32_t *second_id = by_supplier ? store->broker : store->buyer;
+
+  unsigned char *selected = NULL;
+  if (filter && filter[0] != '\0') {
+    selected = select_goods(&store->goods, by_supplier,
+                            dict_find(first, filter));
+    if (!selected) {
+      return SQLITE_NOMEM;
+    }
+  }
+  GroupTable table = {NULL, NULL, 0, 0};
+  int rc = SQLITE_OK;
+  for (size_t first_deal = 0; rc == SQLITE_OK && first_deal < store->count;
+       first_deal += ANALYTICS_BLOCK) {
+    size_t n = store->count - first_deal < ANALYTICS_BLOCK
+                   ? store->count - first_deal
+                   : ANALYTICS_BLOCK;
+    unsigned char keep[ANALYTICS_BLOCK];
+    int32_t units[ANALYTICS_BLOCK];
+    double revenue[ANALYTICS_BLOCK];
+    const int32_t *good = store->good + first_deal;
+    const int32_t *other = second_id + first_deal;
+    if (selected) {
+      for (size_t j = 0; j < n; j++) {
+        keep[j] = selected[good[j]];
+      }
+    }
+    block_measures(store, first_deal, n, selected ? keep : NULL, units,
+                   revenue);
+    for (size_t j = 0; j < n && rc == SQLITE_OK; j++) {
+      if (selected && !keep[j]) {
+        continue;
+      }
+      uint64_t key =
+          pair_key(first_of_good[good[j]], second_lookup->code[other[j]]);
+      if (group_add(&table, key, units[j], revenue[j]) != 0) {
+        rc = SQLITE_NOMEM;
+      }
+    }
+  }
+  free(selected);
+  if (rc == SQLITE_OK && group_sort(&table, first, second) != 0) {
+    rc = SQLITE_NOMEM;
+  }
+  if (rc == SQLITE_OK) {
+    rc = print_groups(&table, first, second, columns, out);
+  }
+  group_free(&table);
+  return rc;
+}
+
+static int report_buyers_by_good(AnalyticsStore *store, const char *filter,
+                                 FILE *out) {
+  static const char *const columns[] = {"GoodName", "Buyer", "TotalUnits",
+                                        "TotalCost"};
+  return report_pairs(store, 0, filter, columns, out);
+}
+
+static int report_supplier_brokers(AnalyticsStore *store, const char *filter,
+                                   FILE *out) {
+  static const char *const columns[] = {"Supplier", "Broker", "TotalSold",
+                                        "TotalValue"};
+  return report_pairs(store, 1, filter, columns, out);
+}
+
+static int report_most_popular_type(AnalyticsStore *store, FILE *out) {
+  size_t types = store->types.cap, buyers = store->buyers.cap;
+  long long *type_units = calloc(types ? types : 1, sizeof(*type_units));
+  long long *units = calloc(buyers ? buyers : 1, sizeof(*units));
+  double *cost = calloc(buyers ? buyers : 1, sizeof(*cost));
+  int rc = type_units && units && cost && dict_rank(&store->type_names) == 0 &&
+                   dict_rank(&store->buyer_names) == 0
+               ? SQLITE_OK
+               : SQLITE_NOMEM;
+
+  // Units per type; type 0 (no type) collects the untyped deals
+  for (size_t i = 0; rc == SQLITE_OK && i < store->count; i++) {
+    type_units[store->type[i]] += store->quantity[i];
+  }
+  // Most units wins, ties go to the first name
+  int32_t top = 0;
+  for (size_t id = 1; rc == SQLITE_OK && id < types; id++) {
+    if (type_units[id] == 0) {
+      continue;
+    }
+    const uint32_t *rank = store->type_names.rank;
+    if (top == 0 || type_units[id] > type_units[top] ||
+        (type_units[id] == type_units[top] &&
+         rank[store->types.code[id]] < rank[store->types.code[top]])) {
+      top = (int32_t)id;
+    }
+  }
+
+  DbTableWriter writer;
+  db_table_begin(&writer, out);
+  if (rc == SQLITE_OK && top != 0) {
+    for (size_t first = 0; first < store->count; first += ANALYTICS_BLOCK) {
+      size_t n = store->count - first < ANALYTICS_BLOCK ? store->count - first
+                                                        : ANALYTICS_BLOCK;
+      unsigned char keep[ANALYTICS_BLOCK];
+      int32_t block_units[ANALYTICS_BLOCK];
+      double block_cost[ANALYTICS_BLOCK];
+      const int32_t *type = store->type + first;
+      for (size_t j = 0; j < n; j++) {
+        keep[j] = (unsigned char)(type[j] == top);
+      }
+      block_measures(store, first, n, keep, block_units, block_cost);
+      const int32_t *buyer = store->buyer + first;
+      for (size_t j = 0; j < n; j++) {
+        units[buyer[j]] += block_units[j];
+        cost[buyer[j]] += block_cost[j];
+      }
+    }
+    // Buyers in name order: walk the ranks of the buyer dictionary
+    StrDict *names = &store->buyer_names;
+    uint32_t *codes = dict_codes_by_rank(names);
+    int32_t *id_of_code = malloc((names->count ? names->count : 1) *
+                                 sizeof(*id_of_code));
+    if (!codes || !id_of_code) {
+      rc = SQLITE_NOMEM;
+    } else {
+      for (size_t id = 0; id < buyers; id++) {
+        if (store->buyers.code[id] >= 0) {
+          id_of_code[store->buyers.code[id]] = (int32_t)id;
+        }
+      }
+    }
+    static const char *const columns[] = {"Buyer", "GoodType", "TotalUnits",
+                                          "TotalCost"};
+    const char *type_name = store->type_names.text[store->types.code[top]];
+    for (uint32_t r = 0; rc == SQLITE_OK && r < names->count; r++) {
+      int32_t id = id_of_code[codes[r]];
+      if (units[id] > 0) {
+        DbValue values[4] = {{SQLITE_TEXT, 0, 0.0, names->text[codes[r]], -1},
+                             {SQLITE_TEXT, 0, 0.0, type_name, -1},
+                             {SQLITE_INTEGER, units[id], 0.0, NULL, 0},
+                             {SQLITE_FLOAT, 0, cost[id], NULL, 0}};
+        rc = db_table_row(&writer, columns, values, 4);
+      }
+    }
+    free(codes);
+    free(id_of_code);
+  }
+  rc = db_table_end(&writer, rc);
+  free(type_units);
+  free(units);
+  free(cost);
+  return rc;
+}
+
+static int report_top_broker(AnalyticsStore *store, FILE *out) {
+  size_t brokers = store->brokers.cap;
+  long long *deals = calloc(brokers ? brokers : 1, sizeof(*deals));
+  unsigned char *seen = calloc(store->suppliers.count + 1, 1);
+  int rc = deals && seen ? SQLITE_OK : SQLITE_NOMEM;
+
+  for (size_t i = 0; rc == SQLITE_OK && i < store->count; i++) {
+    deals[store->broker[i]]++;
+  }
+  int32_t top = 0;
+  for (size_t id = 1; rc == SQLITE_OK && id < brokers; id++) {
+    if (deals[id] > deals[top]) { // Ties go to the lowest broker_id
+      top = (int32_t)id;
+    }
+  }
+
+  // Suppliers in the order of the broker's first deal with each
+  char *suppliers = NULL;
+  size_t suppliers_len = 0;
+  FILE *list = NULL;
+  if (rc == SQLITE_OK && top != 0) {
+    list = open_memstream(&suppliers, &suppliers_len);
+    if (!list) {
+      rc = SQLITE_NOMEM;
+    }
+  }
+  for (size_t i = 0; list && i < store->count; i++) {
+    if (store->broker[i] != top) {
+      continue;
+    }
+    int32_t supplier = store->goods.extra[store->good[i]];
+    if (!seen[supplier]) {
+      seen[supplier] = 1;
+      fprintf(list, "%s%s", suppliers_len ? "," : "",
+              store->suppliers.text[supplier]);
+      fflush(list);
+    }
+  }
+  if (list && fclose(list) != 0) {
+    rc = SQLITE_NOMEM;
+  }
+
+  // The broker's own columns come from the table, as stored
+  DbTableWriter writer;
+  db_table_begin(&writer, out);
+  if (rc == SQLITE_OK && top != 0) {
+    DbCursor cur;
+    DbParam params[] = {DB_INT(top)};
+    rc = db_cursor_open(&cur,
+                        "SELECT surname, address, birth_year FROM Brokers "
+                        "WHERE broker_id = ?;",
+                        params, DB_PARAM_COUNT(params));
+    if (rc == SQLITE_OK && db_cursor_next(&cur) == SQLITE_ROW) {
+      static const char *const columns[] = {"surname", "address",
+                                            "birth_year", "Suppliers"};
+      DbValue values[4];
+      for (int i = 0; i < 3; i++) {
+        values[i] = (DbValue){db_cursor_type(&cur, i), 0, 0.0, NULL, -1};
+        if (values[i].type == SQLITE_INTEGER) {
+          values[i].i = db_cursor_int64(&cur, i);
+        } else if (values[i].type == SQLITE_FLOAT) {
+          values[i].d = db_cursor_double(&cur, i);
+        } else if (values[i].type != SQLITE_NULL) {
+          values[i].type = SQLITE_TEXT;
+          values[i].s = db_cursor_text(&cur, i, &values[i].len);
+        }
+      }
+      values[3] = (DbValue){SQLITE_TEXT, 0, 0.0, suppliers, -1};
+      rc = db_table_row(&writer, columns, values, 4);
+    } else if (rc == SQLITE_OK && cur.rc != SQLITE_DONE) {
+      rc = cur.rc;
+    }
+    db_cursor_close(&cur);
+  }
+  rc = db_table_end(&writer, rc);
+  free(suppliers);
+  free(deals);
+  free(seen);
+  return rc;
+}
+
+// --- Public reports: sync, then run the kernel ---
+static int parse_period(const char *start_date, const char *end_date,
+                        int *start, int *end) {
+  if (date_parse(start_date, start) != 0 || date_parse(end_date, end) != 0) {
+    fprintf(stderr, "!!! analytics: invalid period '%s'..'%s'.\n",
+            start_date ? start_date : "", end_date ? end_date : "");
+    return SQLITE_MISMATCH;
+  }
+  return SQLITE_OK;
+}
+
+int analytics_sales_summary(AnalyticsStore *store, const char *start_date,
+                            const char *end_date, FILE *out) {
+  int start, end;
+  int rc = parse_period(start_date, end_date, &start, &end);
+  if (rc == SQLITE_OK) {
+    rc = analytics_sync(store);
+  }
+  return rc == SQLITE_OK ? report_sales_summary(store, start, end, out) : rc;
+}
+
+int analytics_buyers_by_good(AnalyticsStore *store,
+                             const char *good_name_filter, FILE *out) {
+  int rc = analytics_sync(store);
+  return rc == SQLITE_OK ? report_buyers_by_good(store, good_name_filter, out)
+                         : rc;
+}
+
+int analytics_most_popular_type(AnalyticsStore *store, FILE *out) {
+  int rc = analytics_sync(store);
+  return rc == SQLITE_OK ? report_most_popular_type(store, out) : rc;
+}
+
+int analytics_top_broker(AnalyticsStore *store, FILE *out) {
+  int rc = analytics_sync(store);
+  return rc == SQLITE_OK ? report_top_broker(store, out) : rc;
+}
+
+int analytics_supplier_brokers(AnalyticsStore *store,
+                               const char *supplier_filter, FILE *out) {
+  int rc = analytics_sync(store);
+  return rc == SQLITE_OK ? report_supplier_brokers(store, supplier_filter, out)
+                         : rc;
+}
+
+// --- analytics_report_bundle ---
+// Runs bundle report `index` from the synced store
+static int run_bundle_report(AnalyticsStore *store, int index, int start,
+                             int end, FILE *out) {
+  switch (index) {
+  case 0:
+    return report_sales_summary(store, start, end, out);
+  case 1:
+    return report_buyers_by_good(store, NULL, out);
+  case 2:
+    return report_most_popular_type(store, out);
+  case 3:
+    return report_top_broker(store, out);
+  default:
+    return report_supplier_brokers(store, NULL, out);
+  }
+}
+
+int analytics_report_bundle(AnalyticsStore *store, const char *start_date,
+                            const char *end_date, FILE *out) {
+  int start, end;
+  int rc = parse_period(start_date, end_date, &start, &end);
+  if (rc == SQLITE_OK) {
+    rc = analytics_sync(store);
+  }
+  for (int i = 0; rc == SQLITE_OK && i < REPORT_BUNDLE_SIZE; i++) {
+    fprintf(out, "\n--- %s ---\n", report_bundle_titles[i]);
+    rc = run_bundle_report(store, i, start, end, out);
+  }
+  return rc;
+}
+
+// --- analytics_cross_check ---
+// The SQL side of bundle report `index`, printed like the bundle does
+static int run_sql_report(int index, const char *start_date,
+                          const char *end_date, FILE *out) {
+  DbCursor cur;
+  int rc;
+  switch (index) {
+  case 0:
+    rc = open_sales_summary_cursor(&cur, start_date, end_date);
+    break;
+  case 1:
+    rc = open_buyers_by_good_cursor(&cur, NULL);
+    break;
+  case 2:
+    rc = open_most_popular_type_cursor(&cur);
+    break;
+  case 3:
+    rc = open_top_broker_cursor(&cur);
+    break;
+  default:
+    rc = open_supplier_brokers_cursor(&cur, NULL);
+    break;
+  }
+  if (rc == SQLITE_OK) {
+    rc = db_cursor_print(&cur, out);
+  }
+  db_cursor_close(&cur);
+  return rc;
+}
+
+int analytics_cross_check(AnalyticsStore *store, const char *start_date,
+                          const char *end_date, FILE *out) {
+  int start, end;
+  if (parse_period(start_date, end_date, &start, &end) != SQLITE_OK ||
+      analytics_sync(store) != SQLITE_OK) {
+    return -1;
+  }
+  int mismatches = 0;
+  for (int i = 0; i < REPORT_BUNDLE_SIZE && mismatches >= 0; i++) {
+    char *sql_text = NULL, *engine_text = NULL;
+    size_t sql_len = 0, engine_len = 0;
+    FILE *sql_out = open_memstream(&sql_text, &sql_len);
+    FILE *engine_out = open_memstream(&engine_text, &engine_len);
+    int rc = sql_out && engine_out ? SQLITE_OK : SQLITE_NOMEM;
+    if (rc == SQLITE_OK) {
+      rc = run_sql_report(i, start_date, end_date, sql_out);
+    }
+    if (rc == SQLITE_OK) {
+      rc = run_bundle_report(store, i, start, end, engine_out);
+    }
+    if (sql_out && fclose(sql_out) != 0) {
+      rc = SQLITE_NOMEM;
+    }
+    if (engine_out && fclose(engine_out) != 0) {
+      rc = SQLITE_NOMEM;
+    }
+    if (rc != SQLITE_OK) {
+      mismatches = -1;
+    } else if (sql_len != engine_len ||
+               memcmp(sql_text, engine_text, sql_len) != 0) {
+      mismatches++;
+      if (out) {
+        fprintf(out, "!!! %s: the engine differs from SQL.\n--- SQL:\n%s"
+                     "--- engine:\n%s",
+                report_bundle_titles[i], sql_text, engine_text);
+      }
+    }
+    free(sql_text);
+    free(engine_text);
+  }
+  return mismatches;
+}
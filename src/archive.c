@@ -0,0 +1,322 @@
+#define _POSIX_C_SOURCE 200809L // mkdir, access
+
+#include "../includes/archive.h"
+#include "../includes/dates.h"
+#include "../includes/db.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ARCHIVE_PATH_SIZE 512
+
+// Same columns as the DealDetails view
+static const char *SQL_ARCHIVE_CREATE_DEALS =
+    "CREATE TABLE IF NOT EXISTS archive_month.Deals ("
+    "  deal_id INTEGER PRIMARY KEY,"
+    "  deal_date INTEGER NOT NULL,"
+    "  good_name_fk TEXT NOT NULL,"
+    "  supplier_name_fk TEXT NOT NULL,"
+    "  type_of_good TEXT,"
+    "  sell_quantity INTEGER NOT NULL,"
+    "  unit_price REAL NOT NULL,"
+    "  broker_surname_fk TEXT NOT NULL,"
+    "  buyer_name_fk TEXT NOT NULL"
+    ");";
+
+static const char *SQL_ARCHIVE_CREATE_TEMP =
+    "CREATE TEMP TABLE IF NOT EXISTS ArchivedDeals ("
+    "  deal_id INTEGER PRIMARY KEY,"
+    "  deal_date INTEGER NOT NULL,"
+    "  good_name_fk TEXT NOT NULL,"
+    "  supplier_name_fk TEXT NOT NULL,"
+    "  type_of_good TEXT,"
+    "  sell_quantity INTEGER NOT NULL,"
+    "  unit_price REAL NOT NULL,"
+    "  broker_surname_fk TEXT NOT NULL,"
+    "  buyer_name_fk TEXT NOT NULL"
+    ");";
+
+// The DealDetails columns, spelled out to keep the idx_deals_date range as
+// the outer loop (SQL_DEALS_OUTER_JOIN). Committed on its own before the
+// deals are deleted from main, since a commit across the two files is not
+// atomic. OR REPLACE: if the deletion then fails or never commits, the deals
+// are still in Deals and the next run copies them again over the same
+// deal_ids.
+static const char *SQL_ARCHIVE_COPY =
+    "INSERT OR REPLACE INTO archive_month.Deals "
+    "SELECT d.deal_id, d.deal_date, g.name, g.supplier_name_fk, t.name, "
+    "d.sell_quantity, d.unit_price, b.surname, u.buyer_name "
+    "FROM Deals d" SQL_DEALS_OUTER_JOIN "Goods g ON g.good_id = d.good_id "
+    "LEFT JOIN GoodTypes t ON t.type_id = d.type_id "
+    "JOIN Brokers b ON b.broker_id = d.broker_id "
+    "JOIN Buyers u ON u.buyer_id = d.buyer_id "
+    "WHERE d.deal_date BETWEEN ? AND ?;";
+
+// Deals the purge through ?1 would delete that the attached month lacks
+// (recorded after the copy)
+static const char *SQL_ARCHIVE_MISSING =
+    "SELECT COUNT(*) FROM Deals d WHERE d.deal_date <= ? AND NOT EXISTS "
+    "(SELECT 1 FROM archive_month.Deals a WHERE a.deal_id = d.deal_id);";
+
+static const char *SQL_ARCHIVE_MANIFEST_ADD =
+    "INSERT INTO DealArchive (month, file, first_day, last_day, deal_count, "
+    "units, revenue, archived_at) "
+    "SELECT ?3, ?4, MIN(deal_date), MAX(deal_date), COUNT(*), "
+    "SUM(sell_quantity), SUM(sell_quantity * unit_price), "
+    "datetime('now', 'localtime') "
+    "FROM Deals WHERE deal_date BETWEEN ?1 AND ?2 HAVING COUNT(*) > 0 "
+    "ON CONFLICT(month) DO UPDATE SET "
+    "first_day = MIN(first_day, excluded.first_day), "
+    "last_day = MAX(last_day, excluded.last_day), "
+    "deal_count = deal_count + excluded.deal_count, "
+    "units = units + excluded.units, revenue = revenue + excluded.revenue, "
+    "archived_at = excluded.archived_at;";
+
+// The attached month: its first day and file
+static int attached_month = -1;
+static char attached_path[ARCHIVE_PATH_SIZE];
+
+// "YYYY-MM" of a day number
+static void month_key(int day, char out[8]) {
+  char text[DATE_TEXT_SIZE];
+  date_format(day, text);
+  memcpy(out, text, 7);
+  out[7] = '\0';
+}
+
+// --- Settings ---
+static ArchiveSettings settings_in_effect = {"archive", 10000};
+
+const ArchiveSettings *archive_get_settings(void) {
+  return &settings_in_effect;
+}
+
+void archive_set_settings(const ArchiveSettings *settings) {
+  settings_in_effect = *settings;
+}
+
+static int set_archive_dir(const char *value) {
+  return db_setting_text(value, settings_in_effect.dir,
+                         sizeof(settings_in_effect.dir), 0);
+}
+
+static int set_archive_chunk_size(const char *value) {
+  long long v;
+  if (db_setting_int(value, 1, 100000000, &v) != 0) {
+    return -1;
+  }
+  settings_in_effect.chunk_size = (int)v;
+  return 0;
+}
+
+const DbSettingKey archive_setting_keys[] = {
+    {"archive_dir", set_archive_dir},
+    {"archive_chunk_size", set_archive_chunk_size},
+    {NULL, NULL}};
+
+// --- archive_attach_month ---
+int archive_attach_month(int day) {
+  if (attached_month >= 0) {
+    fprintf(stderr, "!!! archive: A month is already attached.\n");
+    return SQLITE_MISUSE;
+  }
+  const char *dir = settings_in_effect.dir;
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "!!! archive: Cannot create directory '%s': %s\n", dir,
+            strerror(errno));
+    return SQLITE_CANTOPEN;
+  }
+  char month[8];
+  month_key(day, month);
+  int len = snprintf(attached_path, sizeof(attached_path), "%s/deals_%s.db",
+                     dir, month);
+  if (len < 0 || (size_t)len >= sizeof(attached_path)) {
+    fprintf(stderr, "!!! archive: Directory name too long: '%s'\n", dir);
+    return SQLITE_CANTOPEN;
+  }
+  // A month archived before keeps its file, even if archive_dir has changed
+  DbParam key[] = {DB_TEXT(month)};
+  DbCursor cur;
+  int rc =
+      db_cursor_open(&cur, "SELECT file FROM DealArchive WHERE month = ?;",
+                     key, DB_PARAM_COUNT(key));
+  if (rc == SQLITE_OK && (rc = db_cursor_next(&cur)) == SQLITE_ROW) {
+    snprintf(attached_path, sizeof(attached_path), "%s",
+             db_cursor_text(&cur, 0, NULL));
+  }
+  db_cursor_close(&cur);
+  if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+    return rc;
+  }
+
+  DbParam params[] = {DB_TEXT(attached_path)};
+  rc = execute_non_query_params("ATTACH DATABASE ? AS archive_month;", params,
+                                DB_PARAM_COUNT(params));
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  rc = execute_non_query(SQL_ARCHIVE_CREATE_DEALS);
+  if (rc != SQLITE_OK) {
+    execute_non_query("DETACH DATABASE archive_month;");
+    return rc;
+  }
+  int last_day;
+  date_month_range(day, &attached_month, &last_day);
+  printf("DEBUG: archive: Attached %s.\n", attached_path);
+  return SQLITE_OK;
+}
+
+// --- archive_detach_month ---
+int archive_detach_month(void) {
+  if (attached_month < 0) {
+    return SQLITE_OK;
+  }
+  int rc = execute_non_query("DETACH DATABASE archive_month;");
+  if (rc == SQLITE_OK) {
+    attached_month = -1;
+  }
+  return rc;
+}
+
+// The range must lie within the attached month
+static int check_attached_range(int first_day, int last_day) {
+  int month_first, month_last;
+  date_month_range(first_day, &month_first, &month_last);
+  if (attached_month != month_first || last_day > month_last ||
+      last_day < first_day) {
+    fprintf(stderr, "!!! archive: Days outside the attached month.\n");
+    return SQLITE_MISUSE;
+  }
+  return SQLITE_OK;
+}
+
+// --- archive_copy_deals ---
+int archive_copy_deals(int first_day, int last_day, int *copied) {
+  int rc = check_attached_range(first_day, last_day);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  DbParam range[] = {DB_INT(first_day), DB_INT(last_day)};
+  rc = execute_non_query_params(SQL_ARCHIVE_COPY, range,
+                                DB_PARAM_COUNT(range));
+  if (rc == SQLITE_OK && copied) {
+    *copied = sqlite3_changes(db);
+  }
+  return rc;
+}
+
+// --- archive_confirm_deals ---
+int archive_confirm_deals(int first_day, int last_day, int *missing) {
+  int rc = check_attached_range(first_day, last_day);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  DbParam upto[] = {DB_INT(last_day)};
+  DbCursor cur;
+  rc = db_cursor_open(&cur, SQL_ARCHIVE_MISSING, upto, DB_PARAM_COUNT(upto));
+  if (rc == SQLITE_OK && (rc = db_cursor_next(&cur)) == SQLITE_ROW) {
+    *missing = (int)db_cursor_int64(&cur, 0);
+    rc = SQLITE_OK;
+  }
+  db_cursor_close(&cur);
+  if (rc != SQLITE_OK || *missing > 0) {
+    return rc;
+  }
+  char month[8];
+  month_key(first_day, month);
+  DbParam manifest[] = {DB_INT(first_day), DB_INT(last_day), DB_TEXT(month),
+                        DB_TEXT(attached_path)};
+  return execute_non_query_params(SQL_ARCHIVE_MANIFEST_ADD, manifest,
+                                  DB_PARAM_COUNT(manifest));
+}
+
+// --- archive_load_range ---
+int archive_load_range(int first_day, int last_day) {
+  int rc = execute_non_query(SQL_ARCHIVE_CREATE_TEMP);
+  if (rc == SQLITE_OK) {
+    rc = execute_non_query("DELETE FROM temp.ArchivedDeals;");
+  }
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  // The files are collected first: ATTACH cannot run while the manifest
+  // cursor is open on the same connection
+  char **files = NULL;
+  size_t count = 0, cap = 0;
+  DbParam range[] = {DB_INT(first_day), DB_INT(last_day)};
+  DbCursor cur;
+  rc = db_cursor_open(&cur,
+                      "SELECT file FROM DealArchive "
+                      "WHERE last_day >= ?1 AND first_day <= ?2 "
+                      "ORDER BY month;",
+                      range, DB_PARAM_COUNT(range));
+  while (rc == SQLITE_OK && (rc = db_cursor_next(&cur)) == SQLITE_ROW) {
+    rc = SQLITE_OK;
+    if (count == cap) {
+      size_t new_cap = cap ? cap * 2 : 16;
+      char **grown = realloc(files, new_cap * sizeof(*files));
+      if (!grown) {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      files = grown;
+      cap = new_cap;
+    }
+    const char *file = db_cursor_text(&cur, 0, NULL);
+    files[count] = malloc(strlen(file) + 1);
+    if (!files[count]) {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    strcpy(files[count++], file);
+  }
+  db_cursor_close(&cur);
+  if (rc == SQLITE_DONE) {
+    rc = SQLITE_OK;
+  }
+
+  for (size_t i = 0; i < count && rc == SQLITE_OK; i++) {
+    // ATTACH would silently create an empty file in place of a lost one
+    if (access(files[i], R_OK) != 0) {
+      fprintf(stderr, "!!! archive: Month file '%s' is missing.\n", files[i]);
+      rc = SQLITE_CANTOPEN;
+      break;
+    }
+    DbParam file[] = {DB_TEXT(files[i])};
+    rc = execute_non_query_params("ATTACH DATABASE ? AS archive_read;", file,
+                                  DB_PARAM_COUNT(file));
+    if (rc != SQLITE_OK) {
+      break;
+    }
+    rc = execute_non_query_params(
+        "INSERT INTO temp.ArchivedDeals SELECT * FROM archive_read.Deals "
+        "WHERE deal_date BETWEEN ? AND ?;",
+        range, DB_PARAM_COUNT(range));
+    int rc_detach = execute_non_query("DETACH DATABASE archive_read;");
+    if (rc == SQLITE_OK) {
+      rc = rc_detach;
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    free(files[i]);
+  }
+  free(files);
+  return rc;
+}
+
+// --- archive_month_count ---
+int archive_month_count(void) {
+  DbCursor cur;
+  int count = -1;
+  if (db_cursor_open(&cur, "SELECT COUNT(*) FROM DealArchive;", NULL, 0) ==
+          SQLITE_OK &&
+      db_cursor_next(&cur) == SQLITE_ROW) {
+    count = (int)db_cursor_int64(&cur, 0);
+  }
+  db_cursor_close(&cur);
+  return count;
+}
@@ -1,102 +1,364 @@
 #include "../includes/auth.h" // Correct path
 #include "../includes/db.h"   // Correct path
+#include "../includes/sha256.h"
+#include <pthread.h> // The login cache is shared by all threads
 #include <sqlite3.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-// --- VERY INSECURE HASHING PLACEHOLDER ---
-// Replace with bcrypt, Argon2, or similar library
+#define HASH_PREFIX "pbkdf2-sha256$"
+#define LEGACY_PREFIX "hashed_" // Unsalted placeholder of the first schema
+#define SALT_SIZE 16
+#define MAX_ITERATIONS 100000000UL // Refuse absurd costs from a stored hash
+#define LOGIN_CACHE_SIZE 64
+
+static atomic_ullong stat_hashes;
+static atomic_ullong stat_cache_hits;
+static atomic_ullong stat_rehashes;
+
+// --- Settings ---
+static AuthSettings settings_in_effect = {100000, 300};
+
+const AuthSettings *auth_get_settings(void) { return &settings_in_effect; }
+
+void auth_set_settings(const AuthSettings *settings) {
+  settings_in_effect = *settings;
+}
+
+static int set_password_iterations(const char *value) {
+  long long v;
+  if (db_setting_int(value, 1000, 100000000, &v) != 0) {
+    return -1;
+  }
+  settings_in_effect.password_iterations = (int)v;
+  return 0;
+}
+
+static int set_login_cache_ttl(const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 86400, &v) != 0) {
+    return -1;
+  }
+  settings_in_effect.login_cache_ttl_s = (int)v;
+  return 0;
+}
+
+const DbSettingKey auth_setting_keys[] = {
+    {"password_iterations", set_password_iterations},
+    {"login_cache_ttl_s", set_login_cache_ttl},
+    {NULL, NULL}};
+
+// Compares n bytes without stopping at the first difference
+static int equal_const_time(const void *a, const void *b, size_t n) {
+  const unsigned char *x = a, *y = b;
+  unsigned char diff = 0;
+  for (size_t i = 0; i < n; i++) {
+    diff |= (unsigned char)(x[i] ^ y[i]);
+  }
+  return diff == 0;
+}
+
+static void to_hex(const unsigned char *bytes, size_t n, char *out) {
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < n; i++) {
+    out[2 * i] = digits[bytes[i] >> 4];
+    out[2 * i + 1] = digits[bytes[i] & 0x0f];
+  }
+  out[2 * n] = '\0';
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+// Exactly 2 * n lowercase hex digits; returns the text after them or NULL
+static const char *from_hex(const char *text, unsigned char *bytes, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    int hi = hex_value(text[2 * i]);
+    int lo = hi < 0 ? -1 : hex_value(text[2 * i + 1]);
+    if (lo < 0) {
+      return NULL;
+    }
+    bytes[i] = (unsigned char)(hi << 4 | lo);
+  }
+  return text + 2 * n;
+}
+
+// Splits a PBKDF2 hash; 0 on success, -1 if it is not one
+static int parse_hash(const char *hash, unsigned long *iterations,
+                      unsigned char salt[SALT_SIZE],
+                      unsigned char key[SHA256_DIGEST_SIZE]) {
+  size_t prefix_len = strlen(HASH_PREFIX);
+  if (strncmp(hash, HASH_PREFIX, prefix_len) != 0) {
+    return -1;
+  }
+  const char *p = hash + prefix_len;
+  if (*p < '1' || *p > '9') {
+    return -1;
+  }
+  char *end = NULL;
+  unsigned long count = strtoul(p, &end, 10);
+  if (*end != '$' || count > MAX_ITERATIONS) {
+    return -1;
+  }
+  p = from_hex(end + 1, salt, SALT_SIZE);
+  if (!p || *p != '$') {
+    return -1;
+  }
+  p = from_hex(p + 1, key, SHA256_DIGEST_SIZE);
+  if (!p || *p != '\0') {
+    return -1;
+  }
+  *iterations = count;
+  return 0;
+}
+
+static void derive_key(const char *password, const unsigned char *salt,
+                       unsigned long iterations,
+                       unsigned char key[SHA256_DIGEST_SIZE]) {
+  pbkdf2_hmac_sha256(password, strlen(password), salt, SALT_SIZE, iterations,
+                     key, SHA256_DIGEST_SIZE);
+  atomic_fetch_add(&stat_hashes, 1);
+}
+
+// Does the PBKDF2 work of a real check and discards it, so an unknown user
+// takes as long to reject as a wrong password
+static void derive_dummy_key(const char *password) {
+  static const unsigned char dummy_salt[SALT_SIZE] = "perfume-no-user";
+  unsigned char key[SHA256_DIGEST_SIZE];
+  derive_key(password, dummy_salt,
+             (unsigned long)settings_in_effect.password_iterations, key);
+}
+
+// --- hash_password ---
 void hash_password(const char *password, char *hashed_output,
                    size_t output_size) {
-  // Example: Simple 'hashing' (DO NOT USE - just for demonstration)
-  if (password && hashed_output && output_size > 0) {
-    snprintf(hashed_output, output_size, "hashed_%s", password);
-  } else if (hashed_output && output_size > 0) {
-    hashed_output[0] = '\0'; // Handle null password case
+  if (!hashed_output || output_size == 0) {
+    return;
+  }
+  hashed_output[0] = '\0';
+  if (!password || output_size < AUTH_HASH_SIZE) {
+    return;
   }
+  unsigned long iterations =
+      (unsigned long)settings_in_effect.password_iterations;
+  unsigned char salt[SALT_SIZE], key[SHA256_DIGEST_SIZE];
+  sqlite3_randomness(SALT_SIZE, salt);
+  derive_key(password, salt, iterations, key);
+  char salt_hex[2 * SALT_SIZE + 1], key_hex[2 * SHA256_DIGEST_SIZE + 1];
+  to_hex(salt, SALT_SIZE, salt_hex);
+  to_hex(key, SHA256_DIGEST_SIZE, key_hex);
+  snprintf(hashed_output, output_size, HASH_PREFIX "%lu$%s$%s", iterations,
+           salt_hex, key_hex);
 }
 
+// --- verify_password ---
 int verify_password(const char *password, const char *hash_from_db) {
   if (!password || !hash_from_db) {
     printf("DEBUG: verify_password: Received NULL password or hash_from_db.\n");
     return 0; // Cannot verify if input is NULL
   }
-  char temp_hash[256]; // Ensure buffer is large enough
-  hash_password(password, temp_hash,
-                sizeof(temp_hash)); // Hash the input password
-  printf("DEBUG: verify_password: Comparing hash_from_input ('%s') with "
-         "hash_from_db ('%s')\n",
-         temp_hash, hash_from_db);
-  int result = strcmp(temp_hash,
-                      hash_from_db); // Compare generated hash with stored hash
-  printf("DEBUG: verify_password: strcmp result = %d (0 means match)\n",
-         result);
-  return (
-      result ==
-      0); // Return 1 (true) if strcmp returns 0 (match), otherwise 0 (false)
-}
-// --- END INSECURE PLACEHOLDER ---
-
-// Callback for login query
-static int login_callback(void *data, int argc, char **argv, char **azColName) {
-  UserSession *session = (UserSession *)data; // Get pointer to session struct
-  const char *db_password_hash = NULL;
-  const char *db_role = NULL;
-  const char *db_broker_surname = NULL;
-
-  printf("DEBUG: login_callback: Entered.\n");
-
-  // Extract data from the row returned by SQLite
-  for (int i = 0; i < argc; i++) {
-    if (strcmp(azColName[i], "password_hash") == 0) {
-      db_password_hash = argv[i];
-    } else if (strcmp(azColName[i], "role") == 0) {
-      db_role = argv[i];
-    } else if (strcmp(azColName[i], "broker_surname_fk") == 0) {
-      db_broker_surname = argv[i];
+  unsigned long iterations;
+  unsigned char salt[SALT_SIZE], stored[SHA256_DIGEST_SIZE];
+  if (parse_hash(hash_from_db, &iterations, salt, stored) == 0) {
+    unsigned char key[SHA256_DIGEST_SIZE];
+    derive_key(password, salt, iterations, key);
+    return equal_const_time(key, stored, sizeof(key));
+  }
+  size_t legacy_len = strlen(LEGACY_PREFIX);
+  if (strncmp(hash_from_db, LEGACY_PREFIX, legacy_len) == 0) {
+    printf("DEBUG: verify_password: Legacy unsalted hash.\n");
+    const char *plain = hash_from_db + legacy_len;
+    size_t len = strlen(password);
+    return strlen(plain) == len && equal_const_time(plain, password, len);
+  }
+  printf("DEBUG: verify_password: Unknown password hash format.\n");
+  return 0;
+}
+
+// --- password_needs_rehash ---
+int password_needs_rehash(const char *hash_from_db) {
+  unsigned long iterations;
+  unsigned char salt[SALT_SIZE], key[SHA256_DIGEST_SIZE];
+  if (!hash_from_db || parse_hash(hash_from_db, &iterations, salt, key) != 0) {
+    return 1;
+  }
+  return iterations != (unsigned long)settings_in_effect.password_iterations;
+}
+
+// --- auth_upgrade_legacy_hashes ---
+int auth_upgrade_legacy_hashes(void) {
+  // One row at a time: every update takes the row out of the query
+  for (;;) {
+    DbCursor cur;
+    int rc = db_cursor_open(&cur,
+                            "SELECT user_id, substr(password_hash, 8) "
+                            "FROM Users WHERE substr(password_hash, 1, 7) = "
+                            "'" LEGACY_PREFIX "' LIMIT 1;",
+                            NULL, 0);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+    rc = db_cursor_next(&cur);
+    if (rc != SQLITE_ROW) {
+      db_cursor_close(&cur);
+      return rc == SQLITE_DONE ? SQLITE_OK : rc;
+    }
+    sqlite3_int64 user_id = db_cursor_int64(&cur, 0);
+    const char *password = db_cursor_text(&cur, 1, NULL);
+    char hash[AUTH_HASH_SIZE];
+    hash_password(password ? password : "", hash, sizeof(hash));
+    db_cursor_close(&cur);
+    DbParam params[] = {DB_TEXT(hash), DB_INT(user_id)};
+    rc = execute_non_query_params(
+        "UPDATE Users SET password_hash = ? WHERE user_id = ?;", params,
+        DB_PARAM_COUNT(params));
+    if (rc != SQLITE_OK) {
+      return rc;
     }
   }
+}
 
-  // Basic validation
-  if (!db_password_hash || !db_role) {
-    fprintf(stderr, "!!! login_callback: Login query failed to retrieve "
-                    "necessary user data (hash or role is NULL).\n");
-    session->is_authenticated = 0; // Ensure flag is reset
-    return 1; // Indicate error (stop processing if possible)
+// --- Login cache ---
+// Remembered logins: the user, an HMAC of user and password under a random
+// per-process key, and the stored hash they were verified against. A hit
+// needs all three to match, so a password change in the database (by any
+// process) invalidates the entry.
+typedef struct {
+  char username[MAX_USERNAME_LEN];
+  unsigned char token[SHA256_DIGEST_SIZE];
+  char hash[AUTH_HASH_SIZE];
+  time_t expires; // 0 = free slot
+} LoginCacheEntry;
+
+static pthread_mutex_t login_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static LoginCacheEntry login_cache[LOGIN_CACHE_SIZE];
+static unsigned char login_cache_key[SHA256_DIGEST_SIZE];
+static int login_cache_keyed = 0;
+
+// Under login_cache_lock
+static void login_token(const char *username, const char *password,
+                        unsigned char token[SHA256_DIGEST_SIZE]) {
+  if (!login_cache_keyed) {
+    sqlite3_randomness(sizeof(login_cache_key), login_cache_key);
+    login_cache_keyed = 1;
   }
+  size_t user_len = strlen(username), password_len = strlen(password);
+  char message[MAX_USERNAME_LEN + MAX_PASSWORD_LEN + 1];
+  if (user_len >= MAX_USERNAME_LEN || password_len > MAX_PASSWORD_LEN) {
+    memset(token, 0, SHA256_DIGEST_SIZE); // Never cached (see callers)
+    return;
+  }
+  memcpy(message, username, user_len + 1); // NUL separates the two
+  memcpy(message + user_len + 1, password, password_len);
+  hmac_sha256(login_cache_key, sizeof(login_cache_key), message,
+              user_len + 1 + password_len, token);
+}
 
-  printf("DEBUG: login_callback: Found user '%s', role '%s'. Verifying "
-         "password...\n",
-         session->username, db_role);
+static int login_cache_cacheable(const char *username, const char *password,
+                                 const char *hash) {
+  return settings_in_effect.login_cache_ttl_s > 0 &&
+         strlen(username) < MAX_USERNAME_LEN &&
+         strlen(password) <= MAX_PASSWORD_LEN && strlen(hash) < AUTH_HASH_SIZE;
+}
+
+// 1 if the login was verified before against this stored hash
+static int login_cache_lookup(const char *username, const char *password,
+                              const char *hash) {
+  if (!login_cache_cacheable(username, password, hash)) {
+    return 0;
+  }
+  time_t now = time(NULL);
+  int hit = 0;
+  pthread_mutex_lock(&login_cache_lock);
+  for (int i = 0; i < LOGIN_CACHE_SIZE; i++) {
+    LoginCacheEntry *e = &login_cache[i];
+    if (e->expires > now && strcmp(e->username, username) == 0) {
+      unsigned char token[SHA256_DIGEST_SIZE];
+      login_token(username, password, token);
+      hit = equal_const_time(token, e->token, sizeof(token)) &&
+            strcmp(e->hash, hash) == 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&login_cache_lock);
+  if (hit) {
+    atomic_fetch_add(&stat_cache_hits, 1);
+  }
+  return hit;
+}
 
-  // --- !!! CORRECTED call to verify_password !!! ---
-  // Use the password temporarily stored in the session structure
-  if (verify_password(session->current_password_attempt, db_password_hash)) {
-    // Password matches
-    printf("DEBUG: login_callback: Password verified successfully.\n");
-    session->is_authenticated = 1; // Set authentication flag
-    strncpy(session->role, db_role, sizeof(session->role) - 1);
-    session->role[sizeof(session->role) - 1] = '\0'; // Ensure null termination
-
-    // Handle broker-specific info
-    if (strcmp(session->role, "broker") == 0 && db_broker_surname) {
-      strncpy(session->broker_surname, db_broker_surname,
-              sizeof(session->broker_surname) - 1);
-      session->broker_surname[sizeof(session->broker_surname) - 1] = '\0';
-      printf("DEBUG: login_callback: Broker surname set to '%s'.\n",
-             session->broker_surname);
-    } else {
-      session->broker_surname[0] =
-          '\0'; // Clear if not a broker or no surname linked
+static void login_cache_store(const char *username, const char *password,
+                              const char *hash) {
+  if (!login_cache_cacheable(username, password, hash)) {
+    return;
+  }
+  time_t now = time(NULL);
+  pthread_mutex_lock(&login_cache_lock);
+  // The user's own slot, else a free or expired one, else the oldest
+  LoginCacheEntry *slot = &login_cache[0];
+  for (int i = 0; i < LOGIN_CACHE_SIZE; i++) {
+    LoginCacheEntry *e = &login_cache[i];
+    if (e->expires > now && strcmp(e->username, username) == 0) {
+      slot = e;
+      break;
+    }
+    if (slot->expires > now && e->expires < slot->expires) {
+      slot = e;
     }
-    return 0; // Success - stop sqlite3_exec from processing more rows (though
-              // LIMIT 1 should prevent it)
-  } else {
-    // Password mismatch
-    printf("DEBUG: login_callback: Password verification failed.\n");
-    session->is_authenticated = 0; // Ensure flag is reset
-    return 1; // Indicate failure - stop sqlite3_exec from processing more rows
   }
+  snprintf(slot->username, sizeof(slot->username), "%s", username);
+  login_token(username, password, slot->token);
+  snprintf(slot->hash, sizeof(slot->hash), "%s", hash);
+  slot->expires = now + settings_in_effect.login_cache_ttl_s;
+  pthread_mutex_unlock(&login_cache_lock);
+}
+
+// --- auth_login_cache_clear ---
+void auth_login_cache_clear(void) {
+  pthread_mutex_lock(&login_cache_lock);
+  memset(login_cache, 0, sizeof(login_cache));
+  pthread_mutex_unlock(&login_cache_lock);
+}
+
+// --- auth_get_stats ---
+void auth_get_stats(AuthStats *stats) {
+  stats->hashes = atomic_load(&stat_hashes);
+  stats->cache_hits = atomic_load(&stat_cache_hits);
+  stats->rehashes = atomic_load(&stat_rehashes);
+}
+
+// Stores a hash with the current cost after a successful login. hash is the
+// value read at login and receives the new one. Only a warning on failure
+// (e.g. a read-only database): the old hash still works.
+static void rehash_stored_password(const char *username, const char *password,
+                                   char *hash, size_t hash_size) {
+  char new_hash[AUTH_HASH_SIZE];
+  hash_password(password, new_hash, sizeof(new_hash));
+  // Unless the password was changed meanwhile
+  DbParam params[] = {DB_TEXT(new_hash), DB_TEXT(username), DB_TEXT(hash)};
+  int rc = execute_non_query_params("UPDATE Users SET password_hash = ? "
+                                    "WHERE username = ? AND password_hash = ?;",
+                                    params, DB_PARAM_COUNT(params));
+  if (rc != SQLITE_OK || sqlite3_changes(db) != 1) {
+    fprintf(stderr,
+            "!!! WARNING: login_user: Could not update the password hash of "
+            "'%s' (rc=%d).\n",
+            username, rc);
+    return;
+  }
+  atomic_fetch_add(&stat_rehashes, 1);
+  snprintf(hash, hash_size, "%s", new_hash);
+  printf("DEBUG: login_user: Password hash of '%s' upgraded.\n", username);
 }
 
 // Login function
@@ -120,51 +382,82 @@ int login_user(const char *username, const char *password,
   session->username[sizeof(session->username) - 1] =
       '\0'; // Ensure null termination
 
-  // --- !!! Temporarily store password in session !!! ---
-  // INSECURE for production - password should be hashed ASAP
-  strncpy(session->current_password_attempt, password,
-          sizeof(session->current_password_attempt) - 1);
-  session->current_password_attempt[sizeof(session->current_password_attempt) -
-                                    1] = '\0';
-  // --- End temp password storage ---
-
-  char query[512];
-  // !!! VULNERABLE TO SQL INJECTION - Use prepared statements !!!
-  snprintf(query, sizeof(query),
-           "SELECT password_hash, role, broker_surname_fk FROM Users WHERE "
-           "username = '%s' LIMIT 1;",
-           username);
-
-  char *errMsg = NULL;
-  printf("DEBUG: login_user: Executing query: %s\n", query);
-
-  // Execute the query, passing the session struct to the callback
-  int rc = sqlite3_exec(db, query, login_callback, session, &errMsg);
-
-  // --- !!! Clear password from memory ASAP !!! ---
-  // Overwrite the temporary storage
-  memset(session->current_password_attempt, 0,
-         sizeof(session->current_password_attempt));
-  // --- End password clearing ---
-
-  // Check execution result
-  if (rc != SQLITE_OK && rc != SQLITE_ABORT) {
-    // SQLITE_ABORT means the callback requested stop (which it does on
-    // success/failure)
+  // Username is bound as a parameter, never interpolated into the SQL text
+  sqlite3_stmt *stmt = NULL;
+  int rc = db_prepare_cached("SELECT password_hash, role, broker_surname_fk "
+                             "FROM Users WHERE username = ? LIMIT 1;",
+                             &stmt);
+  if (rc != SQLITE_OK) {
+    return -1; // Database error (already reported)
+  }
+  DbParam params[] = {DB_TEXT(username)};
+  if (db_bind_params(stmt, params, DB_PARAM_COUNT(params)) != SQLITE_OK) {
+    db_release_stmt(stmt);
+    return -1;
+  }
+
+  rc = sqlite3_step(stmt);
+  if (rc == SQLITE_DONE) {
+    printf("DEBUG: login_user: User '%s' not found.\n", username);
+    db_release_stmt(stmt);
+    derive_dummy_key(password);
+    return 1; // Authentication failed (user not found)
+  }
+  if (rc != SQLITE_ROW) {
     fprintf(stderr, "!!! SQL error during login query execution: %s (rc=%d)\n",
-            errMsg ? errMsg : "Unknown error", rc);
-    sqlite3_free(errMsg);
-    session->is_authenticated = 0; // Ensure not authenticated on error
-    return -1;                     // Database error
+            sqlite3_errmsg(db), rc);
+    db_release_stmt(stmt);
+    return -1; // Database error
   }
 
-  // Check the authentication flag set by the callback
-  if (!session->is_authenticated) {
-    // Failure message printed by callback or main loop
-    return 1; // Authentication failed (user not found or password mismatch)
+  const char *db_password_hash = (const char *)sqlite3_column_text(stmt, 0);
+  const char *db_role = (const char *)sqlite3_column_text(stmt, 1);
+  const char *db_broker_surname = (const char *)sqlite3_column_text(stmt, 2);
+
+  // Basic validation
+  if (!db_password_hash || !db_role) {
+    fprintf(stderr, "!!! login_user: Login query failed to retrieve "
+                    "necessary user data (hash or role is NULL).\n");
+    db_release_stmt(stmt);
+    derive_dummy_key(password);
+    return -1;
+  }
+
+  printf("DEBUG: login_user: Found user '%s', role '%s'. Verifying "
+         "password...\n",
+         session->username, db_role);
+
+  int cached = login_cache_lookup(username, password, db_password_hash);
+  if (cached) {
+    printf("DEBUG: login_user: Verified earlier (login cache).\n");
+  } else if (!verify_password(password, db_password_hash)) {
+    printf("DEBUG: login_user: Password verification failed.\n");
+    db_release_stmt(stmt);
+    return 1; // Authentication failed (password mismatch)
+  }
+
+  session->is_authenticated = 1; // Set authentication flag
+  strncpy(session->role, db_role, sizeof(session->role) - 1);
+  session->role[sizeof(session->role) - 1] = '\0'; // Ensure null termination
+
+  // Handle broker-specific info
+  if (strcmp(session->role, "broker") == 0 && db_broker_surname) {
+    strncpy(session->broker_surname, db_broker_surname,
+            sizeof(session->broker_surname) - 1);
+    session->broker_surname[sizeof(session->broker_surname) - 1] = '\0';
+  }
+  char stored_hash[AUTH_HASH_SIZE];
+  snprintf(stored_hash, sizeof(stored_hash), "%s", db_password_hash);
+  db_release_stmt(stmt); // Column pointers are invalid after this point
+
+  if (!cached) {
+    if (password_needs_rehash(stored_hash)) {
+      rehash_stored_password(username, password, stored_hash,
+                             sizeof(stored_hash));
+    }
+    login_cache_store(username, password, stored_hash);
   }
 
-  // If we reach here, session->is_authenticated must be 1
   printf("DEBUG: login_user: Login successful for user '%s'. Role: '%s'.\n",
          session->username, session->role);
   if (strcmp(session->role, "broker") == 0) {
@@ -172,4 +465,4 @@ int login_user(const char *username, const char *password,
            session->broker_surname);
   }
   return 0; // Login successful
-}
\ No newline at end of file
+}
@@ -0,0 +1,711 @@
+#define _POSIX_C_SOURCE 200809L // stat
+
+#include "../includes/cli.h"
+#include "../includes/aggregates.h"
+#include "../includes/dates.h"
+#include "../includes/db.h"
+#include "../includes/db_memory.h"
+#include "../includes/queries.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CLI_MAX_OPTIONS 8
+#define CLI_LINE_SIZE 4096
+
+// Exit codes of cli_run_command
+#define CLI_OK 0
+#define CLI_FAILED 1
+#define CLI_USAGE 2
+#define CLI_DENIED 3
+
+typedef struct CliCommand CliCommand;
+
+// One parsed invocation
+typedef struct {
+  const UserSession *session;
+  const CliCommand *command;
+  const char *values[CLI_MAX_OPTIONS]; // By option position; flags get "1"
+  FILE *out; // Tables and messages
+  FILE *err; // Errors
+} CliCall;
+
+typedef int (*CliHandler)(const CliCall *call);
+
+// Options: "name=" takes a value, "name" is a flag; a trailing '!' marks a
+// required one. The list ends with NULL.
+struct CliCommand {
+  const char *group;
+  const char *name;
+  int broker_allowed; // The broker menu offers it
+  const char *const *options;
+  CliHandler run;
+  const char *help; // Options as shown by "help"
+};
+
+// --- Option access ---
+static size_t option_name_len(const char *spec) {
+  return strcspn(spec, "=!");
+}
+
+static int option_index(const CliCommand *command, const char *name,
+                        size_t len) {
+  for (int i = 0; command->options[i]; i++) {
+    const char *spec = command->options[i];
+    if (option_name_len(spec) == len && strncmp(spec, name, len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Value of an option (flags: "1"), NULL if not given
+static const char *arg(const CliCall *call, const char *name) {
+  int i = option_index(call->command, name, strlen(name));
+  return i >= 0 ? call->values[i] : NULL;
+}
+
+// Integer option in [min, max]; *out keeps its default if not given
+static int arg_int(const CliCall *call, const char *name, long min, long max,
+                   int *out) {
+  const char *text = arg(call, name);
+  if (!text) {
+    return 0;
+  }
+  char *end;
+  errno = 0;
+  long v = strtol(text, &end, 10);
+  if (errno != 0 || end == text || *end != '\0' || v < min || v > max) {
+    fprintf(call->err, "!!! cli: --%s expects an integer from %ld to %ld.\n",
+            name, min, max);
+    return -1;
+  }
+  *out = (int)v;
+  return 0;
+}
+
+static int arg_double(const CliCall *call, const char *name, double *out) {
+  const char *text = arg(call, name);
+  if (!text) {
+    return 0;
+  }
+  char *end;
+  errno = 0;
+  double v = strtod(text, &end);
+  if (errno != 0 || end == text || *end != '\0' || !(v > 0)) {
+    fprintf(call->err, "!!! cli: --%s expects a positive number.\n", name);
+    return -1;
+  }
+  *out = v;
+  return 0;
+}
+
+// Maps a query result to an exit code. The query layer reports details on
+// stderr, which a server client does not see, so a failure gets a line on err
+static int sqlite_result(const CliCall *call, int rc) {
+  if (rc == SQLITE_OK) {
+    return CLI_OK;
+  }
+  if (rc == SQLITE_MISMATCH) { // Arguments rejected before running the query
+    fprintf(call->err, "!!! cli: Invalid date or argument.\n");
+  } else {
+    fprintf(call->err, "!!! cli: Query failed: %s.\n", sqlite3_errstr(rc));
+  }
+  return CLI_FAILED;
+}
+
+// --- Reports ---
+static int cmd_report_sales(const CliCall *call) {
+  const char *from = arg(call, "from"), *to = arg(call, "to");
+  return sqlite_result(
+      call, arg(call, "archive")
+                ? query_sales_summary_with_archive(from, to, call->out)
+                : query_sales_summary_by_period(from, to, call->out));
+}
+
+static int cmd_report_buyers(const CliCall *call) {
+  return sqlite_result(call,
+                       query_buyers_by_good(arg(call, "good"), call->out));
+}
+
+static int cmd_report_popular_type(const CliCall *call) {
+  return sqlite_result(call, query_most_popular_type_info(call->out));
+}
+
+static int cmd_report_top_broker(const CliCall *call) {
+  return sqlite_result(call, query_top_broker_info(call->out));
+}
+
+static int cmd_report_supplier_brokers(const CliCall *call) {
+  return sqlite_result(
+      call, query_supplier_brokers_info(arg(call, "supplier"), call->out));
+}
+
+static int cmd_report_leaderboard(const CliCall *call) {
+  static const char *const boards[LEADERBOARD_COUNT] = {
+      "brokers-deals", "brokers-units", "goods", "types"};
+  const char *board = arg(call, "board");
+  int limit = 10;
+  if (arg_int(call, "limit", 1, 1000000, &limit) != 0) {
+    return CLI_USAGE;
+  }
+  for (int i = 0; i < LEADERBOARD_COUNT; i++) {
+    if (strcmp(board, boards[i]) == 0) {
+      return sqlite_result(
+          call, query_leaderboard((Leaderboard)i, limit, call->out));
+    }
+  }
+  fprintf(call->err,
+          "!!! cli: --board expects brokers-deals, brokers-units, goods or "
+          "types.\n");
+  return CLI_USAGE;
+}
+
+static int cmd_report_bundle(const CliCall *call) {
+  return sqlite_result(call, query_report_bundle(NULL, arg(call, "from"),
+                                                 arg(call, "to"), call->out));
+}
+
+// --- Deal listings ---
+static int cmd_deals_on_date(const CliCall *call) {
+  const char *date = arg(call, "date");
+  return sqlite_result(
+      call, arg(call, "archive")
+                ? query_deals_on_date_with_archive(date, call->out)
+                : query_deals_on_date(date, call->out));
+}
+
+// One keyset page (see DealKey); prints the options of the next page
+static int cmd_deals_broker(const CliCall *call) {
+  const UserSession *session = call->session;
+  const char *surname = arg(call, "surname");
+  if (strcmp(session->role, "broker") == 0) {
+    if (surname && strcmp(surname, session->broker_surname) != 0) {
+      fprintf(call->err, "!!! cli: A broker may list only their own deals.\n");
+      return CLI_DENIED;
+    }
+    surname = session->broker_surname;
+  } else if (!surname) {
+    fprintf(call->err, "!!! cli: --surname is required.\n");
+    return CLI_USAGE;
+  }
+  int limit = query_get_settings()->list_page_size;
+  int after_id = 0;
+  if (arg_int(call, "limit", 1, 100000, &limit) != 0 ||
+      arg_int(call, "after-id", 1, 2147483647L, &after_id) != 0) {
+    return CLI_USAGE;
+  }
+  const char *after_date = arg(call, "after-date");
+  if (!after_date != !arg(call, "after-id")) {
+    fprintf(call->err, "!!! cli: --after-date and --after-id go together.\n");
+    return CLI_USAGE;
+  }
+  DealKey after = {0, after_id};
+  if (after_date && date_parse(after_date, &after.deal_date) != 0) {
+    fprintf(call->err, "!!! Invalid date '%s' (expected YYYY-MM-DD).\n",
+            after_date);
+    return CLI_USAGE;
+  }
+  DealPage page;
+  int rc = query_broker_deals_page(surname, after_date ? &after : NULL,
+                                   limit, &page, call->out);
+  if (rc == SQLITE_OK && page.has_more) {
+    char date[DATE_TEXT_SIZE];
+    date_format(page.last.deal_date, date);
+    fprintf(call->out, "Следующая страница: --after-date %s --after-id %lld\n",
+            date, (long long)page.last.deal_id);
+  }
+  return sqlite_result(call, rc);
+}
+
+// --- Data management (Task 3) ---
+static int cmd_add_broker(const CliCall *call) {
+  const char *surname = arg(call, "surname");
+  const char *address = arg(call, "address");
+  int birth_year = 0;
+  if (arg_int(call, "birth-year", 1900, 2100, &birth_year) != 0) {
+    return CLI_USAGE;
+  }
+  if (insert_broker(surname, address ? address : "", birth_year) !=
+      SQLITE_OK) {
+    fprintf(call->out, "Не удалось добавить маклера.\n");
+    return CLI_FAILED;
+  }
+  fprintf(call->out, "Маклер '%s' успешно добавлен.\n", surname);
+  return CLI_OK;
+}
+
+static int cmd_add_good(const CliCall *call) {
+  const char *name = arg(call, "name"), *supplier = arg(call, "supplier");
+  double price = 0;
+  int quantity = 0;
+  if (arg_double(call, "price", &price) != 0 ||
+      arg_int(call, "quantity", 0, 2147483647L, &quantity) != 0) {
+    return CLI_USAGE;
+  }
+  if (insert_good(name, arg(call, "type"), price, supplier,
+                  arg(call, "expiry"), quantity) != SQLITE_OK) {
+    fprintf(call->out, "Не удалось добавить товар.\n");
+    return CLI_FAILED;
+  }
+  fprintf(call->out, "Товар '%s' от '%s' успешно добавлен.\n", name, supplier);
+  return CLI_OK;
+}
+
+static int deal_from_call(const CliCall *call, DealInput *deal) {
+  DealInput parsed = {arg(call, "date"),   arg(call, "good"),
+                      arg(call, "supplier"), arg(call, "type"),
+                      0,                   arg(call, "broker"),
+                      arg(call, "buyer")};
+  *deal = parsed;
+  return arg_int(call, "quantity", 1, 2147483647L, &deal->quantity) == 0
+             ? CLI_OK
+             : CLI_USAGE;
+}
+
+// --- cli_report_deal ---
+int cli_report_deal(const DealInput *deal, DealResult result, FILE *out) {
+  switch (result) {
+  case DEAL_RESULT_OK:
+    fprintf(out, "Сделка успешно добавлена и остатки обновлены.\n");
+    return CLI_OK;
+  case DEAL_RESULT_NO_STOCK:
+    fprintf(out,
+            "Не удалось добавить сделку: Недостаточно товара '%s' от '%s' "
+            "на складе или товар не найден.\n",
+            deal->good_name, deal->supplier);
+    return CLI_FAILED;
+  default:
+    fprintf(out, "Не удалось добавить сделку: Ошибка при добавлении записи в "
+                 "Deals.\n");
+    return CLI_FAILED;
+  }
+}
+
+static int cmd_add_deal(const CliCall *call) {
+  DealInput deal;
+  if (deal_from_call(call, &deal) != CLI_OK) {
+    return CLI_USAGE;
+  }
+  return cli_report_deal(&deal, insert_deal(&deal), call->out);
+}
+
+static int cmd_set_price(const CliCall *call) {
+  const char *good = arg(call, "good"), *supplier = arg(call, "supplier");
+  double price = 0;
+  if (arg_double(call, "price", &price) != 0) {
+    return CLI_USAGE;
+  }
+  int updated = set_good_price(good, supplier, price);
+  if (updated > 0) {
+    fprintf(call->out, "Цена товара '%s' от '%s' успешно обновлена.\n", good,
+            supplier);
+    return CLI_OK;
+  }
+  if (updated == 0) {
+    fprintf(call->out, "Товар '%s' от '%s' не найден.\n", good, supplier);
+  } else {
+    fprintf(call->out, "Не удалось обновить цену товара.\n");
+  }
+  return CLI_FAILED;
+}
+
+static int cmd_delete_deal(const CliCall *call) {
+  int deal_id = 0;
+  if (arg_int(call, "id", 1, 2147483647L, &deal_id) != 0) {
+    return CLI_USAGE;
+  }
+  int deleted = remove_deal(deal_id);
+  if (deleted > 0) {
+    fprintf(call->out, "Сделка с ID %d успешно удалена.\n", deal_id);
+    return CLI_OK;
+  }
+  if (deleted == 0) {
+    fprintf(call->out, "Сделка с ID %d не найдена.\n", deal_id);
+  } else {
+    fprintf(call->out, "Не удалось удалить сделку.\n");
+  }
+  return CLI_FAILED;
+}
+
+// --- Task 4 and 5 ---
+static int cmd_stats_verify(const CliCall *call) {
+  int mismatches = aggregates_verify(arg(call, "repair") != NULL, call->out);
+  if (mismatches < 0) {
+    return CLI_FAILED;
+  }
+  fprintf(call->out, "Найдено расхождений: %d.\n", mismatches);
+  // Repaired counters are consistent again
+  return mismatches == 0 || arg(call, "repair") ? CLI_OK : CLI_FAILED;
+}
+
+static int cmd_stats_rebuild(const CliCall *call) {
+  return sqlite_result(call, aggregates_rebuild());
+}
+
+static int cmd_stats_memory(const CliCall *call) {
+  db_memory_print(call->out);
+  return CLI_OK;
+}
+
+static int cmd_purge_deals(const CliCall *call) {
+  const char *through = arg(call, "through");
+  if (arg(call, "archive")) {
+    int archived = 0, chunks = 0;
+    int rc = archive_deals_up_to(through, 0, &archived, &chunks);
+    fprintf(call->out,
+            "%d записей сделок перенесено в архив (%d транзакций).\n",
+            archived, chunks);
+    return sqlite_result(call, rc);
+  }
+  int goods_updated = 0, deals_deleted = 0;
+  int rc = clear_deals_up_to(through, &goods_updated, &deals_deleted);
+  if (rc == SQLITE_OK) {
+    fprintf(call->out,
+            "%d записей товаров обновлено, %d записей сделок удалено.\n",
+            goods_updated, deals_deleted);
+  }
+  return sqlite_result(call, rc);
+}
+
+static int cmd_help(const CliCall *call);
+
+// --- Command table ---
+static const char *const opts_none[] = {NULL};
+static const char *const opts_period[] = {"from=!", "to=!", NULL};
+static const char *const opts_sales[] = {"from=!", "to=!", "archive", NULL};
+static const char *const opts_buyers[] = {"good=", NULL};
+static const char *const opts_suppliers[] = {"supplier=", NULL};
+static const char *const opts_leaderboard[] = {"board=!", "limit=", NULL};
+static const char *const opts_on_date[] = {"date=!", "archive", NULL};
+static const char *const opts_broker_deals[] = {
+    "surname=", "limit=", "after-date=", "after-id=", NULL};
+static const char *const opts_add_broker[] = {"surname=!", "address=",
+                                              "birth-year=", NULL};
+static const char *const opts_add_good[] = {
+    "name=!",     "type=",     "price=!", "supplier=!",
+    "expiry=",    "quantity=!", NULL};
+static const char *const opts_add_deal[] = {
+    "date=!",     "good=!",   "supplier=!", "type=",
+    "quantity=!", "broker=!", "buyer=!",    NULL};
+static const char *const opts_set_price[] = {"good=!", "supplier=!",
+                                             "price=!", NULL};
+static const char *const opts_delete_deal[] = {"id=!", NULL};
+static const char *const opts_verify[] = {"repair", NULL};
+static const char *const opts_purge[] = {"through=!", "archive", NULL};
+
+static const CliCommand commands[] = {
+    {"report", "sales", 0, opts_sales, cmd_report_sales,
+     "--from DATE --to DATE [--archive]"},
+    {"report", "buyers", 1, opts_buyers, cmd_report_buyers, "[--good NAME]"},
+    {"report", "popular-type", 1, opts_none, cmd_report_popular_type, ""},
+    {"report", "top-broker", 0, opts_none, cmd_report_top_broker, ""},
+    {"report", "supplier-brokers", 0, opts_suppliers,
+     cmd_report_supplier_brokers, "[--supplier NAME]"},
+    {"report", "leaderboard", 0, opts_leaderboard, cmd_report_leaderboard,
+     "--board brokers-deals|brokers-units|goods|types [--limit N]"},
+    {"report", "bundle", 0, opts_period, cmd_report_bundle,
+     "--from DATE --to DATE"},
+    {"deals", "on-date", 0, opts_on_date, cmd_deals_on_date,
+     "--date DATE [--archive]"},
+    {"deals", "broker", 1, opts_broker_deals, cmd_deals_broker,
+     "[--surname NAME] [--limit N] [--after-date DATE --after-id ID]"},
+    {"add", "broker", 0, opts_add_broker, cmd_add_broker,
+     "--surname NAME [--address TEXT] [--birth-year N]"},
+    {"add", "good", 0, opts_add_good, cmd_add_good,
+     "--name NAME --supplier NAME --price P --quantity N [--type TYPE] "
+     "[--expiry DATE]"},
+    {"add", "deal", 0, opts_add_deal, cmd_add_deal,
+     "--date DATE --good NAME --supplier NAME --quantity N --broker NAME "
+     "--buyer NAME [--type TYPE]"},
+    {"set", "price", 0, opts_set_price, cmd_set_price,
+     "--good NAME --supplier NAME --price P"},
+    {"delete", "deal", 0, opts_delete_deal, cmd_delete_deal, "--id ID"},
+    {"stats", "verify", 0, opts_verify, cmd_stats_verify, "[--repair]"},
+    {"stats", "rebuild", 0, opts_none, cmd_stats_rebuild, ""},
+    {"stats", "memory", 0, opts_none, cmd_stats_memory, ""},
+    {"purge", "deals", 0, opts_purge, cmd_purge_deals,
+     "--through DATE [--archive]"},
+    {"help", NULL, 1, opts_none, cmd_help, ""},
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static int cmd_help(const CliCall *call) {
+  int broker = strcmp(call->session->role, "broker") == 0;
+  fprintf(call->out, "Команды:\n");
+  for (size_t i = 0; i < COMMAND_COUNT; i++) {
+    const CliCommand *c = &commands[i];
+    if (c->name && (!broker || c->broker_allowed)) {
+      fprintf(call->out, "  %s %s%s%s\n", c->group, c->name,
+              c->help[0] ? " " : "", c->help);
+    }
+  }
+  return CLI_OK;
+}
+
+// Fills call->values from "--name value" and "--flag" words
+static int parse_options(CliCall *call, int argc, char **argv) {
+  const CliCommand *command = call->command;
+  for (int i = 0; i < argc; i++) {
+    int index = strncmp(argv[i], "--", 2) == 0
+                    ? option_index(command, argv[i] + 2, strlen(argv[i] + 2))
+                    : -1;
+    if (index < 0) {
+      fprintf(call->err, "!!! cli: Unexpected '%s'.\n", argv[i]);
+      return -1;
+    }
+    if (strchr(command->options[index], '=')) {
+      if (i + 1 >= argc) {
+        fprintf(call->err, "!!! cli: %s needs a value.\n", argv[i]);
+        return -1;
+      }
+      call->values[index] = argv[++i];
+    } else {
+      call->values[index] = "1";
+    }
+  }
+  for (int i = 0; command->options[i]; i++) {
+    const char *spec = command->options[i];
+    if (strchr(spec, '!') && !call->values[i]) {
+      fprintf(call->err, "!!! cli: --%.*s is required.\n",
+              (int)option_name_len(spec), spec);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Finds the command, checks the role and parses the options into call (whose
+// out and err are set)
+static int prepare_call(const UserSession *session, int argc, char **argv,
+                        CliCall *call) {
+  if (argc < 1) {
+    fprintf(call->err, "!!! cli: No command; try 'help'.\n");
+    return CLI_USAGE;
+  }
+  const CliCommand *command = NULL;
+  for (size_t i = 0; i < COMMAND_COUNT && !command; i++) {
+    const CliCommand *c = &commands[i];
+    if (strcmp(c->group, argv[0]) == 0 &&
+        (!c->name || (argc >= 2 && strcmp(c->name, argv[1]) == 0))) {
+      command = c;
+    }
+  }
+  if (!command) {
+    fprintf(call->err, "!!! cli: Unknown command '%s%s%s'; try 'help'.\n",
+            argv[0], argc >= 2 ? " " : "", argc >= 2 ? argv[1] : "");
+    return CLI_USAGE;
+  }
+  if (strcmp(session->role, "admin") != 0 &&
+      !(command->broker_allowed && strcmp(session->role, "broker") == 0)) {
+    fprintf(call->err, "!!! cli: '%s %s' is not allowed for role '%s'.\n",
+            command->group, command->name ? command->name : "",
+            session->role);
+    return CLI_DENIED;
+  }
+  CliCall parsed = {session, command, {NULL}, call->out, call->err};
+  *call = parsed;
+  int skip = command->name ? 2 : 1;
+  if (parse_options(call, argc - skip, argv + skip) != 0) {
+    fprintf(call->err, "Usage: %s %s %s\n", command->group,
+            command->name ? command->name : "", command->help);
+    return CLI_USAGE;
+  }
+  return CLI_OK;
+}
+
+// --- cli_run_command ---
+int cli_run_command(const UserSession *session, int argc, char **argv,
+                    FILE *out, FILE *err) {
+  CliCall call = {session, NULL, {NULL}, out, err};
+  int rc = prepare_call(session, argc, argv, &call);
+  return rc == CLI_OK ? call.command->run(&call) : rc;
+}
+
+// --- cli_parse_deal ---
+int cli_parse_deal(const UserSession *session, int argc, char **argv,
+                   DealInput *deal, FILE *err) {
+  if (argc < 2 || strcmp(argv[0], "add") != 0 ||
+      strcmp(argv[1], "deal") != 0) {
+    return -1;
+  }
+  CliCall call = {session, NULL, {NULL}, NULL, err}; // Prints no output
+  int rc = prepare_call(session, argc, argv, &call);
+  return rc == CLI_OK ? deal_from_call(&call, deal) : rc;
+}
+
+// --- cli_split_line ---
+int cli_split_line(char *line, char **words, int max_words) {
+  int count = 0;
+  char *p = line;
+  for (;;) {
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    if (*p == '\0' || *p == '#') {
+      return count;
+    }
+    if (count == max_words) {
+      return -1;
+    }
+    char *out = p; // Words shrink while unquoting, so they are copied down
+    words[count++] = out;
+    int quoted = 0;
+    while (*p && (quoted || !isspace((unsigned char)*p))) {
+      if (*p == '"') {
+        quoted = !quoted;
+        p++;
+      } else if (quoted && *p == '\\' && (p[1] == '"' || p[1] == '\\')) {
+        *out++ = p[1];
+        p += 2;
+      } else {
+        *out++ = *p++;
+      }
+    }
+    if (quoted) {
+      return -1;
+    }
+    int end = *p != '\0';
+    *out = '\0';
+    if (!end) {
+      return count;
+    }
+    p++;
+  }
+}
+
+// --- cli_run_script ---
+int cli_run_script(const UserSession *session, FILE *in, const char *name,
+                   int keep_going) {
+  char line[CLI_LINE_SIZE];
+  char *words[CLI_MAX_WORDS];
+  int line_no = 0, result = CLI_OK;
+  while (fgets(line, sizeof(line), in)) {
+    line_no++;
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      fflush(stdout);
+      fprintf(stderr, "!!! %s:%d: line too long.\n", name, line_no);
+      return CLI_USAGE; // The rest of the line would run as a command
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    char text[CLI_LINE_SIZE];
+    strcpy(text, line); // Kept for the header: splitting edits line
+    int count = cli_split_line(line, words, CLI_MAX_WORDS);
+    if (count == 0) {
+      continue;
+    }
+    printf("\n>>> %s:%d: %s\n", name, line_no, text);
+    // stdout is buffered and stderr is not: flush before every write to
+    // stderr so a message cannot land in the middle of pending output
+    fflush(stdout);
+    int rc = CLI_USAGE;
+    if (count < 0) {
+      fprintf(stderr, "!!! %s:%d: unterminated quote or more than %d words.\n",
+              name, line_no, CLI_MAX_WORDS);
+    } else {
+      rc = cli_run_command(session, count, words, stdout, stderr);
+    }
+    if (rc != CLI_OK) {
+      fflush(stdout);
+      fprintf(stderr, "!!! %s:%d: command failed (%d).\n", name, line_no, rc);
+      result = rc;
+      if (!keep_going) {
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+// --- cli_login ---
+// Trims leading/trailing whitespace in place
+static char *trim(char *str) {
+  while (isspace((unsigned char)*str)) {
+    str++;
+  }
+  char *end = str + strlen(str);
+  while (end > str && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+  return str;
+}
+
+static int read_credentials(const char *path, char *user, size_t user_size,
+                            char *password, size_t password_size) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "!!! cli: Cannot open credentials '%s': %s\n", path,
+            strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fileno(fp), &st) == 0 && (st.st_mode & 077) != 0) {
+    fprintf(stderr,
+            "!!! cli: Warning: credentials '%s' are readable by others "
+            "(chmod 600).\n",
+            path);
+  }
+  char line[256];
+  int rc = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    char *hash = strchr(line, '#');
+    if (hash) {
+      *hash = '\0';
+    }
+    char *text = trim(line);
+    char *eq = strchr(text, '=');
+    if (text[0] == '\0' || !eq) {
+      continue;
+    }
+    *eq = '\0';
+    char *key = trim(text), *value = trim(eq + 1);
+    if (strcmp(key, "user") == 0 && strlen(value) < user_size) {
+      strcpy(user, value);
+    } else if (strcmp(key, "password") == 0 && strlen(value) < password_size) {
+      strcpy(password, value);
+    } else {
+      fprintf(stderr, "!!! cli: Invalid line for '%s' in '%s'.\n", key, path);
+      rc = -1;
+    }
+  }
+  memset(line, 0, sizeof(line));
+  fclose(fp);
+  return rc;
+}
+
+int cli_login(const char *credentials_path, UserSession *session) {
+  char user[MAX_USERNAME_LEN] = "", password[MAX_PASSWORD_LEN] = "";
+  if (!credentials_path) {
+    credentials_path = getenv("PERFUME_CREDENTIALS");
+  }
+  if (credentials_path) {
+    if (read_credentials(credentials_path, user, sizeof(user), password,
+                         sizeof(password)) != 0) {
+      memset(password, 0, sizeof(password));
+      return 1;
+    }
+  } else {
+    const char *env_user = getenv("PERFUME_USER");
+    const char *env_password = getenv("PERFUME_PASSWORD");
+    if (env_user && strlen(env_user) < sizeof(user)) {
+      strcpy(user, env_user);
+    }
+    if (env_password && strlen(env_password) < sizeof(password)) {
+      strcpy(password, env_password);
+    }
+  }
+  if (user[0] == '\0' || password[0] == '\0') {
+    fprintf(stderr, "!!! cli: No credentials: use --credentials FILE, "
+                    "PERFUME_CREDENTIALS or PERFUME_USER and "
+                    "PERFUME_PASSWORD.\n");
+    return 1;
+  }
+  memset(session, 0, sizeof(*session));
+  int rc = login_user(user, password, session);
+  memset(password, 0, sizeof(password));
+  return rc;
+}
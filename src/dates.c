@@ -0,0 +1,84 @@
+#include "../includes/dates.h"
+#include <stdio.h>
+
+static int is_leap_year(int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// Day number of a valid civil date (H. Hinnant's days_from_civil)
+static int days_from_civil(int y, int m, int d) {
+  y -= m <= 2;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// --- date_parse ---
+int date_parse(const char *text, int *days) {
+  static const int days_in_month[] = {31, 28, 31, 30, 31, 30,
+                                      31, 31, 30, 31, 30, 31};
+  if (!text) {
+    return -1;
+  }
+  for (int i = 0; i < 10; i++) {
+    if (i == 4 || i == 7) {
+      if (text[i] != '-') {
+        return -1;
+      }
+    } else if (text[i] < '0' || text[i] > '9') {
+      return -1; // Also stops at a NUL before position 10
+    }
+  }
+  if (text[10] != '\0') {
+    return -1;
+  }
+  int year = (text[0] - '0') * 1000 + (text[1] - '0') * 100 +
+             (text[2] - '0') * 10 + (text[3] - '0');
+  int month = (text[5] - '0') * 10 + (text[6] - '0');
+  int day = (text[8] - '0') * 10 + (text[9] - '0');
+  if (year < 1 || month < 1 || month > 12 || day < 1) {
+    return -1;
+  }
+  int max_day = days_in_month[month - 1] +
+                (month == 2 && is_leap_year(year) ? 1 : 0);
+  if (day > max_day) {
+    return -1;
+  }
+  if (days) {
+    *days = days_from_civil(year, month, day);
+  }
+  return 0;
+}
+
+// --- date_format ---
+void date_format(int days, char out[DATE_TEXT_SIZE]) {
+  // H. Hinnant's civil_from_days
+  long z = (long)days + 719468;
+  long era = (z >= 0 ? z : z - 146096) / 146097;
+  long doe = z - era * 146097;
+  long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  long mp = (5 * doy + 2) / 153;
+  long d = doy - (153 * mp + 2) / 5 + 1;
+  long m = mp < 10 ? mp + 3 : mp - 9;
+  long y = yoe + era * 400 + (m <= 2);
+  // The modulos change nothing for years 0..9999; they bound the field
+  // widths so the compiler can see the text fits
+  snprintf(out, DATE_TEXT_SIZE, "%04u-%02u-%02u", (unsigned)y % 10000u,
+           (unsigned)m % 13u, (unsigned)d % 32u);
+}
+
+// --- date_month_range ---
+void date_month_range(int days, int *first_day, int *last_day) {
+  char text[DATE_TEXT_SIZE];
+  date_format(days, text);
+  int year = (text[0] - '0') * 1000 + (text[1] - '0') * 100 +
+             (text[2] - '0') * 10 + (text[3] - '0');
+  int month = (text[5] - '0') * 10 + (text[6] - '0');
+  *first_day = days_from_civil(year, month, 1);
+  *last_day = (month == 12 ? days_from_civil(year + 1, 1, 1)
+                           : days_from_civil(year, month + 1, 1)) -
+              1;
+}
@@ -1,12 +1,402 @@
 #include "../includes/db.h" // Correct path
+#include "../includes/dates.h"
+#include "../includes/db_memory.h"
+#include "../includes/migrations.h"
+#include "../includes/report_cache.h"
 #include <ctype.h>          // For isspace
 #include <errno.h>
+#include <pthread.h> // Profiler statistics are shared by all connections
 #include <sqlite3.h>
+#include <stdatomic.h> // Cancel requests come from a signal handler
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> // For strcmp, strlen
+#include <time.h>   // timespec_get for the profiler
 
-sqlite3 *db = NULL;
+_Thread_local sqlite3 *db = NULL;
+
+static void profiler_attach(void);
+static int profiler_enabled = 0;
+static void budget_attach(void);
+
+// --- Connection profile ---
+static DbProfile active_profile;
+static int active_profile_set = 0;
+
+// ASCII case-insensitive equality (strcasecmp is not part of C11)
+static int str_ieq(const char *a, const char *b) {
+  while (*a && *b) {
+    if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) {
+      return 0;
+    }
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+int db_setting_int(const char *value, long long min, long long max,
+                   long long *out) {
+  char *endptr;
+  errno = 0;
+  long long v = strtoll(value, &endptr, 10);
+  if (endptr == value || *endptr != '\0' || errno != 0 || v < min ||
+      v > max) {
+    return -1;
+  }
+  *out = v;
+  return 0;
+}
+
+// Maps a symbolic PRAGMA value to its number, or parses a plain number
+static int parse_profile_enum(const char *value, const char *const *names,
+                              int count, int *out) {
+  for (int i = 0; i < count; i++) {
+    if (str_ieq(value, names[i])) {
+      *out = i;
+      return 0;
+    }
+  }
+  long long v;
+  if (db_setting_int(value, 0, count - 1, &v) != 0) {
+    return -1;
+  }
+  *out = (int)v;
+  return 0;
+}
+
+int db_setting_text(const char *value, char *out, size_t size,
+                    int allow_empty) {
+  size_t len = strlen(value);
+  if (len >= size || (len == 0 && !allow_empty)) {
+    return -1;
+  }
+  memcpy(out, value, len + 1);
+  return 0;
+}
+
+// --- db_profile_defaults ---
+void db_profile_defaults(DbProfile *profile) {
+  memset(profile, 0, sizeof(*profile));
+  strcpy(profile->journal_mode, "WAL"); // Readers no longer block on writers
+  profile->synchronous = 2;             // FULL: commits survive power loss
+  profile->cache_size = -16384;         // 16 MiB
+  profile->mmap_size = DB_PROFILE_UNSET;
+  profile->temp_store = DB_PROFILE_UNSET;
+  profile->page_size = DB_PROFILE_UNSET;
+  profile->busy_timeout_ms = 5000;
+  profile->read_pool_size = 0; // One read-only connection per CPU
+  profile->sql_profiler = 0;
+  strcpy(profile->sql_profile_file, "sql_profile.txt");
+}
+
+// --- db_profile_set ---
+static int set_journal_mode(DbProfile *profile, const char *value) {
+  static const char *const journal_modes[] = {"DELETE", "TRUNCATE", "PERSIST",
+                                              "MEMORY", "WAL",      "OFF"};
+  for (size_t i = 0; i < sizeof(journal_modes) / sizeof(journal_modes[0]);
+       i++) {
+    if (str_ieq(value, journal_modes[i])) {
+      strcpy(profile->journal_mode, journal_modes[i]);
+      return 0;
+    }
+  }
+  if (value[0] == '\0') {
+    profile->journal_mode[0] = '\0'; // Leave SQLite default
+    return 0;
+  }
+  return -1;
+}
+
+static int set_synchronous(DbProfile *profile, const char *value) {
+  static const char *const sync_names[] = {"OFF", "NORMAL", "FULL", "EXTRA"};
+  return parse_profile_enum(value, sync_names, 4, &profile->synchronous);
+}
+
+static int set_temp_store(DbProfile *profile, const char *value) {
+  static const char *const temp_names[] = {"DEFAULT", "FILE", "MEMORY"};
+  return parse_profile_enum(value, temp_names, 3, &profile->temp_store);
+}
+
+static int set_cache_size(DbProfile *profile, const char *value) {
+  long long v;
+  if (db_setting_int(value, -2147483647LL, 2147483647LL, &v) != 0) {
+    return -1;
+  }
+  profile->cache_size = (int)v;
+  return 0;
+}
+
+static int set_mmap_size(DbProfile *profile, const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 0x7fffffffffffffffLL, &v) != 0) {
+    return -1;
+  }
+  profile->mmap_size = v;
+  return 0;
+}
+
+static int set_page_size(DbProfile *profile, const char *value) {
+  long long v;
+  // Power of two between 512 and 65536
+  if (db_setting_int(value, 512, 65536, &v) != 0 || (v & (v - 1)) != 0) {
+    return -1;
+  }
+  profile->page_size = (int)v;
+  return 0;
+}
+
+static int set_busy_timeout(DbProfile *profile, const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 2147483647LL, &v) != 0) {
+    return -1;
+  }
+  profile->busy_timeout_ms = (int)v;
+  return 0;
+}
+
+static int set_read_pool_size(DbProfile *profile, const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 256, &v) != 0) {
+    return -1;
+  }
+  profile->read_pool_size = (int)v;
+  return 0;
+}
+
+static int set_sql_profiler(DbProfile *profile, const char *value) {
+  static const char *const switch_names[] = {"OFF", "ON"};
+  return parse_profile_enum(value, switch_names, 2, &profile->sql_profiler);
+}
+
+static int set_sql_profile_file(DbProfile *profile, const char *value) {
+  // "" = do not dump
+  return db_setting_text(value, profile->sql_profile_file,
+                         sizeof(profile->sql_profile_file), 1);
+}
+
+static const struct {
+  const char *key;
+  int (*set)(DbProfile *profile, const char *value);
+} profile_keys[] = {
+    {"journal_mode", set_journal_mode},
+    {"synchronous", set_synchronous},
+    {"cache_size", set_cache_size},
+    {"mmap_size", set_mmap_size},
+    {"temp_store", set_temp_store},
+    {"page_size", set_page_size},
+    {"busy_timeout", set_busy_timeout},
+    {"read_pool_size", set_read_pool_size},
+    {"sql_profiler", set_sql_profiler},
+    {"sql_profile_file", set_sql_profile_file},
+};
+#define PROFILE_KEY_COUNT                                                      \
+  ((int)(sizeof(profile_keys) / sizeof(profile_keys[0])))
+
+int db_profile_set(DbProfile *profile, const char *key, const char *value) {
+  for (int i = 0; i < PROFILE_KEY_COUNT; i++) {
+    if (str_ieq(key, profile_keys[i].key)) {
+      return profile_keys[i].set(profile, value);
+    }
+  }
+  for (int t = 0; db_setting_tables[t]; t++) {
+    for (const DbSettingKey *k = db_setting_tables[t]; k->key; k++) {
+      if (str_ieq(key, k->key)) {
+        return k->set(value);
+      }
+    }
+  }
+  return -1;
+}
+
+// Trims leading/trailing whitespace in place
+static char *trim(char *str) {
+  while (isspace((unsigned char)*str)) {
+    str++;
+  }
+  char *end = str + strlen(str);
+  while (end > str && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+  return str;
+}
+
+// --- db_profile_load_file ---
+int db_profile_load_file(DbProfile *profile, const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return 1; // Missing config file is not an error
+  }
+  char line[256];
+  int line_no = 0;
+  int rc = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    line_no++;
+    char *hash = strchr(line, '#');
+    if (hash) {
+      *hash = '\0';
+    }
+    char *text = trim(line);
+    if (text[0] == '\0') {
+      continue;
+    }
+    char *eq = strchr(text, '=');
+    if (!eq) {
+      fprintf(stderr, "!!! %s:%d: expected 'key = value'\n", path, line_no);
+      rc = -1;
+      continue;
+    }
+    *eq = '\0';
+    char *key = trim(text);
+    char *value = trim(eq + 1);
+    if (db_profile_set(profile, key, value) != 0) {
+      fprintf(stderr, "!!! %s:%d: invalid setting '%s = %s'\n", path, line_no,
+              key, value);
+      rc = -1;
+    }
+  }
+  fclose(fp);
+  return rc;
+}
+
+// --- db_profile_load_env ---
+// Sets key from PERFUME_DB_<KEY> if that variable exists
+static int load_env_key(DbProfile *profile, const char *key) {
+  char name[64] = "PERFUME_DB_";
+  size_t len = strlen(name);
+  for (const char *k = key; *k && len < sizeof(name) - 1; k++) {
+    name[len++] = (char)toupper((unsigned char)*k);
+  }
+  name[len] = '\0';
+  const char *value = getenv(name);
+  if (value && db_profile_set(profile, key, value) != 0) {
+    fprintf(stderr, "!!! Invalid value for %s: '%s'\n", name, value);
+    return -1;
+  }
+  return 0;
+}
+
+int db_profile_load_env(DbProfile *profile) {
+  int rc = 0;
+  for (int i = 0; i < PROFILE_KEY_COUNT; i++) {
+    if (load_env_key(profile, profile_keys[i].key) != 0) {
+      rc = -1;
+    }
+  }
+  for (int t = 0; db_setting_tables[t]; t++) {
+    for (const DbSettingKey *k = db_setting_tables[t]; k->key; k++) {
+      if (load_env_key(profile, k->key) != 0) {
+        rc = -1;
+      }
+    }
+  }
+  return rc;
+}
+
+// --- db_profile_load ---
+int db_profile_load(DbProfile *profile) {
+  db_profile_defaults(profile);
+  const char *path = getenv("PERFUME_DB_CONFIG");
+  int rc_file =
+      db_profile_load_file(profile, path ? path : DB_PROFILE_DEFAULT_FILE);
+  if (rc_file == 1 && path) {
+    fprintf(stderr, "!!! Config file '%s' (PERFUME_DB_CONFIG) not found.\n",
+            path);
+    return -1;
+  }
+  if (rc_file < 0) {
+    return -1;
+  }
+  return db_profile_load_env(profile);
+}
+
+// --- db_set_profile / db_get_profile ---
+void db_set_profile(const DbProfile *profile) {
+  active_profile = *profile;
+  active_profile_set = 1;
+  profiler_enabled = profile->sql_profiler;
+}
+
+const DbProfile *db_get_profile(void) {
+  if (!active_profile_set) {
+    db_profile_defaults(&active_profile);
+    active_profile_set = 1;
+  }
+  return &active_profile;
+}
+
+// Runs one PRAGMA built from validated values
+static int exec_pragma(const char *pragma) {
+  char *errMsg = NULL;
+  int rc = sqlite3_exec(db, pragma, NULL, NULL, &errMsg);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "!!! Failed to execute '%s': %s (rc=%d)\n", pragma,
+            errMsg ? errMsg : sqlite3_errmsg(db), rc);
+    sqlite3_free(errMsg);
+  }
+  return rc;
+}
+
+// Applies the connection profile to the freshly opened handle. Read-only
+// handles skip the settings that belong to the writer (file format, journal
+// mode, durability).
+static int apply_profile(const DbProfile *profile, int read_only) {
+  char pragma[128];
+  int rc = SQLITE_OK;
+
+  // page_size must precede WAL and is only honoured while the file is empty
+  if (!read_only && profile->page_size > 0) {
+    sqlite3_stmt *stmt = NULL;
+    int page_count = -1;
+    if (sqlite3_prepare_v2(db, "PRAGMA page_count;", -1, &stmt, NULL) ==
+            SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+      page_count = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    if (page_count == 0) {
+      snprintf(pragma, sizeof(pragma), "PRAGMA page_size = %d;",
+               profile->page_size);
+      rc |= exec_pragma(pragma);
+    }
+  }
+  if (!read_only && profile->journal_mode[0] != '\0') {
+    snprintf(pragma, sizeof(pragma), "PRAGMA journal_mode = %s;",
+             profile->journal_mode);
+    rc |= exec_pragma(pragma);
+  }
+  if (!read_only && profile->synchronous != DB_PROFILE_UNSET) {
+    snprintf(pragma, sizeof(pragma), "PRAGMA synchronous = %d;",
+             profile->synchronous);
+    rc |= exec_pragma(pragma);
+  }
+  if (profile->cache_size != 0) {
+    snprintf(pragma, sizeof(pragma), "PRAGMA cache_size = %d;",
+             profile->cache_size);
+    rc |= exec_pragma(pragma);
+  }
+  if (profile->mmap_size != DB_PROFILE_UNSET) {
+    snprintf(pragma, sizeof(pragma), "PRAGMA mmap_size = %lld;",
+             (long long)profile->mmap_size);
+    rc |= exec_pragma(pragma);
+  }
+  if (profile->temp_store != DB_PROFILE_UNSET) {
+    snprintf(pragma, sizeof(pragma), "PRAGMA temp_store = %d;",
+             profile->temp_store);
+    rc |= exec_pragma(pragma);
+  }
+  if (profile->busy_timeout_ms > 0) {
+    rc |= sqlite3_busy_timeout(db, profile->busy_timeout_ms);
+  }
+  printf("DEBUG: Connection profile applied: journal_mode=%s synchronous=%d "
+         "cache_size=%d mmap_size=%lld temp_store=%d page_size=%d "
+         "busy_timeout=%d\n",
+         profile->journal_mode[0] ? profile->journal_mode : "(default)",
+         profile->synchronous, profile->cache_size,
+         (long long)profile->mmap_size, profile->temp_store,
+         profile->page_size, profile->busy_timeout_ms);
+  return rc == SQLITE_OK ? SQLITE_OK : SQLITE_ERROR;
+}
 
 // --- open_db ---
 int open_db(const char *filename) {
@@ -15,6 +405,7 @@ int open_db(const char *filename) {
     return 0;
   }
   printf("DEBUG: Attempting to open/create database: %s\n", filename);
+  db_memory_configure(db_memory_get_settings());
   int rc = sqlite3_open_v2(filename, &db,
                            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
   if (rc != SQLITE_OK) {
@@ -64,14 +455,60 @@ int open_db(const char *filename) {
   }
   printf("DEBUG: 'PRAGMA foreign_keys = ON;' executed successfully.\n");
 
+  int rc_profile = apply_profile(db_get_profile(), 0);
+  if (rc_profile != SQLITE_OK) {
+    fprintf(stderr,
+            "!!! Failed to apply connection profile. Closing database.\n");
+    sqlite3_close(db);
+    db = NULL;
+    return rc_profile;
+  }
+  profiler_attach();
+  budget_attach();
+
   printf("Database opened successfully: %s\n", filename);
   return 0;
 }
 
+// --- open_db_readonly ---
+int open_db_readonly(const char *filename) {
+  if (db != NULL) {
+    fprintf(stderr, "DEBUG: Database already open in this thread.\n");
+    return 0;
+  }
+  db_memory_configure(db_memory_get_settings());
+  // The handle never leaves the calling thread, so SQLite's per-connection
+  // mutex is not needed
+  int rc = sqlite3_open_v2(filename, &db,
+                           SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+  if (rc == SQLITE_OK) {
+    rc = apply_profile(db_get_profile(), 1);
+  }
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "!!! Failed to open '%s' read-only: %s (rc=%d)\n",
+            filename, db ? sqlite3_errmsg(db) : "out of memory", rc);
+    sqlite3_close(db);
+    db = NULL;
+    return rc;
+  }
+  profiler_attach();
+  budget_attach();
+  return 0;
+}
+
 // --- close_db ---
 void close_db() {
   if (db) {
     printf("DEBUG: Closing database...\n");
+    db_stmt_cache_clear(); // Cached statements keep the connection busy
+    report_cache_clear();
+    // The writer connection outlives the report workers: dump once, there
+    const char *dump_path = db_get_profile()->sql_profile_file;
+    if (profiler_enabled && dump_path[0] != '\0' &&
+        !sqlite3_db_readonly(db, "main") &&
+        db_profiler_dump(dump_path) != 0) {
+      fprintf(stderr, "!!! Failed to write SQL profile to '%s'\n", dump_path);
+    }
     int rc = sqlite3_close(db);
     if (rc == SQLITE_OK) {
       printf("Database closed successfully.\n");
@@ -96,72 +533,1013 @@ int default_callback(void *NotUsed, int argc, char **argv, char **azColName) {
   return 0;
 }
 
-// --- execute_non_query (uses prepare/step/finalize) ---
+// --- Prepared statement cache ---
+// Keyed by the SQL template text. Statements are prepared with
+// SQLITE_PREPARE_PERSISTENT and reused after sqlite3_reset(), so the parse and
+// plan cost is paid once per template instead of once per call.
+#define STMT_CACHE_SIZE 64
+
+typedef struct {
+  char *sql;           // Owned copy of the SQL text (cache key)
+  unsigned long hash;  // FNV-1a hash of sql
+  sqlite3_stmt *stmt;  // Prepared statement
+  int in_use;          // 1 while handed out by db_prepare_cached()
+  unsigned long stamp; // Last use, for LRU eviction
+} StmtCacheEntry;
+
+// One cache per thread, like the connection it belongs to
+static _Thread_local StmtCacheEntry stmt_cache[STMT_CACHE_SIZE];
+static _Thread_local unsigned long stmt_cache_clock = 0;
+static _Thread_local StmtCacheStats stmt_cache_stats = {0, 0, 0, 0};
+
+static unsigned long sql_hash(const char *sql) {
+  unsigned long h = 2166136261UL;
+  for (const unsigned char *p = (const unsigned char *)sql; *p; p++) {
+    h ^= *p;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+static void stmt_cache_drop_entry(StmtCacheEntry *entry) {
+  sqlite3_finalize(entry->stmt);
+  free(entry->sql);
+  memset(entry, 0, sizeof(*entry));
+  stmt_cache_stats.entries--;
+}
+
+// --- db_stmt_cache_clear ---
+void db_stmt_cache_clear(void) {
+  for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+    if (stmt_cache[i].stmt) {
+      stmt_cache_drop_entry(&stmt_cache[i]);
+    }
+  }
+  stmt_cache_stats.entries = 0;
+}
+
+// --- db_stmt_cache_get_stats ---
+void db_stmt_cache_get_stats(StmtCacheStats *stats) {
+  if (stats) {
+    *stats = stmt_cache_stats;
+  }
+}
+
+// --- db_prepare_cached ---
+int db_prepare_cached(const char *sql, sqlite3_stmt **out_stmt) {
+  *out_stmt = NULL;
+  if (!db) {
+    fprintf(stderr, "!!! db_prepare_cached: Database not open.\n");
+    return SQLITE_ERROR;
+  }
+
+  unsigned long hash = sql_hash(sql);
+  StmtCacheEntry *free_slot = NULL;
+  StmtCacheEntry *lru_slot = NULL;
+  int busy_copy = 0;
+
+  for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+    StmtCacheEntry *entry = &stmt_cache[i];
+    if (!entry->stmt) {
+      if (!free_slot) {
+        free_slot = entry;
+      }
+      continue;
+    }
+    if (entry->hash == hash && strcmp(entry->sql, sql) == 0) {
+      if (entry->in_use) {
+        busy_copy = 1; // Same template already stepping: use a one-off copy
+        break;
+      }
+      entry->in_use = 1;
+      entry->stamp = ++stmt_cache_clock;
+      stmt_cache_stats.hits++;
+      *out_stmt = entry->stmt;
+      return SQLITE_OK;
+    }
+    if (!entry->in_use && (!lru_slot || entry->stamp < lru_slot->stamp)) {
+      lru_slot = entry;
+    }
+  }
+
+  stmt_cache_stats.misses++;
+  sqlite3_stmt *stmt = NULL;
+  const char *tail = NULL;
+  int rc = sqlite3_prepare_v3(db, sql, -1,
+                              busy_copy ? 0 : SQLITE_PREPARE_PERSISTENT, &stmt,
+                              &tail);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "!!! SQL prepare error (%d) for query [%s]: %s\n", rc, sql,
+            sqlite3_errmsg(db));
+    sqlite3_finalize(stmt);
+    return rc;
+  }
+  if (!stmt) {
+    return SQLITE_OK; // Only comments or whitespace: nothing to execute
+  }
+
+  StmtCacheEntry *slot = free_slot ? free_slot : lru_slot;
+  if (busy_copy || !slot) {
+    *out_stmt = stmt; // Uncached: finalized by db_release_stmt()
+    return SQLITE_OK;
+  }
+  if (slot->stmt) {
+    stmt_cache_drop_entry(slot);
+    stmt_cache_stats.evictions++;
+  }
+  slot->sql = malloc(strlen(sql) + 1);
+  if (!slot->sql) {
+    *out_stmt = stmt; // Out of memory for the key: run uncached
+    return SQLITE_OK;
+  }
+  strcpy(slot->sql, sql);
+  slot->hash = hash;
+  slot->stmt = stmt;
+  slot->in_use = 1;
+  slot->stamp = ++stmt_cache_clock;
+  stmt_cache_stats.entries++;
+  *out_stmt = stmt;
+  return SQLITE_OK;
+}
+
+// --- db_release_stmt ---
+void db_release_stmt(sqlite3_stmt *stmt) {
+  if (!stmt) {
+    return;
+  }
+  for (int i = 0; i < STMT_CACHE_SIZE; i++) {
+    if (stmt_cache[i].stmt == stmt) {
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+      stmt_cache[i].in_use = 0;
+      return;
+    }
+  }
+  sqlite3_finalize(stmt);
+}
+
+// --- SQL profiler (sqlite3_trace_v2) ---
+// Statements are grouped by their normalized text: literals become '?' and
+// whitespace runs collapse, so the same template with different constants is
+// one entry. Durations go into a log-scale histogram (4 buckets per power of
+// two) from which p99 is estimated without keeping samples. SQLite's own
+// PROFILE duration has millisecond resolution, so each run is timed from its
+// STMT event instead.
+#define PROFILER_BUCKETS 256
+#define PROFILER_PENDING 64
+
+typedef struct {
+  char *sql; // Normalized text (owned)
+  unsigned long hash;
+  sqlite3_int64 calls;
+  sqlite3_int64 total_ns;
+  sqlite3_int64 max_ns;
+  sqlite3_int64 rows;
+  sqlite3_int64 vm_steps;
+  sqlite3_int64 histogram[PROFILER_BUCKETS];
+} ProfilerEntry;
+
+static pthread_mutex_t profiler_lock = PTHREAD_MUTEX_INITIALIZER;
+static ProfilerEntry **profiler_entries = NULL; // Open addressing by hash
+static size_t profiler_capacity = 0;
+static size_t profiler_count = 0;
+
+// Start time and rows so far of each running statement of this thread's
+// connection
+typedef struct {
+  sqlite3_stmt *stmt;
+  sqlite3_int64 start_ns;
+  sqlite3_int64 rows;
+} ProfilerPending;
+static _Thread_local ProfilerPending profiler_pending[PROFILER_PENDING];
+
+static ProfilerPending *profiler_pending_slot(sqlite3_stmt *stmt, int create) {
+  size_t start = ((size_t)stmt >> 4) % PROFILER_PENDING;
+  for (size_t i = 0; i < PROFILER_PENDING; i++) {
+    ProfilerPending *slot = &profiler_pending[(start + i) % PROFILER_PENDING];
+    if (slot->stmt == stmt) {
+      return slot;
+    }
+    if (slot->stmt == NULL && create) {
+      slot->stmt = stmt;
+      slot->rows = 0;
+      return slot;
+    }
+  }
+  return NULL; // Table full: rows of this statement are not counted
+}
+
+// Writes the normalized form of sql into out (at most size - 1 bytes)
+static void profiler_normalize(const char *sql, char *out, size_t size) {
+  size_t n = 0;
+  int pending_space = 0;
+  const char *p = sql;
+  while (*p && n + 2 < size) {
+    unsigned char c = (unsigned char)*p;
+    if (isspace(c)) {
+      pending_space = n > 0;
+      p++;
+      continue;
+    }
+    if (pending_space) {
+      out[n++] = ' ';
+      pending_space = 0;
+    }
+    if (c == '\'') { // String literal ('' escapes a quote)
+      p++;
+      while (*p && !(*p == '\'' && p[1] != '\'')) {
+        p += (*p == '\'') ? 2 : 1;
+      }
+      if (*p) {
+        p++;
+      }
+      out[n++] = '?';
+    } else if (isdigit(c) && (n == 0 || !(isalnum((unsigned char)out[n - 1]) ||
+                                         out[n - 1] == '_'))) {
+      while (isalnum((unsigned char)*p) || *p == '.') {
+        p++; // Numeric literal (also 1e5, 0x1F)
+      }
+      out[n++] = '?';
+    } else {
+      out[n++] = (char)c;
+      p++;
+    }
+  }
+  while (n > 0 && (out[n - 1] == ';' || out[n - 1] == ' ')) {
+    n--;
+  }
+  out[n] = '\0';
+}
+
+static int profiler_bucket(sqlite3_int64 ns) {
+  if (ns < 4) {
+    return ns > 0 ? (int)ns : 0;
+  }
+  int msb = 0;
+  while ((ns >> (msb + 1)) != 0) {
+    msb++;
+  }
+  int bucket = msb * 4 + (int)((ns >> (msb - 2)) & 3);
+  return bucket < PROFILER_BUCKETS ? bucket : PROFILER_BUCKETS - 1;
+}
+
+// Upper bound (ns) of the durations that fall into bucket
+static sqlite3_int64 profiler_bucket_limit(int bucket) {
+  if (bucket < 4) {
+    return bucket + 1;
+  }
+  int msb = bucket / 4;
+  return (sqlite3_int64)(4 + bucket % 4 + 1) << (msb - 2);
+}
+
+// Caller holds profiler_lock
+static ProfilerEntry *profiler_find(const char *sql) {
+  unsigned long hash = sql_hash(sql);
+  if (profiler_count * 2 >= profiler_capacity) {
+    size_t new_capacity = profiler_capacity ? profiler_capacity * 2 : 256;
+    ProfilerEntry **grown = calloc(new_capacity, sizeof(*grown));
+    if (!grown) {
+      return NULL;
+    }
+    for (size_t i = 0; i < profiler_capacity; i++) {
+      ProfilerEntry *e = profiler_entries[i];
+      if (e) {
+        size_t j = e->hash % new_capacity;
+        while (grown[j]) {
+          j = (j + 1) % new_capacity;
+        }
+        grown[j] = e;
+      }
+    }
+    free(profiler_entries);
+    profiler_entries = grown;
+    profiler_capacity = new_capacity;
+  }
+  size_t i = hash % profiler_capacity;
+  while (profiler_entries[i]) {
+    ProfilerEntry *e = profiler_entries[i];
+    if (e->hash == hash && strcmp(e->sql, sql) == 0) {
+      return e;
+    }
+    i = (i + 1) % profiler_capacity;
+  }
+  ProfilerEntry *e = calloc(1, sizeof(*e));
+  if (!e || !(e->sql = malloc(strlen(sql) + 1))) {
+    free(e);
+    return NULL;
+  }
+  strcpy(e->sql, sql);
+  e->hash = hash;
+  profiler_entries[i] = e;
+  profiler_count++;
+  return e;
+}
+
+static sqlite3_int64 profiler_now_ns(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (sqlite3_int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int profiler_trace(unsigned type, void *ctx, void *p, void *x) {
+  sqlite3_stmt *stmt = p;
+  (void)ctx;
+  if (type == SQLITE_TRACE_STMT) {
+    ProfilerPending *slot = profiler_pending_slot(stmt, 1);
+    if (slot) {
+      slot->rows = 0; // A new run of the statement starts
+      slot->start_ns = profiler_now_ns();
+    }
+    return 0;
+  }
+  if (type == SQLITE_TRACE_ROW) {
+    ProfilerPending *slot = profiler_pending_slot(stmt, 1);
+    if (slot) {
+      slot->rows++;
+    }
+    return 0;
+  }
+  if (type != SQLITE_TRACE_PROFILE) {
+    return 0;
+  }
+
+  sqlite3_int64 ns = *(sqlite3_int64 *)x;
+  sqlite3_int64 rows = 0;
+  ProfilerPending *slot = profiler_pending_slot(stmt, 0);
+  if (slot) {
+    rows = slot->rows;
+    if (slot->start_ns > 0) {
+      ns = profiler_now_ns() - slot->start_ns;
+    }
+    slot->stmt = NULL;
+  }
+  int vm_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+  char normalized[1024];
+  profiler_normalize(sqlite3_sql(stmt) ? sqlite3_sql(stmt) : "", normalized,
+                     sizeof(normalized));
+
+  pthread_mutex_lock(&profiler_lock);
+  ProfilerEntry *e = profiler_find(normalized);
+  if (e) {
+    e->calls++;
+    e->total_ns += ns;
+    if (ns > e->max_ns) {
+      e->max_ns = ns;
+    }
+    e->rows += rows;
+    e->vm_steps += vm_steps;
+    e->histogram[profiler_bucket(ns)]++;
+  }
+  pthread_mutex_unlock(&profiler_lock);
+  return 0;
+}
+
+// Registers or removes the trace hook on this thread's connection
+static void profiler_attach(void) {
+  if (!db) {
+    return;
+  }
+  if (profiler_enabled) {
+    sqlite3_trace_v2(db,
+                     SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE |
+                         SQLITE_TRACE_ROW,
+                     profiler_trace, NULL);
+  } else {
+    sqlite3_trace_v2(db, 0, NULL, NULL);
+  }
+}
+
+// --- db_profiler_enable ---
+void db_profiler_enable(int enabled) {
+  profiler_enabled = enabled != 0;
+  profiler_attach();
+}
+
+// --- db_profiler_is_enabled ---
+int db_profiler_is_enabled(void) {
+  return profiler_enabled;
+}
+
+// --- db_profiler_reset ---
+void db_profiler_reset(void) {
+  pthread_mutex_lock(&profiler_lock);
+  for (size_t i = 0; i < profiler_capacity; i++) {
+    if (profiler_entries[i]) {
+      free(profiler_entries[i]->sql);
+      free(profiler_entries[i]);
+    }
+  }
+  free(profiler_entries);
+  profiler_entries = NULL;
+  profiler_capacity = 0;
+  profiler_count = 0;
+  pthread_mutex_unlock(&profiler_lock);
+}
+
+static sqlite3_int64 profiler_p99(const ProfilerEntry *e) {
+  sqlite3_int64 target = e->calls - e->calls / 100; // ceil(0.99 * calls)
+  sqlite3_int64 seen = 0;
+  for (int b = 0; b < PROFILER_BUCKETS; b++) {
+    seen += e->histogram[b];
+    if (seen >= target) {
+      sqlite3_int64 limit = profiler_bucket_limit(b);
+      return limit < e->max_ns ? limit : e->max_ns;
+    }
+  }
+  return e->max_ns;
+}
+
+static int profiler_compare_total(const void *a, const void *b) {
+  const ProfilerEntry *x = *(const ProfilerEntry *const *)a;
+  const ProfilerEntry *y = *(const ProfilerEntry *const *)b;
+  return (y->total_ns > x->total_ns) - (y->total_ns < x->total_ns);
+}
+
+// --- db_profiler_print ---
+int db_profiler_print(FILE *out, int limit, int sql_width) {
+  pthread_mutex_lock(&profiler_lock);
+  ProfilerEntry **sorted = malloc(sizeof(*sorted) * (profiler_count + 1));
+  if (!sorted) {
+    pthread_mutex_unlock(&profiler_lock);
+    return -1;
+  }
+  size_t n = 0;
+  sqlite3_int64 grand_total = 0;
+  for (size_t i = 0; i < profiler_capacity; i++) {
+    if (profiler_entries[i]) {
+      sorted[n++] = profiler_entries[i];
+      grand_total += profiler_entries[i]->total_ns;
+    }
+  }
+  qsort(sorted, n, sizeof(*sorted), profiler_compare_total);
+
+  fprintf(out, "--- SQL profile: %zu statements, %.3f ms total ---\n", n,
+          grand_total / 1e6);
+  fprintf(out, "%10s %12s %10s %10s %12s %14s  %s\n", "calls", "total_ms",
+          "mean_us", "p99_us", "rows", "vm_steps", "sql");
+  for (size_t i = 0; i < n && (limit <= 0 || (int)i < limit); i++) {
+    const ProfilerEntry *e = sorted[i];
+    fprintf(out, "%10lld %12.3f %10.1f %10.1f %12lld %14lld  %.*s\n",
+            (long long)e->calls, e->total_ns / 1e6,
+            e->calls ? e->total_ns / 1e3 / e->calls : 0.0,
+            profiler_p99(e) / 1e3, (long long)e->rows,
+            (long long)e->vm_steps,
+            sql_width > 0 ? sql_width : (int)strlen(e->sql), e->sql);
+  }
+  pthread_mutex_unlock(&profiler_lock);
+  free(sorted);
+  return 0;
+}
+
+// --- db_profiler_dump ---
+int db_profiler_dump(const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    return -1;
+  }
+  int rc = db_profiler_print(fp, 0, 0);
+  if (fclose(fp) != 0) {
+    rc = -1;
+  }
+  return rc;
+}
+
+// --- Query budgets (sqlite3_progress_handler) ---
+// Every connection calls budget_progress() each BUDGET_TICK VM instructions.
+// It acts only while a statement is armed: a cursor from db_cursor_open() to
+// db_cursor_close(), or the step of execute_non_query_params(). The time and
+// step limits apply to read-only statements only, so a purge or an archive
+// run is never cut off halfway; a cancel stops either kind.
+#define BUDGET_TICK 10000
+
+static DbQueryLimits query_limits; // All 0: unlimited, no progress lines
+
+const DbQueryLimits *db_get_query_limits(void) { return &query_limits; }
+
+void db_set_query_limits(const DbQueryLimits *limits) {
+  query_limits = *limits;
+}
+
+static int set_query_time_limit(const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 86400000, &v) != 0) {
+    return -1;
+  }
+  query_limits.time_limit_ms = (int)v;
+  return 0;
+}
+
+static int set_query_step_limit(const char *value) {
+  return db_setting_int(value, 0, 1000000000000000LL,
+                        &query_limits.step_limit);
+}
+
+static int set_query_progress(const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 3600000, &v) != 0) {
+    return -1;
+  }
+  query_limits.progress_ms = (int)v;
+  return 0;
+}
+
+const DbSettingKey db_query_limit_keys[] = {
+    {"query_time_limit_ms", set_query_time_limit},
+    {"query_step_limit", set_query_step_limit},
+    {"query_progress_ms", set_query_progress},
+    {NULL, NULL}};
+
+typedef struct {
+  sqlite3_stmt *stmt; // Armed statement, NULL if none
+  int limited;        // Read-only: the limits apply
+  sqlite3_int64 ticks;
+  sqlite3_int64 start_ns;
+  sqlite3_int64 reported_ns; // Last progress line
+  int cancel_seen;           // cancel_generation when armed
+  volatile DbStopReason stop;
+} QueryBudget;
+
+static _Thread_local QueryBudget budget;
+static atomic_int budgets_armed = 0; // Threads with an armed statement
+static atomic_int cancel_generation = 0;
+
+static void budget_arm(sqlite3_stmt *stmt) {
+  if (!budget.stmt) {
+    atomic_fetch_add(&budgets_armed, 1);
+  }
+  // A nested statement takes over; the outer one runs unbudgeted from here
+  budget.stmt = stmt;
+  budget.limited = sqlite3_stmt_readonly(stmt);
+  budget.ticks = 0;
+  budget.start_ns = budget.reported_ns = profiler_now_ns();
+  budget.cancel_seen = atomic_load(&cancel_generation);
+  budget.stop = DB_STOP_NONE;
+}
+
+static void budget_disarm(sqlite3_stmt *stmt) {
+  if (stmt && budget.stmt == stmt) {
+    budget.stmt = NULL;
+    atomic_fetch_sub(&budgets_armed, 1);
+  }
+}
+
+static int budget_progress(void *unused) {
+  (void)unused;
+  if (!budget.stmt) {
+    return 0;
+  }
+  budget.ticks++;
+  if (budget.cancel_seen != atomic_load(&cancel_generation)) {
+    budget.stop = DB_STOP_CANCELLED;
+    return 1;
+  }
+  const DbQueryLimits *limits = &query_limits;
+  if (budget.limited && limits->step_limit > 0 &&
+      budget.ticks * BUDGET_TICK > limits->step_limit) {
+    budget.stop = DB_STOP_STEP_LIMIT;
+    return 1;
+  }
+  if (limits->time_limit_ms <= 0 && limits->progress_ms <= 0) {
+    return 0;
+  }
+  sqlite3_int64 now = profiler_now_ns();
+  if (budget.limited && limits->time_limit_ms > 0 &&
+      now - budget.start_ns >=
+          (sqlite3_int64)limits->time_limit_ms * 1000000) {
+    budget.stop = DB_STOP_TIME_LIMIT;
+    return 1;
+  }
+  if (limits->progress_ms > 0 &&
+      now - budget.reported_ns >=
+          (sqlite3_int64)limits->progress_ms * 1000000) {
+    budget.reported_ns = now;
+    fprintf(stderr, "... запрос выполняется %.1f с, ~%lld шагов\n",
+            (double)(now - budget.start_ns) / 1e9,
+            (long long)(budget.ticks * BUDGET_TICK));
+  }
+  return 0;
+}
+
+// Registers the progress handler on this thread's connection
+static void budget_attach(void) {
+  if (db) {
+    sqlite3_progress_handler(db, BUDGET_TICK, budget_progress, NULL);
+  }
+}
+
+// Explains a failed step; a budget stop gets its own message
+static void budget_report_error(int rc, const char *sql) {
+  if (rc != SQLITE_INTERRUPT || budget.stop == DB_STOP_NONE) {
+    fprintf(stderr, "!!! SQL step error (%d) for query [%s]: %s\n", rc, sql,
+            sqlite3_errmsg(db));
+  } else if (budget.stop == DB_STOP_TIME_LIMIT) {
+    fprintf(stderr,
+            "!!! Запрос остановлен: превышен лимит времени %d мс "
+            "(query_time_limit_ms).\n",
+            query_limits.time_limit_ms);
+  } else if (budget.stop == DB_STOP_STEP_LIMIT) {
+    fprintf(stderr,
+            "!!! Запрос остановлен: превышен лимит %lld шагов "
+            "(query_step_limit).\n",
+            query_limits.step_limit);
+  } else {
+    fprintf(stderr, "!!! Запрос отменён.\n");
+  }
+}
+
+// --- db_cancel_running ---
+int db_cancel_running(void) {
+  if (atomic_load(&budgets_armed) == 0) {
+    return 0;
+  }
+  atomic_fetch_add(&cancel_generation, 1);
+  if (db && budget.stmt) {
+    // Also stops this thread's statement between steps, e.g. while its rows
+    // are being printed
+    budget.stop = DB_STOP_CANCELLED;
+    sqlite3_interrupt(db);
+  }
+  return 1;
+}
+
+// --- db_last_stop_reason ---
+DbStopReason db_last_stop_reason(void) { return budget.stop; }
+
+// --- db_bind_params ---
+int db_bind_params(sqlite3_stmt *stmt, const DbParam *params,
+                   int param_count) {
+  for (int i = 0; i < param_count; i++) {
+    int rc;
+    switch (params[i].type) {
+    case DB_PARAM_INT:
+      rc = sqlite3_bind_int64(stmt, i + 1, params[i].value.i);
+      break;
+    case DB_PARAM_DOUBLE:
+      rc = sqlite3_bind_double(stmt, i + 1, params[i].value.d);
+      break;
+    case DB_PARAM_TEXT:
+      rc = params[i].value.s ? sqlite3_bind_text(stmt, i + 1,
+                                                 params[i].value.s, -1,
+                                                 SQLITE_STATIC)
+                             : sqlite3_bind_null(stmt, i + 1);
+      break;
+    case DB_PARAM_NULL:
+    default:
+      rc = sqlite3_bind_null(stmt, i + 1);
+      break;
+    }
+    if (rc != SQLITE_OK) {
+      fprintf(stderr, "!!! SQL bind error (%d) for parameter %d: %s\n", rc,
+              i + 1, sqlite3_errmsg(db));
+      return rc;
+    }
+  }
+  return SQLITE_OK;
+}
+
+// --- execute_non_query (no parameters) ---
 int execute_non_query(const char *query) {
+  return execute_non_query_params(query, NULL, 0);
+}
+
+// --- execute_non_query_params (cached prepare/bind/step/reset) ---
+int execute_non_query_params(const char *sql, const DbParam *params,
+                             int param_count) {
   if (!db) {
     fprintf(stderr, "!!! execute_non_query: Database not open.\n");
     return SQLITE_ERROR;
   }
-  if (!query || query[0] == '\0') {
+  if (!sql || sql[0] == '\0') {
     // It's okay to receive empty queries sometimes after parsing, just ignore
-    // them. fprintf(stderr, "!!! execute_non_query: Received empty query.\n");
+    // them.
     return SQLITE_OK; // Treat empty query as success (no-op)
   }
 
   sqlite3_stmt *stmt = NULL;
-  int rc_prepare = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
-
-  if (rc_prepare != SQLITE_OK) {
-    fprintf(stderr, "!!! SQL prepare error (%d) for query [%s]: %s\n",
-            rc_prepare, query, sqlite3_errmsg(db));
-    sqlite3_finalize(stmt); // Finalize even if NULL or error
-    return rc_prepare;
+  int rc = db_prepare_cached(sql, &stmt);
+  if (rc != SQLITE_OK) {
+    return rc;
   }
   if (!stmt) {
-    // This case means the input string contained only comments or whitespace
-    // printf("DEBUG: SQL prepare resulted in NULL statement (likely
-    // comment/whitespace): [%s]\n", query);
+    // The input string contained only comments or whitespace
     return SQLITE_OK; // Valid outcome, just nothing to execute
   }
 
+  rc = db_bind_params(stmt, params, param_count);
+  if (rc != SQLITE_OK) {
+    db_release_stmt(stmt);
+    return rc;
+  }
+
+  budget_arm(stmt);
   int rc_step = sqlite3_step(stmt);
+  budget_disarm(stmt);
   if (rc_step != SQLITE_DONE) {
-    fprintf(stderr, "!!! SQL step error (%d) for query [%s]: %s\n", rc_step,
-            query, sqlite3_errmsg(db));
-    sqlite3_finalize(stmt);
+    budget_report_error(rc_step, sql);
+    db_release_stmt(stmt);
     return rc_step;
   }
-
-  int rc_finalize = sqlite3_finalize(stmt);
-  if (rc_finalize != SQLITE_OK) {
-    fprintf(stderr, "!!! SQL finalize error (%d) for query [%s]: %s\n",
-            rc_finalize, query, sqlite3_errmsg(db));
-    return rc_finalize;
-  }
+  db_release_stmt(stmt);
   return SQLITE_OK;
 }
 
-// --- execute_select_query (uses sqlite3_exec) ---
+// --- execute_select_query (no parameters) ---
 int execute_select_query(const char *query) {
+  return execute_select_query_params(query, NULL, 0);
+}
+
+// --- execute_select_query_params (cursor + table printer) ---
+int execute_select_query_params(const char *sql, const DbParam *params,
+                                int param_count) {
   if (!db) {
     fprintf(stderr, "!!! execute_select_query: Database not open.\n");
     return SQLITE_ERROR;
   }
-  char *errMsg = NULL;
-  printf("DEBUG: Executing SELECT: %s\n", query);
-  int rc = sqlite3_exec(db, query, default_callback, NULL,
-                        &errMsg); // No need for callback_arg here
+  printf("DEBUG: Executing SELECT: %s\n", sql);
 
+  DbCursor cur;
+  int rc = db_cursor_open(&cur, sql, params, param_count);
+  if (rc == SQLITE_OK) {
+    rc = db_cursor_print(&cur, stdout);
+  }
+  db_cursor_close(&cur);
   if (rc != SQLITE_OK) {
-    fprintf(stderr, "!!! SQL SELECT error (%d): %s\nQuery: %s\n", rc, errMsg,
-            query);
-    sqlite3_free(errMsg);
     return rc;
   }
   printf("--- SELECT query finished ---\n");
   return SQLITE_OK;
 }
 
+// --- Cursor API ---
+int db_cursor_open(DbCursor *cur, const char *sql, const DbParam *params,
+                   int param_count) {
+  memset(cur, 0, sizeof(*cur));
+  cur->rc = SQLITE_DONE;
+  if (!db) {
+    fprintf(stderr, "!!! db_cursor_open: Database not open.\n");
+    return SQLITE_ERROR;
+  }
+  int rc = db_prepare_cached(sql, &cur->stmt);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  if (!cur->stmt) {
+    return SQLITE_OK; // Comment-only SQL: behaves as an empty result
+  }
+  rc = db_bind_params(cur->stmt, params, param_count);
+  if (rc != SQLITE_OK) {
+    db_cursor_close(cur);
+    return rc;
+  }
+  cur->column_count = sqlite3_column_count(cur->stmt);
+  cur->rc = SQLITE_OK;
+  budget_arm(cur->stmt);
+  return SQLITE_OK;
+}
+
+int db_cursor_next(DbCursor *cur) {
+  if (!cur->stmt || (cur->rc != SQLITE_OK && cur->rc != SQLITE_ROW)) {
+    return cur->rc; // Finished or failed: stay there
+  }
+  cur->rc = sqlite3_step(cur->stmt);
+  if (cur->rc == SQLITE_INTERRUPT && budget.stop != DB_STOP_NONE) {
+    budget_report_error(cur->rc, sqlite3_sql(cur->stmt));
+  } else if (cur->rc != SQLITE_ROW && cur->rc != SQLITE_DONE) {
+    fprintf(stderr, "!!! SQL SELECT error (%d): %s\nQuery: %s\n", cur->rc,
+            sqlite3_errmsg(db), sqlite3_sql(cur->stmt));
+  }
+  return cur->rc;
+}
+
+int db_cursor_type(const DbCursor *cur, int i) {
+  return sqlite3_column_type(cur->stmt, i);
+}
+
+const char *db_cursor_name(const DbCursor *cur, int i) {
+  return sqlite3_column_name(cur->stmt, i);
+}
+
+sqlite3_int64 db_cursor_int64(const DbCursor *cur, int i) {
+  return sqlite3_column_int64(cur->stmt, i);
+}
+
+double db_cursor_double(const DbCursor *cur, int i) {
+  return sqlite3_column_double(cur->stmt, i);
+}
+
+const char *db_cursor_text(const DbCursor *cur, int i, int *len) {
+  const char *text = (const char *)sqlite3_column_text(cur->stmt, i);
+  if (len) {
+    *len = text ? sqlite3_column_bytes(cur->stmt, i) : 0;
+  }
+  return text;
+}
+
+void db_cursor_close(DbCursor *cur) {
+  if (cur->stmt) {
+    budget_disarm(cur->stmt);
+    db_release_stmt(cur->stmt);
+    cur->stmt = NULL;
+  }
+}
+
+// Grows the line buffer of a table writer (one allocation per table)
+static int line_reserve(DbTableWriter *table, size_t extra) {
+  if (table->len + extra + 1 <= table->cap) {
+    return 0;
+  }
+  size_t cap = table->cap ? table->cap : 256;
+  while (table->len + extra + 1 > cap) {
+    cap *= 2;
+  }
+  char *data = realloc(table->data, cap);
+  if (!data) {
+    return -1;
+  }
+  table->data = data;
+  table->cap = cap;
+  return 0;
+}
+
+// Appends `text` (len bytes) padded to `width`, right-aligned if requested
+static int line_cell(DbTableWriter *table, const char *text, size_t len,
+                     int width, int right_align) {
+  size_t pad = len < (size_t)width ? (size_t)width - len : 0;
+  if (line_reserve(table, len + pad + 1) != 0) {
+    return -1;
+  }
+  if (table->len > 0) {
+    table->data[table->len++] = ' ';
+  }
+  if (right_align) {
+    memset(table->data + table->len, ' ', pad);
+    table->len += pad;
+  }
+  memcpy(table->data + table->len, text, len);
+  table->len += len;
+  if (!right_align) {
+    memset(table->data + table->len, ' ', pad);
+    table->len += pad;
+  }
+  table->data[table->len] = '\0';
+  return 0;
+}
+
+// Writes the line without its trailing padding, then starts a new one
+static void line_flush(DbTableWriter *table) {
+  while (table->len > 0 && table->data[table->len - 1] == ' ') {
+    table->len--;
+  }
+  table->data[table->len++] = '\n';
+  fwrite(table->data, 1, table->len, table->out);
+  table->len = 0;
+}
+
+#define TABLE_TEXT_WIDTH 20
+#define TABLE_NUMBER_WIDTH 12
+
+// --- Text tables ---
+void db_table_begin(DbTableWriter *table, FILE *out) {
+  memset(table, 0, sizeof(*table));
+  table->out = out;
+}
+
+int db_table_row(DbTableWriter *table, const char *const *names,
+                 const DbValue *values, int count) {
+  if (table->rows == 0) {
+    // Header: numeric columns (by the first row) are right-aligned
+    for (int i = 0; i < count; i++) {
+      int numeric = values[i].type == SQLITE_INTEGER ||
+                    values[i].type == SQLITE_FLOAT;
+      if (line_cell(table, names[i], strlen(names[i]),
+                    numeric ? TABLE_NUMBER_WIDTH : TABLE_TEXT_WIDTH,
+                    numeric) != 0 ||
+          line_reserve(table, 1) != 0) {
+        return SQLITE_NOMEM;
+      }
+    }
+    line_flush(table);
+  }
+  for (int i = 0; i < count; i++) {
+    char number[32];
+    const char *text;
+    size_t len;
+    int right_align = 1;
+    switch (values[i].type) {
+    case DB_VALUE_DATE: // Shown as YYYY-MM-DD, aligned like text
+      date_format((int)values[i].i, number);
+      text = number;
+      len = DATE_TEXT_SIZE - 1;
+      right_align = 0;
+      break;
+    case SQLITE_INTEGER:
+      len = (size_t)snprintf(number, sizeof(number), "%lld",
+                             (long long)values[i].i);
+      text = number;
+      break;
+    case SQLITE_FLOAT:
+      len = (size_t)snprintf(number, sizeof(number), "%.2f", values[i].d);
+      text = number;
+      break;
+    case SQLITE_NULL:
+      text = "NULL";
+      len = 4;
+      break;
+    default:
+      text = values[i].s ? values[i].s : "";
+      len = values[i].len >= 0 ? (size_t)values[i].len : strlen(text);
+      right_align = 0;
+      break;
+    }
+    if (line_cell(table, text, len,
+                  right_align ? TABLE_NUMBER_WIDTH : TABLE_TEXT_WIDTH,
+                  right_align) != 0) {
+      return SQLITE_NOMEM;
+    }
+  }
+  if (line_reserve(table, 1) != 0) {
+    return SQLITE_NOMEM;
+  }
+  line_flush(table);
+  table->rows++;
+  return SQLITE_OK;
+}
+
+int db_table_end(DbTableWriter *table, int rc) {
+  free(table->data);
+  table->data = NULL;
+  table->len = table->cap = 0;
+  if (rc == SQLITE_NOMEM) {
+    fprintf(stderr, "!!! db_table: Out of memory.\n");
+    return rc;
+  }
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  fprintf(table->out, "(%ld rows)\n", table->rows);
+  return SQLITE_OK;
+}
+
+// Integer values of columns declared DATE are day numbers (dates.h)
+static int cursor_cell_is_date(const DbCursor *cur, int i) {
+  if (db_cursor_type(cur, i) != SQLITE_INTEGER) {
+    return 0;
+  }
+  const char *decltype = sqlite3_column_decltype(cur->stmt, i);
+  return decltype && strcmp(decltype, "DATE") == 0;
+}
+
+int db_cursor_print(DbCursor *cur, FILE *out) {
+  return db_cursor_print_rows(cur, out, -1);
+}
+
+int db_cursor_print_rows(DbCursor *cur, FILE *out, long max_rows) {
+  DbTableWriter table;
+  db_table_begin(&table, out);
+  int count = cur->column_count;
+  DbValue *values = calloc(count > 0 ? (size_t)count : 1, sizeof(*values));
+  const char **names =
+      calloc(count > 0 ? (size_t)count : 1, sizeof(*names));
+  int rc = values && names ? SQLITE_OK : SQLITE_NOMEM;
+
+  while (rc == SQLITE_OK && (max_rows < 0 || table.rows < max_rows) &&
+         (rc = db_cursor_next(cur)) == SQLITE_ROW) {
+    for (int i = 0; i < count; i++) {
+      DbValue *value = &values[i];
+      value->type = db_cursor_type(cur, i);
+      switch (value->type) {
+      case SQLITE_INTEGER:
+        value->i = db_cursor_int64(cur, i);
+        if (cursor_cell_is_date(cur, i)) {
+          value->type = DB_VALUE_DATE;
+        }
+        break;
+      case SQLITE_FLOAT:
+        value->d = db_cursor_double(cur, i);
+        break;
+      case SQLITE_NULL:
+        break;
+      default:
+        value->type = SQLITE_TEXT;
+        value->s = db_cursor_text(cur, i, &value->len);
+        break;
+      }
+      if (table.rows == 0) {
+        names[i] = db_cursor_name(cur, i);
+      }
+    }
+    rc = db_table_row(&table, names, values, count);
+  }
+  free(values);
+  free(names);
+  if (rc == SQLITE_OK && table.rows > 0) {
+    // Stopped at max_rows: the last printed row stays current
+    db_table_end(&table, SQLITE_OK);
+    return SQLITE_ROW;
+  }
+  return db_table_end(&table, rc == SQLITE_DONE ? SQLITE_OK : rc);
+}
+
 // --- Simplified execute_sql_from_file ---
 int execute_sql_from_file(const char *filename) {
   if (!db) {
@@ -188,8 +1566,9 @@ int execute_sql_from_file(const char *filename) {
     return SQLITE_OK; // Empty file is not an error in itself
   }
 
-  // Allocate buffer for the whole file + null terminator
-  char *sql_buffer = (char *)malloc(file_size + 1);
+  // Allocate buffer for the whole file + null terminator; from SQLite's
+  // allocator, so it is counted and bounded like the rest (db_memory.h)
+  char *sql_buffer = sqlite3_malloc64((sqlite3_uint64)file_size + 1);
   if (!sql_buffer) {
     fprintf(stderr,
             "!!! Failed to allocate memory (%ld bytes) to read SQL file: %s\n",
@@ -207,66 +1586,78 @@ int execute_sql_from_file(const char *filename) {
         stderr,
         "!!! Failed to read entire SQL file (%zu bytes read out of %ld): %s\n",
         bytes_read, file_size, filename);
-    free(sql_buffer);
+    sqlite3_free(sql_buffer);
     return SQLITE_ERROR; // File read error
   }
 
   // Null-terminate the buffer
   sql_buffer[file_size] = '\0';
 
-  // Execute the entire buffer using sqlite3_exec
-  printf(
-      "DEBUG: Executing entire SQL script from buffer (size: %ld bytes)...\n",
-      file_size);
-  char *errMsg = NULL;
-  int rc = sqlite3_exec(db, sql_buffer, NULL, NULL,
-                        &errMsg); // No callback needed here
-
-  free(sql_buffer); // Free the buffer
+  int rc = execute_sql_script(sql_buffer, filename);
+  sqlite3_free(sql_buffer); // Free the buffer
+  return rc;
+}
 
-  if (rc != SQLITE_OK) {
-    fprintf(stderr, "!!! Error executing SQL script: %s (rc=%d)\n",
-            errMsg ? errMsg : "Unknown error", rc);
-    sqlite3_free(errMsg);
-    return rc; // Return the SQLite error code
+// --- execute_sql_script ---
+int execute_sql_script(const char *sql, const char *name) {
+  if (!db) {
+    fprintf(stderr, "!!! Database not open for executing SQL script.\n");
+    return SQLITE_ERROR;
   }
-
-  printf("DEBUG: SQL script executed successfully via sqlite3_exec.\n");
+  printf("DEBUG: Executing SQL script %s...\n", name);
+  // Each statement is prepared only when the previous one is done, so a
+  // script may create the tables its later statements use
+  const char *tail = sql;
+  int count = 0;
+  while (*tail) {
+    sqlite3_stmt *stmt = NULL;
+    const char *next = NULL;
+    int rc = sqlite3_prepare_v2(db, tail, -1, &stmt, &next);
+    if (rc == SQLITE_OK && stmt) {
+      while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+      }
+      if (rc == SQLITE_DONE) {
+        rc = SQLITE_OK;
+      }
+      count++;
+    }
+    if (rc != SQLITE_OK) {
+      fprintf(stderr, "!!! Error executing SQL script %s: %s (rc=%d)\n", name,
+              sqlite3_errmsg(db), rc);
+      sqlite3_finalize(stmt);
+      return rc;
+    }
+    sqlite3_finalize(stmt);
+    tail = next; // Also skips trailing whitespace and comments
+  }
+  printf("DEBUG: SQL script %s executed successfully (%d statements).\n",
+         name, count);
   return SQLITE_OK;
 }
 
-// --- table_exists_callback ---
-static int table_exists_callback(void *data, int argc, char **argv,
-                                 char **azColName) {
-  int *found = (int *)data;
-  *found = 1;
-  (void)argc;
-  (void)argv;
-  (void)azColName;
-  return 0;
-}
-
 // --- table_exists ---
 int table_exists(const char *table_name) {
   if (!db) {
     fprintf(stderr, "!!! table_exists: Database not open.\n");
     return -1;
   }
-  char query[256];
-  snprintf(query, sizeof(query),
-           "SELECT name FROM sqlite_master WHERE type='table' AND name='%s';",
-           table_name);
-  int found = 0;
-  char *errMsg = NULL;
   printf("DEBUG: Executing table existence check for: %s\n", table_name);
-  int rc = sqlite3_exec(db, query, table_exists_callback, &found, &errMsg);
+  sqlite3_stmt *stmt = NULL;
+  int rc = db_prepare_cached(
+      "SELECT 1 FROM sqlite_master WHERE type='table' AND name=?;", &stmt);
   if (rc != SQLITE_OK) {
+    return -1;
+  }
+  sqlite3_bind_text(stmt, 1, table_name, -1, SQLITE_STATIC);
+  rc = sqlite3_step(stmt);
+  int found = (rc == SQLITE_ROW);
+  if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
     fprintf(stderr,
             "!!! SQL error checking table existence for '%s': %s (rc=%d)\n",
-            table_name, errMsg, rc);
-    sqlite3_free(errMsg);
-    return -1;
+            table_name, sqlite3_errmsg(db), rc);
+    found = -1;
   }
+  db_release_stmt(stmt);
   printf("DEBUG: Table '%s' found status (0=No, 1=Yes): %d\n", table_name,
          found);
   return found;
@@ -274,70 +1665,5 @@ int table_exists(const char *table_name) {
 
 // --- init_tables_if_needed ---
 int init_tables_if_needed(const char *schema_file) {
-  printf("DEBUG: Checking database schema presence...\n");
-  int exists = table_exists("Users");
-
-  if (exists == -1) {
-    fprintf(stderr, "!!! DEBUG: Failed to check if table 'Users' exists. "
-                    "Aborting schema initialization.\n");
-    return -1;
-  }
-  printf("DEBUG: Initial check for 'Users' table returned: %d\n", exists);
-
-  if (exists == 0) {
-    printf("DEBUG: Table 'Users' not found. Attempting to initialize database "
-           "from %s...\n",
-           schema_file);
-    printf(
-        "DEBUG: --- Calling execute_sql_from_file (simplified version) ---\n");
-    int rc_exec = execute_sql_from_file(schema_file);
-    printf("DEBUG: --- execute_sql_from_file returned %d ---\n", rc_exec);
-
-    if (rc_exec != SQLITE_OK) {
-      fprintf(stderr,
-              "!!! DEBUG: Schema execution from '%s' failed with rc=%d. "
-              "Aborting.\n",
-              schema_file, rc_exec);
-      return rc_exec;
-    }
-
-    printf("DEBUG: Schema script execution sequence reportedly finished OK. "
-           "Verifying 'Users' table presence AGAIN...\n");
-    int exists_after = table_exists("Users");
-    printf("DEBUG: Verification check for 'Users' table returned: %d\n",
-           exists_after);
-
-    if (exists_after == 1) {
-      printf("DEBUG: Verification successful: Table 'Users' now exists.\n");
-
-      printf("DEBUG: --- Attempting to SEED database with initial data ---\n");
-      // Предполагаем, что seed_data.sql скопирован рядом с исполняемым файлом
-      int rc_exec_seed = execute_sql_from_file("seed_data.sql");
-      printf("DEBUG: --- execute_sql_from_file for SEED returned %d ---\n",
-             rc_exec_seed);
-      if (rc_exec_seed != SQLITE_OK) {
-        fprintf(
-            stderr,
-            "!!! WARNING: Failed to execute seed data script 'seed_data.sql' "
-            "(rc=%d). Database schema created, but seeding failed.\n",
-            rc_exec_seed);
-        // Не возвращаем ошибку, так как схема создана, но предупреждаем
-      } else {
-        printf("DEBUG: Seed data script executed successfully.\n");
-      }
-
-      return 0; // Explicit Success
-    } else {
-      fprintf(stderr,
-              "!!! CRITICAL ERROR: Schema execution finished OK BUT table "
-              "'Users' STILL not found! (exists_after=%d)\n",
-              exists_after);
-      return -1; // Indicate critical inconsistency
-    }
-
-  } else { // exists == 1
-    printf("DEBUG: Database table 'Users' seems to exist. Skipping schema "
-           "execution.\n");
-    return 0; // Tables already exist
-  }
-}
\ No newline at end of file
+  return migrations_apply(schema_file, 1);
+}
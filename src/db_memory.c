@@ -0,0 +1,399 @@
+#include "../includes/db_memory.h"
+#include <pthread.h>
+#include <stdatomic.h> // Allocator counters are bumped from every thread
+#include <stdlib.h>
+#include <string.h>
+
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+static int configured = 0;
+
+// --- Allocator counters ---
+static atomic_ullong count_mallocs = 0;
+static atomic_ullong count_reallocs = 0;
+static atomic_ullong count_frees = 0;
+static atomic_ullong count_bytes = 0;
+static atomic_ullong count_pool_hits = 0;
+static atomic_ullong count_pool_misses = 0;
+static atomic_ullong count_heap_calls = 0;
+
+static void count(atomic_ullong *counter, unsigned long long n) {
+  atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+// --- Small-block pool ---
+// The arena is split into one region per size class. A region hands out
+// never-used blocks from its end of the bump pointer and takes freed ones
+// back on a free list, so untouched parts of the arena cost no resident
+// memory.
+#define POOL_CLASSES 4
+#define POOL_MAX_BLOCK 512
+static const int pool_class_size[POOL_CLASSES] = {64, 128, 256, 512};
+
+typedef struct PoolBlock {
+  struct PoolBlock *next;
+} PoolBlock;
+
+typedef struct {
+  char *start;
+  char *end;
+  char *unused; // Blocks from here to end were never handed out
+  PoolBlock *free_list;
+  sqlite3_int64 used;
+  sqlite3_int64 peak;
+} PoolClass;
+
+static sqlite3_mem_methods system_mem; // SQLite's default allocator
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *pool_arena = NULL;
+static char *pool_arena_end = NULL;
+static PoolClass pool_classes[POOL_CLASSES];
+static sqlite3_int64 pool_blocks = 0;
+
+static int pool_init(size_t bytes) {
+  size_t region = bytes / POOL_CLASSES;
+  region -= region % POOL_MAX_BLOCK; // A whole number of blocks of any class
+  if (region == 0) {
+    return -1;
+  }
+  pool_arena = malloc(region * POOL_CLASSES);
+  if (!pool_arena) {
+    return -1;
+  }
+  pool_arena_end = pool_arena + region * POOL_CLASSES;
+  for (int i = 0; i < POOL_CLASSES; i++) {
+    PoolClass *c = &pool_classes[i];
+    c->start = c->unused = pool_arena + region * (size_t)i;
+    c->end = c->start + region;
+    pool_blocks += (sqlite3_int64)(region / (size_t)pool_class_size[i]);
+  }
+  return 0;
+}
+
+// Class index of a block in the arena, or -1 for a heap block
+static int pool_class_of(const void *p) {
+  const char *cp = p;
+  if (!pool_arena || cp < pool_arena || cp >= pool_arena_end) {
+    return -1;
+  }
+  return (int)((size_t)(cp - pool_arena) /
+               (size_t)(pool_classes[0].end - pool_classes[0].start));
+}
+
+static void *pool_alloc(int n) {
+  if (!pool_arena || n > POOL_MAX_BLOCK) {
+    return NULL;
+  }
+  int i = 0;
+  while (pool_class_size[i] < n) {
+    i++;
+  }
+  PoolClass *c = &pool_classes[i];
+  void *block = NULL;
+  pthread_mutex_lock(&pool_lock);
+  if (c->free_list) {
+    block = c->free_list;
+    c->free_list = c->free_list->next;
+  } else if (c->unused < c->end) {
+    block = c->unused;
+    c->unused += pool_class_size[i];
+  }
+  if (block && ++c->used > c->peak) {
+    c->peak = c->used;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  count(block ? &count_pool_hits : &count_pool_misses, 1);
+  return block;
+}
+
+static void pool_free(void *p, int i) {
+  PoolBlock *block = p;
+  pthread_mutex_lock(&pool_lock);
+  block->next = pool_classes[i].free_list;
+  pool_classes[i].free_list = block;
+  pool_classes[i].used--;
+  pthread_mutex_unlock(&pool_lock);
+}
+
+// --- sqlite3_mem_methods over the pool and the default allocator ---
+static void *mem_malloc(int n) {
+  count(&count_mallocs, 1);
+  count(&count_bytes, (unsigned long long)n);
+  void *p = pool_alloc(n);
+  if (p) {
+    return p;
+  }
+  count(&count_heap_calls, 1);
+  return system_mem.xMalloc(n);
+}
+
+static void mem_free(void *p) {
+  count(&count_frees, 1);
+  int i = pool_class_of(p);
+  if (i >= 0) {
+    pool_free(p, i);
+  } else {
+    count(&count_heap_calls, 1);
+    system_mem.xFree(p);
+  }
+}
+
+static void *mem_realloc(void *p, int n) {
+  count(&count_reallocs, 1);
+  count(&count_bytes, (unsigned long long)n);
+  int i = pool_class_of(p);
+  if (i < 0) {
+    count(&count_heap_calls, 1);
+    return system_mem.xRealloc(p, n); // Heap blocks stay on the heap
+  }
+  if (n <= pool_class_size[i]) {
+    return p;
+  }
+  void *q = pool_alloc(n);
+  if (!q) {
+    count(&count_heap_calls, 1);
+    q = system_mem.xMalloc(n);
+  }
+  if (q) {
+    memcpy(q, p, (size_t)pool_class_size[i]);
+    pool_free(p, i);
+  }
+  return q;
+}
+
+static int mem_size(void *p) {
+  int i = pool_class_of(p);
+  return i >= 0 ? pool_class_size[i] : system_mem.xSize(p);
+}
+
+static int mem_roundup(int n) {
+  if (pool_arena && n <= POOL_MAX_BLOCK) {
+    int i = 0;
+    while (pool_class_size[i] < n) {
+      i++;
+    }
+    return pool_class_size[i];
+  }
+  return system_mem.xRoundup(n);
+}
+
+static int mem_init(void *unused) {
+  (void)unused;
+  return system_mem.xInit(system_mem.pAppData);
+}
+
+static void mem_shutdown(void *unused) {
+  (void)unused;
+  system_mem.xShutdown(system_mem.pAppData);
+}
+
+// --- Settings ---
+static DbMemorySettings settings_in_effect;
+
+const DbMemorySettings *db_memory_get_settings(void) {
+  return &settings_in_effect;
+}
+
+void db_memory_set_settings(const DbMemorySettings *settings) {
+  settings_in_effect = *settings;
+}
+
+static int set_up_to(const char *value, long long max, int *out) {
+  long long v;
+  if (db_setting_int(value, 0, max, &v) != 0) {
+    return -1;
+  }
+  *out = (int)v;
+  return 0;
+}
+
+static int set_page_cache_kb(const char *value) {
+  return set_up_to(value, 16777216, &settings_in_effect.page_cache_kb);
+}
+
+static int set_mem_pool_kb(const char *value) {
+  return set_up_to(value, 1048576, &settings_in_effect.mem_pool_kb);
+}
+
+static int set_lookaside_slot_size(const char *value) {
+  return set_up_to(value, 65536, &settings_in_effect.lookaside_slot_size);
+}
+
+static int set_lookaside_slots(const char *value) {
+  return set_up_to(value, 65536, &settings_in_effect.lookaside_slots);
+}
+
+static int set_soft_heap_limit_kb(const char *value) {
+  return set_up_to(value, 1073741824, &settings_in_effect.soft_heap_limit_kb);
+}
+
+const DbSettingKey db_memory_setting_keys[] = {
+    {"page_cache_kb", set_page_cache_kb},
+    {"mem_pool_kb", set_mem_pool_kb},
+    {"lookaside_slot_size", set_lookaside_slot_size},
+    {"lookaside_slots", set_lookaside_slots},
+    {"soft_heap_limit_kb", set_soft_heap_limit_kb},
+    {NULL, NULL}};
+
+// --- db_memory_configure ---
+// Page slots: a page plus SQLite's per-page header
+static void *page_arena = NULL;
+static sqlite3_int64 page_slots = 0;
+
+static void configure_page_cache(const DbMemorySettings *settings) {
+  int header = 0;
+  sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header);
+  int page_size = db_get_profile()->page_size;
+  int page = page_size > 0 ? page_size : 4096;
+  int slot = (page + header + 7) & ~7;
+  sqlite3_int64 slots = (sqlite3_int64)settings->page_cache_kb * 1024 / slot;
+  if (slots < 1 || !(page_arena = malloc((size_t)(slots * slot)))) {
+    fprintf(stderr, "!!! page_cache_kb: cannot set up the arena.\n");
+    return;
+  }
+  if (sqlite3_config(SQLITE_CONFIG_PAGECACHE, page_arena, slot, (int)slots) !=
+      SQLITE_OK) {
+    free(page_arena);
+    page_arena = NULL;
+    return;
+  }
+  page_slots = slots;
+  printf("DEBUG: Page cache arena: %lld slots of %d bytes\n",
+         (long long)slots, slot);
+}
+
+static int configure_allocator(const DbMemorySettings *settings) {
+  sqlite3_config(SQLITE_CONFIG_GETMALLOC, &system_mem);
+  if (settings->mem_pool_kb > 0 &&
+      pool_init((size_t)settings->mem_pool_kb * 1024) != 0) {
+    fprintf(stderr, "!!! mem_pool_kb: cannot set up the pool.\n");
+    return -1;
+  }
+  sqlite3_mem_methods methods = {mem_malloc,  mem_free, mem_realloc,
+                                 mem_size,    mem_roundup, mem_init,
+                                 mem_shutdown, NULL};
+  if (sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) != SQLITE_OK) {
+    // Already initialized (e.g. another library opened a database first)
+    fprintf(stderr, "DEBUG: SQLite already initialized; memory settings "
+                    "not applied.\n");
+    free(pool_arena);
+    pool_arena = pool_arena_end = NULL;
+    pool_blocks = 0;
+    return -1;
+  }
+  if (pool_arena) {
+    printf("DEBUG: SQLite small-block pool: %d KB\n", settings->mem_pool_kb);
+  }
+  if (settings->page_cache_kb > 0) {
+    configure_page_cache(settings);
+  }
+  if (settings->lookaside_slot_size > 0 && settings->lookaside_slots > 0) {
+    sqlite3_config(SQLITE_CONFIG_LOOKASIDE, settings->lookaside_slot_size,
+                   settings->lookaside_slots);
+  }
+  return 0;
+}
+
+int db_memory_configure(const DbMemorySettings *settings) {
+  int rc = 0;
+  pthread_mutex_lock(&config_lock);
+  if (!configured) {
+    configured = 1;
+    rc = configure_allocator(settings);
+  }
+  pthread_mutex_unlock(&config_lock);
+  sqlite3_soft_heap_limit64((sqlite3_int64)settings->soft_heap_limit_kb *
+                            1024);
+  return rc;
+}
+
+// --- db_memory_get_stats ---
+static void status(int op, sqlite3_int64 *current, sqlite3_int64 *peak) {
+  sqlite3_int64 cur = 0, hi = 0;
+  sqlite3_status64(op, &cur, &hi, 0);
+  if (current) {
+    *current = cur;
+  }
+  if (peak) {
+    *peak = hi;
+  }
+}
+
+void db_memory_get_stats(DbMemoryStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  status(SQLITE_STATUS_MEMORY_USED, &stats->heap_used, &stats->heap_peak);
+  status(SQLITE_STATUS_MALLOC_COUNT, &stats->allocations, NULL);
+  status(SQLITE_STATUS_MALLOC_SIZE, NULL, &stats->largest_request);
+  status(SQLITE_STATUS_PAGECACHE_USED, &stats->page_slots_used,
+         &stats->page_slots_peak);
+  status(SQLITE_STATUS_PAGECACHE_OVERFLOW, &stats->page_overflow,
+         &stats->page_overflow_peak);
+  stats->page_slots = page_slots;
+  stats->soft_heap_limit = sqlite3_soft_heap_limit64(-1);
+  stats->mallocs = atomic_load(&count_mallocs);
+  stats->reallocs = atomic_load(&count_reallocs);
+  stats->frees = atomic_load(&count_frees);
+  stats->bytes_requested = atomic_load(&count_bytes);
+  stats->pool_hits = atomic_load(&count_pool_hits);
+  stats->pool_misses = atomic_load(&count_pool_misses);
+  stats->heap_calls = atomic_load(&count_heap_calls);
+  stats->pool_blocks = pool_blocks;
+  pthread_mutex_lock(&pool_lock);
+  for (int i = 0; i < POOL_CLASSES; i++) {
+    stats->pool_blocks_used += pool_classes[i].used;
+    stats->pool_blocks_peak += pool_classes[i].peak;
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
+
+// --- db_memory_print ---
+static long long kb(sqlite3_int64 bytes) { return (bytes + 1023) / 1024; }
+
+void db_memory_print(FILE *out) {
+  DbMemoryStats s;
+  db_memory_get_stats(&s);
+  fprintf(out, "Память SQLite: занято %lld КБ (пик %lld КБ), блоков %lld, "
+               "крупнейший запрос %lld байт.\n",
+          kb(s.heap_used), kb(s.heap_peak), (long long)s.allocations,
+          (long long)s.largest_request);
+  if (s.soft_heap_limit > 0) {
+    fprintf(out, "  Мягкий лимит кучи: %lld КБ.\n", kb(s.soft_heap_limit));
+  }
+  if (s.page_slots > 0) {
+    fprintf(out,
+            "  Арена кэша страниц: занято %lld из %lld страниц (пик %lld), "
+            "вне арены %lld КБ (пик %lld КБ).\n",
+            (long long)s.page_slots_used, (long long)s.page_slots,
+            (long long)s.page_slots_peak, kb(s.page_overflow),
+            kb(s.page_overflow_peak));
+  }
+  if (s.pool_blocks > 0) {
+    fprintf(out,
+            "  Пул мелких блоков: занято %lld из %lld (сумма пиков классов "
+            "%lld), выдано %llu, отказов %llu.\n",
+            (long long)s.pool_blocks_used, (long long)s.pool_blocks,
+            (long long)s.pool_blocks_peak, s.pool_hits, s.pool_misses);
+    for (int i = 0; i < POOL_CLASSES; i++) {
+      pthread_mutex_lock(&pool_lock);
+      PoolClass c = pool_classes[i];
+      pthread_mutex_unlock(&pool_lock);
+      fprintf(out, "    до %3d байт: занято %lld, пик %lld, из %lld\n",
+              pool_class_size[i], (long long)c.used, (long long)c.peak,
+              (long long)((c.end - c.start) / pool_class_size[i]));
+    }
+  }
+  fprintf(out,
+          "  Вызовы распределителя: malloc %llu, realloc %llu, free %llu "
+          "(из них до системной кучи %llu), запрошено %llu КБ.\n",
+          s.mallocs, s.reallocs, s.frees, s.heap_calls,
+          (s.bytes_requested + 1023) / 1024);
+  if (db) {
+    int cache = 0, schema = 0, stmts = 0, hi = 0;
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_USED, &cache, &hi, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_SCHEMA_USED, &schema, &hi, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_STMT_USED, &stmts, &hi, 0);
+    fprintf(out,
+            "  Это соединение: кэш страниц %lld КБ, схема %lld КБ, "
+            "подготовленные запросы %lld КБ.\n",
+            kb(cache), kb(schema), kb(stmts));
+  }
+}
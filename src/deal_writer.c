@@ -0,0 +1,232 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include "../includes/deal_writer.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct DealWriter {
+  char *path;
+  int max_batch;
+  int window_ms;
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready; // Submitters -> writer: queued or shutdown
+  pthread_cond_t finished;   // Writer -> deal_writer_insert(): batch done
+  int opened;                // Writer tried to open its connection
+  int open_failed;
+  int shutdown;
+
+  // Queue, oldest first (protected by lock)
+  DealSubmission *head;
+  DealSubmission *tail;
+  int queued;
+  DealWriterStats stats;
+};
+
+// Records a batch in one transaction on the writer's connection
+static int run_batch(DealSubmission *batch) {
+  int rc = execute_non_query("BEGIN IMMEDIATE;");
+  for (DealSubmission *sub = batch; sub; sub = sub->next) {
+    sub->result = rc == SQLITE_OK ? insert_deal(sub->deal) : DEAL_RESULT_ERROR;
+  }
+  if (rc == SQLITE_OK && (rc = execute_non_query("COMMIT;")) != SQLITE_OK) {
+    execute_non_query("ROLLBACK;");
+    for (DealSubmission *sub = batch; sub; sub = sub->next) {
+      sub->result = DEAL_RESULT_ERROR; // Nothing of the batch was kept
+    }
+  }
+  return rc;
+}
+
+// Waits until the window after the first queued deal closes or the batch is
+// full; called with the lock held
+static void wait_for_batch(DealWriter *writer) {
+  if (writer->window_ms <= 0) {
+    return;
+  }
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += (long)writer->window_ms * 1000000L;
+  deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+  deadline.tv_nsec %= 1000000000L;
+  while (!writer->shutdown && writer->queued < writer->max_batch &&
+         pthread_cond_timedwait(&writer->work_ready, &writer->lock,
+                                &deadline) == 0) {
+  }
+}
+
+static void *writer_thread(void *arg) {
+  DealWriter *writer = arg;
+  int rc_open = open_db(writer->path);
+
+  pthread_mutex_lock(&writer->lock);
+  writer->opened = 1;
+  writer->open_failed = rc_open != 0;
+  pthread_cond_broadcast(&writer->finished);
+
+  while (rc_open == 0) {
+    while (!writer->head && !writer->shutdown) {
+      pthread_cond_wait(&writer->work_ready, &writer->lock);
+    }
+    if (!writer->head) {
+      break; // Shut down with nothing left to record
+    }
+    wait_for_batch(writer);
+
+    // Take up to max_batch deals off the queue
+    DealSubmission *batch = writer->head, *last = batch;
+    int count = 1;
+    while (count < writer->max_batch && last->next) {
+      last = last->next;
+      count++;
+    }
+    writer->head = last->next;
+    if (!writer->head) {
+      writer->tail = NULL;
+    }
+    last->next = NULL;
+    writer->queued -= count;
+    pthread_mutex_unlock(&writer->lock);
+
+    int rc = run_batch(batch);
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stats.deals += (unsigned long)count;
+    writer->stats.batches++;
+    if ((unsigned long)count > writer->stats.largest_batch) {
+      writer->stats.largest_batch = (unsigned long)count;
+    }
+    if (rc != SQLITE_OK) {
+      writer->stats.failed_batches++;
+    }
+    // A callback may free its node, so next is read first
+    for (DealSubmission *sub = batch, *next; sub; sub = next) {
+      next = sub->next;
+      if (sub->done) {
+        pthread_mutex_unlock(&writer->lock);
+        sub->done(sub->ctx, sub->result);
+        pthread_mutex_lock(&writer->lock);
+      } else {
+        sub->finished = 1;
+      }
+    }
+    pthread_cond_broadcast(&writer->finished);
+  }
+  pthread_mutex_unlock(&writer->lock);
+
+  close_db();
+  return NULL;
+}
+
+// --- deal_writer_create ---
+DealWriter *deal_writer_create(const char *db_path, int max_batch,
+                               int window_ms) {
+  if (!db_path || db_path[0] == '\0' || strcmp(db_path, ":memory:") == 0) {
+    fprintf(stderr, "!!! deal writer: a database file is required.\n");
+    return NULL;
+  }
+  DealWriter *writer = calloc(1, sizeof(*writer));
+  if (!writer) {
+    return NULL;
+  }
+  writer->path = malloc(strlen(db_path) + 1);
+  if (!writer->path) {
+    free(writer);
+    return NULL;
+  }
+  strcpy(writer->path, db_path);
+  writer->max_batch = max_batch > 0 ? max_batch : 1;
+  writer->window_ms = window_ms;
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->work_ready, NULL);
+  pthread_cond_init(&writer->finished, NULL);
+
+  if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+    fprintf(stderr, "!!! deal writer: cannot create the writer thread.\n");
+    pthread_cond_destroy(&writer->finished);
+    pthread_cond_destroy(&writer->work_ready);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->path);
+    free(writer);
+    return NULL;
+  }
+  pthread_mutex_lock(&writer->lock);
+  while (!writer->opened) {
+    pthread_cond_wait(&writer->finished, &writer->lock);
+  }
+  int failed = writer->open_failed;
+  pthread_mutex_unlock(&writer->lock);
+  if (failed) {
+    deal_writer_destroy(writer);
+    return NULL;
+  }
+  printf("DEBUG: Deal writer started: up to %d deals per transaction, "
+         "%d ms window, on %s\n",
+         writer->max_batch, window_ms, db_path);
+  return writer;
+}
+
+// --- deal_writer_submit ---
+int deal_writer_submit(DealWriter *writer, DealSubmission *sub) {
+  sub->finished = 0;
+  sub->next = NULL;
+  pthread_mutex_lock(&writer->lock);
+  if (writer->shutdown) {
+    pthread_mutex_unlock(&writer->lock);
+    return -1;
+  }
+  if (writer->tail) {
+    writer->tail->next = sub;
+  } else {
+    writer->head = sub;
+  }
+  writer->tail = sub;
+  writer->queued++;
+  // The first deal starts the window, a full batch ends it
+  if (writer->queued == 1 || writer->queued >= writer->max_batch) {
+    pthread_cond_signal(&writer->work_ready);
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return 0;
+}
+
+// --- deal_writer_insert ---
+DealResult deal_writer_insert(DealWriter *writer, const DealInput *deal) {
+  DealSubmission sub = {deal, NULL, NULL, DEAL_RESULT_ERROR, 0, NULL};
+  if (deal_writer_submit(writer, &sub) != 0) {
+    return DEAL_RESULT_ERROR;
+  }
+  pthread_mutex_lock(&writer->lock);
+  while (!sub.finished) {
+    pthread_cond_wait(&writer->finished, &writer->lock);
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return sub.result;
+}
+
+// --- deal_writer_get_stats ---
+void deal_writer_get_stats(DealWriter *writer, DealWriterStats *stats) {
+  pthread_mutex_lock(&writer->lock);
+  *stats = writer->stats;
+  pthread_mutex_unlock(&writer->lock);
+}
+
+// --- deal_writer_destroy ---
+void deal_writer_destroy(DealWriter *writer) {
+  if (!writer) {
+    return;
+  }
+  pthread_mutex_lock(&writer->lock);
+  writer->shutdown = 1;
+  pthread_cond_signal(&writer->work_ready);
+  pthread_mutex_unlock(&writer->lock);
+  pthread_join(writer->thread, NULL);
+  pthread_cond_destroy(&writer->finished);
+  pthread_cond_destroy(&writer->work_ready);
+  pthread_mutex_destroy(&writer->lock);
+  free(writer->path);
+  free(writer);
+}
@@ -0,0 +1,821 @@
+#include "../includes/importer.h"
+#include "../includes/aggregates.h"
+#include "../includes/dates.h"
+#include "../includes/db.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define IMPORT_LINE_MAX 4096
+#define IMPORT_KEY_MAX 512
+
+// --- Reference data loaded once per import ---
+// Goods, Brokers, Buyers and GoodTypes, name -> integer id. Open-addressing
+// hash table keyed by string. Memory is bounded by the size of the reference
+// tables, never by the size of the input.
+typedef struct {
+  char *key;           // Owned; NULL = empty slot
+  sqlite3_int64 id;    // good_id, broker_id, buyer_id or type_id
+  long long available; // Goods only: quantity at batch start
+  long long pending;   // Goods only: units sold in the current batch
+  char *type;          // Goods only: type_of_good (may be NULL)
+  int touched;         // Goods only: listed in the batch touch list
+} RefEntry;
+
+typedef struct {
+  RefEntry *slots;
+  size_t capacity; // Power of two
+  size_t count;
+} RefTable;
+
+static unsigned long ref_hash(const char *key) {
+  unsigned long h = 2166136261UL;
+  for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+    h ^= *p;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+static void ref_table_free(RefTable *table) {
+  for (size_t i = 0; i < table->capacity; i++) {
+    free(table->slots[i].key);
+    free(table->slots[i].type);
+  }
+  free(table->slots);
+  memset(table, 0, sizeof(*table));
+}
+
+static RefEntry *ref_table_find(const RefTable *table, const char *key) {
+  if (table->capacity == 0) {
+    return NULL;
+  }
+  size_t mask = table->capacity - 1;
+  for (size_t i = ref_hash(key) & mask;; i = (i + 1) & mask) {
+    RefEntry *entry = &table->slots[i];
+    if (!entry->key) {
+      return NULL;
+    }
+    if (strcmp(entry->key, key) == 0) {
+      return entry;
+    }
+  }
+}
+
+static int ref_table_grow(RefTable *table) {
+  size_t new_capacity = table->capacity ? table->capacity * 2 : 256;
+  RefEntry *slots = calloc(new_capacity, sizeof(RefEntry));
+  if (!slots) {
+    return -1;
+  }
+  for (size_t i = 0; i < table->capacity; i++) {
+    RefEntry *old = &table->slots[i];
+    if (!old->key) {
+      continue;
+    }
+    size_t j = ref_hash(old->key) & (new_capacity - 1);
+    while (slots[j].key) {
+      j = (j + 1) & (new_capacity - 1);
+    }
+    slots[j] = *old;
+  }
+  free(table->slots);
+  table->slots = slots;
+  table->capacity = new_capacity;
+  return 0;
+}
+
+static RefEntry *ref_table_insert(RefTable *table, const char *key) {
+  if ((table->count + 1) * 2 > table->capacity && ref_table_grow(table) != 0) {
+    return NULL;
+  }
+  size_t mask = table->capacity - 1;
+  size_t i = ref_hash(key) & mask;
+  while (table->slots[i].key) {
+    if (strcmp(table->slots[i].key, key) == 0) {
+      return &table->slots[i];
+    }
+    i = (i + 1) & mask;
+  }
+  RefEntry *entry = &table->slots[i];
+  entry->key = malloc(strlen(key) + 1);
+  if (!entry->key) {
+    return NULL;
+  }
+  strcpy(entry->key, key);
+  table->count++;
+  return entry;
+}
+
+// Goods are keyed by "name<US>supplier"
+static int make_good_key(char *buffer, size_t size, const char *name,
+                         const char *supplier) {
+  int n = snprintf(buffer, size, "%s\x1f%s", name, supplier);
+  return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+// Loads (id, name) rows
+static int load_ids(RefTable *table, const char *sql) {
+  sqlite3_stmt *stmt = NULL;
+  int rc = db_prepare_cached(sql, &stmt);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char *name = (const char *)sqlite3_column_text(stmt, 1);
+    if (!name) {
+      continue;
+    }
+    RefEntry *entry = ref_table_insert(table, name);
+    if (!entry) {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    entry->id = sqlite3_column_int64(stmt, 0);
+  }
+  db_release_stmt(stmt);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+static int load_goods(RefTable *table) {
+  sqlite3_stmt *stmt = NULL;
+  int rc = db_prepare_cached("SELECT good_id, name, supplier_name_fk, "
+                             "quantity, type_of_good FROM Goods;",
+                             &stmt);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  char key[IMPORT_KEY_MAX];
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char *name = (const char *)sqlite3_column_text(stmt, 1);
+    const char *supplier = (const char *)sqlite3_column_text(stmt, 2);
+    const char *type = (const char *)sqlite3_column_text(stmt, 4);
+    if (!name || !supplier ||
+        make_good_key(key, sizeof(key), name, supplier) != 0) {
+      continue; // Cannot be referenced by an input row anyway
+    }
+    RefEntry *entry = ref_table_insert(table, key);
+    if (!entry) {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    entry->id = sqlite3_column_int64(stmt, 0);
+    entry->available = sqlite3_column_int64(stmt, 3);
+    if (type) {
+      entry->type = malloc(strlen(type) + 1);
+      if (entry->type) {
+        strcpy(entry->type, type);
+      }
+    }
+  }
+  db_release_stmt(stmt);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+// --- Row parsing ---
+typedef struct {
+  char *date;
+  char *good_name;
+  char *supplier;
+  char *type;
+  char *quantity;
+  char *broker;
+  char *buyer;
+} ImportRow;
+
+// Splits one CSV line in place. Quoted fields may contain commas and "".
+static const char *parse_csv_line(char *line, ImportRow *row) {
+  char *fields[7];
+  int count = 0;
+  char *p = line;
+
+  while (count < 7) {
+    char *start = p;
+    if (*p == '"') {
+      char *out = p;
+      p++;
+      while (*p) {
+        if (*p == '"') {
+          if (p[1] == '"') {
+            *out++ = '"';
+            p += 2;
+            continue;
+          }
+          p++;
+          break;
+        }
+        *out++ = *p++;
+      }
+      if (*p != ',' && *p != '\0') {
+        return "malformed quoted field";
+      }
+      fields[count++] = start;
+      int more = (*p == ',');
+      *out = '\0';
+      if (!more) {
+        break;
+      }
+      p++;
+    } else {
+      while (*p && *p != ',') {
+        p++;
+      }
+      fields[count++] = start;
+      if (*p == '\0') {
+        break;
+      }
+      *p++ = '\0';
+    }
+  }
+  if (count != 7 || *p != '\0') {
+    return "expected 7 fields";
+  }
+  row->date = fields[0];
+  row->good_name = fields[1];
+  row->supplier = fields[2];
+  row->type = fields[3];
+  row->quantity = fields[4];
+  row->broker = fields[5];
+  row->buyer = fields[6];
+  return NULL;
+}
+
+// Appends the UTF-8 encoding of a code point; returns bytes written
+static int put_utf8(char *out, unsigned long cp) {
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  out[0] = (char)(0xE0 | (cp >> 12));
+  out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+  out[2] = (char)(0x80 | (cp & 0x3F));
+  return 3;
+}
+
+// Decodes a JSON string starting after the opening quote, in place.
+// Returns a pointer past the closing quote, or NULL if malformed.
+static char *json_string(char *p, char **value) {
+  char *out = p;
+  *value = p;
+  while (*p && *p != '"') {
+    if (*p != '\\') {
+      *out++ = *p++;
+      continue;
+    }
+    p++;
+    switch (*p) {
+    case '"':
+    case '\\':
+    case '/':
+      *out++ = *p++;
+      break;
+    case 'b':
+      *out++ = '\b';
+      p++;
+      break;
+    case 'f':
+      *out++ = '\f';
+      p++;
+      break;
+    case 'n':
+      *out++ = '\n';
+      p++;
+      break;
+    case 'r':
+      *out++ = '\r';
+      p++;
+      break;
+    case 't':
+      *out++ = '\t';
+      p++;
+      break;
+    case 'u': {
+      unsigned long cp = 0;
+      for (int i = 1; i <= 4; i++) {
+        char c = p[i];
+        cp <<= 4;
+        if (c >= '0' && c <= '9') {
+          cp |= (unsigned long)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+          cp |= (unsigned long)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+          cp |= (unsigned long)(c - 'A' + 10);
+        } else {
+          return NULL;
+        }
+      }
+      // \uXXXX is 6 input bytes and at most 3 output bytes
+      out += put_utf8(out, cp);
+      p += 5;
+      break;
+    }
+    default:
+      return NULL;
+    }
+  }
+  if (*p != '"') {
+    return NULL;
+  }
+  *out = '\0';
+  return p + 1;
+}
+
+static char *skip_ws(char *p) {
+  while (*p == ' ' || *p == '\t') {
+    p++;
+  }
+  return p;
+}
+
+// Parses one flat JSON object ({"key": "string" | number, ...}) in place
+static const char *parse_json_line(char *line, ImportRow *row) {
+  memset(row, 0, sizeof(*row));
+  char *p = skip_ws(line);
+  if (*p++ != '{') {
+    return "expected JSON object";
+  }
+  p = skip_ws(p);
+  if (*p == '}') {
+    return "empty JSON object";
+  }
+  while (1) {
+    char *key, *value;
+    if (*p++ != '"' || !(p = json_string(p, &key))) {
+      return "malformed JSON key";
+    }
+    p = skip_ws(p);
+    if (*p++ != ':') {
+      return "expected ':' in JSON object";
+    }
+    p = skip_ws(p);
+    char *value_end = NULL;
+    if (*p == '"') {
+      if (!(p = json_string(p + 1, &value))) {
+        return "malformed JSON string";
+      }
+    } else {
+      value = p; // Bare number (or literal): terminated below
+      while (*p && *p != ',' && *p != '}' && *p != ' ' && *p != '\t') {
+        p++;
+      }
+      if (value == p) {
+        return "missing JSON value";
+      }
+      value_end = p;
+    }
+    p = skip_ws(p);
+    char sep = *p++;
+    if (value_end) {
+      *value_end = '\0';
+    }
+
+    if (strcmp(key, "deal_date") == 0 || strcmp(key, "date") == 0) {
+      row->date = value;
+    } else if (strcmp(key, "good_name") == 0) {
+      row->good_name = value;
+    } else if (strcmp(key, "supplier") == 0 ||
+               strcmp(key, "supplier_name") == 0) {
+      row->supplier = value;
+    } else if (strcmp(key, "type_of_good") == 0 || strcmp(key, "type") == 0) {
+      row->type = value;
+    } else if (strcmp(key, "sell_quantity") == 0 ||
+               strcmp(key, "quantity") == 0) {
+      row->quantity = value;
+    } else if (strcmp(key, "broker") == 0 ||
+               strcmp(key, "broker_surname") == 0) {
+      row->broker = value;
+    } else if (strcmp(key, "buyer") == 0 || strcmp(key, "buyer_name") == 0) {
+      row->buyer = value;
+    } // Unknown keys are ignored
+
+    if (sep == '}') {
+      break;
+    }
+    if (sep != ',') {
+      return "expected ',' or '}' in JSON object";
+    }
+    p = skip_ws(p);
+  }
+  if (*skip_ws(p) != '\0') {
+    return "trailing data after JSON object";
+  }
+  if (!row->date || !row->good_name || !row->supplier || !row->quantity ||
+      !row->broker || !row->buyer) {
+    return "missing required field";
+  }
+  if (!row->type) {
+    static char no_type[] = "";
+    row->type = no_type; // Use the good's type
+  }
+  return NULL;
+}
+
+// --- Field validation ---
+// Positive integer quantity without sign, spaces or fraction
+static int parse_quantity(const char *s, long long *out) {
+  long long v = 0;
+  if (*s == '\0') {
+    return -1;
+  }
+  for (; *s; s++) {
+    if (*s < '0' || *s > '9' || v > 214748364LL) {
+      return -1;
+    }
+    v = v * 10 + (*s - '0');
+  }
+  if (v <= 0 || v > 2147483647LL) {
+    return -1;
+  }
+  *out = v;
+  return 0;
+}
+
+// --- Import state ---
+typedef struct {
+  RefTable goods;
+  RefTable brokers;
+  RefTable buyers;
+  RefTable types;
+  RefEntry **touched; // Goods with pending units in the current batch
+  size_t touched_count;
+  sqlite3_stmt *insert_stmt;
+  FILE *rejects;
+  const ImportOptions *options;
+  ImportStats *stats;
+  long batch_rows;
+  sqlite3_int64 batch_first_id; // Deals of the current batch are exactly
+  sqlite3_int64 batch_last_id;  // [first, last]: the batch holds the lock
+} ImportState;
+
+static void write_reject(ImportState *state, long line_no, const char *reason,
+                         const char *line) {
+  state->stats->rows_rejected++;
+  if (state->rejects) {
+    fprintf(state->rejects, "%ld\t%s\t%s\n", line_no, reason, line);
+  }
+}
+
+// Applies the per-good stock deltas and the aggregate deltas of the batch and
+// commits it
+static int commit_batch(ImportState *state) {
+  int rc = SQLITE_OK;
+  if (state->batch_rows > 0) {
+    rc = aggregates_apply_deal_range(state->batch_first_id,
+                                     state->batch_last_id, 1);
+  }
+  for (size_t i = 0; i < state->touched_count && rc == SQLITE_OK; i++) {
+    RefEntry *good = state->touched[i];
+    DbParam params[] = {DB_INT(good->pending), DB_INT(good->id),
+                        DB_INT(good->pending)};
+    rc = execute_non_query_params("UPDATE Goods SET quantity = quantity - ? "
+                                  "WHERE good_id = ? AND quantity >= ?;",
+                                  params, DB_PARAM_COUNT(params));
+    if (rc == SQLITE_OK && sqlite3_changes(db) == 0) {
+      fprintf(stderr, "!!! import: stock of good_id %lld changed during the "
+                      "import; batch rolled back.\n",
+              (long long)good->id);
+      rc = SQLITE_CONSTRAINT;
+    }
+    state->stats->goods_updates++;
+  }
+  if (rc == SQLITE_OK) {
+    rc = execute_non_query("COMMIT;");
+  }
+  if (rc != SQLITE_OK) {
+    execute_non_query("ROLLBACK;");
+    return rc;
+  }
+  for (size_t i = 0; i < state->touched_count; i++) {
+    RefEntry *good = state->touched[i];
+    good->available -= good->pending;
+    good->pending = 0;
+    good->touched = 0;
+  }
+  state->touched_count = 0;
+  state->stats->rows_imported += state->batch_rows;
+  state->stats->batches++;
+  state->batch_rows = 0;
+  return SQLITE_OK;
+}
+
+// GoodTypes id of a type name; a new name is added to GoodTypes (inside the
+// batch) and to the cache
+static int resolve_type(ImportState *state, const char *name,
+                        sqlite3_int64 *type_id) {
+  RefEntry *entry = ref_table_find(&state->types, name);
+  if (entry) {
+    *type_id = entry->id;
+    return SQLITE_OK;
+  }
+  DbParam params[] = {DB_TEXT(name)};
+  int rc = execute_non_query_params("INSERT INTO GoodTypes (name) VALUES (?) "
+                                    "ON CONFLICT(name) DO NOTHING;",
+                                    params, DB_PARAM_COUNT(params));
+  DbCursor cur;
+  if (rc == SQLITE_OK) {
+    rc = db_cursor_open(&cur, "SELECT type_id FROM GoodTypes WHERE name = ?;",
+                        params, DB_PARAM_COUNT(params));
+    if (rc == SQLITE_OK) {
+      rc = db_cursor_next(&cur) == SQLITE_ROW ? SQLITE_OK : SQLITE_ERROR;
+      *type_id = db_cursor_int64(&cur, 0);
+    }
+    db_cursor_close(&cur);
+  }
+  if (rc == SQLITE_OK) {
+    entry = ref_table_insert(&state->types, name);
+    if (!entry) {
+      return SQLITE_NOMEM;
+    }
+    entry->id = *type_id;
+  }
+  return rc;
+}
+
+// Validates and inserts one parsed row. Returns NULL on success, a reject
+// reason for bad input, or sets *db_error on a database failure.
+static const char *import_row(ImportState *state, ImportRow *row,
+                              int *db_error) {
+  char key[IMPORT_KEY_MAX];
+  long long quantity;
+  int day;
+
+  if (date_parse(row->date, &day) != 0) {
+    return "invalid date (expected YYYY-MM-DD)";
+  }
+  if (parse_quantity(row->quantity, &quantity) != 0) {
+    return "invalid quantity (expected positive integer)";
+  }
+  if (make_good_key(key, sizeof(key), row->good_name, row->supplier) != 0) {
+    return "good name or supplier too long";
+  }
+  RefEntry *good = ref_table_find(&state->goods, key);
+  if (!good) {
+    return "unknown good/supplier";
+  }
+  RefEntry *broker = ref_table_find(&state->brokers, row->broker);
+  if (!broker) {
+    return "unknown broker";
+  }
+  RefEntry *buyer = ref_table_find(&state->buyers, row->buyer);
+  if (!buyer) {
+    return "unknown buyer";
+  }
+  if (good->available - good->pending < quantity) {
+    return "insufficient quantity";
+  }
+
+  const char *type = row->type[0] != '\0' ? row->type : good->type;
+  sqlite3_int64 type_id = 0;
+  if (type) {
+    int rc = resolve_type(state, type, &type_id);
+    if (rc != SQLITE_OK) {
+      fprintf(stderr, "!!! import: cannot add type '%s' (%d): %s\n", type,
+              rc, sqlite3_errmsg(db));
+      *db_error = rc;
+      return NULL;
+    }
+  }
+  sqlite3_stmt *stmt = state->insert_stmt;
+  sqlite3_bind_int(stmt, 1, day);
+  sqlite3_bind_int64(stmt, 2, good->id);
+  if (type) {
+    sqlite3_bind_int64(stmt, 3, type_id);
+  } else {
+    sqlite3_bind_null(stmt, 3);
+  }
+  sqlite3_bind_int64(stmt, 4, quantity);
+  sqlite3_bind_int64(stmt, 5, broker->id);
+  sqlite3_bind_int64(stmt, 6, buyer->id);
+  int rc = sqlite3_step(stmt);
+  int extended_rc = sqlite3_extended_errcode(db);
+  sqlite3_reset(stmt);
+  if (rc != SQLITE_DONE) {
+    // The reference data is loaded once, but foreign keys stay on: a broker,
+    // buyer or good deleted by another connection since then is caught here
+    if (extended_rc == SQLITE_CONSTRAINT_FOREIGNKEY) {
+      return "broker, buyer or good no longer exists";
+    }
+    if ((rc & 0xff) == SQLITE_CONSTRAINT) {
+      return "constraint violation";
+    }
+    fprintf(stderr, "!!! import: insert failed (%d): %s\n", rc,
+            sqlite3_errmsg(db));
+    *db_error = rc;
+    return NULL;
+  }
+
+  if (!good->touched) {
+    good->touched = 1;
+    state->touched[state->touched_count++] = good;
+  }
+  state->batch_last_id = sqlite3_last_insert_rowid(db);
+  if (state->batch_rows == 0) {
+    state->batch_first_id = state->batch_last_id;
+  }
+  good->pending += quantity;
+  state->batch_rows++;
+  return NULL;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return (double)(now.tv_sec - start->tv_sec) +
+         (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// --- import_options_defaults ---
+void import_options_defaults(ImportOptions *options) {
+  memset(options, 0, sizeof(*options));
+  options->format = IMPORT_FORMAT_AUTO;
+  options->batch_size = 50000;
+  options->progress_every = 1000000;
+  options->progress_out = stderr;
+}
+
+// --- import_deals_stream ---
+int import_deals_stream(FILE *in, ImportFormat format,
+                        const ImportOptions *options, ImportStats *stats) {
+  ImportOptions defaults;
+  ImportStats local_stats;
+  if (!options) {
+    import_options_defaults(&defaults);
+    options = &defaults;
+  }
+  if (!stats) {
+    stats = &local_stats;
+  }
+  memset(stats, 0, sizeof(*stats));
+  if (!db) {
+    fprintf(stderr, "!!! import: Database not open.\n");
+    return SQLITE_ERROR;
+  }
+
+  struct timespec start;
+  timespec_get(&start, TIME_UTC);
+
+  ImportState state;
+  memset(&state, 0, sizeof(state));
+  state.options = options;
+  state.stats = stats;
+  int batch_size = options->batch_size > 0 ? options->batch_size : 50000;
+
+  int rc = load_goods(&state.goods);
+  if (rc == SQLITE_OK) {
+    rc = load_ids(&state.brokers, "SELECT broker_id, surname FROM Brokers;");
+  }
+  if (rc == SQLITE_OK) {
+    rc = load_ids(&state.buyers, "SELECT buyer_id, buyer_name FROM Buyers;");
+  }
+  if (rc == SQLITE_OK) {
+    rc = load_ids(&state.types, "SELECT type_id, name FROM GoodTypes;");
+  }
+  if (rc == SQLITE_OK) {
+    state.touched = malloc(sizeof(RefEntry *) * (state.goods.count + 1));
+    if (!state.touched) {
+      rc = SQLITE_NOMEM;
+    }
+  }
+  if (rc == SQLITE_OK && options->reject_path) {
+    state.rejects = fopen(options->reject_path, "w");
+    if (!state.rejects) {
+      perror("!!! import: cannot open reject file");
+      rc = SQLITE_CANTOPEN;
+    }
+  }
+  if (rc == SQLITE_OK) {
+    rc = db_prepare_cached(
+        "INSERT INTO Deals (deal_date, good_id, type_id, sell_quantity, "
+        "unit_price, broker_id, buyer_id) VALUES (?1, ?2, ?3, ?4, "
+        "(SELECT price FROM Goods WHERE good_id = ?2), ?5, ?6);",
+        &state.insert_stmt);
+  }
+
+  char line[IMPORT_LINE_MAX];
+  long line_no = 0;
+  int in_batch = 0;
+  while (rc == SQLITE_OK && fgets(line, sizeof(line), in)) {
+    line_no++;
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      int c;
+      while ((c = fgetc(in)) != '\n' && c != EOF)
+        ; // Drop the rest of an over-long line
+      stats->rows_read++;
+      write_reject(&state, line_no, "line too long", "");
+      continue;
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0) {
+      continue;
+    }
+    if (line_no == 1 && format == IMPORT_FORMAT_CSV &&
+        strncmp(line, "deal_date,", 10) == 0) {
+      continue; // Header row
+    }
+    stats->rows_read++;
+
+    if (!in_batch) {
+      rc = execute_non_query("BEGIN IMMEDIATE;");
+      if (rc != SQLITE_OK) {
+        break;
+      }
+      in_batch = 1;
+    }
+
+    char original[IMPORT_LINE_MAX];
+    if (state.rejects) {
+      memcpy(original, line, len + 1); // Parsing modifies the line in place
+    }
+    ImportRow row;
+    const char *reason = format == IMPORT_FORMAT_JSONL
+                             ? parse_json_line(line, &row)
+                             : parse_csv_line(line, &row);
+    int db_error = SQLITE_OK;
+    if (!reason) {
+      reason = import_row(&state, &row, &db_error);
+    }
+    if (db_error != SQLITE_OK) {
+      rc = db_error;
+      break;
+    }
+    if (reason) {
+      write_reject(&state, line_no, reason, state.rejects ? original : "");
+      if (options->max_rejects > 0 &&
+          stats->rows_rejected > options->max_rejects) {
+        fprintf(stderr, "!!! import: more than %ld rejected rows, aborting.\n",
+                options->max_rejects);
+        rc = SQLITE_ABORT;
+        break;
+      }
+    }
+
+    if (state.batch_rows >= batch_size) {
+      rc = commit_batch(&state);
+      in_batch = 0;
+    }
+    if (options->progress_every > 0 && options->progress_out &&
+        stats->rows_read % options->progress_every == 0) {
+      double secs = elapsed_seconds(&start);
+      fprintf(options->progress_out,
+              "import: %ld rows read, %ld imported, %ld rejected "
+              "(%.0f rows/s)\n",
+              stats->rows_read, stats->rows_imported + state.batch_rows,
+              stats->rows_rejected, secs > 0 ? stats->rows_read / secs : 0.0);
+    }
+  }
+
+  if (in_batch) {
+    if (rc == SQLITE_OK) {
+      rc = commit_batch(&state);
+    } else {
+      execute_non_query("ROLLBACK;");
+    }
+  }
+  if (rc == SQLITE_OK && ferror(in)) {
+    perror("!!! import: read error");
+    rc = SQLITE_IOERR;
+  }
+  db_release_stmt(state.insert_stmt);
+  if (state.rejects) {
+    fclose(state.rejects);
+  }
+  free(state.touched);
+  ref_table_free(&state.goods);
+  ref_table_free(&state.brokers);
+  ref_table_free(&state.buyers);
+  ref_table_free(&state.types);
+  stats->seconds = elapsed_seconds(&start);
+  return rc;
+}
+
+// --- import_deals_file ---
+int import_deals_file(const char *path, const ImportOptions *options,
+                      ImportStats *stats) {
+  ImportFormat format = options ? options->format : IMPORT_FORMAT_AUTO;
+  if (format == IMPORT_FORMAT_AUTO) {
+    const char *dot = strrchr(path, '.');
+    format = (dot && (strcmp(dot, ".jsonl") == 0 || strcmp(dot, ".json") == 0))
+                 ? IMPORT_FORMAT_JSONL
+                 : IMPORT_FORMAT_CSV;
+  }
+  FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!in) {
+    perror("!!! import: cannot open input");
+    fprintf(stderr, "!!! Failed to open input file: %s\n", path);
+    return SQLITE_CANTOPEN;
+  }
+  int rc = import_deals_stream(in, format, options, stats);
+  if (in != stdin) {
+    fclose(in);
+  }
+  return rc;
+}
@@ -1,6 +1,11 @@
+#define _POSIX_C_SOURCE 200809L // sigaction
+
 #include "../includes/auth.h"    // Correct path
+#include "../includes/cli.h"
 #include "../includes/db.h"      // Correct path
 #include "../includes/queries.h" // Correct path
+#include "../includes/server.h"
+#include <signal.h> // Ctrl-C cancels the running report
 #include <stdio.h>
 #include <stdlib.h> // For exit()
 #include <string.h> // For strcmp()
@@ -9,25 +14,123 @@
 void show_admin_menu(UserSession *session);
 void show_broker_menu(UserSession *session);
 
-int main() {
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [--db FILE]                     (interactive menus)\n"
+          "       %s [--db FILE] [--credentials FILE] COMMAND [OPTIONS]\n"
+          "       %s [--db FILE] [--credentials FILE] [--keep-going] "
+          "--script FILE|-\n"
+          "       %s [--db FILE] --serve SOCKET       (server mode)\n"
+          "Without --credentials: PERFUME_CREDENTIALS, or PERFUME_USER and "
+          "PERFUME_PASSWORD.\n"
+          "'%s help' lists the commands.\n",
+          prog, prog, prog, prog, prog);
+}
+
+// Ctrl-C stops the running report and the menu comes back; at a prompt it
+// ends the program as before
+static void on_sigint(int sig) {
+  if (!db_cancel_running()) {
+    signal(sig, SIG_DFL);
+    raise(sig);
+  }
+}
+
+static void install_sigint_handler(void) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_sigint;
+  action.sa_flags = SA_RESTART; // Keep reads at the menu prompts going
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+}
+
+// Batch mode: log in from the credentials, then one command or a script.
+// Returns the exit code (see cli_run_command; 3 also for a failed login).
+static int run_batch(const char *credentials, const char *script,
+                     int keep_going, int argc, char **argv) {
+  UserSession session;
+  int login = cli_login(credentials, &session);
+  if (login != 0) {
+    fprintf(stderr, login > 0 ? "Login failed.\n" : "Login error.\n");
+    return login > 0 ? 3 : 1;
+  }
+  if (!script) {
+    return cli_run_command(&session, argc, argv, stdout, stderr);
+  }
+  FILE *in = strcmp(script, "-") == 0 ? stdin : fopen(script, "r");
+  if (!in) {
+    perror(script);
+    return 1;
+  }
+  int rc = cli_run_script(&session, in, script, keep_going);
+  if (in != stdin) {
+    fclose(in);
+  }
+  return rc;
+}
+
+int main(int argc, char **argv) {
   const char *db_path = "ParfumeMarket.db"; // Relative path
-  const char *schema_path = "database_schema.sql";
+  const char *credentials = NULL, *script = NULL, *socket_path = NULL;
+  int keep_going = 0;
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if (strcmp(argv[arg], "--db") == 0 && arg + 1 < argc) {
+      db_path = argv[++arg];
+    } else if (strcmp(argv[arg], "--credentials") == 0 && arg + 1 < argc) {
+      credentials = argv[++arg];
+    } else if (strcmp(argv[arg], "--script") == 0 && arg + 1 < argc) {
+      script = argv[++arg];
+    } else if (strcmp(argv[arg], "--serve") == 0 && arg + 1 < argc) {
+      socket_path = argv[++arg];
+    } else if (strcmp(argv[arg], "--keep-going") == 0) {
+      keep_going = 1;
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  // A command, or a script, and nothing else: any other use is a mistake.
+  // The server takes its logins from the clients.
+  int batch = script || arg < argc;
+  if ((script && arg < argc) || (!batch && (credentials || keep_going)) ||
+      (socket_path && (batch || credentials))) {
+    usage(argv[0]);
+    return 2;
+  }
 
-  // 1. Open Database
+  // 1. Open Database (connection profile: perfume.conf / PERFUME_DB_* env)
+  DbProfile profile;
+  if (db_profile_load(&profile) != 0) {
+    fprintf(stderr, "Invalid database connection profile. Exiting.\n");
+    return 1;
+  }
+  db_set_profile(&profile);
   if (open_db(db_path) != 0) {
     fprintf(stderr, "Failed to open database '%s'. Exiting.\n", db_path);
     return 1;
   }
 
-  // 2. Initialize Tables if needed
-  if (init_tables_if_needed(schema_path) != 0) {
-    fprintf(stderr,
-            "Failed to initialize database schema from '%s'. Exiting.\n",
-            schema_path);
+  // 2. Initialize Tables if needed (schema and seed data built into the binary)
+  if (init_tables_if_needed(NULL) != 0) {
+    fprintf(stderr, "Failed to initialize database schema. Exiting.\n");
     close_db();
     return 1;
   }
 
+  if (socket_path) {
+    int rc = server_run(socket_path);
+    close_db();
+    return rc == 0 ? 0 : 1;
+  }
+
+  if (batch) {
+    int rc = run_batch(credentials, script, keep_going, argc - arg, argv + arg);
+    close_db();
+    return rc;
+  }
+
   // 3. Authentication
   UserSession current_session;
   memset(&current_session, 0, sizeof(UserSession)); // Clear session info
@@ -78,6 +181,7 @@ int main() {
   }
 
   // 4. Authorization & Menu Display
+  install_sigint_handler();
   if (strcmp(current_session.role, "admin") == 0) {
     show_admin_menu(&current_session);
   } else if (strcmp(current_session.role, "broker") == 0) {
@@ -95,6 +199,8 @@ int main() {
 // --- Admin Menu ---
 void show_admin_menu(UserSession *session) {
   int choice;
+  ReportPool *report_pool = NULL; // Started on first use of item 6
+  AnalyticsStore *analytics = NULL; // Loaded on first use of item 7 or 8
   do {
     printf("\n=== Меню Администратора (%s) ===\n", session->username);
     printf("--- Запросы (Task 2) ---\n");
@@ -103,6 +209,10 @@ void show_admin_menu(UserSession *session) {
     printf(" 3. Инфо по самому популярному типу товара\n");
     printf(" 4. Маклер с макс. количеством сделок\n");
     printf(" 5. Маклеры по поставщикам (опц. фильтр)\n");
+    printf(" 6. Сводный отчет: все запросы параллельно\n");
+    printf(" 7. Сводный отчет из памяти (аналитический движок)\n");
+    printf(" 8. Сверка аналитического движка с SQL\n");
+    printf(" 9. Рейтинги маклеров, товаров и типов\n");
     printf("--- Управление данными (Task 3) ---\n");
     printf(" 10. Добавить нового маклера\n");
     printf(" 11. Добавить новый товар\n");
@@ -111,9 +221,12 @@ void show_admin_menu(UserSession *session) {
     printf(" 14. Удалить сделку по ID\n");
     // Add more CRUD options: Suppliers, Buyers, Users
     printf("--- Функции (Task 4, 5, 6) ---\n");
-    printf(" 20. Пересчитать статистику маклеров (Task 4 - Batch)\n");
+    printf(" 20. Пересчитать статистику маклеров полностью (Task 4)\n");
     printf(" 21. Обновить остатки и очистить сделки до даты (Task 5)\n");
     printf(" 22. Показать сделки на указанную дату (Task 6)\n");
+    printf(" 23. Проверить статистику маклеров (Task 4)\n");
+    printf(" 24. Профиль SQL-запросов, кэш отчетов и память\n");
+    printf(" 25. Перенести сделки до даты в архив (Task 5)\n");
     printf("---------------------------\n");
     printf(" 0. Выход\n");
 
@@ -136,6 +249,30 @@ void show_admin_menu(UserSession *session) {
     case 5:
       run_supplier_brokers_info();
       break;
+    case 6:
+      if (!report_pool) {
+        // Falls back to serial execution if the pool cannot be started
+        report_pool = report_pool_create(sqlite3_db_filename(db, "main"),
+                                         db_get_profile()->read_pool_size);
+      }
+      run_report_bundle(report_pool);
+      break;
+    case 7:
+    case 8:
+      if (!analytics) {
+        analytics = analytics_create();
+      }
+      if (!analytics) {
+        printf("Недостаточно памяти для аналитического движка.\n");
+      } else if (choice == 7) {
+        run_analytics_report_bundle(analytics);
+      } else {
+        run_analytics_cross_check(analytics);
+      }
+      break;
+    case 9:
+      run_leaderboard();
+      break;
     // Task 3
     case 10:
       add_new_broker();
@@ -162,6 +299,15 @@ void show_admin_menu(UserSession *session) {
     case 22:
       show_deals_on_date();
       break; // (*) Accessible to admin
+    case 23:
+      verify_broker_stats();
+      break;
+    case 24:
+      show_sql_profile();
+      break;
+    case 25:
+      archive_old_deals();
+      break;
 
     case 0:
       printf("Выход из меню администратора...\n");
@@ -171,6 +317,8 @@ void show_admin_menu(UserSession *session) {
       break;
     }
   } while (choice != 0);
+  report_pool_destroy(report_pool);
+  analytics_destroy(analytics);
 }
 
 // --- Broker Menu ---
@@ -0,0 +1,505 @@
+#include "../includes/migrations.h"
+#include "../includes/aggregates.h"
+#include "../includes/auth.h"
+#include "../includes/db.h"
+#include "../includes/embedded_sql.h"
+#include <stdio.h>
+
+#define BASELINE_VERSION 1
+
+typedef struct {
+  int version;
+  const char *name;
+  const char *sql;    // Script run with sqlite3_exec, or NULL
+  int (*apply)(void); // Data conversion done in C (after sql), or NULL
+  // 1 = rebuilds tables (create new, copy, drop old, rename): runs with
+  // foreign_keys off, then PRAGMA foreign_key_check must come back empty
+  int rebuilds_tables;
+} Migration;
+
+// 'YYYY-MM-DD' text to a day number (dates.h) inside migration SQL. Text
+// that is not a real calendar date stays as it is and fails the target
+// column's typeof() CHECK, which aborts the migration.
+#define TEXT_TO_DAY(col)                                                       \
+  "CASE WHEN " col " GLOB '[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]' "      \
+  "AND date(" col ") = " col " "                                               \
+  "THEN CAST(julianday(" col ") - 2440587.5 AS INTEGER) ELSE " col " END"
+
+// Ordered by version, without gaps. Append new versions at the end and never
+// edit one that has shipped: existing databases have already applied it.
+// The baseline has neither sql nor apply; it runs the schema script.
+static const Migration migrations[] = {
+    {BASELINE_VERSION, "baseline schema", NULL, NULL, 0},
+    {2, "DailySales rollup",
+     "CREATE TABLE DailySales ("
+     "  sale_date TEXT NOT NULL,"
+     "  good_name_fk TEXT NOT NULL,"
+     "  supplier_name_fk TEXT NOT NULL,"
+     "  units INTEGER NOT NULL DEFAULT 0,"
+     "  revenue REAL NOT NULL DEFAULT 0.0,"
+     "  PRIMARY KEY (sale_date, good_name_fk, supplier_name_fk),"
+     "  FOREIGN KEY (good_name_fk, supplier_name_fk) REFERENCES "
+     "  Goods(name, supplier_name_fk) ON DELETE CASCADE ON UPDATE CASCADE"
+     ") WITHOUT ROWID;"
+     "CREATE INDEX idx_daily_sales_good "
+     "ON DailySales(good_name_fk, supplier_name_fk);"
+     "INSERT INTO DailySales (sale_date, good_name_fk, supplier_name_fk, "
+     "units, revenue) "
+     "SELECT d.deal_date, d.good_name_fk, d.supplier_name_fk, "
+     "SUM(d.sell_quantity), SUM(d.sell_quantity * g.price) "
+     "FROM Deals d JOIN Goods g ON d.good_name_fk = g.name AND "
+     "d.supplier_name_fk = g.supplier_name_fk "
+     "GROUP BY d.deal_date, d.good_name_fk, d.supplier_name_fk;",
+     NULL, 0},
+    {3, "integer day numbers for dates",
+     // Goods: expiry_date (empty text meant "none")
+     "CREATE TABLE Goods_new ("
+     "  good_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+     "  name TEXT NOT NULL,"
+     "  type_of_good TEXT,"
+     "  price REAL NOT NULL CHECK(price > 0),"
+     "  supplier_name_fk TEXT NOT NULL,"
+     "  expiry_date DATE CHECK(expiry_date IS NULL OR "
+     "  typeof(expiry_date) = 'integer'),"
+     "  quantity INTEGER NOT NULL CHECK(quantity >= 0),"
+     "  FOREIGN KEY (supplier_name_fk) REFERENCES Suppliers(supplier_name) "
+     "  ON DELETE RESTRICT ON UPDATE CASCADE,"
+     "  UNIQUE (name, supplier_name_fk)"
+     ");"
+     "INSERT INTO Goods_new (good_id, name, type_of_good, price, "
+     "supplier_name_fk, expiry_date, quantity) "
+     "SELECT good_id, name, type_of_good, price, supplier_name_fk, "
+     "CASE WHEN expiry_date = '' THEN NULL "
+     "ELSE " TEXT_TO_DAY("expiry_date") " END, quantity FROM Goods;"
+     // Deals: deal_date
+     "CREATE TABLE Deals_new ("
+     "  deal_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+     "  deal_date DATE NOT NULL CHECK(typeof(deal_date) = 'integer'),"
+     "  good_name_fk TEXT NOT NULL,"
+     "  supplier_name_fk TEXT NOT NULL,"
+     "  type_of_good TEXT,"
+     "  sell_quantity INTEGER NOT NULL CHECK(sell_quantity > 0),"
+     "  broker_surname_fk TEXT NOT NULL,"
+     "  buyer_name_fk TEXT NOT NULL,"
+     "  FOREIGN KEY (broker_surname_fk) REFERENCES Brokers(surname) "
+     "  ON DELETE RESTRICT ON UPDATE CASCADE,"
+     "  FOREIGN KEY (buyer_name_fk) REFERENCES Buyers(buyer_name) "
+     "  ON DELETE RESTRICT ON UPDATE CASCADE,"
+     "  FOREIGN KEY (good_name_fk, supplier_name_fk) REFERENCES "
+     "  Goods(name, supplier_name_fk) ON DELETE RESTRICT ON UPDATE CASCADE"
+     ");"
+     "INSERT INTO Deals_new (deal_id, deal_date, good_name_fk, "
+     "supplier_name_fk, type_of_good, sell_quantity, broker_surname_fk, "
+     "buyer_name_fk) "
+     "SELECT deal_id, " TEXT_TO_DAY("deal_date") ", good_name_fk, "
+     "supplier_name_fk, type_of_good, sell_quantity, broker_surname_fk, "
+     "buyer_name_fk FROM Deals;"
+     // Keep the AUTOINCREMENT high-water marks: ids of deleted rows must
+     // not come back
+     "DELETE FROM sqlite_sequence WHERE name IN ('Goods_new', 'Deals_new');"
+     "UPDATE sqlite_sequence SET name = name || '_new' "
+     "WHERE name IN ('Goods', 'Deals');"
+     "DROP TABLE DailySales;"
+     "DROP TABLE Deals;"
+     "DROP TABLE Goods;"
+     "ALTER TABLE Goods_new RENAME TO Goods;"
+     "ALTER TABLE Deals_new RENAME TO Deals;"
+     "CREATE INDEX idx_goods_supplier ON Goods(supplier_name_fk);"
+     "CREATE INDEX idx_deals_date ON Deals(deal_date);"
+     "CREATE INDEX idx_deals_broker ON Deals(broker_surname_fk);"
+     "CREATE INDEX idx_deals_good_supplier "
+     "ON Deals(good_name_fk, supplier_name_fk);"
+     // DailySales: recreated from the converted deals
+     "CREATE TABLE DailySales ("
+     "  sale_date DATE NOT NULL,"
+     "  good_name_fk TEXT NOT NULL,"
+     "  supplier_name_fk TEXT NOT NULL,"
+     "  units INTEGER NOT NULL DEFAULT 0,"
+     "  revenue REAL NOT NULL DEFAULT 0.0,"
+     "  PRIMARY KEY (sale_date, good_name_fk, supplier_name_fk),"
+     "  FOREIGN KEY (good_name_fk, supplier_name_fk) REFERENCES "
+     "  Goods(name, supplier_name_fk) ON DELETE CASCADE ON UPDATE CASCADE"
+     ") WITHOUT ROWID;"
+     "CREATE INDEX idx_daily_sales_good "
+     "ON DailySales(good_name_fk, supplier_name_fk);"
+     "INSERT INTO DailySales (sale_date, good_name_fk, supplier_name_fk, "
+     "units, revenue) "
+     "SELECT d.deal_date, d.good_name_fk, d.supplier_name_fk, "
+     "SUM(d.sell_quantity), SUM(d.sell_quantity * g.price) "
+     "FROM Deals d JOIN Goods g ON d.good_name_fk = g.name AND "
+     "d.supplier_name_fk = g.supplier_name_fk "
+     "GROUP BY d.deal_date, d.good_name_fk, d.supplier_name_fk;",
+     NULL, 1},
+    {4, "integer keys in Deals",
+     // Lookup tables. Brokers and Buyers get an integer key; their names stay
+     // unique, so Users and BrokerStats keep referencing the surname.
+     "CREATE TABLE GoodTypes ("
+     "  type_id INTEGER PRIMARY KEY,"
+     "  name TEXT NOT NULL UNIQUE"
+     ");"
+     "INSERT INTO GoodTypes (name) SELECT DISTINCT type_of_good FROM Deals "
+     "WHERE type_of_good IS NOT NULL ORDER BY type_of_good;"
+     "CREATE TABLE Brokers_new ("
+     "  broker_id INTEGER PRIMARY KEY,"
+     "  surname TEXT NOT NULL UNIQUE,"
+     "  address TEXT,"
+     "  birth_year INTEGER"
+     ");"
+     "INSERT INTO Brokers_new (surname, address, birth_year) "
+     "SELECT surname, address, birth_year FROM Brokers ORDER BY rowid;"
+     "CREATE TABLE Buyers_new ("
+     "  buyer_id INTEGER PRIMARY KEY,"
+     "  buyer_name TEXT NOT NULL UNIQUE,"
+     "  address TEXT"
+     ");"
+     "INSERT INTO Buyers_new (buyer_name, address) "
+     "SELECT buyer_name, address FROM Buyers ORDER BY rowid;"
+     // Deals: ids instead of names. A deal whose good, broker or buyer does
+     // not exist gets NULL and fails NOT NULL, which aborts the migration.
+     "CREATE TABLE Deals_new ("
+     "  deal_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+     "  deal_date DATE NOT NULL CHECK(typeof(deal_date) = 'integer'),"
+     "  good_id INTEGER NOT NULL REFERENCES Goods(good_id) "
+     "  ON DELETE RESTRICT,"
+     "  type_id INTEGER REFERENCES GoodTypes(type_id) ON DELETE RESTRICT,"
+     "  sell_quantity INTEGER NOT NULL CHECK(sell_quantity > 0),"
+     "  broker_id INTEGER NOT NULL REFERENCES Brokers(broker_id) "
+     "  ON DELETE RESTRICT,"
+     "  buyer_id INTEGER NOT NULL REFERENCES Buyers(buyer_id) "
+     "  ON DELETE RESTRICT"
+     ");"
+     "INSERT INTO Deals_new (deal_id, deal_date, good_id, type_id, "
+     "sell_quantity, broker_id, buyer_id) "
+     "SELECT d.deal_id, d.deal_date, g.good_id, t.type_id, d.sell_quantity, "
+     "b.broker_id, u.buyer_id FROM Deals d "
+     "LEFT JOIN Goods g ON g.name = d.good_name_fk AND "
+     "g.supplier_name_fk = d.supplier_name_fk "
+     "LEFT JOIN GoodTypes t ON t.name = d.type_of_good "
+     "LEFT JOIN Brokers_new b ON b.surname = d.broker_surname_fk "
+     "LEFT JOIN Buyers_new u ON u.buyer_name = d.buyer_name_fk;"
+     "DELETE FROM sqlite_sequence WHERE name = 'Deals_new';"
+     "UPDATE sqlite_sequence SET name = 'Deals_new' WHERE name = 'Deals';"
+     "DROP TABLE DailySales;"
+     "DROP TABLE Deals;"
+     "DROP TABLE Buyers;"
+     "DROP TABLE Brokers;"
+     "ALTER TABLE Brokers_new RENAME TO Brokers;"
+     "ALTER TABLE Buyers_new RENAME TO Buyers;"
+     "ALTER TABLE Deals_new RENAME TO Deals;"
+     "CREATE INDEX idx_deals_date ON Deals(deal_date);"
+     "CREATE INDEX idx_deals_broker ON Deals(broker_id);"
+     "CREATE INDEX idx_deals_good ON Deals(good_id);"
+     "CREATE TABLE DailySales ("
+     "  sale_date DATE NOT NULL,"
+     "  good_id INTEGER NOT NULL REFERENCES Goods(good_id) "
+     "  ON DELETE CASCADE,"
+     "  units INTEGER NOT NULL DEFAULT 0,"
+     "  revenue REAL NOT NULL DEFAULT 0.0,"
+     "  PRIMARY KEY (sale_date, good_id)"
+     ") WITHOUT ROWID;"
+     "CREATE INDEX idx_daily_sales_good ON DailySales(good_id);"
+     "INSERT INTO DailySales (sale_date, good_id, units, revenue) "
+     "SELECT d.deal_date, d.good_id, SUM(d.sell_quantity), "
+     "SUM(d.sell_quantity * g.price) "
+     "FROM Deals d JOIN Goods g ON g.good_id = d.good_id "
+     "GROUP BY d.deal_date, d.good_id;"
+     // Deals with names, in the old column layout, for listings. A later
+     // migration that rebuilds Deals drops and recreates it.
+     "CREATE VIEW DealDetails AS "
+     "SELECT d.deal_id, d.deal_date, g.name AS good_name_fk, "
+     "g.supplier_name_fk, t.name AS type_of_good, d.sell_quantity, "
+     "b.surname AS broker_surname_fk, u.buyer_name AS buyer_name_fk "
+     "FROM Deals d JOIN Goods g ON g.good_id = d.good_id "
+     "LEFT JOIN GoodTypes t ON t.type_id = d.type_id "
+     "JOIN Brokers b ON b.broker_id = d.broker_id "
+     "JOIN Buyers u ON u.buyer_id = d.buyer_id;",
+     NULL, 1},
+    {5, "unit price on deals",
+     // Backfilled with the current price, which is what every stored revenue
+     // was computed with, so the aggregates stay consistent. A rebuild
+     // rather than ADD COLUMN: the backfill rewrites every row either way,
+     // and only a new table can declare the column NOT NULL.
+     "DROP VIEW DealDetails;"
+     "CREATE TABLE Deals_new ("
+     "  deal_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+     "  deal_date DATE NOT NULL CHECK(typeof(deal_date) = 'integer'),"
+     "  good_id INTEGER NOT NULL REFERENCES Goods(good_id) "
+     "  ON DELETE RESTRICT,"
+     "  type_id INTEGER REFERENCES GoodTypes(type_id) ON DELETE RESTRICT,"
+     "  sell_quantity INTEGER NOT NULL CHECK(sell_quantity > 0),"
+     "  unit_price REAL NOT NULL CHECK(unit_price > 0),"
+     "  broker_id INTEGER NOT NULL REFERENCES Brokers(broker_id) "
+     "  ON DELETE RESTRICT,"
+     "  buyer_id INTEGER NOT NULL REFERENCES Buyers(buyer_id) "
+     "  ON DELETE RESTRICT"
+     ");"
+     "INSERT INTO Deals_new (deal_id, deal_date, good_id, type_id, "
+     "sell_quantity, unit_price, broker_id, buyer_id) "
+     "SELECT d.deal_id, d.deal_date, d.good_id, d.type_id, d.sell_quantity, "
+     "g.price, d.broker_id, d.buyer_id FROM Deals d "
+     "LEFT JOIN Goods g ON g.good_id = d.good_id;"
+     "DELETE FROM sqlite_sequence WHERE name = 'Deals_new';"
+     "UPDATE sqlite_sequence SET name = 'Deals_new' WHERE name = 'Deals';"
+     "DROP TABLE Deals;"
+     "ALTER TABLE Deals_new RENAME TO Deals;"
+     "CREATE INDEX idx_deals_date ON Deals(deal_date);"
+     "CREATE INDEX idx_deals_broker ON Deals(broker_id);"
+     "CREATE INDEX idx_deals_good ON Deals(good_id);"
+     "CREATE VIEW DealDetails AS "
+     "SELECT d.deal_id, d.deal_date, g.name AS good_name_fk, "
+     "g.supplier_name_fk, t.name AS type_of_good, d.sell_quantity, "
+     "d.unit_price, b.surname AS broker_surname_fk, "
+     "u.buyer_name AS buyer_name_fk "
+     "FROM Deals d JOIN Goods g ON g.good_id = d.good_id "
+     "LEFT JOIN GoodTypes t ON t.type_id = d.type_id "
+     "JOIN Brokers b ON b.broker_id = d.broker_id "
+     "JOIN Buyers u ON u.buyer_id = d.buyer_id;",
+     NULL, 1},
+    {6, "leaderboard counters",
+     // Counters per broker, good and type, maintained with BrokerStats
+     // (aggregates.c); the descending indexes serve "top N" as an index walk
+     "ALTER TABLE BrokerStats "
+     "ADD COLUMN deal_count INTEGER NOT NULL DEFAULT 0;"
+     "UPDATE BrokerStats SET deal_count = IFNULL(("
+     "  SELECT COUNT(*) FROM Deals d JOIN Brokers b "
+     "  ON b.broker_id = d.broker_id "
+     "  WHERE b.surname = BrokerStats.broker_surname_fk), 0);"
+     "CREATE INDEX idx_broker_stats_deals "
+     "ON BrokerStats(deal_count DESC, broker_surname_fk);"
+     "CREATE INDEX idx_broker_stats_units "
+     "ON BrokerStats(total_sold_units DESC, broker_surname_fk);"
+     "CREATE TABLE GoodStats ("
+     "  good_id INTEGER PRIMARY KEY"
+     "  REFERENCES Goods(good_id) ON DELETE CASCADE,"
+     "  deal_count INTEGER NOT NULL DEFAULT 0,"
+     "  units INTEGER NOT NULL DEFAULT 0,"
+     "  revenue REAL NOT NULL DEFAULT 0.0"
+     ");"
+     "CREATE INDEX idx_good_stats_units ON GoodStats(units DESC);"
+     "INSERT INTO GoodStats (good_id, deal_count, units, revenue) "
+     "SELECT good_id, COUNT(*), SUM(sell_quantity), "
+     "SUM(sell_quantity * unit_price) FROM Deals GROUP BY good_id;"
+     "CREATE TABLE TypeStats ("
+     "  type_id INTEGER PRIMARY KEY"
+     "  REFERENCES GoodTypes(type_id) ON DELETE CASCADE,"
+     "  deal_count INTEGER NOT NULL DEFAULT 0,"
+     "  units INTEGER NOT NULL DEFAULT 0,"
+     "  revenue REAL NOT NULL DEFAULT 0.0"
+     ");"
+     "CREATE INDEX idx_type_stats_units ON TypeStats(units DESC);"
+     "INSERT INTO TypeStats (type_id, deal_count, units, revenue) "
+     "SELECT type_id, COUNT(*), SUM(sell_quantity), "
+     "SUM(sell_quantity * unit_price) FROM Deals "
+     "WHERE type_id IS NOT NULL GROUP BY type_id;",
+     NULL, 0},
+    {7, "deal archive manifest",
+     // One row per archived month file (archive.c); days are day numbers
+     "CREATE TABLE DealArchive ("
+     "  month TEXT PRIMARY KEY," // YYYY-MM
+     "  file TEXT NOT NULL,"
+     "  first_day INTEGER NOT NULL,"
+     "  last_day INTEGER NOT NULL,"
+     "  deal_count INTEGER NOT NULL DEFAULT 0,"
+     "  units INTEGER NOT NULL DEFAULT 0,"
+     "  revenue REAL NOT NULL DEFAULT 0.0,"
+     "  archived_at TEXT NOT NULL"
+     ");",
+     NULL, 0},
+    {8, "broker deals by date index",
+     // Keyset pages of a broker's deals (queries.c) walk (broker_id,
+     // deal_date, rowid) in order; it replaces the broker_id-only index
+     "DROP INDEX idx_deals_broker;"
+     "CREATE INDEX idx_deals_broker_date ON Deals(broker_id, deal_date);",
+     NULL, 0},
+    {9, "salted password hashes",
+     // The unsalted "hashed_<password>" placeholders still contain the
+     // password, so every one can be replaced with a PBKDF2 hash (auth.h)
+     NULL, auth_upgrade_legacy_hashes, 0},
+};
+
+#define MIGRATION_COUNT (sizeof(migrations) / sizeof(migrations[0]))
+
+// --- migrations_latest_version ---
+int migrations_latest_version(void) {
+  return migrations[MIGRATION_COUNT - 1].version;
+}
+
+// --- migrations_current_version ---
+int migrations_current_version(void) {
+  sqlite3_stmt *stmt = NULL;
+  if (db_prepare_cached("PRAGMA user_version;", &stmt) != SQLITE_OK) {
+    return -1;
+  }
+  int version = -1;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    version = sqlite3_column_int(stmt, 0);
+  } else {
+    fprintf(stderr, "!!! Failed to read schema version: %s\n",
+            sqlite3_errmsg(db));
+  }
+  db_release_stmt(stmt);
+  return version;
+}
+
+static int exec_script(const char *sql) {
+  char *errmsg = NULL;
+  int rc = sqlite3_exec(db, sql, NULL, NULL, &errmsg);
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "!!! SQL error in migration: %s (rc=%d)\n",
+            errmsg ? errmsg : sqlite3_errmsg(db), rc);
+    sqlite3_free(errmsg);
+  }
+  return rc;
+}
+
+static int set_version(int version) {
+  char sql[64];
+  snprintf(sql, sizeof(sql), "PRAGMA user_version = %d;", version);
+  return exec_script(sql);
+}
+
+// Rows violating a foreign key after a table rebuild (printed), or -1
+static int foreign_key_violations(void) {
+  DbCursor cur;
+  int rc = db_cursor_open(&cur, "PRAGMA foreign_key_check;", NULL, 0);
+  int violations = 0;
+  while (rc == SQLITE_OK && (rc = db_cursor_next(&cur)) == SQLITE_ROW) {
+    fprintf(stderr, "!!! Foreign key violation: %s rowid %lld -> %s\n",
+            db_cursor_text(&cur, 0, NULL), (long long)db_cursor_int64(&cur, 1),
+            db_cursor_text(&cur, 2, NULL));
+    violations++;
+    rc = SQLITE_OK;
+  }
+  db_cursor_close(&cur);
+  return rc == SQLITE_DONE ? violations : -1;
+}
+
+// Applies one migration and records its version in a single transaction
+static int run_migration(const Migration *m, const char *schema_file) {
+  // foreign_keys cannot change inside a transaction
+  if (m->rebuilds_tables) {
+    exec_script("PRAGMA foreign_keys = OFF;");
+  }
+  int rc = exec_script("BEGIN IMMEDIATE;");
+  if (rc != SQLITE_OK) {
+    if (m->rebuilds_tables) {
+      exec_script("PRAGMA foreign_keys = ON;");
+    }
+    return rc;
+  }
+  if (m->version == BASELINE_VERSION) {
+    rc = schema_file ? execute_sql_from_file(schema_file)
+                     : execute_sql_script(embedded_schema_sql,
+                                          "database_schema.sql (embedded)");
+  } else if (m->sql) {
+    rc = exec_script(m->sql);
+  }
+  if (rc == SQLITE_OK && m->apply) {
+    rc = m->apply();
+  }
+  if (rc == SQLITE_OK && m->rebuilds_tables && foreign_key_violations() != 0) {
+    rc = SQLITE_CONSTRAINT_FOREIGNKEY;
+  }
+  if (rc == SQLITE_OK) {
+    rc = set_version(m->version);
+  }
+  if (rc == SQLITE_OK) {
+    rc = exec_script("COMMIT;");
+  }
+  if (rc != SQLITE_OK) {
+    sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+  }
+  if (m->rebuilds_tables) {
+    exec_script("PRAGMA foreign_keys = ON;");
+  }
+  return rc;
+}
+
+// Loads the initial data into a just-created baseline. A failure is only a
+// warning: the schema itself is usable.
+static int seed_database(const char *schema_file) {
+  printf("DEBUG: --- Attempting to SEED database with initial data ---\n");
+  // Seed data next to a custom schema file goes with that schema
+  int rc = schema_file ? execute_sql_from_file("seed_data.sql")
+                       : execute_sql_script(embedded_seed_sql,
+                                            "seed_data.sql (embedded)");
+  if (rc != SQLITE_OK) {
+    fprintf(stderr,
+            "!!! WARNING: Failed to execute seed data script (rc=%d). "
+            "Database schema created, but seeding failed.\n",
+            rc);
+    return 0;
+  }
+  printf("DEBUG: Seed data script executed successfully.\n");
+  return 1;
+}
+
+// --- migrations_apply ---
+int migrations_apply(const char *schema_file, int seed) {
+  int version = migrations_current_version();
+  if (version < 0) {
+    return -1;
+  }
+  int latest = migrations_latest_version();
+  if (version == latest) {
+    printf("DEBUG: Schema is current (version %d).\n", version);
+    return 0; // Fast path: one integer read
+  }
+  if (version > latest) {
+    fprintf(stderr,
+            "!!! Database schema version %d is newer than this build "
+            "supports (%d).\n",
+            version, latest);
+    return -1;
+  }
+
+  int fresh = 0;
+  if (version == 0) {
+    int exists = table_exists("Users");
+    if (exists < 0) {
+      return -1;
+    }
+    if (exists == 1) {
+      // Created before versioning: its tables are the baseline
+      printf("DEBUG: Unversioned database adopted as schema version %d.\n",
+             BASELINE_VERSION);
+      if (set_version(BASELINE_VERSION) != SQLITE_OK) {
+        return -1;
+      }
+      version = BASELINE_VERSION;
+    } else {
+      fresh = 1;
+    }
+  }
+
+  int seeded = 0;
+  for (size_t i = 0; i < MIGRATION_COUNT; i++) {
+    const Migration *m = &migrations[i];
+    if (m->version <= version) {
+      continue;
+    }
+    printf("DEBUG: Applying migration %d: %s...\n", m->version, m->name);
+    int rc = run_migration(m, schema_file);
+    if (rc != SQLITE_OK) {
+      fprintf(stderr,
+              "!!! Migration %d (%s) failed (rc=%d). Database left at schema "
+              "version %d.\n",
+              m->version, m->name, rc, version);
+      return rc;
+    }
+    version = m->version;
+    // The seed script is written against the baseline; later migrations
+    // convert it like any other existing data
+    if (version == BASELINE_VERSION && fresh && seed) {
+      seeded = seed_database(schema_file);
+    }
+  }
+
+  // Seeded deals bypass the incremental aggregate maintenance
+  if (seeded && aggregates_rebuild() != SQLITE_OK) {
+    fprintf(stderr, "!!! WARNING: Failed to build the aggregates for the "
+                    "seed data.\n");
+  }
+  printf("DEBUG: Schema migrated to version %d.\n", version);
+  return 0;
+}
@@ -1,5 +1,11 @@
 #include "../includes/queries.h" // Correct path
 #include "../includes/db.h"      // Correct path
+#include "../includes/aggregates.h"
+#include "../includes/archive.h"
+#include "../includes/dates.h"
+#include "../includes/db_memory.h"
+#include "../includes/report_cache.h"
+#include <limits.h>
 #include <stdio.h> // <<< Make sure this is included for printf, fgets, etc.
 #include <stdlib.h>
 #include <string.h>
@@ -50,26 +56,183 @@ int safe_scanf_int(const char *prompt) {
   return value;
 }
 
+// --- Helper for date input ---
+// Re-prompts until the input is a valid YYYY-MM-DD (or empty, if allowed)
+void safe_scanf_date(const char *prompt, char *buffer, size_t buffer_size,
+                     int allow_empty) {
+  char input[32]; // Longer than a date, so trailing characters are seen
+  while (1) {
+    safe_scanf(prompt, input, sizeof(input));
+    if (input[0] == '\0' && (allow_empty || feof(stdin))) {
+      break;
+    }
+    if (date_parse(input, NULL) == 0) {
+      break;
+    }
+    printf("Некорректная дата. Используйте формат YYYY-MM-DD.\n");
+  }
+  snprintf(buffer, buffer_size, "%s", input);
+}
+
+// Dates cross the C API as YYYY-MM-DD and are bound as day numbers
+static int parse_date_arg(const char *text, int *days) {
+  if (date_parse(text, days) != 0) {
+    fprintf(stderr, "!!! Invalid date '%s' (expected YYYY-MM-DD).\n",
+            text ? text : "");
+    return -1;
+  }
+  return 0;
+}
+
+// Leaves a cursor closed (safe for db_cursor_close) after rejected input
+static int reject_cursor(DbCursor *cur) {
+  *cur = (DbCursor){NULL, 0, SQLITE_DONE};
+  return SQLITE_MISMATCH;
+}
+
 // --- Task 2 Queries ---
 
+// Prints a report cursor opened with result rc_open as a table to out and
+// closes it. The same report with the same parameters is served from the
+// report cache (report_cache.h) until the data changes.
+static int print_report(DbCursor *cur, int rc_open, FILE *out) {
+  int rc = rc_open;
+  if (rc == SQLITE_OK) {
+    rc = report_cache_print(cur, out);
+  }
+  db_cursor_close(cur);
+  return rc;
+}
+
+// SQL templates are constants so the statement cache in db.c can reuse their
+// plans; user input only ever travels as bound parameters.
+// Read from the DailySales rollup (aggregates.c): one row per day and good
+// instead of every deal. Its key is deal_date itself, so the range selects
+// exactly the deals the same BETWEEN on Deals would; goods whose deals in the
+// range were all deleted keep zero rows, hence the HAVING. The range is summed
+// per good_id first, so each good's name is looked up once.
+static const char *SQL_SALES_SUMMARY =
+    "SELECT g.name AS GoodName, SUM(s.units) AS TotalSold, "
+    "SUM(s.revenue) AS TotalIncome "
+    "FROM (SELECT good_id, SUM(units) AS units, SUM(revenue) AS revenue "
+    "      FROM DailySales WHERE sale_date BETWEEN ? AND ? "
+    "      GROUP BY good_id) AS s "
+    "JOIN Goods g ON g.good_id = s.good_id "
+    "GROUP BY g.name HAVING SUM(s.units) > 0;";
+
+int open_sales_summary_cursor(DbCursor *cur, const char *start_date,
+                              const char *end_date) {
+  int start, end;
+  if (parse_date_arg(start_date, &start) != 0 ||
+      parse_date_arg(end_date, &end) != 0) {
+    return reject_cursor(cur);
+  }
+  DbParam params[] = {DB_INT(start), DB_INT(end)};
+  return db_cursor_open(cur, SQL_SALES_SUMMARY, params,
+                        DB_PARAM_COUNT(params));
+}
+
+// The same summary over the live deals and the archived ones of the period,
+// which archive_load_range() has copied into temp.ArchivedDeals. Archived
+// rows carry the good name themselves.
+static const char *SQL_SALES_SUMMARY_WITH_ARCHIVE =
+    "SELECT GoodName, SUM(units) AS TotalSold, SUM(revenue) AS TotalIncome "
+    "FROM (SELECT g.name AS GoodName, s.units, s.revenue "
+    "      FROM (SELECT good_id, SUM(units) AS units, "
+    "            SUM(revenue) AS revenue "
+    "            FROM DailySales WHERE sale_date BETWEEN ? AND ? "
+    "            GROUP BY good_id) AS s "
+    "      JOIN Goods g ON g.good_id = s.good_id "
+    "      UNION ALL "
+    "      SELECT good_name_fk, sell_quantity, sell_quantity * unit_price "
+    "      FROM temp.ArchivedDeals) "
+    "GROUP BY GoodName HAVING SUM(units) > 0;";
+
+int open_sales_summary_with_archive_cursor(DbCursor *cur,
+                                           const char *start_date,
+                                           const char *end_date) {
+  int start, end;
+  if (parse_date_arg(start_date, &start) != 0 ||
+      parse_date_arg(end_date, &end) != 0) {
+    return reject_cursor(cur);
+  }
+  int rc = archive_load_range(start, end);
+  if (rc != SQLITE_OK) {
+    *cur = (DbCursor){NULL, 0, SQLITE_DONE};
+    return rc;
+  }
+  DbParam params[] = {DB_INT(start), DB_INT(end)};
+  return db_cursor_open(cur, SQL_SALES_SUMMARY_WITH_ARCHIVE, params,
+                        DB_PARAM_COUNT(params));
+}
+
+int query_sales_summary_by_period(const char *start_date,
+                                  const char *end_date, FILE *out) {
+  DbCursor cur;
+  return print_report(&cur, open_sales_summary_cursor(&cur, start_date,
+                                                      end_date), out);
+}
+
+int query_sales_summary_with_archive(const char *start_date,
+                                     const char *end_date, FILE *out) {
+  DbCursor cur;
+  return print_report(&cur, open_sales_summary_with_archive_cursor(
+                                &cur, start_date, end_date), out);
+}
+
+// Asks whether a report should include archived deals; only when there are
+static int ask_include_archive(void) {
+  if (archive_month_count() <= 0) {
+    return 0;
+  }
+  return safe_scanf_int("Учитывать архивные сделки? (1 - да, 0 - нет): ") ==
+         1;
+}
+
 void run_sales_summary_by_period() {
-  char start[11], end[11];
-  // Consider adding input validation for date format
-  safe_scanf("Начальная дата (YYYY-MM-DD): ", start, sizeof(start));
-  safe_scanf("Конечная дата (YYYY-MM-DD): ", end, sizeof(end));
+  char start[DATE_TEXT_SIZE], end[DATE_TEXT_SIZE];
+  safe_scanf_date("Начальная дата (YYYY-MM-DD): ", start, sizeof(start), 0);
+  safe_scanf_date("Конечная дата (YYYY-MM-DD): ", end, sizeof(end), 0);
+  if (ask_include_archive()) {
+    query_sales_summary_with_archive(start, end, stdout);
+  } else {
+    query_sales_summary_by_period(start, end, stdout);
+  }
+}
 
-  char query[1024];
-  // Corrected JOIN condition and aliases for clarity
-  snprintf(
-      query, sizeof(query),
-      "SELECT d.good_name_fk AS GoodName, SUM(d.sell_quantity) AS TotalSold, "
-      "SUM(d.sell_quantity * g.price) AS TotalIncome "
-      "FROM Deals d JOIN Goods g ON d.good_name_fk = g.name AND "
-      "d.supplier_name_fk = g.supplier_name_fk "
-      "WHERE d.deal_date BETWEEN '%s' AND '%s' GROUP BY d.good_name_fk;",
-      start, end); // TODO: Use prepared statements to prevent SQL injection
+// Deals carry integer keys and the unit price of the sale; names come from
+// the joined lookup rows; the unfiltered reports read Deals in rowid order
+// (SQL_DEALS_OUTER_JOIN). Two templates instead of an optional interpolated
+// WHERE clause: the filtered one can use idx_deals_good.
+static const char *SQL_BUYERS_BY_GOOD_ALL =
+    "SELECT g.name AS GoodName, u.buyer_name AS Buyer, "
+    "SUM(d.sell_quantity) AS TotalUnits, "
+    "SUM(d.sell_quantity * d.unit_price) AS TotalCost "
+    "FROM Deals d" SQL_DEALS_OUTER_JOIN "Goods g ON g.good_id = d.good_id "
+    "JOIN Buyers u ON u.buyer_id = d.buyer_id "
+    "GROUP BY g.name, u.buyer_name ORDER BY GoodName, Buyer;";
+static const char *SQL_BUYERS_BY_GOOD_FILTERED =
+    "SELECT g.name AS GoodName, u.buyer_name AS Buyer, "
+    "SUM(d.sell_quantity) AS TotalUnits, "
+    "SUM(d.sell_quantity * d.unit_price) AS TotalCost "
+    "FROM Deals d JOIN Goods g ON g.good_id = d.good_id "
+    "JOIN Buyers u ON u.buyer_id = d.buyer_id "
+    "WHERE d.good_id IN (SELECT good_id FROM Goods WHERE name = ?) "
+    "GROUP BY g.name, u.buyer_name ORDER BY GoodName, Buyer;";
+
+int open_buyers_by_good_cursor(DbCursor *cur, const char *good_name_filter) {
+  if (good_name_filter && good_name_filter[0] != '\0') {
+    DbParam params[] = {DB_TEXT(good_name_filter)};
+    return db_cursor_open(cur, SQL_BUYERS_BY_GOOD_FILTERED, params,
+                          DB_PARAM_COUNT(params));
+  }
+  return db_cursor_open(cur, SQL_BUYERS_BY_GOOD_ALL, NULL, 0);
+}
 
-  execute_select_query(query);
+int query_buyers_by_good(const char *good_name_filter, FILE *out) {
+  DbCursor cur;
+  return print_report(&cur, open_buyers_by_good_cursor(&cur, good_name_filter),
+                      out);
 }
 
 void run_buyers_by_good() {
@@ -77,76 +240,108 @@ void run_buyers_by_good() {
   safe_scanf(
       "Введите название товара для фильтрации (оставьте пустым для всех): ",
       good_name_filter, sizeof(good_name_filter));
+  query_buyers_by_good(good_name_filter, stdout);
+}
 
-  char query[1024];
-  char where_clause[150] = "";
-  if (strlen(good_name_filter) > 0) {
-    snprintf(where_clause, sizeof(where_clause), "WHERE d.good_name_fk = '%s'",
-             good_name_filter); // SQL Injection risk! Use prepared statements.
-  }
+// The type is read from the TypeStats counters (aggregates.c): MAX and the
+// equality probe are both served by idx_type_stats_units, so only the tied
+// types are looked at. Ties go to the smallest type name.
+static const char *SQL_MOST_POPULAR_TYPE =
+    "WITH MaxType AS ("
+    "  SELECT s.type_id FROM TypeStats s "
+    "  JOIN GoodTypes t ON t.type_id = s.type_id "
+    "  WHERE s.units = (SELECT MAX(units) FROM TypeStats) AND s.units > 0 "
+    "  ORDER BY t.name LIMIT 1"
+    ") "
+    "SELECT u.buyer_name AS Buyer, t.name AS GoodType, "
+    "SUM(d.sell_quantity) AS TotalUnits, "
+    "SUM(d.sell_quantity * d.unit_price) AS TotalCost "
+    "FROM Deals d JOIN Buyers u ON u.buyer_id = d.buyer_id "
+    "JOIN GoodTypes t ON t.type_id = d.type_id "
+    "WHERE d.type_id = (SELECT type_id FROM MaxType) "
+    "GROUP BY d.buyer_id ORDER BY Buyer;";
+
+int open_most_popular_type_cursor(DbCursor *cur) {
+  return db_cursor_open(cur, SQL_MOST_POPULAR_TYPE, NULL, 0);
+}
 
-  // Corrected JOIN and added aliases
-  snprintf(query, sizeof(query),
-           "SELECT d.good_name_fk AS GoodName, d.buyer_name_fk AS Buyer, "
-           "SUM(d.sell_quantity) AS TotalUnits, "
-           "SUM(d.sell_quantity * g.price) AS TotalCost "
-           "FROM Deals d JOIN Goods g ON d.good_name_fk = g.name AND "
-           "d.supplier_name_fk = g.supplier_name_fk "
-           "%s " // Insert WHERE clause here
-           "GROUP BY d.good_name_fk, d.buyer_name_fk ORDER BY GoodName, Buyer;",
-           where_clause);
-  execute_select_query(query);
+int query_most_popular_type_info(FILE *out) {
+  DbCursor cur;
+  return print_report(&cur, open_most_popular_type_cursor(&cur), out);
 }
 
 void run_most_popular_type_info() {
   // Find the most popular type first
-  // NOTE: This requires more complex logic or potentially a better data model
-  // if 'type_of_good' needs to be consistently tracked and queried efficiently.
-  // The original query assumes 'type_of_good' is reliably in Deals.
-  // Let's stick to the original logic for now, assuming the Deals table has the
-  // type.
-
-  const char
-      *query = "WITH TypeSales AS ("
-               "  SELECT type_of_good, SUM(sell_quantity) AS total_sold "
-               "  FROM Deals WHERE type_of_good IS NOT NULL GROUP BY "
-               "type_of_good " // Added check for NULL
-               "), MaxType AS ("
-               "  SELECT type_of_good FROM TypeSales "
-               "  ORDER BY total_sold DESC LIMIT 1" // Simplified way to get max
-               ") "
-               "SELECT d.buyer_name_fk AS Buyer, d.type_of_good AS GoodType, "
-               "SUM(d.sell_quantity) AS TotalUnits, "
-               "SUM(d.sell_quantity * g.price) AS TotalCost "
-               "FROM Deals d "
-               "JOIN Goods g ON d.good_name_fk = g.name AND d.supplier_name_fk "
-               "= g.supplier_name_fk "
-               "WHERE d.type_of_good = (SELECT type_of_good FROM MaxType) "
-               "GROUP BY d.buyer_name_fk, d.type_of_good ORDER BY Buyer;"; // Added
-                                                                           // ORDER
-                                                                           // BY
+  // NOTE: This relies on the per-deal type (Deals.type_id), not Goods.
   printf("--- Информация по самому популярному типу товара ---\n");
-  execute_select_query(query);
+  query_most_popular_type_info(stdout);
+}
+
+// Same through BrokerStats.deal_count and idx_broker_stats_deals; ties go to
+// the broker registered first (lowest broker_id).
+static const char *SQL_TOP_BROKER =
+    "WITH TopBroker AS ("
+    "  SELECT b.broker_id FROM BrokerStats s "
+    "  JOIN Brokers b ON b.surname = s.broker_surname_fk "
+    "  WHERE s.deal_count = (SELECT MAX(deal_count) FROM BrokerStats) "
+    "  AND s.deal_count > 0 "
+    "  ORDER BY b.broker_id LIMIT 1"
+    ") "
+    // Select broker details and unique suppliers they dealt with
+    "SELECT b.surname, b.address, b.birth_year, GROUP_CONCAT(DISTINCT "
+    "g.supplier_name_fk) AS Suppliers "
+    "FROM Brokers b "
+    "JOIN Deals d ON d.broker_id = b.broker_id "
+    "JOIN Goods g ON g.good_id = d.good_id "
+    "WHERE b.broker_id = (SELECT broker_id FROM TopBroker) "
+    "GROUP BY b.broker_id;";
+
+int open_top_broker_cursor(DbCursor *cur) {
+  return db_cursor_open(cur, SQL_TOP_BROKER, NULL, 0);
+}
+
+int query_top_broker_info(FILE *out) {
+  DbCursor cur;
+  return print_report(&cur, open_top_broker_cursor(&cur), out);
 }
 
 void run_top_broker_info() {
-  const char *query =
-      "WITH BrokerDeals AS ("
-      "  SELECT broker_surname_fk, COUNT(*) AS deal_count "
-      "  FROM Deals GROUP BY broker_surname_fk"
-      "), TopBroker AS ("
-      "  SELECT broker_surname_fk FROM BrokerDeals "
-      "  ORDER BY deal_count DESC LIMIT 1" // Simplified max
-      ") "
-      // Select broker details and unique suppliers they dealt with
-      "SELECT b.surname, b.address, b.birth_year, GROUP_CONCAT(DISTINCT "
-      "d.supplier_name_fk) AS Suppliers "
-      "FROM Brokers b "
-      "JOIN Deals d ON b.surname = d.broker_surname_fk "
-      "WHERE b.surname = (SELECT broker_surname_fk FROM TopBroker) "
-      "GROUP BY b.surname, b.address, b.birth_year;"; // Group by broker details
   printf("--- Информация о Маклере с максимальным количеством сделок ---\n");
-  execute_select_query(query);
+  query_top_broker_info(stdout);
+}
+
+static const char *SQL_SUPPLIER_BROKERS_ALL =
+    "SELECT g.supplier_name_fk AS Supplier, b.surname AS Broker, "
+    "SUM(d.sell_quantity) AS TotalSold, "
+    "SUM(d.sell_quantity * d.unit_price) AS TotalValue "
+    "FROM Deals d" SQL_DEALS_OUTER_JOIN "Goods g ON g.good_id = d.good_id "
+    "JOIN Brokers b ON b.broker_id = d.broker_id "
+    "GROUP BY g.supplier_name_fk, b.surname "
+    "ORDER BY Supplier, Broker;";
+static const char *SQL_SUPPLIER_BROKERS_FILTERED =
+    "SELECT g.supplier_name_fk AS Supplier, b.surname AS Broker, "
+    "SUM(d.sell_quantity) AS TotalSold, "
+    "SUM(d.sell_quantity * d.unit_price) AS TotalValue "
+    "FROM Deals d JOIN Goods g ON g.good_id = d.good_id "
+    "JOIN Brokers b ON b.broker_id = d.broker_id "
+    "WHERE d.good_id IN "
+    "(SELECT good_id FROM Goods WHERE supplier_name_fk = ?) "
+    "GROUP BY g.supplier_name_fk, b.surname "
+    "ORDER BY Supplier, Broker;";
+
+int open_supplier_brokers_cursor(DbCursor *cur, const char *supplier_filter) {
+  if (supplier_filter && supplier_filter[0] != '\0') {
+    DbParam params[] = {DB_TEXT(supplier_filter)};
+    return db_cursor_open(cur, SQL_SUPPLIER_BROKERS_FILTERED, params,
+                          DB_PARAM_COUNT(params));
+  }
+  return db_cursor_open(cur, SQL_SUPPLIER_BROKERS_ALL, NULL, 0);
+}
+
+int query_supplier_brokers_info(const char *supplier_filter, FILE *out) {
+  DbCursor cur;
+  return print_report(&cur,
+                      open_supplier_brokers_cursor(&cur, supplier_filter), out);
 }
 
 void run_supplier_brokers_info() {
@@ -154,33 +349,191 @@ void run_supplier_brokers_info() {
   safe_scanf("Введите название фирмы-поставщика для фильтрации (оставьте "
              "пустым для всех): ",
              supplier_filter, sizeof(supplier_filter));
-
-  char query[1024];
-  char where_clause[150] = "";
-  if (strlen(supplier_filter) > 0) {
-    snprintf(where_clause, sizeof(where_clause),
-             "WHERE d.supplier_name_fk = '%s'",
-             supplier_filter); // SQL Injection risk!
-  }
-
-  // Corrected JOIN, added aliases and ORDER BY
-  snprintf(query, sizeof(query),
-           "SELECT d.supplier_name_fk AS Supplier, d.broker_surname_fk AS "
-           "Broker, SUM(d.sell_quantity) AS TotalSold, "
-           "SUM(d.sell_quantity * g.price) AS TotalValue "
-           "FROM Deals d "
-           "JOIN Goods g ON d.good_name_fk = g.name AND d.supplier_name_fk = "
-           "g.supplier_name_fk "
-           "%s " // Insert WHERE clause
-           "GROUP BY d.supplier_name_fk, d.broker_surname_fk "
-           "ORDER BY Supplier, Broker;",
-           where_clause);
   printf("--- Информация о маклерах по поставщикам ---\n");
-  execute_select_query(query);
+  query_supplier_brokers_info(supplier_filter, stdout);
+}
+
+// --- Leaderboards ---
+// Top N of the counters kept by aggregates.c. Each board walks the
+// descending index of its counter (the tie key is part of the index, or the
+// rowid) and stops after N rows, so the cost does not grow with Deals. Rows
+// left at zero by deleted deals are skipped.
+static const char *const SQL_LEADERBOARD[LEADERBOARD_COUNT] = {
+    [LEADERBOARD_BROKERS_BY_DEALS] =
+        "SELECT broker_surname_fk AS Broker, deal_count AS Deals, "
+        "total_sold_units AS TotalUnits, total_deal_sum AS TotalValue "
+        "FROM BrokerStats WHERE deal_count > 0 "
+        "ORDER BY deal_count DESC, broker_surname_fk LIMIT ?;",
+    [LEADERBOARD_BROKERS_BY_UNITS] =
+        "SELECT broker_surname_fk AS Broker, deal_count AS Deals, "
+        "total_sold_units AS TotalUnits, total_deal_sum AS TotalValue "
+        "FROM BrokerStats WHERE total_sold_units > 0 "
+        "ORDER BY total_sold_units DESC, broker_surname_fk LIMIT ?;",
+    [LEADERBOARD_GOODS_BY_UNITS] =
+        "SELECT g.name AS GoodName, g.supplier_name_fk AS Supplier, "
+        "s.deal_count AS Deals, s.units AS TotalUnits, "
+        "s.revenue AS TotalValue "
+        "FROM GoodStats s JOIN Goods g ON g.good_id = s.good_id "
+        "WHERE s.units > 0 ORDER BY s.units DESC, s.good_id LIMIT ?;",
+    [LEADERBOARD_TYPES_BY_UNITS] =
+        "SELECT t.name AS GoodType, s.deal_count AS Deals, "
+        "s.units AS TotalUnits, s.revenue AS TotalValue "
+        "FROM TypeStats s JOIN GoodTypes t ON t.type_id = s.type_id "
+        "WHERE s.units > 0 ORDER BY s.units DESC, s.type_id LIMIT ?;",
+};
+
+static const char *const leaderboard_titles[LEADERBOARD_COUNT] = {
+    [LEADERBOARD_BROKERS_BY_DEALS] = "Маклеры по количеству сделок",
+    [LEADERBOARD_BROKERS_BY_UNITS] = "Маклеры по проданным единицам",
+    [LEADERBOARD_GOODS_BY_UNITS] = "Товары по проданным единицам",
+    [LEADERBOARD_TYPES_BY_UNITS] = "Типы товаров по проданным единицам",
+};
+
+int open_leaderboard_cursor(DbCursor *cur, Leaderboard board, int limit) {
+  if ((int)board < 0 || board >= LEADERBOARD_COUNT || limit <= 0) {
+    fprintf(stderr, "!!! Invalid leaderboard %d or size %d.\n", (int)board,
+            limit);
+    return reject_cursor(cur);
+  }
+  DbParam params[] = {DB_INT(limit)};
+  return db_cursor_open(cur, SQL_LEADERBOARD[board], params,
+                        DB_PARAM_COUNT(params));
+}
+
+int query_leaderboard(Leaderboard board, int limit, FILE *out) {
+  DbCursor cur;
+  return print_report(&cur, open_leaderboard_cursor(&cur, board, limit), out);
+}
+
+void run_leaderboard() {
+  printf("--- Рейтинги ---\n");
+  for (int i = 0; i < LEADERBOARD_COUNT; i++) {
+    printf(" %d. %s\n", i + 1, leaderboard_titles[i]);
+  }
+  int board = safe_scanf_int("Рейтинг: ") - 1;
+  if (board < 0 || board >= LEADERBOARD_COUNT) {
+    printf("Неверный номер рейтинга.\n");
+    return;
+  }
+  int limit = safe_scanf_int("Сколько позиций показать: ");
+  if (limit <= 0) {
+    printf("Количество позиций должно быть положительным.\n");
+    return;
+  }
+  printf("--- %s (топ %d) ---\n", leaderboard_titles[board], limit);
+  query_leaderboard((Leaderboard)board, limit, stdout);
+}
+
+// --- End-of-day bundle: all Task 2 reports at once ---
+// Each job adapts one cursor opener to ReportOpenFn; the pool runs them on
+// its read-only connections.
+typedef struct {
+  const char *start_date;
+  const char *end_date;
+} PeriodArgs;
+
+static int open_sales_summary_job(DbCursor *cur, const void *arg) {
+  const PeriodArgs *period = arg;
+  return open_sales_summary_cursor(cur, period->start_date, period->end_date);
+}
+
+static int open_buyers_by_good_job(DbCursor *cur, const void *arg) {
+  return open_buyers_by_good_cursor(cur, arg);
+}
+
+static int open_most_popular_type_job(DbCursor *cur, const void *arg) {
+  (void)arg;
+  return open_most_popular_type_cursor(cur);
+}
+
+static int open_top_broker_job(DbCursor *cur, const void *arg) {
+  (void)arg;
+  return open_top_broker_cursor(cur);
+}
+
+static int open_supplier_brokers_job(DbCursor *cur, const void *arg) {
+  return open_supplier_brokers_cursor(cur, arg);
+}
+
+const char *const report_bundle_titles[REPORT_BUNDLE_SIZE] = {
+    "Сводка продаж за период",
+    "Покупатели по товарам",
+    "Информация по самому популярному типу товара",
+    "Информация о Маклере с максимальным количеством сделок",
+    "Информация о маклерах по поставщикам",
+};
+
+int query_report_bundle(ReportPool *pool, const char *start_date,
+                        const char *end_date, FILE *out) {
+  PeriodArgs period = {start_date, end_date};
+  ReportJob jobs[REPORT_BUNDLE_SIZE] = {
+      {report_bundle_titles[0], open_sales_summary_job, &period, NULL, 0,
+       SQLITE_OK, 0.0},
+      {report_bundle_titles[1], open_buyers_by_good_job, NULL, NULL, 0,
+       SQLITE_OK, 0.0},
+      {report_bundle_titles[2], open_most_popular_type_job, NULL, NULL, 0,
+       SQLITE_OK, 0.0},
+      {report_bundle_titles[3], open_top_broker_job, NULL, NULL, 0, SQLITE_OK,
+       0.0},
+      {report_bundle_titles[4], open_supplier_brokers_job, NULL, NULL, 0,
+       SQLITE_OK, 0.0},
+  };
+  size_t count = sizeof(jobs) / sizeof(jobs[0]);
+
+  int rc = report_pool_run(pool, jobs, count);
+  report_jobs_print(jobs, count, out); // In job order, not finish order
+  report_jobs_release(jobs, count);
+  return rc;
+}
+
+void run_report_bundle(ReportPool *pool) {
+  char start[DATE_TEXT_SIZE], end[DATE_TEXT_SIZE];
+  safe_scanf_date("Начальная дата (YYYY-MM-DD): ", start, sizeof(start), 0);
+  safe_scanf_date("Конечная дата (YYYY-MM-DD): ", end, sizeof(end), 0);
+  printf("--- Сводный отчет (потоков: %d) ---\n",
+         pool ? report_pool_size(pool) : 1);
+  query_report_bundle(pool, start, end, stdout);
+}
+
+// --- The same bundle from the in-memory analytics engine ---
+void run_analytics_report_bundle(AnalyticsStore *store) {
+  char start[DATE_TEXT_SIZE], end[DATE_TEXT_SIZE];
+  safe_scanf_date("Начальная дата (YYYY-MM-DD): ", start, sizeof(start), 0);
+  safe_scanf_date("Конечная дата (YYYY-MM-DD): ", end, sizeof(end), 0);
+  int rc = analytics_sync(store);
+  if (rc == SQLITE_OK) {
+    printf("--- Сводный отчет из памяти (сделок: %zu) ---\n",
+           analytics_deal_count(store));
+    rc = analytics_report_bundle(store, start, end, stdout);
+  }
+  if (rc != SQLITE_OK) {
+    printf("Не удалось построить отчет (rc=%d).\n", rc);
+  }
+}
+
+void run_analytics_cross_check(AnalyticsStore *store) {
+  char start[DATE_TEXT_SIZE], end[DATE_TEXT_SIZE];
+  safe_scanf_date("Начальная дата (YYYY-MM-DD): ", start, sizeof(start), 0);
+  safe_scanf_date("Конечная дата (YYYY-MM-DD): ", end, sizeof(end), 0);
+  int mismatches = analytics_cross_check(store, start, end, stdout);
+  if (mismatches == 0) {
+    printf("Аналитический движок совпадает с SQL по всем отчетам.\n");
+  } else if (mismatches > 0) {
+    printf("Расхождений с SQL: %d.\n", mismatches);
+  } else {
+    printf("Не удалось выполнить сверку.\n");
+  }
 }
 
 // --- Task 3 CRUD Operations ---
 
+int insert_broker(const char *surname, const char *address, int birth_year) {
+  DbParam params[] = {DB_TEXT(surname), DB_TEXT(address), DB_INT(birth_year)};
+  return execute_non_query_params(
+      "INSERT INTO Brokers (surname, address, birth_year) VALUES (?, ?, ?);",
+      params, DB_PARAM_COUNT(params));
+}
+
 void add_new_broker() {
   char surname[100], address[200];
   int birth_year;
@@ -190,22 +543,34 @@ void add_new_broker() {
 
   // TODO: Add checks if broker already exists?
 
-  char query[512];
-  // Use prepared statements in real code!
-  snprintf(query, sizeof(query),
-           "INSERT INTO Brokers (surname, address, birth_year) VALUES ('%s', "
-           "'%s', %d);",
-           surname, address, birth_year);
-
-  if (execute_non_query(query) == SQLITE_OK) {
+  if (insert_broker(surname, address, birth_year) == SQLITE_OK) {
     printf("Маклер '%s' успешно добавлен.\n", surname);
   } else {
     printf("Не удалось добавить маклера.\n");
   }
 }
 
+int insert_good(const char *name, const char *type, double price,
+                const char *supplier, const char *expiry_date, int quantity) {
+  int has_expiry = expiry_date && expiry_date[0] != '\0';
+  int expiry = 0;
+  if (has_expiry && parse_date_arg(expiry_date, &expiry) != 0) {
+    return SQLITE_MISMATCH;
+  }
+  DbParam params[] = {DB_TEXT(name),
+                      DB_TEXT(type),
+                      DB_DOUBLE(price),
+                      DB_TEXT(supplier),
+                      has_expiry ? DB_INT(expiry) : DB_NULL(),
+                      DB_INT(quantity)};
+  return execute_non_query_params(
+      "INSERT INTO Goods (name, type_of_good, price, supplier_name_fk, "
+      "expiry_date, quantity) VALUES (?, ?, ?, ?, ?, ?);",
+      params, DB_PARAM_COUNT(params));
+}
+
 void add_new_good() {
-  char name[100], type[100], supplier[100], expiry[11];
+  char name[100], type[100], supplier[100], expiry[DATE_TEXT_SIZE];
   double price;
   int quantity;
 
@@ -217,106 +582,148 @@ void add_new_good() {
   // If double is needed, create safe_scanf_double or use sscanf carefully
   price = (double)safe_scanf_int("Цена за единицу (целое число): ");
   quantity = safe_scanf_int("Количество поставленных единиц: ");
-  safe_scanf("Срок годности (YYYY-MM-DD, оставьте пустым если нет): ", expiry,
-             sizeof(expiry));
+  safe_scanf_date("Срок годности (YYYY-MM-DD, оставьте пустым если нет): ",
+                  expiry, sizeof(expiry), 1);
 
   // TODO: Check if supplier exists in Suppliers table first. Add supplier if
   // not?
   // TODO: Check if this good from this supplier already exists? Update quantity
   // instead?
 
-  char query[1024];
-  char expiry_sql[20];
-  if (strlen(expiry) > 0) {
-    snprintf(expiry_sql, sizeof(expiry_sql), "'%s'", expiry);
+  if (insert_good(name, type, price, supplier, expiry, quantity) == SQLITE_OK) {
+    printf("Товар '%s' от '%s' успешно добавлен.\n", name, supplier);
   } else {
-    strcpy(expiry_sql, "NULL");
+    printf("Не удалось добавить товар.\n");
   }
+}
 
-  // Prepared statements are essential here
-  snprintf(query, sizeof(query),
-           "INSERT INTO Goods (name, type_of_good, price, supplier_name_fk, "
-           "expiry_date, quantity) "
-           "VALUES ('%s', '%s', %.2f, '%s', %s, %d);",
-           name, type, price, supplier, expiry_sql, quantity);
+// The statements of one deal; the caller undoes them on failure
+static DealResult apply_deal(const DealInput *deal, int day) {
+  DbParam type_params[] = {DB_TEXT(deal->type)};
+  DbParam deal_params[] = {DB_INT(day),           DB_TEXT(deal->good_name),
+                           DB_TEXT(deal->supplier), DB_TEXT(deal->type),
+                           DB_INT(deal->quantity), DB_TEXT(deal->broker),
+                           DB_TEXT(deal->buyer)};
+  DbParam stock_params[] = {DB_INT(deal->quantity), DB_TEXT(deal->good_name),
+                            DB_TEXT(deal->supplier), DB_INT(deal->quantity)};
 
-  if (execute_non_query(query) == SQLITE_OK) {
-    printf("Товар '%s' от '%s' успешно добавлен.\n", name, supplier);
-  } else {
-    printf("Не удалось добавить товар.\n");
+  // A type seen for the first time becomes a GoodTypes row
+  if (deal->type &&
+      execute_non_query_params("INSERT INTO GoodTypes (name) VALUES (?) "
+                               "ON CONFLICT(name) DO NOTHING;",
+                               type_params,
+                               DB_PARAM_COUNT(type_params)) != SQLITE_OK) {
+    return DEAL_RESULT_ERROR;
+  }
+
+  // Names resolve to ids here; an unknown good, broker or buyer leaves a
+  // NULL id, which the NOT NULL constraint rejects. The deal keeps the
+  // good's price of this moment.
+  if (execute_non_query_params(
+          "INSERT INTO Deals (deal_date, good_id, type_id, sell_quantity, "
+          "unit_price, broker_id, buyer_id) VALUES (?1, "
+          "(SELECT good_id FROM Goods WHERE name = ?2 AND "
+          "supplier_name_fk = ?3), "
+          "(SELECT type_id FROM GoodTypes WHERE name = ?4), ?5, "
+          "(SELECT price FROM Goods WHERE name = ?2 AND "
+          "supplier_name_fk = ?3), "
+          "(SELECT broker_id FROM Brokers WHERE surname = ?6), "
+          "(SELECT buyer_id FROM Buyers WHERE buyer_name = ?7));",
+          deal_params, DB_PARAM_COUNT(deal_params)) != SQLITE_OK) {
+    return DEAL_RESULT_ERROR;
   }
+  sqlite3_int64 deal_id = sqlite3_last_insert_rowid(db);
+
+  // Now update the Goods quantity
+  if (execute_non_query_params(
+          "UPDATE Goods SET quantity = quantity - ? WHERE name = ? AND "
+          "supplier_name_fk = ? AND quantity >= ?;",
+          stock_params, DB_PARAM_COUNT(stock_params)) != SQLITE_OK) {
+    return DEAL_RESULT_ERROR;
+  }
+  if (sqlite3_changes(db) == 0) {
+    return DEAL_RESULT_NO_STOCK;
+  }
+
+  // Task 4: apply only this deal's delta to BrokerStats
+  if (aggregates_apply_deal_range(deal_id, deal_id, 1) != SQLITE_OK) {
+    return DEAL_RESULT_ERROR;
+  }
+  return DEAL_RESULT_OK;
+}
+
+DealResult insert_deal(const DealInput *deal) {
+  int day;
+  if (parse_date_arg(deal->date, &day) != 0) {
+    return DEAL_RESULT_ERROR;
+  }
+  // --- Wrap INSERT Deal and UPDATE Goods in a SAVEPOINT ---
+  // On its own it is the deal's transaction; inside the caller's (the group
+  // commit of deal_writer.c) a failed deal undoes only its own changes.
+  if (execute_non_query("SAVEPOINT insert_deal;") != SQLITE_OK) {
+    return DEAL_RESULT_ERROR;
+  }
+  DealResult result = apply_deal(deal, day);
+  if (result != DEAL_RESULT_OK) {
+    execute_non_query("ROLLBACK TO insert_deal;");
+  }
+  if (execute_non_query("RELEASE insert_deal;") != SQLITE_OK) {
+    // Only an outermost RELEASE commits, and so can fail
+    execute_non_query("ROLLBACK;");
+    return DEAL_RESULT_ERROR;
+  }
+  return result;
 }
 
 void add_new_deal() {
-  char date[11], good_name[100], supplier[100], broker[100], buyer[100],
-      type[100];
-  int quantity;
+  char date[DATE_TEXT_SIZE], good_name[100], supplier[100], broker[100],
+      buyer[100], type[100];
+  DealInput deal;
 
-  safe_scanf("Дата сделки (YYYY-MM-DD): ", date, sizeof(date));
+  safe_scanf_date("Дата сделки (YYYY-MM-DD): ", date, sizeof(date), 0);
   safe_scanf("Название товара: ", good_name, sizeof(good_name));
   safe_scanf("Фирма-поставщик товара: ", supplier, sizeof(supplier));
   safe_scanf("Вид (тип) товара: ", type,
              sizeof(type)); // Could fetch from Goods table?
-  quantity = safe_scanf_int("Количество проданных единиц: ");
+  deal.quantity = safe_scanf_int("Количество проданных единиц: ");
   safe_scanf("Фамилия маклера: ", broker,
              sizeof(broker)); // Check if broker exists?
   safe_scanf("Фирма-покупатель: ", buyer,
              sizeof(buyer)); // Check if buyer exists? Add if not?
 
-  // --- Important Checks Needed ---
-  // 1. Does the Good exist (name, supplier)?
-  // 2. Is there enough quantity in the Goods table?
-  // 3. Does the Broker exist?
-  // 4. Does the Buyer exist? (Add if not?)
-  // 5. Update Goods quantity after successful deal (Transaction needed)
-  // 6. Update BrokerStats after successful deal (Task 4)
-  // --------------------------------
-
-  // Example Query (Needs checks and transactions)
-  char query[1024];
-  snprintf(query, sizeof(query),
-           "INSERT INTO Deals (deal_date, good_name_fk, supplier_name_fk, "
-           "type_of_good, sell_quantity, broker_surname_fk, buyer_name_fk) "
-           "VALUES ('%s', '%s', '%s', '%s', %d, '%s', '%s');",
-           date, good_name, supplier, type, quantity, broker, buyer);
-
-  // --- Wrap INSERT Deal and UPDATE Goods in a TRANSACTION ---
-  execute_non_query("BEGIN TRANSACTION;");
-
-  if (execute_non_query(query) == SQLITE_OK) {
-    // Now update the Goods quantity
-    char update_goods_query[512];
-    snprintf(update_goods_query, sizeof(update_goods_query),
-             "UPDATE Goods SET quantity = quantity - %d WHERE name = '%s' AND "
-             "supplier_name_fk = '%s' AND quantity >= %d;",
-             quantity, good_name, supplier, quantity);
-
-    if (execute_non_query(update_goods_query) == SQLITE_OK &&
-        sqlite3_changes(db) > 0) {
-      // Now potentially update BrokerStats (Task 4) - complex part
-      // update_single_broker_stat(broker, quantity, price_of_good); //
-      // Hypothetical function
-
-      execute_non_query("COMMIT;");
-      printf("Сделка успешно добавлена и остатки обновлены.\n");
-      // Consider calling recalculate_broker_stats() here if incremental is too
-      // complex
-      recalculate_broker_stats(); // Run batch update for simplicity for now
-    } else {
-      execute_non_query("ROLLBACK;");
-      if (sqlite3_changes(db) == 0) {
-        printf("Не удалось добавить сделку: Недостаточно товара '%s' от '%s' "
-               "на складе или товар не найден.\n",
-               good_name, supplier);
-      } else {
-        printf("Не удалось добавить сделку: Ошибка при обновлении остатков.\n");
-      }
-    }
-  } else {
-    execute_non_query("ROLLBACK;");
+  deal.date = date;
+  deal.good_name = good_name;
+  deal.supplier = supplier;
+  deal.type = type;
+  deal.broker = broker;
+  deal.buyer = buyer;
+
+  switch (insert_deal(&deal)) {
+  case DEAL_RESULT_OK:
+    printf("Сделка успешно добавлена и остатки обновлены.\n");
+    break;
+  case DEAL_RESULT_NO_STOCK:
+    printf("Не удалось добавить сделку: Недостаточно товара '%s' от '%s' "
+           "на складе или товар не найден.\n",
+           good_name, supplier);
+    break;
+  default:
     printf(
         "Не удалось добавить сделку: Ошибка при добавлении записи в Deals.\n");
+    break;
+  }
+}
+
+int set_good_price(const char *name, const char *supplier, double new_price) {
+  DbParam params[] = {DB_DOUBLE(new_price), DB_TEXT(name), DB_TEXT(supplier)};
+  // Recorded deals keep their unit_price: history and aggregates stay as
+  // they are, only later deals use the new price
+  if (execute_non_query_params("UPDATE Goods SET price = ? WHERE name = ? AND "
+                               "supplier_name_fk = ?;",
+                               params, DB_PARAM_COUNT(params)) != SQLITE_OK) {
+    return -1;
   }
+  return sqlite3_changes(db);
 }
 
 void update_good_price() {
@@ -333,45 +740,54 @@ void update_good_price() {
     return;
   }
 
-  char query[512];
-  snprintf(query, sizeof(query),
-           "UPDATE Goods SET price = %.2f WHERE name = '%s' AND "
-           "supplier_name_fk = '%s';",
-           new_price, name, supplier); // SQL Injection risk
-
-  if (execute_non_query(query) == SQLITE_OK) {
-    if (sqlite3_changes(db) > 0) { // Check if any row was actually updated
-      printf("Цена товара '%s' от '%s' успешно обновлена.\n", name, supplier);
-    } else {
-      printf("Товар '%s' от '%s' не найден.\n", name, supplier);
-    }
+  int updated = set_good_price(name, supplier, new_price);
+  if (updated > 0) { // Check if any row was actually updated
+    printf("Цена товара '%s' от '%s' успешно обновлена.\n", name, supplier);
+  } else if (updated == 0) {
+    printf("Товар '%s' от '%s' не найден.\n", name, supplier);
   } else {
     printf("Не удалось обновить цену товара.\n");
   }
 }
 
-void delete_deal_by_id() {
-  int deal_id = safe_scanf_int("Введите ID сделки для удаления: ");
-
-  // Optional: Ask for confirmation
-
+int remove_deal(int deal_id) {
   // --- Consideration ---
   // Should deleting a deal revert the Goods quantity?
-  // If yes, need to fetch deal details before deleting and wrap in transaction.
   // For simplicity now, just delete the record.
   // ---------------------
+  DbParam params[] = {DB_INT(deal_id)};
 
-  char query[256];
-  snprintf(query, sizeof(query), "DELETE FROM Deals WHERE deal_id = %d;",
-           deal_id);
+  // IMMEDIATE: a deferred transaction would read the deal first and could
+  // not upgrade to a writer after another connection's commit
+  // (SQLITE_BUSY_SNAPSHOT, not retried by the busy handler)
+  if (execute_non_query("BEGIN IMMEDIATE;") != SQLITE_OK) {
+    return -1;
+  }
 
-  if (execute_non_query(query) == SQLITE_OK) {
-    if (sqlite3_changes(db) > 0) {
-      printf("Сделка с ID %d успешно удалена.\n", deal_id);
-      // Potentially recalculate broker stats if needed
-    } else {
-      printf("Сделка с ID %d не найдена.\n", deal_id);
-    }
+  // Subtract the deal from BrokerStats while it still exists
+  int rc = aggregates_apply_deal_range(deal_id, deal_id, -1);
+  if (rc == SQLITE_OK) {
+    rc = execute_non_query_params("DELETE FROM Deals WHERE deal_id = ?;",
+                                  params, DB_PARAM_COUNT(params));
+  }
+  int deleted = sqlite3_changes(db);
+  if (rc != SQLITE_OK || execute_non_query("COMMIT;") != SQLITE_OK) {
+    execute_non_query("ROLLBACK;");
+    return -1;
+  }
+  return deleted;
+}
+
+void delete_deal_by_id() {
+  int deal_id = safe_scanf_int("Введите ID сделки для удаления: ");
+
+  // Optional: Ask for confirmation
+
+  int deleted = remove_deal(deal_id);
+  if (deleted > 0) {
+    printf("Сделка с ID %d успешно удалена.\n", deal_id);
+  } else if (deleted == 0) {
+    printf("Сделка с ID %d не найдена.\n", deal_id);
   } else {
     printf("Не удалось удалить сделку.\n");
   }
@@ -379,122 +795,532 @@ void delete_deal_by_id() {
 
 // --- Task 4, 5, 6 Functions ---
 
-// Task 4: Recalculate stats for ALL brokers and update BrokerStats table
-// Note: This is a batch update, not the incremental update potentially implied
-// by Task 4.
+// Task 4: BrokerStats is maintained incrementally by every deal mutation
+// (see aggregates.c). The full recomputation remains as a repair tool.
 void recalculate_broker_stats() {
   printf("Пересчет статистики маклеров...\n");
-  // Clear existing stats or use INSERT OR REPLACE / UPDATE
-  // Using separate DELETE + INSERT for simplicity here
-  execute_non_query("BEGIN TRANSACTION;");
-
-  const char *delete_query = "DELETE FROM BrokerStats;";
-  if (execute_non_query(delete_query) != SQLITE_OK) {
-    execute_non_query("ROLLBACK;");
-    printf("Ошибка при очистке статистики маклеров.\n");
-    return;
-  }
-
-  // Insert updated stats
-  const char *insert_query =
-      "INSERT INTO BrokerStats (broker_surname_fk, total_sold_units, "
-      "total_deal_sum, last_updated) "
-      "SELECT "
-      "  d.broker_surname_fk, "
-      "  SUM(d.sell_quantity), "
-      "  SUM(d.sell_quantity * g.price), "
-      "  datetime('now', 'localtime') "
-      "FROM Deals d JOIN Goods g ON d.good_name_fk = g.name AND "
-      "d.supplier_name_fk = g.supplier_name_fk "
-      "GROUP BY d.broker_surname_fk;";
-
-  if (execute_non_query(insert_query) == SQLITE_OK) {
-    execute_non_query("COMMIT;");
-    printf("Статистика маклеров успешно обновлена (пакетно).\n");
+  if (aggregates_rebuild() == SQLITE_OK) {
+    printf("Статистика маклеров полностью пересчитана.\n");
     // Optional: Display the updated stats
     execute_select_query(
         "SELECT bs.*, b.address, b.birth_year FROM BrokerStats bs JOIN Brokers "
         "b ON bs.broker_surname_fk = b.surname;");
-
   } else {
-    execute_non_query("ROLLBACK;");
     printf("Ошибка при пересчете статистики маклеров.\n");
   }
 }
 
+void verify_broker_stats() {
+  printf("Проверка статистики маклеров...\n");
+  int mismatches = aggregates_verify(0, stdout);
+  if (mismatches < 0) {
+    printf("Ошибка при проверке статистики маклеров.\n");
+    return;
+  }
+  if (mismatches == 0) {
+    printf("Статистика маклеров согласована со сделками.\n");
+    return;
+  }
+  printf("Найдено расхождений: %d.\n", mismatches);
+  char answer[8];
+  safe_scanf("Пересчитать статистику полностью? (y/n): ", answer,
+             sizeof(answer));
+  if (answer[0] == 'y' || answer[0] == 'Y') {
+    recalculate_broker_stats();
+  }
+}
+
+// SQL profiler summary (db_profiler_*), top statements by total time, after
+// the report cache and memory counters
+void show_sql_profile() {
+  ReportCacheStats cache;
+  report_cache_get_stats(&cache);
+  printf("Кэш отчетов: попаданий %lu, промахов %lu, сбросов после изменений "
+         "%lu, вытеснено %lu, записей %d (%zu КБ).\n",
+         cache.hits, cache.misses, cache.invalidations, cache.evictions,
+         cache.entries, (cache.bytes + 1023) / 1024);
+  db_memory_print(stdout);
+  if (!db_profiler_is_enabled()) {
+    char answer[8];
+    printf("Профилировщик SQL выключен.\n");
+    safe_scanf("Включить? (y/n): ", answer, sizeof(answer));
+    if (answer[0] == 'y' || answer[0] == 'Y') {
+      db_profiler_enable(1);
+      printf("Профилировщик включен. Статистика собирается с этого момента.\n");
+    }
+    return;
+  }
+  db_profiler_print(stdout, 30, 70);
+  char answer[8];
+  safe_scanf("Сбросить статистику? (y/n): ", answer, sizeof(answer));
+  if (answer[0] == 'y' || answer[0] == 'Y') {
+    db_profiler_reset();
+  }
+}
+
 // Task 5
+// The Task 5 purge of every deal with deal_date <= day, inside the caller's
+// transaction: stock, maintained aggregates, then the deals themselves
+static int purge_deals_through(int day, int *goods_updated,
+                               int *deals_deleted) {
+  DbParam date_params[] = {DB_INT(day)};
+
+  // Update Goods quantity based on deals up to the specified date.
+  // Only goods that actually had sales in the period are touched. The date
+  // index is named for the reason given in aggregates.c.
+  int rc = execute_non_query_params(
+      "UPDATE Goods SET quantity = quantity - p.units "
+      "FROM (SELECT good_id, SUM(sell_quantity) AS units "
+      "      FROM Deals INDEXED BY idx_deals_date "
+      "      WHERE deal_date <= ? GROUP BY good_id) AS p "
+      "WHERE Goods.good_id = p.good_id;",
+      date_params, DB_PARAM_COUNT(date_params));
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  if (goods_updated) {
+    *goods_updated = sqlite3_changes(db);
+  }
+
+  // Subtract the purged deals from the aggregates before they are deleted
+  rc = aggregates_apply_purge(day);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  // Delete deals up to the specified date
+  rc = execute_non_query_params("DELETE FROM Deals WHERE deal_date <= ?;",
+                                date_params, DB_PARAM_COUNT(date_params));
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  if (deals_deleted) {
+    *deals_deleted = sqlite3_changes(db);
+  }
+  return SQLITE_OK;
+}
+
+int clear_deals_up_to(const char *date, int *goods_updated,
+                      int *deals_deleted) {
+  int day;
+  if (parse_date_arg(date, &day) != 0) {
+    return SQLITE_MISMATCH;
+  }
+
+  int rc = execute_non_query("BEGIN IMMEDIATE;");
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  rc = purge_deals_through(day, goods_updated, deals_deleted);
+  if (rc != SQLITE_OK) {
+    execute_non_query("ROLLBACK;");
+    return rc;
+  }
+  // Commit the transaction if all operations were successful
+  return execute_non_query("COMMIT;");
+}
+
+// Day range [*first, *last] of the next archive chunk: whole days from the
+// oldest deal up to day, within one month, holding at most chunk_size deals
+// unless the first day alone holds more. SQLITE_DONE when nothing is left.
+static int next_archive_chunk(int day, int chunk_size, int *first,
+                              int *last) {
+  DbParam upto[] = {DB_INT(day)};
+  DbCursor cur;
+  int rc = db_cursor_open(&cur,
+                          "SELECT MIN(deal_date) FROM Deals "
+                          "WHERE deal_date <= ?;",
+                          upto, DB_PARAM_COUNT(upto));
+  if (rc == SQLITE_OK && (rc = db_cursor_next(&cur)) == SQLITE_ROW) {
+    rc = db_cursor_type(&cur, 0) == SQLITE_NULL ? SQLITE_DONE : SQLITE_OK;
+    *first = (int)db_cursor_int64(&cur, 0);
+  }
+  db_cursor_close(&cur);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+
+  int month_first, month_last;
+  date_month_range(*first, &month_first, &month_last);
+  *last = month_last < day ? month_last : day;
+  // The day of the (chunk_size + 1)-th deal ends the chunk, exclusive
+  DbParam params[] = {DB_INT(*first), DB_INT(*last), DB_INT(chunk_size)};
+  rc = db_cursor_open(&cur,
+                      "SELECT deal_date FROM Deals "
+                      "WHERE deal_date BETWEEN ? AND ? "
+                      "ORDER BY deal_date LIMIT 1 OFFSET ?;",
+                      params, DB_PARAM_COUNT(params));
+  if (rc == SQLITE_OK && (rc = db_cursor_next(&cur)) == SQLITE_ROW) {
+    int stop = (int)db_cursor_int64(&cur, 0);
+    *last = stop > *first ? stop - 1 : *first;
+  }
+  db_cursor_close(&cur);
+  return rc == SQLITE_ROW || rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+// Times a chunk is copied again when deals arrive between copy and purge
+#define ARCHIVE_CHUNK_RETRIES 3
+
+int archive_deals_up_to(const char *date, int chunk_size, int *deals_archived,
+                        int *chunks) {
+  int day;
+  if (parse_date_arg(date, &day) != 0) {
+    return SQLITE_MISMATCH;
+  }
+  if (chunk_size <= 0) {
+    chunk_size = archive_get_settings()->chunk_size;
+  }
+  if (deals_archived) {
+    *deals_archived = 0;
+  }
+  if (chunks) {
+    *chunks = 0;
+  }
+
+  // Each chunk is its own short write transaction, so other connections
+  // get the lock between chunks; the archive file of a month stays attached
+  // while its chunks are written
+  int attached = -1, rc, first = 0, last = 0, retries = 0;
+  while ((rc = next_archive_chunk(day, chunk_size, &first, &last)) ==
+         SQLITE_OK) {
+    int month_first, month_last;
+    date_month_range(first, &month_first, &month_last);
+    if (month_first != attached) {
+      rc = archive_detach_month();
+      if (rc == SQLITE_OK) {
+        rc = archive_attach_month(first);
+      }
+      if (rc != SQLITE_OK) {
+        break;
+      }
+      attached = month_first;
+    }
+
+    // The copy commits on its own first: SQLite commits main before an
+    // attached file, so one transaction over both could lose the copy and
+    // keep the deletion. Then the purge, which deletes only when the month
+    // holds every deal it would remove.
+    rc = execute_non_query("BEGIN;");
+    if (rc != SQLITE_OK) {
+      break;
+    }
+    rc = archive_copy_deals(first, last, NULL);
+    if (rc != SQLITE_OK) {
+      execute_non_query("ROLLBACK;");
+      break;
+    }
+    rc = execute_non_query("COMMIT;");
+    if (rc != SQLITE_OK) {
+      break;
+    }
+
+    int missing = 0, deleted = 0;
+    rc = execute_non_query("BEGIN IMMEDIATE;");
+    if (rc != SQLITE_OK) {
+      break;
+    }
+    rc = archive_confirm_deals(first, last, &missing);
+    if (rc == SQLITE_OK && missing == 0) {
+      rc = purge_deals_through(last, NULL, &deleted);
+    }
+    if (rc != SQLITE_OK || missing > 0) {
+      execute_non_query("ROLLBACK;");
+      if (rc == SQLITE_OK && ++retries <= ARCHIVE_CHUNK_RETRIES) {
+        continue; // Deals recorded since the copy: copy the chunk again
+      }
+      if (rc == SQLITE_OK) {
+        fprintf(stderr, "!!! archive: %d deals keep arriving unarchived.\n",
+                missing);
+        rc = SQLITE_BUSY;
+      }
+      break;
+    }
+    rc = execute_non_query("COMMIT;");
+    if (rc != SQLITE_OK) {
+      break;
+    }
+    retries = 0;
+    if (deals_archived) {
+      *deals_archived += deleted;
+    }
+    if (chunks) {
+      (*chunks)++;
+    }
+  }
+  int rc_detach = archive_detach_month();
+  if (rc == SQLITE_DONE) {
+    rc = rc_detach;
+  }
+  return rc;
+}
+
 void update_goods_quantity_and_clear_deals() {
-  char date[11];
-  safe_scanf("Введите дату (YYYY-MM-DD), до которой будут учтены сделки: ",
-             date, sizeof(date));
-  // TODO: Validate date format
+  char date[DATE_TEXT_SIZE];
+  safe_scanf_date(
+      "Введите дату (YYYY-MM-DD), до которой будут учтены сделки: ", date,
+      sizeof(date), 0);
 
   printf("Обновление остатков товаров и удаление сделок до %s...\n", date);
 
-  execute_non_query("BEGIN TRANSACTION;");
-
-  // Update Goods quantity based on deals up to the specified date
-  // Using a subquery. Ensure Goods table exists and has data.
-  // This query updates ALL goods based on deals before the date.
-  char update_query[1024];
-  snprintf(update_query, sizeof(update_query),
-           "UPDATE Goods SET quantity = quantity - IFNULL(("
-           "  SELECT SUM(d.sell_quantity) FROM Deals d "
-           "  WHERE d.good_name_fk = Goods.name "
-           "  AND d.supplier_name_fk = Goods.supplier_name_fk "
-           "  AND d.deal_date <= '%s'"
-           "), 0) "
-           "WHERE EXISTS (" // Only update goods that actually had sales in the
-                            // period
-           "  SELECT 1 FROM Deals d "
-           "  WHERE d.good_name_fk = Goods.name "
-           "  AND d.supplier_name_fk = Goods.supplier_name_fk "
-           "  AND d.deal_date <= '%s'"
-           ");",
-           date, date); // SQL Injection Risk
-
-  int rc_update = execute_non_query(update_query);
-  if (rc_update != SQLITE_OK) {
-    execute_non_query("ROLLBACK;");
-    printf("Ошибка при обновлении остатков товаров.\n");
+  int goods_updated = 0, deals_deleted = 0;
+  if (clear_deals_up_to(date, &goods_updated, &deals_deleted) != SQLITE_OK) {
+    printf("Ошибка при обновлении остатков товаров или удалении сделок.\n");
     return;
   }
   printf("%d записей товаров обновлено (уменьшено количество).\n",
-         sqlite3_changes(db));
+         goods_updated);
+  printf("%d записей сделок удалено.\n", deals_deleted);
+  printf("Обновление остатков и очистка сделок до %s завершены.\n", date);
+}
 
-  // Delete deals up to the specified date
-  char delete_query[256];
-  snprintf(delete_query, sizeof(delete_query),
-           "DELETE FROM Deals WHERE deal_date <= '%s';",
-           date); // SQL Injection Risk
+void archive_old_deals() {
+  char date[DATE_TEXT_SIZE];
+  safe_scanf_date(
+      "Введите дату (YYYY-MM-DD), до которой сделки переносятся в архив: ",
+      date, sizeof(date), 0);
 
-  int rc_delete = execute_non_query(delete_query);
-  if (rc_delete != SQLITE_OK) {
-    execute_non_query("ROLLBACK;");
-    printf("Ошибка при удалении сделок.\n");
+  printf("Перенос сделок до %s в архив (%s)...\n", date,
+         archive_get_settings()->dir);
+
+  int deals_archived = 0, chunks = 0;
+  int rc = archive_deals_up_to(date, 0, &deals_archived, &chunks);
+  printf("%d записей сделок перенесено в архив (%d транзакций).\n",
+         deals_archived, chunks);
+  if (rc != SQLITE_OK) {
+    printf("Ошибка при переносе сделок в архив; перенесенные части "
+           "сохранены.\n");
     return;
   }
-  printf("%d записей сделок удалено.\n", sqlite3_changes(db));
-
-  // Commit the transaction if both operations were successful
-  execute_non_query("COMMIT;");
-  printf("Обновление остатков и очистка сделок до %s завершены.\n", date);
+  printf("Остатки товаров обновлены, архивация до %s завершена.\n", date);
 }
 
 // Task 6
-void show_deals_on_date() {
-  char date[11];
-  safe_scanf("Введите дату (YYYY-MM-DD) для просмотра сделок: ", date,
-             sizeof(date));
-  // TODO: Validate date format
+int open_deals_on_date_cursor(DbCursor *cur, const char *date) {
+  int day;
+  if (parse_date_arg(date, &day) != 0) {
+    return reject_cursor(cur);
+  }
+  DbParam params[] = {DB_INT(day)};
+  return db_cursor_open(cur,
+                        "SELECT * FROM DealDetails WHERE deal_date = ? "
+                        "ORDER BY deal_id;",
+                        params, DB_PARAM_COUNT(params));
+}
+
+int open_deals_on_date_with_archive_cursor(DbCursor *cur, const char *date) {
+  int day;
+  if (parse_date_arg(date, &day) != 0) {
+    return reject_cursor(cur);
+  }
+  int rc = archive_load_range(day, day);
+  if (rc != SQLITE_OK) {
+    *cur = (DbCursor){NULL, 0, SQLITE_DONE};
+    return rc;
+  }
+  DbParam params[] = {DB_INT(day)};
+  return db_cursor_open(cur,
+                        "SELECT * FROM DealDetails WHERE deal_date = ? "
+                        "UNION ALL SELECT * FROM temp.ArchivedDeals "
+                        "ORDER BY deal_id;",
+                        params, DB_PARAM_COUNT(params));
+}
+
+// --- Settings ---
+static QuerySettings settings_in_effect = {50};
+
+const QuerySettings *query_get_settings(void) { return &settings_in_effect; }
+
+void query_set_settings(const QuerySettings *settings) {
+  settings_in_effect = *settings;
+}
+
+static int set_list_page_size(const char *value) {
+  long long v;
+  if (db_setting_int(value, 1, 100000, &v) != 0) {
+    return -1;
+  }
+  settings_in_effect.list_page_size = (int)v;
+  return 0;
+}
+
+const DbSettingKey query_setting_keys[] = {
+    {"list_page_size", set_list_page_size}, {NULL, NULL}};
+
+// --- Keyset pages of deal listings ---
+// A page continues after the (deal_date, deal_id) key of the previous page's
+// last row instead of skipping an OFFSET, so it costs one index seek plus its
+// own rows at any depth. Each page cursor fetches one row more than it shows
+// to learn whether another page follows. The joins are spelled out (columns
+// as in DealDetails) so the broker page does not join the one broker it is
+// about.
+#define DEAL_PAGE_COLUMNS                                                      \
+  "SELECT d.deal_id, d.deal_date, g.name AS good_name_fk, "                    \
+  "g.supplier_name_fk, t.name AS type_of_good, d.sell_quantity, "              \
+  "d.unit_price, "
+#define DEAL_PAGE_JOINS                                                        \
+  "FROM Deals d JOIN Goods g ON g.good_id = d.good_id "                        \
+  "LEFT JOIN GoodTypes t ON t.type_id = d.type_id "                            \
+  "JOIN Buyers u ON u.buyer_id = d.buyer_id "
 
-  char query[512];
-  snprintf(query, sizeof(query), "SELECT * FROM Deals WHERE deal_date = '%s';",
-           date); // SQL Injection Risk
-  execute_select_query(query);
+// A range of idx_deals_date (deal_date, rowid): already in deal_id order
+static const char *SQL_DEALS_ON_DATE_PAGE =
+    DEAL_PAGE_COLUMNS "b.surname AS broker_surname_fk, "
+    "u.buyer_name AS buyer_name_fk " DEAL_PAGE_JOINS
+    "JOIN Brokers b ON b.broker_id = d.broker_id "
+    "WHERE d.deal_date = ?1 AND d.deal_id > ?2 "
+    "ORDER BY d.deal_id LIMIT ?3;";
+
+// Walks idx_deals_broker_date (broker_id, deal_date, rowid) backwards from
+// the key: newest first, no sort however many deals the broker has
+static const char *SQL_BROKER_DEALS_PAGE =
+    DEAL_PAGE_COLUMNS "u.buyer_name AS buyer_name_fk " DEAL_PAGE_JOINS
+    "WHERE d.broker_id = (SELECT broker_id FROM Brokers WHERE surname = ?1) "
+    "AND (d.deal_date, d.deal_id) < (?2, ?3) "
+    "ORDER BY d.deal_date DESC, d.deal_id DESC LIMIT ?4;";
+
+int open_deals_on_date_page_cursor(DbCursor *cur, const char *date,
+                                   const DealKey *after, int page_size) {
+  int day;
+  if (parse_date_arg(date, &day) != 0 || page_size <= 0) {
+    return reject_cursor(cur);
+  }
+  DbParam params[] = {DB_INT(day), DB_INT(after ? after->deal_id : 0),
+                      DB_INT(page_size + 1)};
+  return db_cursor_open(cur, SQL_DEALS_ON_DATE_PAGE, params,
+                        DB_PARAM_COUNT(params));
+}
+
+int open_broker_deals_page_cursor(DbCursor *cur, const char *broker_surname,
+                                  const DealKey *after, int page_size) {
+  if (!broker_surname || page_size <= 0) {
+    return reject_cursor(cur);
+  }
+  // The first page starts after a key above every real one
+  DbParam params[] = {DB_TEXT(broker_surname),
+                      DB_INT(after ? after->deal_date : INT_MAX),
+                      DB_INT(after ? after->deal_id : LLONG_MAX),
+                      DB_INT(page_size + 1)};
+  return db_cursor_open(cur, SQL_BROKER_DEALS_PAGE, params,
+                        DB_PARAM_COUNT(params));
+}
+
+// Prints a page cursor (deal_id and deal_date first) opened with result
+// rc_open, at most page_size rows, and closes it
+static int print_deal_page(DbCursor *cur, int rc_open, int page_size,
+                           DealPage *page, FILE *out) {
+  *page = (DealPage){0, {0, 0}};
+  int rc = rc_open;
+  if (rc == SQLITE_OK) {
+    rc = db_cursor_print_rows(cur, out, page_size);
+  }
+  if (rc == SQLITE_ROW) {
+    page->last.deal_id = db_cursor_int64(cur, 0);
+    page->last.deal_date = (int)db_cursor_int64(cur, 1);
+    rc = db_cursor_next(cur);
+    page->has_more = rc == SQLITE_ROW;
+    if (rc == SQLITE_ROW || rc == SQLITE_DONE) {
+      rc = SQLITE_OK;
+    }
+  }
+  db_cursor_close(cur);
+  return rc;
+}
+
+int query_deals_on_date_page(const char *date, const DealKey *after,
+                             int page_size, DealPage *page, FILE *out) {
+  DbCursor cur;
+  return print_deal_page(
+      &cur, open_deals_on_date_page_cursor(&cur, date, after, page_size),
+      page_size, page, out);
+}
+
+int query_broker_deals_page(const char *broker_surname, const DealKey *after,
+                            int page_size, DealPage *page, FILE *out) {
+  DbCursor cur;
+  return print_deal_page(&cur,
+                         open_broker_deals_page_cursor(&cur, broker_surname,
+                                                       after, page_size),
+                         page_size, page, out);
+}
+
+typedef int (*DealPageQuery)(const char *arg, const DealKey *after,
+                             int page_size, DealPage *page, FILE *out);
+
+// Shows a listing list_page_size rows at a time (QuerySettings) with
+// next/previous navigation. Going back re-reads the page from its start key,
+// kept for every page on the way.
+static void browse_deal_pages(DealPageQuery query, const char *arg) {
+  int page_size = settings_in_effect.list_page_size;
+  DealKey *starts = NULL; // starts[i]: the key page i + 1 continues after
+  size_t depth = 0, cap = 0;
+  for (;;) {
+    DealPage page;
+    if (query(arg, depth ? &starts[depth - 1] : NULL, page_size, &page,
+              stdout) !=
+            SQLITE_OK ||
+        (depth == 0 && !page.has_more)) {
+      break;
+    }
+    char prompt[160], choice[8];
+    snprintf(prompt, sizeof(prompt), "Страница %zu:%s%s [q] выход: ",
+             depth + 1, page.has_more ? " [n] следующая," : "",
+             depth ? " [p] предыдущая," : "");
+    safe_scanf(prompt, choice, sizeof(choice));
+    if (choice[0] == 'n' && page.has_more) {
+      if (depth == cap) {
+        size_t new_cap = cap ? cap * 2 : 16;
+        DealKey *grown = realloc(starts, new_cap * sizeof(*starts));
+        if (!grown) {
+          fprintf(stderr, "!!! Out of memory.\n");
+          break;
+        }
+        starts = grown;
+        cap = new_cap;
+      }
+      starts[depth++] = page.last;
+    } else if (choice[0] == 'p' && depth > 0) {
+      depth--;
+    } else {
+      break;
+    }
+  }
+  free(starts);
+}
+
+int query_deals_on_date(const char *date, FILE *out) {
+  DbCursor cur;
+  return print_report(&cur, open_deals_on_date_cursor(&cur, date), out);
+}
+
+int query_deals_on_date_with_archive(const char *date, FILE *out) {
+  DbCursor cur;
+  return print_report(&cur, open_deals_on_date_with_archive_cursor(&cur, date),
+                      out);
+}
+
+void show_deals_on_date() {
+  char date[DATE_TEXT_SIZE];
+  safe_scanf_date("Введите дату (YYYY-MM-DD) для просмотра сделок: ", date,
+                  sizeof(date), 0);
+  if (ask_include_archive()) {
+    query_deals_on_date_with_archive(date, stdout);
+  } else {
+    browse_deal_pages(query_deals_on_date_page, date);
+  }
 }
 
 // --- Broker Specific Function ---
+int open_broker_deals_cursor(DbCursor *cur, const char *broker_surname) {
+  DbParam params[] = {DB_TEXT(broker_surname)};
+  return db_cursor_open(
+      cur,
+      "SELECT deal_id, deal_date, good_name_fk, supplier_name_fk, "
+      "type_of_good, sell_quantity, buyer_name_fk "
+      "FROM DealDetails WHERE broker_surname_fk = ? "
+      "ORDER BY deal_date DESC;",
+      params, DB_PARAM_COUNT(params));
+}
+
 // Added for broker role functionality
 void show_broker_deals(const char *broker_surname) {
   if (!broker_surname) {
@@ -502,11 +1328,5 @@ void show_broker_deals(const char *broker_surname) {
     return;
   }
   printf("\n--- Сделки для маклера: %s ---\n", broker_surname);
-  char query[512];
-  snprintf(query, sizeof(query),
-           "SELECT deal_id, deal_date, good_name_fk, supplier_name_fk, "
-           "type_of_good, sell_quantity, buyer_name_fk "
-           "FROM Deals WHERE broker_surname_fk = '%s' ORDER BY deal_date DESC;",
-           broker_surname); // SQL Injection Risk
-  execute_select_query(query);
-}
\ No newline at end of file
+  browse_deal_pages(query_broker_deals_page, broker_surname);
+}
@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L // open_memstream
+
+#include "../includes/report_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define REPORT_CACHE_SIZE 32
+
+typedef struct {
+  char *key;           // sqlite3_expanded_sql() of the report (owned)
+  unsigned long hash;  // FNV-1a hash of key
+  char *text;          // Printed table
+  size_t len;          // Length of text
+  unsigned long stamp; // Last use, for LRU eviction
+} ReportCacheEntry;
+
+typedef struct {
+  ReportCacheEntry entries[REPORT_CACHE_SIZE];
+  unsigned long clock;
+  sqlite3 *conn;         // Connection the entries were read from
+  int data_version;      // PRAGMA data_version: commits of other connections
+  unsigned file_version; // SQLITE_FCNTL_DATA_VERSION: commits of this one
+  ReportCacheStats stats;
+} ReportCache;
+
+static _Thread_local ReportCache cache;
+
+// --- Settings ---
+static ReportCacheSettings settings_in_effect = {4096};
+
+const ReportCacheSettings *report_cache_get_settings(void) {
+  return &settings_in_effect;
+}
+
+void report_cache_set_settings(const ReportCacheSettings *settings) {
+  settings_in_effect = *settings;
+}
+
+static int set_report_cache_kb(const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 1048576, &v) != 0) {
+    return -1;
+  }
+  settings_in_effect.size_kb = (int)v;
+  return 0;
+}
+
+const DbSettingKey report_cache_setting_keys[] = {
+    {"report_cache_kb", set_report_cache_kb}, {NULL, NULL}};
+
+static unsigned long key_hash(const char *key) {
+  unsigned long h = 2166136261UL;
+  for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+    h ^= *p;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+static void drop_entry(ReportCacheEntry *entry) {
+  cache.stats.entries--;
+  cache.stats.bytes -= entry->len;
+  sqlite3_free(entry->key);
+  free(entry->text);
+  memset(entry, 0, sizeof(*entry));
+}
+
+// --- report_cache_clear ---
+void report_cache_clear(void) {
+  for (int i = 0; i < REPORT_CACHE_SIZE; i++) {
+    if (cache.entries[i].key) {
+      drop_entry(&cache.entries[i]);
+    }
+  }
+  cache.conn = NULL; // A later connection may reuse the address
+}
+
+// --- report_cache_get_stats ---
+void report_cache_get_stats(ReportCacheStats *stats) {
+  if (stats) {
+    *stats = cache.stats;
+  }
+}
+
+// Empties the cache if the database changed since the entries were read.
+// Both counters are needed: the file counter misses other connections'
+// commits until a read transaction starts, the pragma misses our own.
+static int check_version(void) {
+  sqlite3_stmt *stmt = NULL;
+  int rc = db_prepare_cached("PRAGMA data_version;", &stmt);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  rc = sqlite3_step(stmt);
+  int data_version = sqlite3_column_int(stmt, 0);
+  db_release_stmt(stmt);
+  if (rc != SQLITE_ROW) {
+    return rc;
+  }
+  unsigned file_version = 0;
+  sqlite3_file_control(db, "main", SQLITE_FCNTL_DATA_VERSION, &file_version);
+  if (cache.conn != db || cache.data_version != data_version ||
+      cache.file_version != file_version) {
+    if (cache.stats.entries > 0) {
+      report_cache_clear();
+      cache.stats.invalidations++;
+    }
+    cache.conn = db;
+    cache.data_version = data_version;
+    cache.file_version = file_version;
+  }
+  return SQLITE_OK;
+}
+
+// Takes ownership of key and text; frees them if they cannot be kept
+static void store(char *key, unsigned long hash, char *text, size_t len,
+                  size_t budget) {
+  if (len > budget) {
+    sqlite3_free(key);
+    free(text);
+    return;
+  }
+  ReportCacheEntry *slot = NULL;
+  for (;;) {
+    ReportCacheEntry *lru = NULL;
+    slot = NULL;
+    for (int i = 0; i < REPORT_CACHE_SIZE; i++) {
+      ReportCacheEntry *entry = &cache.entries[i];
+      if (!entry->key) {
+        slot = slot ? slot : entry;
+      } else if (!lru || entry->stamp < lru->stamp) {
+        lru = entry;
+      }
+    }
+    if (slot && cache.stats.bytes + len <= budget) {
+      break;
+    }
+    drop_entry(lru); // Non-NULL: a full or over-budget cache has entries
+    cache.stats.evictions++;
+  }
+  slot->key = key;
+  slot->hash = hash;
+  slot->text = text;
+  slot->len = len;
+  slot->stamp = ++cache.clock;
+  cache.stats.entries++;
+  cache.stats.bytes += len;
+}
+
+// --- report_cache_print ---
+int report_cache_print(DbCursor *cur, FILE *out) {
+  size_t budget = (size_t)settings_in_effect.size_kb * 1024;
+  // Uncommitted changes of an open transaction are not in the versions
+  if (budget == 0 || !cur->stmt || !sqlite3_get_autocommit(db) ||
+      check_version() != SQLITE_OK) {
+    return db_cursor_print(cur, out);
+  }
+  char *key = sqlite3_expanded_sql(cur->stmt);
+  if (!key) {
+    return db_cursor_print(cur, out);
+  }
+  unsigned long hash = key_hash(key);
+  for (int i = 0; i < REPORT_CACHE_SIZE; i++) {
+    ReportCacheEntry *entry = &cache.entries[i];
+    if (entry->key && entry->hash == hash && strcmp(entry->key, key) == 0) {
+      sqlite3_free(key);
+      entry->stamp = ++cache.clock;
+      cache.stats.hits++;
+      fwrite(entry->text, 1, entry->len, out);
+      return SQLITE_OK;
+    }
+  }
+
+  cache.stats.misses++;
+  char *text = NULL;
+  size_t len = 0;
+  FILE *mem = open_memstream(&text, &len);
+  if (!mem) {
+    sqlite3_free(key);
+    return db_cursor_print(cur, out);
+  }
+  int rc = db_cursor_print(cur, mem);
+  if (fclose(mem) != 0 && rc == SQLITE_OK) {
+    rc = SQLITE_NOMEM;
+  }
+  if (text) {
+    fwrite(text, 1, len, out);
+  }
+  if (rc == SQLITE_OK) {
+    store(key, hash, text, len, budget);
+  } else {
+    sqlite3_free(key);
+    free(text);
+  }
+  return rc;
+}
@@ -0,0 +1,319 @@
+#define _POSIX_C_SOURCE 200809L // open_memstream, sysconf
+
+#include "../includes/report_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPORT_POOL_MAX_DEFAULT_THREADS 8
+
+struct ReportPool {
+  char *path;
+  int thread_count;
+  pthread_t *threads;
+  int threads_started; // Threads actually created (for join on failure)
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready; // Main -> workers: new run or shutdown
+  pthread_cond_t progress;   // Workers -> main: opened/started/finished
+  int opened;                // Workers that tried to open their connection
+  int open_failures;
+  int shutdown;
+
+  // Current run (protected by lock)
+  unsigned long generation;
+  ReportJob *jobs;
+  size_t job_count;
+  size_t next_job;
+  size_t done_jobs;
+  int started; // Workers inside the read transaction of this run
+  int running;
+
+  sqlite3 *holder; // Holds the write lock while the workers begin a run
+};
+
+static double elapsed_seconds(const struct timespec *start) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return (double)(now.tv_sec - start->tv_sec) +
+         (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Runs one job on the calling thread's connection into a memory buffer
+static void run_job(ReportJob *job) {
+  struct timespec start;
+  timespec_get(&start, TIME_UTC);
+  job->output = NULL;
+  job->output_len = 0;
+
+  FILE *out = open_memstream(&job->output, &job->output_len);
+  if (!out) {
+    job->rc = SQLITE_NOMEM;
+    return;
+  }
+  if (job->title) {
+    fprintf(out, "\n--- %s ---\n", job->title);
+  }
+  DbCursor cur;
+  int rc = job->open(&cur, job->arg);
+  if (rc == SQLITE_OK) {
+    rc = db_cursor_print(&cur, out);
+  }
+  db_cursor_close(&cur);
+  if (fclose(out) != 0 && rc == SQLITE_OK) {
+    rc = SQLITE_NOMEM;
+  }
+  job->rc = rc;
+  job->seconds = elapsed_seconds(&start);
+}
+
+// Starts a read transaction so every job of the run sees the same state
+static int begin_read(void) {
+  int rc = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+  // The transaction takes its snapshot at the first read
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_exec(db, "SELECT 1 FROM sqlite_master LIMIT 1;", NULL, NULL,
+                      NULL);
+  }
+  return rc;
+}
+
+static void *report_worker(void *arg) {
+  ReportPool *pool = arg;
+  int rc_open = open_db_readonly(pool->path);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->opened++;
+  if (rc_open != 0) {
+    pool->open_failures++;
+  }
+  pthread_cond_broadcast(&pool->progress);
+
+  unsigned long seen = 0;
+  while (rc_open == 0) {
+    while (!pool->shutdown && pool->generation == seen) {
+      pthread_cond_wait(&pool->work_ready, &pool->lock);
+    }
+    if (pool->shutdown) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    int in_txn = begin_read() == SQLITE_OK;
+    if (!in_txn) {
+      fprintf(stderr, "!!! report pool: cannot start read transaction: %s\n",
+              sqlite3_errmsg(db));
+      sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->started++;
+    pthread_cond_broadcast(&pool->progress);
+    while (pool->next_job < pool->job_count) {
+      ReportJob *job = &pool->jobs[pool->next_job++];
+      pthread_mutex_unlock(&pool->lock);
+      run_job(job);
+      pthread_mutex_lock(&pool->lock);
+      pool->done_jobs++;
+      pthread_cond_broadcast(&pool->progress);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (in_txn) {
+      sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    }
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  close_db();
+  return NULL;
+}
+
+// --- report_pool_create ---
+ReportPool *report_pool_create(const char *db_path, int threads) {
+  if (!db_path || db_path[0] == '\0' || strcmp(db_path, ":memory:") == 0) {
+    fprintf(stderr, "!!! report pool: a database file is required.\n");
+    return NULL;
+  }
+  if (threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (int)cpus : 1;
+    if (threads > REPORT_POOL_MAX_DEFAULT_THREADS) {
+      threads = REPORT_POOL_MAX_DEFAULT_THREADS;
+    }
+  }
+
+  ReportPool *pool = calloc(1, sizeof(*pool));
+  if (!pool) {
+    return NULL;
+  }
+  pool->path = malloc(strlen(db_path) + 1);
+  pool->threads = calloc((size_t)threads, sizeof(pthread_t));
+  if (!pool->path || !pool->threads) {
+    free(pool->path);
+    free(pool->threads);
+    free(pool);
+    return NULL;
+  }
+  strcpy(pool->path, db_path);
+  pool->thread_count = threads;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_ready, NULL);
+  pthread_cond_init(&pool->progress, NULL);
+
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, report_worker, pool) != 0) {
+      fprintf(stderr, "!!! report pool: cannot create worker thread.\n");
+      break;
+    }
+    pool->threads_started++;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->opened < pool->threads_started) {
+    pthread_cond_wait(&pool->progress, &pool->lock);
+  }
+  int failed = pool->open_failures > 0 || pool->threads_started < threads;
+  pthread_mutex_unlock(&pool->lock);
+
+  if (!failed && sqlite3_open_v2(db_path, &pool->holder, SQLITE_OPEN_READWRITE,
+                                 NULL) != SQLITE_OK) {
+    fprintf(stderr, "!!! report pool: cannot open %s: %s\n", db_path,
+            sqlite3_errmsg(pool->holder));
+    failed = 1;
+  }
+  if (!failed) {
+    sqlite3_busy_timeout(pool->holder, db_get_profile()->busy_timeout_ms);
+  }
+  if (failed) {
+    report_pool_destroy(pool);
+    return NULL;
+  }
+  printf("DEBUG: Report pool started: %d read-only connections to %s\n",
+         threads, db_path);
+  return pool;
+}
+
+// --- report_pool_start ---
+int report_pool_start(ReportPool *pool, ReportJob *jobs, size_t count) {
+  pthread_mutex_lock(&pool->lock);
+  if (pool->running) {
+    pthread_mutex_unlock(&pool->lock);
+    return -1;
+  }
+  // Each worker reads the latest commit at the moment it begins; holding the
+  // write lock until all of them have begun pins that to one commit
+  if (sqlite3_exec(pool->holder, "BEGIN IMMEDIATE;", NULL, NULL, NULL) !=
+      SQLITE_OK) {
+    fprintf(stderr, "!!! report pool: cannot lock the database: %s\n",
+            sqlite3_errmsg(pool->holder));
+    pthread_mutex_unlock(&pool->lock);
+    return -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    jobs[i].output = NULL;
+    jobs[i].output_len = 0;
+    jobs[i].rc = SQLITE_OK;
+    jobs[i].seconds = 0.0;
+  }
+  pool->jobs = jobs;
+  pool->job_count = count;
+  pool->next_job = 0;
+  pool->done_jobs = 0;
+  pool->started = 0;
+  pool->running = 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work_ready);
+
+  // Barrier: every worker holds its read transaction before we return
+  while (pool->started < pool->thread_count) {
+    pthread_cond_wait(&pool->progress, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  sqlite3_exec(pool->holder, "COMMIT;", NULL, NULL, NULL);
+  return 0;
+}
+
+// --- report_pool_wait ---
+int report_pool_wait(ReportPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running && pool->done_jobs < pool->job_count) {
+    pthread_cond_wait(&pool->progress, &pool->lock);
+  }
+  int rc = 0;
+  for (size_t i = 0; i < pool->job_count && rc == 0; i++) {
+    rc = pool->jobs[i].rc;
+  }
+  pool->running = 0;
+  pthread_mutex_unlock(&pool->lock);
+  return rc;
+}
+
+// --- report_pool_run ---
+int report_pool_run(ReportPool *pool, ReportJob *jobs, size_t count) {
+  if (pool) {
+    if (report_pool_start(pool, jobs, count) != 0) {
+      return -1;
+    }
+    return report_pool_wait(pool);
+  }
+  int rc = 0;
+  for (size_t i = 0; i < count; i++) {
+    run_job(&jobs[i]);
+    if (rc == 0) {
+      rc = jobs[i].rc;
+    }
+  }
+  return rc;
+}
+
+// --- report_pool_size ---
+int report_pool_size(const ReportPool *pool) {
+  return pool ? pool->thread_count : 0;
+}
+
+// --- report_pool_destroy ---
+void report_pool_destroy(ReportPool *pool) {
+  if (!pool) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->threads_started; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  sqlite3_close(pool->holder);
+  pthread_cond_destroy(&pool->progress);
+  pthread_cond_destroy(&pool->work_ready);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool->path);
+  free(pool);
+}
+
+// --- report_jobs_print ---
+void report_jobs_print(const ReportJob *jobs, size_t count, FILE *out) {
+  for (size_t i = 0; i < count; i++) {
+    if (jobs[i].output) {
+      fwrite(jobs[i].output, 1, jobs[i].output_len, out);
+    }
+    if (jobs[i].rc != SQLITE_OK) {
+      fprintf(out, "!!! Report '%s' failed (rc=%d)\n",
+              jobs[i].title ? jobs[i].title : "?", jobs[i].rc);
+    }
+  }
+}
+
+// --- report_jobs_release ---
+void report_jobs_release(ReportJob *jobs, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free(jobs[i].output);
+    jobs[i].output = NULL;
+    jobs[i].output_len = 0;
+  }
+}
@@ -0,0 +1,849 @@
+#define _POSIX_C_SOURCE 200809L // sigprocmask, ftruncate, pread
+
+#include "../includes/server.h"
+#include "../includes/auth.h"
+#include "../includes/cli.h"
+#include "../includes/deal_writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVER_MAX_EVENTS 64
+// A client that stops reading gets no more requests run past this much
+// pending output
+#define SERVER_OUTPUT_LIMIT (1 << 20)
+
+typedef struct Server Server;
+typedef struct ServerClient ServerClient;
+
+// A deal handed to the deal writer, with its strings copied out of the
+// client's input buffer
+typedef struct PendingDeal {
+  DealSubmission sub;
+  DealInput deal;
+  Server *server;
+  ServerClient *client;
+  struct PendingDeal *next_done;
+  char text[];
+} PendingDeal;
+
+// A login handed to the login thread, with the username and password copied
+// out of the client's input buffer; the password is wiped once checked
+typedef struct PendingLogin {
+  ServerClient *client;
+  char *password; // In text, after the username
+  int rc;         // login_user()
+  UserSession session;
+  struct PendingLogin *next; // In the queue, then in the done list
+  char text[];
+} PendingLogin;
+
+struct ServerClient {
+  int fd; // -1 once closed
+  char in[SERVER_LINE_SIZE + 1]; // Unprocessed input, NUL-terminated
+  size_t in_len;
+  char *out; // Responses not yet sent
+  size_t out_len, out_sent, out_cap;
+  int closing;          // Close once out is sent
+  int dropped;          // Disconnected; freed once its deal or login completes
+  PendingDeal *pending; // Deal being recorded; later requests wait for it
+  PendingLogin *login;  // Login being checked; later requests wait for it
+  UserSession session;
+  struct ServerClient *next_closed;
+};
+
+struct Server {
+  int epoll_fd;
+  int listen_fd;
+  int signal_fd;
+  FILE *capture;          // Output of the request being answered
+  unsigned long requests; // Served since start
+  int clients;            // Connected now
+  // Group commit: "add deal" goes to the writer thread instead of this
+  // connection, so deals of many clients share transactions
+  DealWriter *writer;
+  int wake_fds[2]; // Writer and login thread -> loop: results are waiting
+  pthread_mutex_t done_lock;
+  PendingDeal *done;          // Completed deals (protected by done_lock)
+  PendingLogin *logins_done;  // Checked logins (protected by done_lock)
+  // PBKDF2 takes tens of milliseconds, so logins are checked on a thread with
+  // its own connection instead of stalling every client of the loop
+  const char *db_path;
+  int login_started;
+  pthread_t login_thread;
+  pthread_mutex_t login_lock;
+  pthread_cond_t login_ready; // Loop -> thread: queued or shutdown, and back
+  int login_opened;           // 1 once connected, -1 if that failed
+  int login_shutdown;
+  PendingLogin *login_head, *login_tail; // Queue (protected by login_lock)
+  // Clients closed during the current epoll batch: later events of the batch
+  // may still point at them, so they are freed once the batch is done
+  ServerClient *closed;
+};
+
+// Markers in epoll_event.data.ptr for the non-client descriptors
+static int listener_tag, signal_tag, wake_tag;
+
+// --- Settings ---
+static ServerSettings settings_in_effect = {128, 0};
+
+const ServerSettings *server_get_settings(void) { return &settings_in_effect; }
+
+void server_set_settings(const ServerSettings *settings) {
+  settings_in_effect = *settings;
+}
+
+static int set_group_commit_batch(const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 100000, &v) != 0) {
+    return -1;
+  }
+  settings_in_effect.group_commit_batch = (int)v;
+  return 0;
+}
+
+static int set_group_commit_window(const char *value) {
+  long long v;
+  if (db_setting_int(value, 0, 1000, &v) != 0) {
+    return -1;
+  }
+  settings_in_effect.group_commit_window_ms = (int)v;
+  return 0;
+}
+
+const DbSettingKey server_setting_keys[] = {
+    {"group_commit_batch", set_group_commit_batch},
+    {"group_commit_window_ms", set_group_commit_window},
+    {NULL, NULL}};
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Makes room for len more bytes of output
+static int reserve_output(ServerClient *client, size_t len) {
+  if (client->out_len + len <= client->out_cap) {
+    return 0;
+  }
+  size_t cap = client->out_cap ? client->out_cap : 4096;
+  while (cap < client->out_len + len) {
+    cap *= 2;
+  }
+  char *grown = realloc(client->out, cap);
+  if (!grown) {
+    return -1;
+  }
+  client->out = grown;
+  client->out_cap = cap;
+  return 0;
+}
+
+static int append_output(ServerClient *client, const char *data, size_t len) {
+  if (reserve_output(client, len) != 0) {
+    return -1;
+  }
+  memcpy(client->out + client->out_len, data, len);
+  client->out_len += len;
+  return 0;
+}
+
+static int respond(ServerClient *client, int code, const char *body,
+                   size_t len) {
+  char header[32];
+  int n = snprintf(header, sizeof(header), "%d %zu\n", code, len);
+  return append_output(client, header, (size_t)n) == 0 &&
+                 append_output(client, body, len) == 0
+             ? 0
+             : -1;
+}
+
+static int respond_text(ServerClient *client, int code, const char *text) {
+  return respond(client, code, text, strlen(text));
+}
+
+// Answers with what the request printed to the capture file and empties it.
+// Only this thread writes there: messages of the deal writer thread and of
+// the database layer go to the server's own stdout and stderr.
+static int send_captured(Server *server, ServerClient *client, int code) {
+  FILE *capture = server->capture;
+  long size = fflush(capture) == 0 ? ftell(capture) : -1;
+  char header[32];
+  int n = snprintf(header, sizeof(header), "%d %ld\n", code,
+                   size > 0 ? size : 0);
+  int rc = size >= 0 ? append_output(client, header, (size_t)n) : -1;
+  // The body is read straight into the output buffer
+  if (rc == 0 && size > 0) {
+    rc = reserve_output(client, (size_t)size);
+    if (rc == 0 && pread(fileno(capture), client->out + client->out_len,
+                         (size_t)size, 0) == size) {
+      client->out_len += (size_t)size;
+    } else {
+      rc = -1;
+    }
+  }
+  if (ftruncate(fileno(capture), 0) != 0) {
+    rc = -1;
+  }
+  rewind(capture);
+  return rc;
+}
+
+// Runs a batch command and answers with what it printed
+static int run_captured(Server *server, ServerClient *client, int argc,
+                        char **argv) {
+  int code = cli_run_command(&client->session, argc, argv, server->capture,
+                             server->capture);
+  return send_captured(server, client, code);
+}
+
+// Copies s to *cursor; NULL stays NULL
+static const char *copy_text(char **cursor, const char *s) {
+  if (!s) {
+    return NULL;
+  }
+  char *copy = *cursor;
+  size_t len = strlen(s) + 1;
+  memcpy(copy, s, len);
+  *cursor += len;
+  return copy;
+}
+
+// Called with done_lock held before a result is added: only the first result
+// wakes the loop, the others are taken with it
+static int needs_wake(const Server *server) {
+  return server->done == NULL && server->logins_done == NULL;
+}
+
+static void wake_loop(Server *server) {
+  char byte = 1;
+  while (write(server->wake_fds[1], &byte, 1) < 0 && errno == EINTR) {
+  }
+}
+
+// Called on the writer thread; the loop answers the client
+static void deal_done(void *ctx, DealResult result) {
+  (void)result; // Kept in sub.result
+  PendingDeal *pending = ctx;
+  Server *server = pending->server;
+  pthread_mutex_lock(&server->done_lock);
+  int wake = needs_wake(server);
+  pending->next_done = server->done;
+  server->done = pending;
+  pthread_mutex_unlock(&server->done_lock);
+  if (wake) {
+    wake_loop(server);
+  }
+}
+
+// Queues an "add deal"; the answer follows when its batch has committed
+static int submit_deal(Server *server, ServerClient *client, int argc,
+                       char **argv) {
+  DealInput deal;
+  int code = cli_parse_deal(&client->session, argc, argv, &deal,
+                            server->capture);
+  if (code != 0) {
+    return send_captured(server, client, code);
+  }
+  const char *fields[] = {deal.date, deal.good_name, deal.supplier,
+                          deal.type, deal.broker,    deal.buyer};
+  size_t size = sizeof(PendingDeal);
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    size += fields[i] ? strlen(fields[i]) + 1 : 0;
+  }
+  PendingDeal *pending = malloc(size);
+  if (pending) {
+    char *cursor = pending->text;
+    pending->deal.date = copy_text(&cursor, deal.date);
+    pending->deal.good_name = copy_text(&cursor, deal.good_name);
+    pending->deal.supplier = copy_text(&cursor, deal.supplier);
+    pending->deal.type = copy_text(&cursor, deal.type);
+    pending->deal.quantity = deal.quantity;
+    pending->deal.broker = copy_text(&cursor, deal.broker);
+    pending->deal.buyer = copy_text(&cursor, deal.buyer);
+    pending->sub.deal = &pending->deal;
+    pending->sub.done = deal_done;
+    pending->sub.ctx = pending;
+    pending->server = server;
+    pending->client = client;
+  }
+  if (!pending || deal_writer_submit(server->writer, &pending->sub) != 0) {
+    free(pending);
+    fprintf(server->capture, "!!! server: Cannot queue the deal.\n");
+    return send_captured(server, client, 1);
+  }
+  client->pending = pending;
+  return 0;
+}
+
+static int answer_login(ServerClient *client, int rc,
+                        const UserSession *session) {
+  if (rc != 0) {
+    return respond_text(client, rc > 0 ? 3 : 1,
+                        rc > 0 ? "!!! server: Login failed.\n"
+                               : "!!! server: Login error.\n");
+  }
+  client->session = *session;
+  char text[160];
+  snprintf(text, sizeof(text), "%s (%s)\n", session->username, session->role);
+  return respond_text(client, 0, text);
+}
+
+static void *login_thread(void *arg) {
+  Server *server = arg;
+  int rc_open = open_db(server->db_path);
+
+  pthread_mutex_lock(&server->login_lock);
+  server->login_opened = rc_open == 0 ? 1 : -1;
+  pthread_cond_broadcast(&server->login_ready);
+  while (rc_open == 0) {
+    while (!server->login_head && !server->login_shutdown) {
+      pthread_cond_wait(&server->login_ready, &server->login_lock);
+    }
+    if (server->login_shutdown) {
+      break; // Logins still queued get no answer, like queued deals
+    }
+    PendingLogin *login = server->login_head;
+    server->login_head = login->next;
+    if (!server->login_head) {
+      server->login_tail = NULL;
+    }
+    pthread_mutex_unlock(&server->login_lock);
+
+    login->rc = login_user(login->text, login->password, &login->session);
+    memset(login->password, 0, strlen(login->password));
+    pthread_mutex_lock(&server->done_lock);
+    int wake = needs_wake(server);
+    login->next = server->logins_done;
+    server->logins_done = login;
+    pthread_mutex_unlock(&server->done_lock);
+    if (wake) {
+      wake_loop(server);
+    }
+    pthread_mutex_lock(&server->login_lock);
+  }
+  pthread_mutex_unlock(&server->login_lock);
+  if (rc_open == 0) {
+    close_db();
+  }
+  return NULL;
+}
+
+// Wipes what is left of the password and the session
+static void free_login(PendingLogin *login) {
+  memset(login->password, 0, strlen(login->password));
+  memset(&login->session, 0, sizeof(login->session));
+  free(login);
+}
+
+// Queues a login for the login thread; the answer follows once it is checked
+static int submit_login(Server *server, ServerClient *client,
+                        const char *username, char *password) {
+  size_t user_len = strlen(username) + 1, password_len = strlen(password) + 1;
+  PendingLogin *login = malloc(sizeof(PendingLogin) + user_len + password_len);
+  if (!login) {
+    memset(password, 0, password_len - 1);
+    return respond_text(client, 1, "!!! server: Login error.\n");
+  }
+  memset(login, 0, sizeof(*login));
+  memcpy(login->text, username, user_len);
+  memcpy(login->text + user_len, password, password_len);
+  memset(password, 0, password_len - 1);
+  login->password = login->text + user_len;
+  login->client = client;
+  pthread_mutex_lock(&server->login_lock);
+  if (server->login_tail) {
+    server->login_tail->next = login;
+  } else {
+    server->login_head = login;
+  }
+  server->login_tail = login;
+  pthread_cond_broadcast(&server->login_ready);
+  pthread_mutex_unlock(&server->login_lock);
+  client->login = login;
+  return 0;
+}
+
+// One request line; returns -1 if the client must be dropped
+static int handle_request(Server *server, ServerClient *client, char *line) {
+  char *words[CLI_MAX_WORDS];
+  int count = cli_split_line(line, words, CLI_MAX_WORDS);
+  server->requests++;
+  if (count < 0) {
+    return respond_text(client, 2,
+                        "!!! server: unterminated quote or too many words.\n");
+  }
+  if (count == 0) {
+    return respond_text(client, 2, "!!! server: empty request.\n");
+  }
+  if (strcmp(words[0], "ping") == 0) {
+    return respond_text(client, 0, "pong\n");
+  }
+  if (strcmp(words[0], "quit") == 0) {
+    client->closing = 1;
+    return respond_text(client, 0, "");
+  }
+  if (strcmp(words[0], "logout") == 0) {
+    memset(&client->session, 0, sizeof(client->session));
+    return respond_text(client, 0, "");
+  }
+  if (strcmp(words[0], "login") == 0) {
+    if (count != 3) {
+      return respond_text(client, 2, "!!! server: login USER PASSWORD\n");
+    }
+    if (server->login_started) {
+      return submit_login(server, client, words[1], words[2]);
+    }
+    UserSession session;
+    memset(&session, 0, sizeof(session));
+    int rc = login_user(words[1], words[2], &session);
+    memset(words[2], 0, strlen(words[2]));
+    return answer_login(client, rc, &session);
+  }
+  if (!client->session.is_authenticated) {
+    return respond_text(client, 3, "!!! server: login first.\n");
+  }
+  if (server->writer && count >= 2 && strcmp(words[0], "add") == 0 &&
+      strcmp(words[1], "deal") == 0) {
+    return submit_deal(server, client, count, words);
+  }
+  return run_captured(server, client, count, words);
+}
+
+static void free_client(ServerClient *client) {
+  free(client->out);
+  memset(&client->session, 0, sizeof(client->session));
+  free(client);
+}
+
+// Frees the client after the current epoll batch
+static void retire_client(Server *server, ServerClient *client) {
+  client->next_closed = server->closed;
+  server->closed = client;
+}
+
+static void free_closed_clients(Server *server) {
+  while (server->closed) {
+    ServerClient *next = server->closed->next_closed;
+    free_client(server->closed);
+    server->closed = next;
+  }
+}
+
+// A deal or login of the client is in progress; its later requests wait
+static int client_waiting(const ServerClient *client) {
+  return client->pending || client->login;
+}
+
+static void close_client(Server *server, ServerClient *client) {
+  epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  client->fd = -1;
+  server->clients--;
+  if (client_waiting(client)) {
+    client->dropped = 1; // The writer or login thread still holds it
+  } else {
+    retire_client(server, client);
+  }
+}
+
+// Watches for input only while the client's output is small and no deal or
+// login of it is in progress
+static void update_interest(Server *server, ServerClient *client) {
+  struct epoll_event ev = {0};
+  ev.data.ptr = client;
+  if (client->out_len > client->out_sent) {
+    ev.events |= EPOLLOUT;
+  }
+  if (!client->closing && !client_waiting(client) &&
+      client->out_len - client->out_sent < SERVER_OUTPUT_LIMIT) {
+    ev.events |= EPOLLIN;
+  }
+  epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+// Runs the complete lines of the input buffer
+static int process_input(Server *server, ServerClient *client) {
+  char *start = client->in;
+  char *newline;
+  while (!client->closing && !client_waiting(client) &&
+         client->out_len - client->out_sent < SERVER_OUTPUT_LIMIT &&
+         (newline = memchr(start, '\n', client->in_len -
+                                            (size_t)(start - client->in)))) {
+    *newline = '\0';
+    if (newline > start && newline[-1] == '\r') {
+      newline[-1] = '\0';
+    }
+    if (handle_request(server, client, start) != 0) {
+      return -1;
+    }
+    start = newline + 1;
+  }
+  client->in_len -= (size_t)(start - client->in);
+  memmove(client->in, start, client->in_len);
+  if (client->in_len == SERVER_LINE_SIZE &&
+      !memchr(client->in, '\n', client->in_len)) {
+    respond_text(client, 2, "!!! server: request line too long.\n");
+    client->closing = 1; // The rest of the line cannot be told apart
+  }
+  return 0;
+}
+
+static int flush_output(ServerClient *client) {
+  while (client->out_sent < client->out_len) {
+    ssize_t n = send(client->fd, client->out + client->out_sent,
+                     client->out_len - client->out_sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    client->out_sent += (size_t)n;
+  }
+  client->out_len = client->out_sent = 0;
+  return 0;
+}
+
+// Runs what the client has queued, sends what is ready, then closes the
+// client or updates what the loop waits for
+static void service_client(Server *server, ServerClient *client, int drop) {
+  if (!drop && (process_input(server, client) != 0 ||
+                flush_output(client) != 0)) {
+    drop = 1;
+  }
+  // Requests held back by the output limit can run now
+  if (!drop && client->out_len == 0 && client->in_len > 0 &&
+      (process_input(server, client) != 0 || flush_output(client) != 0)) {
+    drop = 1;
+  }
+  if (drop || (client->closing && client->out_len == 0)) {
+    close_client(server, client);
+    return;
+  }
+  update_interest(server, client);
+}
+
+static void on_client_event(Server *server, ServerClient *client,
+                            unsigned events) {
+  if (client->fd < 0) {
+    return; // Closed earlier in this batch
+  }
+  int drop = (events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN);
+  if (!drop && (events & EPOLLIN) && client->in_len < SERVER_LINE_SIZE) {
+    ssize_t n = recv(client->fd, client->in + client->in_len,
+                     SERVER_LINE_SIZE - client->in_len, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      drop = 1; // Closed by the client
+    } else if (n > 0) {
+      client->in_len += (size_t)n;
+    }
+  }
+  service_client(server, client, drop);
+}
+
+// Answers the clients whose deals the writer has recorded
+static void complete_deals(Server *server, PendingDeal *done) {
+  while (done) {
+    PendingDeal *next = done->next_done;
+    ServerClient *client = done->client;
+    client->pending = NULL;
+    if (client->dropped) {
+      retire_client(server, client);
+    } else {
+      int code =
+          cli_report_deal(&done->deal, done->sub.result, server->capture);
+      service_client(server, client, send_captured(server, client, code) != 0);
+    }
+    free(done);
+    done = next;
+  }
+}
+
+// Answers the clients whose logins the login thread has checked
+static void complete_logins(Server *server, PendingLogin *done) {
+  while (done) {
+    PendingLogin *next = done->next;
+    ServerClient *client = done->client;
+    client->login = NULL;
+    if (client->dropped) {
+      retire_client(server, client);
+    } else {
+      service_client(server, client,
+                     answer_login(client, done->rc, &done->session) != 0);
+    }
+    free_login(done);
+    done = next;
+  }
+}
+
+static void complete_work(Server *server) {
+  char buf[64];
+  while (read(server->wake_fds[0], buf, sizeof(buf)) > 0) {
+  }
+  pthread_mutex_lock(&server->done_lock);
+  PendingDeal *deals = server->done;
+  PendingLogin *logins = server->logins_done;
+  server->done = NULL;
+  server->logins_done = NULL;
+  pthread_mutex_unlock(&server->done_lock);
+  complete_deals(server, deals);
+  complete_logins(server, logins);
+}
+
+// Starts the login thread; without it logins are checked on the loop
+static void start_login_thread(Server *server) {
+  pthread_mutex_init(&server->login_lock, NULL);
+  pthread_cond_init(&server->login_ready, NULL);
+  if (pthread_create(&server->login_thread, NULL, login_thread, server) == 0) {
+    pthread_mutex_lock(&server->login_lock);
+    while (!server->login_opened) {
+      pthread_cond_wait(&server->login_ready, &server->login_lock);
+    }
+    pthread_mutex_unlock(&server->login_lock);
+    if (server->login_opened > 0) {
+      server->login_started = 1;
+      return;
+    }
+    pthread_join(server->login_thread, NULL);
+  }
+  pthread_cond_destroy(&server->login_ready);
+  pthread_mutex_destroy(&server->login_lock);
+  fprintf(stderr, "!!! server: No login thread; logins stall other clients "
+                  "while hashing.\n");
+}
+
+// Starts the login thread, and the writer when the settings ask for group
+// commit; without it deals are recorded on this connection like any other
+// command. Both need a database file for their own connections.
+static void start_workers(Server *server) {
+  const ServerSettings *settings = &settings_in_effect;
+  server->db_path = sqlite3_db_filename(db, "main");
+  if (!server->db_path || server->db_path[0] == '\0') {
+    return;
+  }
+  if (pipe(server->wake_fds) != 0 || set_nonblocking(server->wake_fds[0])) {
+    perror("!!! server: pipe");
+    return;
+  }
+  pthread_mutex_init(&server->done_lock, NULL);
+  struct epoll_event ev = {0};
+  ev.events = EPOLLIN;
+  ev.data.ptr = &wake_tag;
+  if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fds[0], &ev) !=
+      0) {
+    perror("!!! server: epoll_ctl");
+    return;
+  }
+  start_login_thread(server);
+  if (settings->group_commit_batch <= 0) {
+    return;
+  }
+  server->writer = deal_writer_create(server->db_path,
+                                      settings->group_commit_batch,
+                                      settings->group_commit_window_ms);
+  if (!server->writer) {
+    fprintf(stderr, "!!! server: No group commit; deals are recorded one by "
+                    "one.\n");
+  }
+}
+
+// Stops the login thread; logins still queued or unanswered are dropped
+static void stop_login_thread(Server *server) {
+  if (!server->login_started) {
+    return;
+  }
+  pthread_mutex_lock(&server->login_lock);
+  server->login_shutdown = 1;
+  pthread_cond_broadcast(&server->login_ready);
+  pthread_mutex_unlock(&server->login_lock);
+  pthread_join(server->login_thread, NULL);
+  pthread_cond_destroy(&server->login_ready);
+  pthread_mutex_destroy(&server->login_lock);
+  PendingLogin *lists[] = {server->login_head, server->logins_done};
+  for (int i = 0; i < 2; i++) {
+    for (PendingLogin *login = lists[i], *next; login; login = next) {
+      next = login->next;
+      if (login->client->dropped) {
+        free_client(login->client);
+      }
+      free_login(login);
+    }
+  }
+}
+
+static void accept_clients(Server *server) {
+  for (;;) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("!!! server: accept");
+      }
+      return;
+    }
+    ServerClient *client = calloc(1, sizeof(*client));
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = client;
+    if (!client || set_nonblocking(fd) != 0 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      fprintf(stderr, "!!! server: Cannot add a client.\n");
+      free(client);
+      close(fd);
+      continue;
+    }
+    client->fd = fd;
+    server->clients++;
+  }
+}
+
+static int open_listener(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "!!! server: Socket path too long: '%s'\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path); // Left over from a server that did not shut down
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 128) != 0 || set_nonblocking(fd) != 0) {
+    fprintf(stderr, "!!! server: Cannot listen on '%s': %s\n", path,
+            strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+// --- server_run ---
+int server_run(const char *socket_path) {
+  Server server;
+  memset(&server, 0, sizeof(server));
+  server.epoll_fd = server.listen_fd = server.signal_fd = -1;
+  server.wake_fds[0] = server.wake_fds[1] = -1;
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+
+  server.capture = tmpfile();
+  int ok = server.capture != NULL;
+  if (ok) {
+    server.listen_fd = open_listener(socket_path);
+    ok = server.listen_fd >= 0;
+  }
+  // The signals arrive through a descriptor of the loop instead
+  if (ok && sigprocmask(SIG_BLOCK, &stop_signals, NULL) == 0) {
+    server.signal_fd = signalfd(-1, &stop_signals, 0);
+  }
+  server.epoll_fd = ok && server.signal_fd >= 0 ? epoll_create1(0) : -1;
+  struct epoll_event ev = {0};
+  ev.events = EPOLLIN;
+  ev.data.ptr = &listener_tag;
+  ok = server.epoll_fd >= 0 &&
+       epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev) == 0;
+  ev.data.ptr = &signal_tag;
+  ok = ok &&
+       epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.signal_fd, &ev) == 0;
+
+  if (ok) {
+    start_workers(&server);
+    printf("DEBUG: server: Listening on %s.\n", socket_path);
+    fflush(stdout);
+  } else if (server.capture) {
+    fprintf(stderr, "!!! server: Failed to start.\n");
+  } else {
+    perror("!!! server: tmpfile");
+  }
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  int running = ok;
+  while (running) {
+    int n = epoll_wait(server.epoll_fd, events, SERVER_MAX_EVENTS, -1);
+    if (n < 0 && errno != EINTR) {
+      perror("!!! server: epoll_wait");
+      ok = 0;
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      void *tag = events[i].data.ptr;
+      if (tag == &listener_tag) {
+        accept_clients(&server);
+      } else if (tag == &wake_tag) {
+        complete_work(&server);
+      } else if (tag == &signal_tag) {
+        // Taken off the pending set, or unblocking it below would kill us
+        struct signalfd_siginfo info;
+        if (read(server.signal_fd, &info, sizeof(info)) == sizeof(info)) {
+          printf("DEBUG: server: Got signal %u.\n", info.ssi_signo);
+        }
+        running = 0;
+      } else {
+        on_client_event(&server, tag, events[i].events);
+      }
+    }
+    free_closed_clients(&server);
+  }
+  if (server.epoll_fd >= 0) {
+    printf("DEBUG: server: Stopping: %lu requests served, %d clients "
+           "connected.\n",
+           server.requests, server.clients);
+  }
+  if (server.writer) {
+    DealWriterStats stats;
+    deal_writer_get_stats(server.writer, &stats);
+    printf("DEBUG: server: %lu deals in %lu transactions (largest %lu).\n",
+           stats.deals, stats.batches, stats.largest_batch);
+  }
+
+  // Deals already queued are still recorded; their clients get no answer
+  stop_login_thread(&server);
+  if (server.writer) {
+    deal_writer_destroy(server.writer);
+    PendingDeal *done = server.done;
+    for (PendingDeal *next; done; done = next) {
+      next = done->next_done;
+      if (done->client->dropped) {
+        free_client(done->client);
+      }
+      free(done);
+    }
+  }
+  if (server.wake_fds[0] >= 0) {
+    close(server.wake_fds[0]);
+    close(server.wake_fds[1]);
+    pthread_mutex_destroy(&server.done_lock);
+  }
+
+  // Clients still connected are dropped with the epoll descriptor; their
+  // memory goes with the process
+  if (server.epoll_fd >= 0) {
+    close(server.epoll_fd);
+  }
+  if (server.signal_fd >= 0) {
+    close(server.signal_fd);
+    sigprocmask(SIG_UNBLOCK, &stop_signals, NULL);
+  }
+  if (server.listen_fd >= 0) {
+    close(server.listen_fd);
+    unlink(socket_path);
+  }
+  if (server.capture) {
+    fclose(server.capture);
+  }
+  return ok ? 0 : -1;
+}
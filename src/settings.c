@@ -0,0 +1,16 @@
+#include "../includes/archive.h"
+#include "../includes/auth.h"
+#include "../includes/db.h"
+#include "../includes/db_memory.h"
+#include "../includes/queries.h"
+#include "../includes/report_cache.h"
+#include "../includes/server.h"
+#include <stddef.h>
+
+// Modules configured from perfume.conf and PERFUME_DB_* besides the
+// connection profile; db_profile_set() looks a key up in these tables in
+// this order. A new module setting goes into its module's own table.
+const DbSettingKey *const db_setting_tables[] = {
+    db_query_limit_keys, db_memory_setting_keys, report_cache_setting_keys,
+    query_setting_keys,  archive_setting_keys,   server_setting_keys,
+    auth_setting_keys,   NULL};
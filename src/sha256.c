@@ -0,0 +1,216 @@
+#include "../includes/sha256.h"
+#include <string.h>
+
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t initial_state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                          0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                          0x1f83d9ab, 0x5be0cd19};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static uint32_t load_be32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         (uint32_t)p[3];
+}
+
+static void store_be32(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+// One 64-byte block into state
+static void compress(uint32_t state[8], const unsigned char block[64]) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = load_be32(block + 4 * i);
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + round_constants[i] + w[i];
+    uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+// --- SHA-256 ---
+void sha256_init(Sha256 *ctx) {
+  memcpy(ctx->state, initial_state, sizeof(initial_state));
+  ctx->length = 0;
+  ctx->used = 0;
+}
+
+void sha256_update(Sha256 *ctx, const void *data, size_t len) {
+  const unsigned char *p = data;
+  ctx->length += len;
+  if (ctx->used > 0) {
+    size_t take = SHA256_BLOCK_SIZE - ctx->used;
+    take = take < len ? take : len;
+    memcpy(ctx->block + ctx->used, p, take);
+    ctx->used += take;
+    p += take;
+    len -= take;
+    if (ctx->used < SHA256_BLOCK_SIZE) {
+      return;
+    }
+    compress(ctx->state, ctx->block);
+    ctx->used = 0;
+  }
+  for (; len >= SHA256_BLOCK_SIZE; p += SHA256_BLOCK_SIZE) {
+    compress(ctx->state, p);
+    len -= SHA256_BLOCK_SIZE;
+  }
+  memcpy(ctx->block, p, len);
+  ctx->used = len;
+}
+
+void sha256_final(Sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]) {
+  uint64_t bits = ctx->length * 8;
+  ctx->block[ctx->used++] = 0x80;
+  if (ctx->used > SHA256_BLOCK_SIZE - 8) {
+    memset(ctx->block + ctx->used, 0, SHA256_BLOCK_SIZE - ctx->used);
+    compress(ctx->state, ctx->block);
+    ctx->used = 0;
+  }
+  memset(ctx->block + ctx->used, 0, SHA256_BLOCK_SIZE - 8 - ctx->used);
+  store_be32(ctx->block + 56, (uint32_t)(bits >> 32));
+  store_be32(ctx->block + 60, (uint32_t)bits);
+  compress(ctx->state, ctx->block);
+  for (int i = 0; i < 8; i++) {
+    store_be32(digest + 4 * i, ctx->state[i]);
+  }
+}
+
+// --- HMAC-SHA256 ---
+// States after the ipad and opad blocks of a key
+typedef struct {
+  Sha256 inner;
+  Sha256 outer;
+} HmacKey;
+
+static void hmac_key_init(HmacKey *hk, const void *key, size_t key_len) {
+  unsigned char block[SHA256_BLOCK_SIZE] = {0};
+  if (key_len > SHA256_BLOCK_SIZE) {
+    Sha256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, key, key_len);
+    sha256_final(&ctx, block);
+  } else if (key_len > 0) {
+    memcpy(block, key, key_len);
+  }
+  unsigned char pad[SHA256_BLOCK_SIZE];
+  for (int i = 0; i < SHA256_BLOCK_SIZE; i++) {
+    pad[i] = block[i] ^ 0x36;
+  }
+  sha256_init(&hk->inner);
+  sha256_update(&hk->inner, pad, sizeof(pad));
+  for (int i = 0; i < SHA256_BLOCK_SIZE; i++) {
+    pad[i] = block[i] ^ 0x5c;
+  }
+  sha256_init(&hk->outer);
+  sha256_update(&hk->outer, pad, sizeof(pad));
+}
+
+void hmac_sha256(const void *key, size_t key_len, const void *msg,
+                 size_t msg_len, unsigned char mac[SHA256_DIGEST_SIZE]) {
+  HmacKey hk;
+  hmac_key_init(&hk, key, key_len);
+  unsigned char inner[SHA256_DIGEST_SIZE];
+  sha256_update(&hk.inner, msg, msg_len);
+  sha256_final(&hk.inner, inner);
+  sha256_update(&hk.outer, inner, sizeof(inner));
+  sha256_final(&hk.outer, mac);
+}
+
+// --- PBKDF2-HMAC-SHA256 ---
+// U_i = HMAC(P, U_{i-1}) hashes a 32-byte message after a key block that is
+// already absorbed, so each half is one compression of a fixed padded block
+// from the saved state: no buffering or length bookkeeping in the loop.
+static void hmac_iterate(const HmacKey *hk, unsigned char block[64],
+                         unsigned char u[SHA256_DIGEST_SIZE]) {
+  uint32_t state[8];
+  memcpy(block, u, SHA256_DIGEST_SIZE);
+  memcpy(state, hk->inner.state, sizeof(state));
+  compress(state, block);
+  for (int i = 0; i < 8; i++) {
+    store_be32(block + 4 * i, state[i]);
+  }
+  memcpy(state, hk->outer.state, sizeof(state));
+  compress(state, block);
+  for (int i = 0; i < 8; i++) {
+    store_be32(u + 4 * i, state[i]);
+  }
+}
+
+void pbkdf2_hmac_sha256(const void *password, size_t password_len,
+                        const void *salt, size_t salt_len,
+                        unsigned long iterations, unsigned char *out,
+                        size_t out_len) {
+  HmacKey hk;
+  hmac_key_init(&hk, password, password_len);
+  // Padded block of a 32-byte message following the 64-byte key block
+  unsigned char block[SHA256_BLOCK_SIZE] = {0};
+  block[SHA256_DIGEST_SIZE] = 0x80;
+  store_be32(block + 60, (SHA256_BLOCK_SIZE + SHA256_DIGEST_SIZE) * 8);
+
+  for (uint32_t index = 1; out_len > 0; index++) {
+    // U_1 = HMAC(P, S || INT(index))
+    unsigned char counter[4], u[SHA256_DIGEST_SIZE], t[SHA256_DIGEST_SIZE];
+    store_be32(counter, index);
+    Sha256 inner = hk.inner, outer = hk.outer;
+    sha256_update(&inner, salt, salt_len);
+    sha256_update(&inner, counter, sizeof(counter));
+    sha256_final(&inner, u);
+    sha256_update(&outer, u, sizeof(u));
+    sha256_final(&outer, u);
+    memcpy(t, u, sizeof(t));
+    for (unsigned long i = 1; i < iterations; i++) {
+      hmac_iterate(&hk, block, u);
+      for (int j = 0; j < SHA256_DIGEST_SIZE; j++) {
+        t[j] ^= u[j];
+      }
+    }
+    size_t take = out_len < sizeof(t) ? out_len : sizeof(t);
+    memcpy(out, t, take);
+    out += take;
+    out_len -= take;
+  }
+}
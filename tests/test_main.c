@@ -1,15 +1,39 @@
 // tests/test_main.c
 
+#define _POSIX_C_SOURCE 200809L // fork, kill, nanosleep, open_memstream
+
 #include "../includes/auth.h" // Correct path
 #include "../includes/db.h"   // Correct path
+#include "../includes/aggregates.h"
+#include "../includes/analytics.h"
+#include "../includes/archive.h"
+#include "../includes/cli.h"
+#include "../includes/dates.h"
+#include "../includes/db_memory.h"
+#include "../includes/deal_writer.h"
+#include "../includes/importer.h"
+#include "../includes/migrations.h"
+#include "../includes/queries.h"
+#include "../includes/report_cache.h"
+#include "../includes/report_pool.h"
+#include "../includes/server.h"
+#include "../includes/sha256.h"
 
 #include <setjmp.h> // For jmp_buf (required BEFORE cmocka.h)
 #include <stdio.h>  // For FILE, fopen, fprintf, fclose, remove, printf
 
 #include <cmocka.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdlib.h> // For system() or file operations if needed
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h> // For strcmp()
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h> // For access()
 
 // Test database file name
@@ -202,6 +226,75 @@ static void test_init_tables_run_once(void **state) {
   // Add more checks if needed (e.g., verify no data was wiped)
 }
 
+static void test_schema_migrations(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  int latest = migrations_latest_version();
+  assert_int_equal(migrations_current_version(), latest);
+
+  // A database from before versioning (baseline tables, user_version 0) is
+  // adopted and upgraded, not recreated
+  const char *old_file = "test_unversioned.db";
+  close_db();
+  remove(old_file);
+  assert_int_equal(open_db(old_file), 0);
+  assert_int_equal(execute_sql_from_file(TEST_SCHEMA_FILE), SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Brokers (surname) "
+                                     "VALUES ('Versioned');"),
+                   SQLITE_OK);
+  assert_int_equal(migrations_current_version(), 0);
+  assert_int_equal(init_tables_if_needed(TEST_SCHEMA_FILE), 0);
+  assert_int_equal(migrations_current_version(), latest);
+  DbCursor cur;
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT COUNT(*) FROM Brokers "
+                                  "WHERE surname = 'Versioned';",
+                                  NULL, 0),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_int_equal(db_cursor_int64(&cur, 0), 1);
+  db_cursor_close(&cur);
+
+  // A newer database is refused
+  char sql[64];
+  snprintf(sql, sizeof(sql), "PRAGMA user_version = %d;", latest + 1);
+  assert_int_equal(execute_non_query(sql), SQLITE_OK);
+  assert_int_not_equal(init_tables_if_needed(TEST_SCHEMA_FILE), 0);
+  close_db();
+  remove(old_file);
+  assert_int_equal(open_db(TEST_DB_FILE), 0);
+}
+
+// The schema and seed data built into the program, as a first start creates
+// them in an empty file
+static void test_init_tables_embedded(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  const char *new_file = "test_embedded.db";
+  close_db();
+  remove(new_file);
+  assert_int_equal(open_db(new_file), 0);
+  assert_int_equal(init_tables_if_needed(NULL), 0);
+  assert_int_equal(migrations_current_version(), migrations_latest_version());
+  // Seeded deals, and users whose stub hashes migration 9 replaced
+  DbCursor cur;
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT (SELECT COUNT(*) FROM Deals), "
+                                  "(SELECT COUNT(*) FROM Users WHERE "
+                                  "username = 'broker_petrov' AND "
+                                  "password_hash LIKE 'pbkdf2-sha256$%');",
+                                  NULL, 0),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_true(db_cursor_int64(&cur, 0) > 0);
+  assert_int_equal(db_cursor_int64(&cur, 1), 1);
+  db_cursor_close(&cur);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+  close_db();
+  remove(new_file);
+  assert_int_equal(open_db(TEST_DB_FILE), 0);
+}
+
 static void test_execute_non_query_success(void **state) {
   (void)state;
   printf("--- Running test: %s ---\n", __func__); // Identify test
@@ -248,18 +341,370 @@ static void test_execute_select_query_not_found(void **state) {
   assert_int_equal(rc, SQLITE_OK);
 }
 
+static void test_execute_non_query_params_binds_text(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__); // Identify test
+  // A quote in the value must not break the statement (no interpolation)
+  DbParam params[] = {DB_TEXT("O'Brien"), DB_TEXT("1 Quote St"),
+                      DB_INT(1979)};
+  int rc = execute_non_query_params(
+      "INSERT INTO Brokers (surname, address, birth_year) VALUES (?, ?, ?);",
+      params, DB_PARAM_COUNT(params));
+  assert_int_equal(rc, SQLITE_OK);
+
+  sqlite3_stmt *stmt = NULL;
+  rc = db_prepare_cached("SELECT birth_year FROM Brokers WHERE surname = ?;",
+                         &stmt);
+  assert_int_equal(rc, SQLITE_OK);
+  assert_int_equal(db_bind_params(stmt, params, 1), SQLITE_OK);
+  assert_int_equal(sqlite3_step(stmt), SQLITE_ROW);
+  assert_int_equal(sqlite3_column_int(stmt, 0), 1979);
+  db_release_stmt(stmt);
+}
+
+static void test_stmt_cache_reuses_statement(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__); // Identify test
+  const char *sql = "SELECT COUNT(*) FROM Brokers WHERE birth_year > ?;";
+  StmtCacheStats before, after;
+  sqlite3_stmt *first = NULL, *second = NULL;
+
+  assert_int_equal(db_prepare_cached(sql, &first), SQLITE_OK);
+  db_release_stmt(first);
+  db_stmt_cache_get_stats(&before);
+  assert_int_equal(db_prepare_cached(sql, &second), SQLITE_OK);
+  db_stmt_cache_get_stats(&after);
+  db_release_stmt(second);
+
+  assert_true(first == second); // Same prepared statement handed out again
+  assert_int_equal(after.hits, before.hits + 1);
+  assert_int_equal(after.misses, before.misses);
+}
+
+static void test_cursor_typed_columns(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__); // Identify test
+  DbCursor cur;
+  DbParam params[] = {DB_INT(7), DB_DOUBLE(2.5), DB_TEXT("abc"), DB_NULL()};
+  int rc = db_cursor_open(&cur, "SELECT ?, ?, ?, ?;", params,
+                          DB_PARAM_COUNT(params));
+  assert_int_equal(rc, SQLITE_OK);
+  assert_int_equal(cur.column_count, 4);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_int_equal(db_cursor_type(&cur, 0), SQLITE_INTEGER);
+  assert_int_equal(db_cursor_int64(&cur, 0), 7);
+  assert_int_equal(db_cursor_type(&cur, 1), SQLITE_FLOAT);
+  assert_true(db_cursor_double(&cur, 1) == 2.5);
+  int len = 0;
+  const char *text = db_cursor_text(&cur, 2, &len);
+  assert_int_equal(len, 3);
+  assert_memory_equal(text, "abc", 3);
+  assert_null(db_cursor_text(&cur, 3, &len));
+  assert_int_equal(db_cursor_next(&cur), SQLITE_DONE);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_DONE); // Stays finished
+  db_cursor_close(&cur);
+  db_cursor_close(&cur); // Safe to call twice
+}
+
+// Runs a long read-only statement to its end or first error
+static int run_counting_query(void) {
+  DbCursor cur;
+  int rc = db_cursor_open(&cur,
+                          "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT "
+                          "x + 1 FROM c LIMIT 200000) SELECT count(*) FROM c;",
+                          NULL, 0);
+  if (rc == SQLITE_OK) {
+    rc = db_cursor_next(&cur);
+  }
+  db_cursor_close(&cur);
+  return rc;
+}
+
+// Connection keys land in the profile, module keys in their module
+static void test_profile_keys(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  DbProfile profile;
+  db_profile_defaults(&profile);
+  QuerySettings saved_query = *query_get_settings();
+  ArchiveSettings saved_archive = *archive_get_settings();
+
+  assert_int_equal(db_profile_set(&profile, "Synchronous", "normal"), 0);
+  assert_int_equal(profile.synchronous, 1);
+  assert_int_equal(db_profile_set(&profile, "list_page_size", "7"), 0);
+  assert_int_equal(query_get_settings()->list_page_size, 7);
+  assert_int_equal(db_profile_set(&profile, "list_page_size", "0"), -1);
+  assert_int_equal(query_get_settings()->list_page_size, 7);
+  assert_int_equal(db_profile_set(&profile, "archive_dir", ""), -1);
+  assert_int_equal(db_profile_set(&profile, "no_such_key", "1"), -1);
+
+  setenv("PERFUME_DB_ARCHIVE_CHUNK_SIZE", "123", 1);
+  assert_int_equal(db_profile_load_env(&profile), 0);
+  assert_int_equal(archive_get_settings()->chunk_size, 123);
+  setenv("PERFUME_DB_ARCHIVE_CHUNK_SIZE", "lots", 1);
+  assert_int_equal(db_profile_load_env(&profile), -1);
+  unsetenv("PERFUME_DB_ARCHIVE_CHUNK_SIZE");
+
+  query_set_settings(&saved_query);
+  archive_set_settings(&saved_archive);
+}
+
+static void test_query_budgets(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__); // Identify test
+  DbQueryLimits saved = *db_get_query_limits();
+  DbQueryLimits limits = saved;
+  assert_int_equal(run_counting_query(), SQLITE_ROW);
+  assert_int_equal(db_last_stop_reason(), DB_STOP_NONE);
+
+  limits.step_limit = 50000;
+  db_set_query_limits(&limits);
+  assert_int_equal(run_counting_query(), SQLITE_INTERRUPT);
+  assert_int_equal(db_last_stop_reason(), DB_STOP_STEP_LIMIT);
+  // Write statements are not limited
+  assert_int_equal(
+      execute_non_query("CREATE TEMP TABLE budget_rows AS WITH RECURSIVE "
+                        "c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+                        "LIMIT 100000) SELECT x FROM c;"),
+      SQLITE_OK);
+  assert_int_equal(execute_non_query("DROP TABLE budget_rows;"), SQLITE_OK);
+
+  limits.step_limit = 0;
+  limits.time_limit_ms = 1;
+  db_set_query_limits(&limits);
+  assert_int_equal(run_counting_query(), SQLITE_INTERRUPT);
+  assert_int_equal(db_last_stop_reason(), DB_STOP_TIME_LIMIT);
+  db_set_query_limits(&saved);
+
+  // Cancel: nothing to stop at first, then the cursor stops between rows
+  assert_int_equal(db_cancel_running(), 0);
+  DbCursor cur;
+  assert_int_equal(
+      db_cursor_open(&cur, "SELECT 1 UNION ALL SELECT 2;", NULL, 0),
+      SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_int_equal(db_cancel_running(), 1);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_INTERRUPT);
+  assert_int_equal(db_last_stop_reason(), DB_STOP_CANCELLED);
+  db_cursor_close(&cur);
+  assert_int_equal(db_cancel_running(), 0);
+  assert_int_equal(run_counting_query(), SQLITE_ROW); // The next one runs
+}
+
+static void test_db_memory(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__); // Identify test
+  DbMemoryStats before, after;
+  db_memory_get_stats(&before);
+  assert_true(before.pool_blocks > 0); // Set up by main()
+  assert_true(before.page_slots > 0);
+  assert_int_equal(execute_select_query("SELECT name FROM Goods;"), SQLITE_OK);
+  db_memory_get_stats(&after);
+  assert_true(after.mallocs > before.mallocs);
+  assert_true(after.pool_hits > before.pool_hits);
+  assert_true(after.heap_used > 0 && after.heap_peak >= after.heap_used);
+  assert_true(after.page_slots_used > 0);
+  assert_true(after.page_slots_used <= after.page_slots);
+
+  // The soft heap limit follows the settings on every configure
+  DbMemorySettings saved = *db_memory_get_settings();
+  DbMemorySettings settings = saved;
+  settings.soft_heap_limit_kb = 8192;
+  assert_int_equal(db_memory_configure(&settings), 0);
+  db_memory_get_stats(&after);
+  assert_int_equal(after.soft_heap_limit, 8192 * 1024);
+  assert_int_equal(db_memory_configure(&saved), 0);
+  db_memory_get_stats(&after);
+  assert_int_equal(after.soft_heap_limit, 0);
+
+  FILE *out = tmpfile();
+  assert_non_null(out);
+  db_memory_print(out);
+  rewind(out);
+  char line[256] = "";
+  assert_non_null(fgets(line, sizeof(line), out));
+  assert_non_null(strstr(line, "Память SQLite"));
+  fclose(out);
+}
+
 // --- Placeholder tests for queries.c ---
 // These should be moved to test_queries.c and implemented fully
 
+// Units and income of one good in the period summary (-1 = not listed)
+static long long summary_units(const char *start, const char *end,
+                               const char *good, double *income) {
+  DbCursor cur;
+  long long units = -1;
+  int rc = open_sales_summary_cursor(&cur, start, end);
+  while (rc == SQLITE_OK && db_cursor_next(&cur) == SQLITE_ROW) {
+    if (strcmp(db_cursor_text(&cur, 0, NULL), good) == 0) {
+      units = db_cursor_int64(&cur, 1);
+      *income = db_cursor_double(&cur, 2);
+    }
+  }
+  db_cursor_close(&cur);
+  return units;
+}
+
 static void test_query_sales_summary(void **state) {
   (void)state;
-  printf("--- Running test: %s (Placeholder) ---\n", __func__);
-  assert_true(1);
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('SumSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(
+      execute_non_query("INSERT INTO Buyers (buyer_name) VALUES ('SumBuyer');"),
+      SQLITE_OK);
+  assert_int_equal(
+      execute_non_query("INSERT INTO Brokers (surname) VALUES ('SumBroker');"),
+      SQLITE_OK);
+  assert_int_equal(insert_good("SumGood", "Духи", 4.0, "SumSupplier",
+                               "2030-01-01", 100),
+                   SQLITE_OK);
+  DealInput deal = {"2023-03-01", "SumGood",   "SumSupplier", "Духи",
+                    2,            "SumBroker", "SumBuyer"};
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK); // Same day
+  deal.date = "2023-03-05";
+  deal.quantity = 7;
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  sqlite3_int64 last_id = sqlite3_last_insert_rowid(db);
+
+  double income = 0;
+  assert_int_equal(summary_units("2023-03-01", "2023-03-31", "SumGood",
+                                 &income),
+                   11);
+  assert_true(income == 44.0);
+  assert_int_equal(summary_units("2023-03-02", "2023-03-05", "SumGood",
+                                 &income),
+                   7);
+
+  // Recorded deals keep their price; only new deals use the new one
+  assert_int_equal(set_good_price("SumGood", "SumSupplier", 5.0), 1);
+  assert_int_equal(summary_units("2023-03-01", "2023-03-01", "SumGood",
+                                 &income),
+                   4);
+  assert_true(income == 16.0);
+  deal.date = "2023-03-01";
+  deal.quantity = 1;
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  assert_int_equal(summary_units("2023-03-01", "2023-03-01", "SumGood",
+                                 &income),
+                   5);
+  assert_true(income == 21.0);
+
+  // A day whose deals are all gone drops out of the summary
+  assert_int_equal(remove_deal((int)last_id), 1);
+  assert_int_equal(summary_units("2023-03-02", "2023-03-31", "SumGood",
+                                 &income),
+                   -1);
+  assert_int_equal(clear_deals_up_to("2023-03-01", NULL, NULL), SQLITE_OK);
+  assert_int_equal(summary_units("2023-01-01", "2023-12-31", "SumGood",
+                                 &income),
+                   -1);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
 }
+static void test_date_encoding(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  int days = -1;
+  char text[DATE_TEXT_SIZE];
+  assert_int_equal(date_parse("1970-01-01", &days), 0);
+  assert_int_equal(days, 0);
+  assert_int_equal(date_parse("2024-02-29", &days), 0);
+  date_format(days, text);
+  assert_string_equal(text, "2024-02-29");
+  date_format(days + 1, text);
+  assert_string_equal(text, "2024-03-01");
+  assert_int_equal(date_parse("2025-02-29", NULL), -1);
+  assert_int_equal(date_parse("2025-4-01", NULL), -1);
+  assert_int_equal(date_parse("2025-04-01x", NULL), -1);
+  assert_int_equal(date_parse("2025-13-01", NULL), -1);
+  assert_int_equal(date_parse("", NULL), -1);
+
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('DateSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('DateBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(
+      execute_non_query("INSERT INTO Brokers (surname) VALUES ('DateBroker');"),
+      SQLITE_OK);
+  assert_int_equal(insert_good("DateGood", "Духи", 1.0, "DateSupplier",
+                               "2031-02-30", 10),
+                   SQLITE_MISMATCH);
+  assert_int_equal(insert_good("DateGood", "Духи", 1.0, "DateSupplier",
+                               "2031-02-28", 10),
+                   SQLITE_OK);
+  DealInput deal = {"2024-13-01", "DateGood",   "DateSupplier", "Духи",
+                    1,            "DateBroker", "DateBuyer"};
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_ERROR);
+  deal.date = "2024-12-01";
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+
+  // Stored as day numbers, shown as text
+  DbCursor cur;
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT typeof(deal_date), deal_date "
+                                  "FROM DealDetails "
+                                  "WHERE good_name_fk = 'DateGood';",
+                                  NULL, 0),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_string_equal(db_cursor_text(&cur, 0, NULL), "integer");
+  assert_int_equal(date_parse("2024-12-01", &days), 0);
+  assert_int_equal(db_cursor_int64(&cur, 1), days);
+  db_cursor_close(&cur);
+  assert_int_equal(open_deals_on_date_cursor(&cur, "01.12.2024"),
+                   SQLITE_MISMATCH);
+  db_cursor_close(&cur);
+  assert_int_equal(open_deals_on_date_cursor(&cur, "2024-12-01"), SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  db_cursor_close(&cur);
+}
+
 static void test_query_buyers_by_good(void **state) {
   (void)state;
-  printf("--- Running test: %s (Placeholder) ---\n", __func__);
-  assert_true(1);
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('KeySupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('KeyBuyerA'), ('KeyBuyerB');"),
+                   SQLITE_OK);
+  assert_int_equal(
+      execute_non_query("INSERT INTO Brokers (surname) VALUES ('KeyBroker');"),
+      SQLITE_OK);
+  assert_int_equal(
+      insert_good("KeyGood", "KeyType", 2.5, "KeySupplier", NULL, 100),
+      SQLITE_OK);
+  DealInput deal = {"2024-06-01", "KeyGood",   "KeySupplier", "KeyType",
+                    3,            "KeyBroker", "KeyBuyerA"};
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  deal.buyer = "KeyBuyerB";
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  // Names that resolve to no id are rejected, as the old foreign keys were
+  deal.buyer = "NoSuchBuyer";
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_ERROR);
+  deal.buyer = "KeyBuyerB";
+  deal.broker = "NoSuchBroker";
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_ERROR);
+
+  // Deals hold ids; the report still groups and shows names
+  DbCursor cur;
+  assert_int_equal(open_buyers_by_good_cursor(&cur, "KeyGood"), SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_string_equal(db_cursor_text(&cur, 0, NULL), "KeyGood");
+  assert_string_equal(db_cursor_text(&cur, 1, NULL), "KeyBuyerA");
+  assert_int_equal(db_cursor_int64(&cur, 2), 6);
+  assert_true(db_cursor_double(&cur, 3) == 15.0);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_string_equal(db_cursor_text(&cur, 1, NULL), "KeyBuyerB");
+  assert_int_equal(db_cursor_int64(&cur, 2), 3);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_DONE);
+  db_cursor_close(&cur);
 }
 static void test_query_most_popular(void **state) {
   (void)state;
@@ -267,23 +712,1291 @@ static void test_query_most_popular(void **state) {
   assert_true(1);
 }
 
+static double broker_stats_sum(const char *broker, long long *units) {
+  DbParam params[] = {DB_TEXT(broker)};
+  DbCursor cur;
+  double sum = -1.0;
+  *units = -1;
+  if (db_cursor_open(&cur,
+                     "SELECT total_sold_units, total_deal_sum FROM BrokerStats "
+                     "WHERE broker_surname_fk = ?;",
+                     params, DB_PARAM_COUNT(params)) == SQLITE_OK &&
+      db_cursor_next(&cur) == SQLITE_ROW) {
+    *units = db_cursor_int64(&cur, 0);
+    sum = db_cursor_double(&cur, 1);
+  }
+  db_cursor_close(&cur);
+  return sum;
+}
+
+static void test_broker_stats_incremental(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('StatSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('StatBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(
+      execute_non_query("INSERT INTO Brokers (surname) VALUES ('StatBroker');"),
+      SQLITE_OK);
+  assert_int_equal(insert_good("StatGood", "Духи", 10.0, "StatSupplier",
+                               "2030-01-01", 100),
+                   SQLITE_OK);
+
+  DealInput deal = {"2024-01-10", "StatGood",   "StatSupplier", "Духи",
+                    3,            "StatBroker", "StatBuyer"};
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  deal.date = "2024-02-10";
+  deal.quantity = 5;
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  sqlite3_int64 second_id = sqlite3_last_insert_rowid(db);
+
+  long long units;
+  assert_true(broker_stats_sum("StatBroker", &units) == 80.0);
+  assert_int_equal(units, 8);
+
+  // Re-pricing leaves recorded deals alone
+  assert_int_equal(set_good_price("StatGood", "StatSupplier", 20.0), 1);
+  assert_true(broker_stats_sum("StatBroker", &units) == 80.0);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  // Its own transaction cannot start inside the caller's: nothing is
+  // applied, and the caller's transaction is not committed
+  assert_int_equal(execute_non_query("BEGIN;"), SQLITE_OK);
+  assert_int_equal(remove_deal((int)second_id), -1);
+  assert_int_equal(aggregates_rebuild(), SQLITE_ERROR);
+  assert_int_equal(sqlite3_get_autocommit(db), 0);
+  assert_int_equal(execute_non_query("ROLLBACK;"), SQLITE_OK);
+  assert_true(broker_stats_sum("StatBroker", &units) == 80.0);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  assert_int_equal(remove_deal((int)second_id), 1);
+  assert_true(broker_stats_sum("StatBroker", &units) == 30.0);
+  assert_int_equal(units, 3);
+
+  assert_int_equal(clear_deals_up_to("2024-01-31", NULL, NULL), SQLITE_OK);
+  assert_true(broker_stats_sum("StatBroker", &units) == 0.0);
+  assert_int_equal(units, 0);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  // A corrupted row is detected and repaired by the full rebuild
+  execute_non_query("UPDATE BrokerStats SET total_sold_units = 42 "
+                    "WHERE broker_surname_fk = 'StatBroker';");
+  assert_int_equal(aggregates_verify(1, NULL), 1);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  // Day numbers are reported as dates
+  execute_non_query("INSERT INTO DailySales (sale_date, good_id, units, "
+                    "revenue) SELECT CAST(julianday('2024-01-10') - 2440587.5 "
+                    "AS INTEGER), good_id, 1, 10.0 FROM Goods "
+                    "WHERE name = 'StatGood';");
+  FILE *out = tmpfile();
+  assert_non_null(out);
+  assert_int_equal(aggregates_verify(1, out), 1);
+  char line[256] = "";
+  rewind(out);
+  assert_non_null(fgets(line, sizeof(line), out));
+  fclose(out);
+  assert_non_null(strstr(line, "DailySales mismatch: 2024-01-10 StatGood / "
+                               "StatSupplier units 1 (expected 0)"));
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+}
+
+static long long good_quantity(const char *name) {
+  DbParam params[] = {DB_TEXT(name)};
+  DbCursor cur;
+  long long quantity = -1;
+  if (db_cursor_open(&cur, "SELECT quantity FROM Goods WHERE name = ?;",
+                     params, DB_PARAM_COUNT(params)) == SQLITE_OK &&
+      db_cursor_next(&cur) == SQLITE_ROW) {
+    quantity = db_cursor_int64(&cur, 0);
+  }
+  db_cursor_close(&cur);
+  return quantity;
+}
+
+static long import_text(const char *text, ImportFormat format,
+                        const ImportOptions *options, ImportStats *stats) {
+  FILE *in = tmpfile();
+  assert_non_null(in);
+  fputs(text, in);
+  rewind(in);
+  int rc = import_deals_stream(in, format, options, stats);
+  fclose(in);
+  return rc;
+}
+
+// Feeds an import through a pipe and deletes a broker from its own
+// connection between the two rows
+static void *import_feeder(void *arg) {
+  int fd = *(int *)arg;
+  const char *first = "2024-05-05,ImpGood,ImpSupplier,,1,ImpBroker,ImpBuyer\n";
+  const char *second = "2024-05-06,ImpGood,ImpSupplier,,1,ImpGone,ImpBuyer\n";
+  int ok = write(fd, first, strlen(first)) > 0 && open_db(TEST_DB_FILE) == 0;
+  if (ok) {
+    ok = execute_non_query("DELETE FROM Brokers WHERE surname = 'ImpGone';") ==
+         SQLITE_OK;
+    close_db();
+  }
+  ok = write(fd, second, strlen(second)) > 0 && ok;
+  close(fd);
+  return ok ? arg : NULL;
+}
+
+static void test_import_deals(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('ImpSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('ImpBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Brokers (surname) "
+                                     "VALUES ('ImpBroker'), ('ImpGone');"),
+                   SQLITE_OK);
+  assert_int_equal(insert_good("ImpGood", "Духи", 10.0, "ImpSupplier",
+                               "2030-01-01", 10),
+                   SQLITE_OK);
+
+  ImportOptions options;
+  import_options_defaults(&options);
+  options.batch_size = 2;
+  options.progress_every = 0;
+  options.reject_path = "test_import_rejects.tsv";
+  ImportStats stats;
+  const char *csv =
+      "deal_date,good_name,supplier,type_of_good,sell_quantity,broker,buyer\n"
+      "2024-05-01,ImpGood,ImpSupplier,,4,ImpBroker,ImpBuyer\n"
+      "2024-05-02,\"ImpGood\",ImpSupplier,Духи,3,ImpBroker,ImpBuyer\n"
+      "2024-02-31,ImpGood,ImpSupplier,,1,ImpBroker,ImpBuyer\n"
+      "2024-05-03,ImpGood,ImpSupplier,,0,ImpBroker,ImpBuyer\n"
+      "2024-05-03,ImpGood,ImpSupplier,,1,NoBroker,ImpBuyer\n"
+      "2024-05-03,ImpGood,ImpSupplier,,4,ImpBroker,ImpBuyer\n" // 3 left
+      "2024-05-03,ImpGood,ImpSupplier,1,ImpBroker,ImpBuyer\n";
+  assert_int_equal(import_text(csv, IMPORT_FORMAT_CSV, &options, &stats), 0);
+  assert_int_equal(stats.rows_read, 7);
+  assert_int_equal(stats.rows_imported, 2);
+  assert_int_equal(stats.rows_rejected, 5);
+  assert_int_equal(stats.batches, 2); // The second holds only rejects
+  assert_int_equal(stats.goods_updates, 1); // One UPDATE for both rows
+  assert_int_equal(good_quantity("ImpGood"), 3);
+  long long units;
+  assert_true(broker_stats_sum("ImpBroker", &units) == 70.0);
+  assert_int_equal(units, 7);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  FILE *rejects = fopen(options.reject_path, "r");
+  assert_non_null(rejects);
+  char line[512];
+  int reject_lines = 0, insufficient = 0;
+  while (fgets(line, sizeof(line), rejects)) {
+    reject_lines++;
+    insufficient += strstr(line, "insufficient quantity") != NULL;
+  }
+  fclose(rejects);
+  remove(options.reject_path);
+  assert_int_equal(reject_lines, 5);
+  assert_int_equal(insufficient, 1);
+
+  // JSONL, with aliases and a bare number
+  options.reject_path = NULL;
+  const char *jsonl =
+      "{\"date\": \"2024-05-04\", \"good_name\": \"ImpGood\", "
+      "\"supplier\": \"ImpSupplier\", \"quantity\": 2, "
+      "\"broker\": \"ImpBroker\", \"buyer\": \"ImpBuyer\"}\n"
+      "{\"date\": \"2024-05-04\", \"good_name\": \"ImpGood\"}\n"
+      "{\"date\": \"2024-05-04\"\n";
+  assert_int_equal(import_text(jsonl, IMPORT_FORMAT_JSONL, &options, &stats),
+                   0);
+  assert_int_equal(stats.rows_imported, 1);
+  assert_int_equal(stats.rows_rejected, 2);
+  assert_int_equal(good_quantity("ImpGood"), 1);
+  assert_true(broker_stats_sum("ImpBroker", &units) == 90.0);
+
+  // A broker deleted by another connection during the import is caught by
+  // the foreign key, not inserted as an orphan
+  options.batch_size = 1;
+  int fds[2];
+  assert_int_equal(pipe(fds), 0);
+  pthread_t feeder;
+  assert_int_equal(pthread_create(&feeder, NULL, import_feeder, &fds[1]), 0);
+  FILE *in = fdopen(fds[0], "r");
+  assert_non_null(in);
+  assert_int_equal(import_deals_stream(in, IMPORT_FORMAT_CSV, &options, &stats),
+                   0);
+  fclose(in);
+  void *fed = NULL;
+  pthread_join(feeder, &fed);
+  assert_non_null(fed);
+  assert_int_equal(stats.rows_imported, 1);
+  assert_int_equal(stats.rows_rejected, 1);
+  assert_int_equal(good_quantity("ImpGood"), 0);
+  DbCursor cur;
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT COUNT(*) FROM Deals WHERE broker_id "
+                                  "NOT IN (SELECT broker_id FROM Brokers);",
+                                  NULL, 0),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_int_equal(db_cursor_int64(&cur, 0), 0);
+  db_cursor_close(&cur);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+}
+
+// First row of a leaderboard: column 0 into name (empty if the board is
+// empty), returns the "TotalUnits" or "Deals" column given by units_col
+static long long leaderboard_first(Leaderboard board, int units_col,
+                                   char *name, size_t name_size) {
+  DbCursor cur;
+  long long value = -1;
+  name[0] = '\0';
+  if (open_leaderboard_cursor(&cur, board, 1) == SQLITE_OK &&
+      db_cursor_next(&cur) == SQLITE_ROW) {
+    snprintf(name, name_size, "%s", db_cursor_text(&cur, 0, NULL));
+    value = db_cursor_int64(&cur, units_col);
+  }
+  db_cursor_close(&cur);
+  return value;
+}
+
+static void test_leaderboards(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('LbSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('LbBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(
+      execute_non_query("INSERT INTO GoodTypes (name) VALUES ('LbType');"),
+      SQLITE_OK);
+  // LbBeta sorts after LbAlpha but is registered first
+  assert_int_equal(execute_non_query("INSERT INTO Brokers (surname) "
+                                     "VALUES ('LbBeta'), ('LbAlpha');"),
+                   SQLITE_OK);
+  assert_int_equal(insert_good("LbBig", "LbType", 1.0, "LbSupplier",
+                               "2030-01-01", 100000),
+                   SQLITE_OK);
+  assert_int_equal(insert_good("LbSmall", "LbType", 1.0, "LbSupplier",
+                               "2030-01-01", 100000),
+                   SQLITE_OK);
+
+  // Five deals each: LbBeta sells 1000 units of LbBig a time, LbAlpha one
+  // unit of LbSmall
+  DealInput big = {"2024-03-10", "LbBig",  "LbSupplier", "LbType",
+                   1000,         "LbBeta", "LbBuyer"};
+  DealInput small = {"2024-03-11", "LbSmall", "LbSupplier", "LbType",
+                     1,            "LbAlpha", "LbBuyer"};
+  for (int i = 0; i < 5; i++) {
+    assert_int_equal(insert_deal(&big), DEAL_RESULT_OK);
+    assert_int_equal(insert_deal(&small), DEAL_RESULT_OK);
+  }
+  sqlite3_int64 last_small_id = sqlite3_last_insert_rowid(db);
+
+  // Equal deal counts: the board orders by surname, the top broker report
+  // picks the broker registered first
+  DbCursor cur;
+  assert_int_equal(
+      open_leaderboard_cursor(&cur, LEADERBOARD_BROKERS_BY_DEALS, 2),
+      SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_string_equal(db_cursor_text(&cur, 0, NULL), "LbAlpha");
+  assert_int_equal(db_cursor_int64(&cur, 1), 5);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_string_equal(db_cursor_text(&cur, 0, NULL), "LbBeta");
+  assert_int_equal(db_cursor_next(&cur), SQLITE_DONE);
+  db_cursor_close(&cur);
+  assert_int_equal(open_top_broker_cursor(&cur), SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_string_equal(db_cursor_text(&cur, 0, NULL), "LbBeta");
+  db_cursor_close(&cur);
+
+  char name[64];
+  assert_int_equal(leaderboard_first(LEADERBOARD_BROKERS_BY_UNITS, 2, name,
+                                     sizeof(name)),
+                   5000);
+  assert_string_equal(name, "LbBeta");
+  assert_int_equal(leaderboard_first(LEADERBOARD_GOODS_BY_UNITS, 3, name,
+                                     sizeof(name)),
+                   5000);
+  assert_string_equal(name, "LbBig");
+  assert_int_equal(leaderboard_first(LEADERBOARD_TYPES_BY_UNITS, 2, name,
+                                     sizeof(name)),
+                   5005);
+  assert_string_equal(name, "LbType");
+  assert_int_equal(open_most_popular_type_cursor(&cur), SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_string_equal(db_cursor_text(&cur, 1, NULL), "LbType");
+  db_cursor_close(&cur);
+
+  assert_int_equal(remove_deal((int)last_small_id), 1);
+  assert_int_equal(leaderboard_first(LEADERBOARD_BROKERS_BY_DEALS, 1, name,
+                                     sizeof(name)),
+                   5);
+  assert_string_equal(name, "LbBeta");
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  // Purged counters stay at zero and drop off the boards
+  assert_int_equal(clear_deals_up_to("2024-03-31", NULL, NULL), SQLITE_OK);
+  leaderboard_first(LEADERBOARD_TYPES_BY_UNITS, 2, name, sizeof(name));
+  assert_string_not_equal(name, "LbType");
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  assert_int_equal(open_leaderboard_cursor(&cur, LEADERBOARD_GOODS_BY_UNITS, 0),
+                   SQLITE_MISMATCH);
+  db_cursor_close(&cur);
+
+  // A corrupted counter is detected and repaired by the full rebuild
+  execute_non_query("UPDATE GoodStats SET deal_count = 7 WHERE good_id = "
+                    "(SELECT good_id FROM Goods WHERE name = 'LbBig');");
+  assert_int_equal(aggregates_verify(1, NULL), 1);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+}
+
+// Rows of a report cursor (closes it); -1 if it could not be opened
+static int count_cursor_rows(DbCursor *cur, int rc_open) {
+  int rows = rc_open == SQLITE_OK ? 0 : -1;
+  while (rows >= 0 && db_cursor_next(cur) == SQLITE_ROW) {
+    rows++;
+  }
+  db_cursor_close(cur);
+  return rows;
+}
+
+static void test_archive_deals(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  ArchiveSettings saved = *archive_get_settings();
+  ArchiveSettings settings = saved;
+  strcpy(settings.dir, "test_archive");
+  archive_set_settings(&settings);
+
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('ArcSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('ArcBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(
+      execute_non_query("INSERT INTO Brokers (surname) VALUES ('ArcBroker');"),
+      SQLITE_OK);
+  assert_int_equal(insert_good("ArcGood", "Духи", 2.0, "ArcSupplier",
+                               "2030-01-01", 1000),
+                   SQLITE_OK);
+  // Older than every other deal of the test database
+  const char *dates[] = {"2019-01-05", "2019-01-05", "2019-01-20",
+                         "2019-02-03"};
+  const int quantities[] = {3, 2, 1, 4};
+  for (int i = 0; i < 4; i++) {
+    DealInput deal = {dates[i],      "ArcGood",   "ArcSupplier", "Духи",
+                      quantities[i], "ArcBroker", "ArcBuyer"};
+    assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  }
+
+  // One deal per chunk: the two deals of 2019-01-05 still go together
+  int archived = -1, chunks = -1;
+  assert_int_equal(archive_deals_up_to("2019-01-31", 1, &archived, &chunks),
+                   SQLITE_OK);
+  assert_int_equal(archived, 3);
+  assert_int_equal(chunks, 2);
+  assert_int_equal(access("test_archive/deals_2019-01.db", R_OK), 0);
+  assert_int_equal(archive_month_count(), 1);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  // Stock is reduced by the sales and again by the purge, exactly as with
+  // clear_deals_up_to
+  DbCursor cur;
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT quantity FROM Goods "
+                                  "WHERE name = 'ArcGood';",
+                                  NULL, 0),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_int_equal(db_cursor_int64(&cur, 0), 984);
+  db_cursor_close(&cur);
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT deal_count, units, revenue "
+                                  "FROM DealArchive WHERE month = '2019-01';",
+                                  NULL, 0),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_int_equal(db_cursor_int64(&cur, 0), 3);
+  assert_int_equal(db_cursor_int64(&cur, 1), 6);
+  assert_true(db_cursor_double(&cur, 2) == 12.0);
+  db_cursor_close(&cur);
+
+  // Reports see the archived deals only when asked to
+  assert_int_equal(
+      count_cursor_rows(&cur, open_deals_on_date_cursor(&cur, "2019-01-05")),
+      0);
+  int rc_open = open_deals_on_date_with_archive_cursor(&cur, "2019-01-05");
+  assert_int_equal(count_cursor_rows(&cur, rc_open), 2);
+  assert_int_equal(open_sales_summary_with_archive_cursor(&cur, "2019-01-01",
+                                                          "2019-02-28"),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_string_equal(db_cursor_text(&cur, 0, NULL), "ArcGood");
+  assert_int_equal(db_cursor_int64(&cur, 1), 10);
+  assert_true(db_cursor_double(&cur, 2) == 20.0);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_DONE);
+  db_cursor_close(&cur);
+
+  // The profile chunk size; a new month gets its own file
+  assert_int_equal(archive_deals_up_to("2019-02-28", 0, &archived, NULL),
+                   SQLITE_OK);
+  assert_int_equal(archived, 1);
+  assert_int_equal(archive_month_count(), 2);
+  assert_int_equal(aggregates_verify(0, NULL), 0);
+
+  // A lost month file is an error, not an empty month
+  remove("test_archive/deals_2019-01.db");
+  assert_int_equal(open_sales_summary_with_archive_cursor(&cur, "2019-01-01",
+                                                          "2019-01-31"),
+                   SQLITE_CANTOPEN);
+  db_cursor_close(&cur);
+  assert_int_equal(archive_deals_up_to("2019-13-01", 0, NULL, NULL),
+                   SQLITE_MISMATCH);
+
+  remove("test_archive/deals_2019-02.db");
+  rmdir("test_archive");
+  archive_set_settings(&saved);
+}
+
+static void test_deal_pages(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('PgSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('PgBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(
+      execute_non_query("INSERT INTO Brokers (surname) VALUES ('PgBroker');"),
+      SQLITE_OK);
+  assert_int_equal(insert_good("PgGood", "Духи", 1.0, "PgSupplier",
+                               "2030-01-01", 100),
+                   SQLITE_OK);
+  const char *dates[] = {"2025-07-01", "2025-07-05", "2025-07-01",
+                         "2025-07-02", "2025-07-05"};
+  for (int i = 0; i < 5; i++) {
+    DealInput deal = {dates[i], "PgGood",   "PgSupplier", "Духи",
+                      1,        "PgBroker", "PgBuyer"};
+    assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  }
+  sqlite3_int64 ids[5];
+  DbCursor cur;
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT deal_id FROM Deals WHERE good_id = "
+                                  "(SELECT good_id FROM Goods "
+                                  "WHERE name = 'PgGood') ORDER BY deal_id;",
+                                  NULL, 0),
+                   SQLITE_OK);
+  for (int i = 0; i < 5; i++) {
+    assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+    ids[i] = db_cursor_int64(&cur, 0);
+  }
+  db_cursor_close(&cur);
+
+  // Newest first, ties by deal_id descending, across page boundaries
+  const int order[] = {4, 1, 3, 2, 0};
+  DealKey after = {0, 0};
+  int seen = 0;
+  for (int pages = 0; pages < 3; pages++) {
+    assert_int_equal(open_broker_deals_page_cursor(
+                         &cur, "PgBroker", pages ? &after : NULL, 2),
+                     SQLITE_OK);
+    int rows = 0;
+    while (db_cursor_next(&cur) == SQLITE_ROW && rows < 2) {
+      assert_int_equal(db_cursor_int64(&cur, 0), ids[order[seen]]);
+      after.deal_id = db_cursor_int64(&cur, 0);
+      after.deal_date = (int)db_cursor_int64(&cur, 1);
+      rows++;
+      seen++;
+    }
+    db_cursor_close(&cur);
+  }
+  assert_int_equal(seen, 5);
+
+  // The printed pages report their continuation
+  DealPage page;
+  assert_int_equal(query_broker_deals_page("PgBroker", NULL, 2, &page, stdout),
+                   SQLITE_OK);
+  assert_true(page.has_more);
+  assert_int_equal(page.last.deal_id, ids[1]);
+  DealKey next = page.last;
+  assert_int_equal(query_broker_deals_page("PgBroker", &next, 2, &page, stdout),
+                   SQLITE_OK);
+  assert_true(page.has_more);
+  assert_int_equal(page.last.deal_id, ids[2]);
+  next = page.last;
+  assert_int_equal(query_broker_deals_page("PgBroker", &next, 2, &page, stdout),
+                   SQLITE_OK);
+  assert_false(page.has_more);
+  assert_int_equal(query_broker_deals_page("PgBroker", NULL, 5, &page, stdout),
+                   SQLITE_OK);
+  assert_false(page.has_more); // Exactly one full page
+  assert_int_equal(query_broker_deals_page("Nobody", NULL, 5, &page, stdout),
+                   SQLITE_OK);
+  assert_false(page.has_more);
+
+  // Deals on a date page by deal_id
+  assert_int_equal(
+      query_deals_on_date_page("2025-07-05", NULL, 1, &page, stdout),
+      SQLITE_OK);
+  assert_true(page.has_more);
+  assert_int_equal(page.last.deal_id, ids[1]);
+  next = page.last;
+  assert_int_equal(
+      query_deals_on_date_page("2025-07-05", &next, 1, &page, stdout),
+      SQLITE_OK);
+  assert_false(page.has_more);
+  assert_int_equal(
+      query_deals_on_date_page("2025-07-05", NULL, 0, &page, stdout),
+      SQLITE_MISMATCH);
+}
+
+static void test_report_cache(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  report_cache_clear();
+  ReportCacheStats before, after;
+  report_cache_get_stats(&before);
+
+  // Same report and parameters: the second run is a hit
+  assert_int_equal(query_top_broker_info(stdout), SQLITE_OK);
+  assert_int_equal(query_top_broker_info(stdout), SQLITE_OK);
+  report_cache_get_stats(&after);
+  assert_int_equal(after.misses - before.misses, 1);
+  assert_int_equal(after.hits - before.hits, 1);
+  assert_int_equal(after.entries, 1);
+  assert_true(after.bytes > 0);
+
+  // Other parameters are another entry
+  assert_int_equal(query_buyers_by_good("NoSuchGood", stdout), SQLITE_OK);
+  assert_int_equal(query_buyers_by_good("OtherGood", stdout), SQLITE_OK);
+  assert_int_equal(query_buyers_by_good("NoSuchGood", stdout), SQLITE_OK);
+  report_cache_get_stats(&after);
+  assert_int_equal(after.misses - before.misses, 3);
+  assert_int_equal(after.hits - before.hits, 2);
+  assert_int_equal(after.entries, 3);
+
+  // A commit of this connection empties the cache
+  assert_int_equal(
+      execute_non_query("INSERT INTO Brokers (surname) VALUES ('CacheOne');"),
+      SQLITE_OK);
+  assert_int_equal(query_top_broker_info(stdout), SQLITE_OK);
+  report_cache_get_stats(&after);
+  assert_int_equal(after.invalidations - before.invalidations, 1);
+  assert_int_equal(after.misses - before.misses, 4);
+  assert_int_equal(after.entries, 1);
+
+  // So does a commit of another connection
+  sqlite3 *other = NULL;
+  assert_int_equal(sqlite3_open(TEST_DB_FILE, &other), SQLITE_OK);
+  sqlite3_busy_timeout(other, 5000);
+  assert_int_equal(sqlite3_exec(other,
+                                "INSERT INTO Brokers (surname) "
+                                "VALUES ('CacheTwo');",
+                                NULL, NULL, NULL),
+                   SQLITE_OK);
+  sqlite3_close(other);
+  assert_int_equal(query_top_broker_info(stdout), SQLITE_OK);
+  report_cache_get_stats(&after);
+  assert_int_equal(after.invalidations - before.invalidations, 2);
+  assert_int_equal(after.misses - before.misses, 5);
+
+  // Inside a transaction the report is always computed
+  assert_int_equal(execute_non_query("BEGIN;"), SQLITE_OK);
+  assert_int_equal(query_top_broker_info(stdout), SQLITE_OK);
+  assert_int_equal(execute_non_query("COMMIT;"), SQLITE_OK);
+  // Turned off: neither kept nor counted
+  ReportCacheSettings saved = *report_cache_get_settings();
+  ReportCacheSettings off = {0};
+  report_cache_set_settings(&off);
+  assert_int_equal(query_top_broker_info(stdout), SQLITE_OK);
+  report_cache_set_settings(&saved);
+  report_cache_get_stats(&after);
+  assert_int_equal(after.hits - before.hits, 2);
+  assert_int_equal(after.misses - before.misses, 5);
+
+  report_cache_clear();
+  report_cache_get_stats(&after);
+  assert_int_equal(after.entries, 0);
+  assert_int_equal(after.bytes, 0);
+}
+
+static void test_cli_batch(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  char line[] = "add broker --surname \"Cli  Broker\" # comment";
+  char *words[CLI_MAX_WORDS];
+  assert_int_equal(cli_split_line(line, words, CLI_MAX_WORDS), 4);
+  assert_string_equal(words[1], "broker");
+  assert_string_equal(words[3], "Cli  Broker");
+  char escaped[] = "\"a \\\"b\\\"\" c";
+  assert_int_equal(cli_split_line(escaped, words, CLI_MAX_WORDS), 2);
+  assert_string_equal(words[0], "a \"b\"");
+  char open_quote[] = "report \"buyers";
+  assert_int_equal(cli_split_line(open_quote, words, CLI_MAX_WORDS), -1);
+
+  // Credentials from a file
+  FILE *fp = fopen("test_credentials", "w");
+  assert_non_null(fp);
+  fprintf(fp, "# batch user\nuser = testuser\npassword = testpass\n");
+  fclose(fp);
+  UserSession admin;
+  assert_int_equal(cli_login("test_credentials", &admin), 0);
+  assert_string_equal(admin.role, "admin");
+  remove("test_credentials");
+  assert_int_equal(cli_login("test_credentials", &admin), 1);
+  assert_int_equal(cli_login(NULL, &admin), 1); // Nothing in environment
+
+  char *add[] = {"add", "broker", "--surname", "CliBroker", "--birth-year",
+                 "1980"};
+  assert_int_equal(cli_run_command(&admin, 6, add, stdout, stderr), 0);
+  DbCursor cur;
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT birth_year FROM Brokers "
+                                  "WHERE surname = 'CliBroker';",
+                                  NULL, 0),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_int_equal(db_cursor_int64(&cur, 0), 1980);
+  db_cursor_close(&cur);
+  char *unknown[] = {"report", "nothing"};
+  assert_int_equal(cli_run_command(&admin, 2, unknown, stdout, stderr), 2);
+  char *missing[] = {"report", "sales", "--from", "2024-01-01"};
+  assert_int_equal(cli_run_command(&admin, 4, missing, stdout, stderr), 2);
+  char *bad_year[] = {"add", "broker", "--surname", "X", "--birth-year", "y"};
+  assert_int_equal(cli_run_command(&admin, 6, bad_year, stdout, stderr), 2);
+  char *duplicate[] = {"add", "broker", "--surname", "CliBroker"};
+  assert_int_equal(cli_run_command(&admin, 4, duplicate, stdout, stderr), 1);
+
+  // A broker runs the broker menu's commands, on their own deals only
+  UserSession broker = {"clibroker", "broker", "CliBroker", 1};
+  char *top[] = {"report", "top-broker"};
+  assert_int_equal(cli_run_command(&broker, 2, top, stdout, stderr), 3);
+  char *own[] = {"deals", "broker", "--limit", "5"};
+  assert_int_equal(cli_run_command(&broker, 4, own, stdout, stderr), 0);
+  char *other[] = {"deals", "broker", "--surname", "PgBroker"};
+  assert_int_equal(cli_run_command(&broker, 4, other, stdout, stderr), 3);
+
+  // Output and errors go to the given streams (the server's reply buffer)
+  char *text = NULL;
+  size_t text_len = 0;
+  FILE *out = open_memstream(&text, &text_len);
+  assert_non_null(out);
+  char *help[] = {"help"};
+  assert_int_equal(cli_run_command(&broker, 1, help, out, out), 0);
+  assert_int_equal(cli_run_command(&broker, 4, other, out, out), 3);
+  char *bad_date[] = {"deals", "on-date", "--date", "2024-13-01"};
+  assert_int_equal(cli_run_command(&admin, 4, bad_date, out, out), 1);
+  fclose(out);
+  assert_non_null(strstr(text, "Команды:\n  report buyers"));
+  assert_null(strstr(text, "report top-broker"));
+  assert_non_null(strstr(text, "only their own deals"));
+  assert_non_null(strstr(text, "!!! cli: Invalid date or argument.\n"));
+  free(text);
+
+  // A script stops at the first failure unless told to keep going
+  fp = fopen("test_script", "w");
+  assert_non_null(fp);
+  fprintf(fp, "\n# reports\nreport popular-type\nreport nothing\n"
+              "add broker --surname \"Cli Script\"\n");
+  fclose(fp);
+  fp = fopen("test_script", "r");
+  assert_int_equal(cli_run_script(&admin, fp, "test_script", 0), 2);
+  fclose(fp);
+  assert_int_equal(count_cursor_rows(&cur, db_cursor_open(
+                                               &cur,
+                                               "SELECT 1 FROM Brokers WHERE "
+                                               "surname = 'Cli Script';",
+                                               NULL, 0)),
+                   0);
+  fp = fopen("test_script", "r");
+  assert_int_equal(cli_run_script(&admin, fp, "test_script", 1), 2);
+  fclose(fp);
+  remove("test_script");
+  assert_int_equal(count_cursor_rows(&cur, db_cursor_open(
+                                               &cur,
+                                               "SELECT 1 FROM Brokers WHERE "
+                                               "surname = 'Cli Script';",
+                                               NULL, 0)),
+                   1);
+}
+
+#define TEST_SOCKET "test_server.sock"
+#define TEST_SERVER_DEAL                                                       \
+  "add deal --date 2024-02-02 --good ServerGood --supplier ServerSupplier "    \
+  "--quantity 1 --broker ServerBroker --buyer ServerBuyer\n"
+
+// Connects to the test server, waiting for it to listen; -1 if it does not
+static int connect_test_server(void) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, TEST_SOCKET);
+  int fd = -1;
+  for (int attempt = 0; fd < 0 && attempt < 200; attempt++) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      fd = -1;
+      struct timespec pause = {0, 10 * 1000 * 1000};
+      nanosleep(&pause, NULL);
+    }
+  }
+  return fd;
+}
+
+// Sends requests and reads until the server closes; returns the reply length
+static size_t exchange(int fd, const char *requests, char *reply,
+                       size_t size) {
+  size_t len = 0;
+  ssize_t n;
+  if (fd >= 0 && write(fd, requests, strlen(requests)) ==
+                     (ssize_t)strlen(requests)) {
+    while (len < size - 1 && (n = read(fd, reply + len, size - 1 - len)) > 0) {
+      len += (size_t)n;
+    }
+  }
+  reply[len] = '\0';
+  if (fd >= 0) {
+    close(fd);
+  }
+  return len;
+}
+
+// The server runs in a child process on the inherited connection; the parent
+// leaves the database alone until the child has exited
+static void test_server_mode(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('ServerSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('ServerBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(insert_good("ServerGood", "Духи", 3.0, "ServerSupplier",
+                               NULL, 30),
+                   SQLITE_OK);
+  fflush(stdout);
+  pid_t child = fork();
+  assert_true(child >= 0);
+  if (child == 0) {
+    _exit(server_run(TEST_SOCKET) == 0 ? 0 : 1);
+  }
+
+  // Pipelined requests, answered in order
+  char reply[4096];
+  exchange(connect_test_server(),
+           "ping\nreport popular-type\nlogin testuser wrong\n"
+           "login testuser testpass\nreport nothing\n"
+           "add broker --surname ServerBroker\n" TEST_SERVER_DEAL
+           "ping\nquit\n",
+           reply, sizeof(reply));
+  // Clients that hang up right after queueing a deal: the writer records it
+  // after they are gone, and the server must not touch them again
+  for (int i = 0; i < 20; i++) {
+    int fd = connect_test_server();
+    // Every other one also queues a quit, run when the deal completes
+    const char *deal = i % 2 ? "login testuser testpass\n" TEST_SERVER_DEAL
+                             : "login testuser testpass\n" TEST_SERVER_DEAL
+                               "quit\n";
+    if (fd >= 0) {
+      assert_int_equal(write(fd, deal, strlen(deal)), (ssize_t)strlen(deal));
+      close(fd);
+    }
+  }
+  // A login is checked off the loop: another client is served meanwhile, and
+  // the requests sent after the login wait for its answer
+  const char *login = "login testuser testpass\nping\nquit\n";
+  int slow = connect_test_server();
+  if (slow >= 0) {
+    assert_int_equal(write(slow, login, strlen(login)), (ssize_t)strlen(login));
+  }
+  char other[64], logged_in[128];
+  exchange(connect_test_server(), "ping\nquit\n", other, sizeof(other));
+  exchange(slow, "", logged_in, sizeof(logged_in));
+  char still_up[64];
+  exchange(connect_test_server(), "ping\nquit\n", still_up, sizeof(still_up));
+  // Stopped before any assertion, so a failure leaves no server behind
+  int status = 0;
+  assert_int_equal(kill(child, SIGTERM), 0);
+  assert_int_equal(waitpid(child, &status, 0), child);
+  assert_true(WIFEXITED(status));
+  assert_int_equal(WEXITSTATUS(status), 0);
+
+  const char *expected =
+      "0 5\npong\n"
+      "3 25\n!!! server: login first.\n"
+      "3 26\n!!! server: Login failed.\n"
+      "0 17\ntestuser (admin)\n"
+      "2 55\n!!! cli: Unknown command 'report nothing'; try 'help'.\n"
+      "0 ";
+  char head[512];
+  snprintf(head, strlen(expected) + 1, "%s", reply);
+  assert_string_equal(head, expected);
+  // The deal goes through the group commit; later requests wait for it
+  assert_non_null(strstr(reply, "остатки обновлены.\n0 5\npong\n0 0\n"));
+  assert_string_equal(other, "0 5\npong\n0 0\n");
+  assert_string_equal(logged_in, "0 17\ntestuser (admin)\n0 5\npong\n0 0\n");
+  assert_string_equal(still_up, "0 5\npong\n0 0\n");
+  assert_int_not_equal(access(TEST_SOCKET, F_OK), 0); // Removed on exit
+  DbCursor cur;
+  assert_int_equal(count_cursor_rows(&cur, db_cursor_open(
+                                               &cur,
+                                               "SELECT 1 FROM Brokers WHERE "
+                                               "surname = 'ServerBroker';",
+                                               NULL, 0)),
+                   1);
+}
+
+static void record_deal_result(void *ctx, DealResult result) {
+  *(DealResult *)ctx = result;
+}
+
+static void test_deal_writer(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('WriterSupplier');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('WriterBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Brokers (surname) "
+                                     "VALUES ('WriterBroker');"),
+                   SQLITE_OK);
+  assert_int_equal(insert_good("WriterGood", "Духи", 3.0, "WriterSupplier",
+                               NULL, 5),
+                   SQLITE_OK);
+  // The window lets the three queued deals share one transaction; the third
+  // fills the batch and closes it
+  DealWriter *writer = deal_writer_create(TEST_DB_FILE, 3, 200);
+  assert_non_null(writer);
+  DealInput ok = {"2024-02-01", "WriterGood",   "WriterSupplier", "Духи",
+                  2,            "WriterBroker", "WriterBuyer"};
+  DealInput too_many = ok, unknown = ok;
+  too_many.quantity = 10;
+  unknown.broker = "NoSuchBroker";
+  DealResult results[3] = {DEAL_RESULT_ERROR, DEAL_RESULT_OK, DEAL_RESULT_OK};
+  const DealInput *deals[3] = {&ok, &too_many, &unknown};
+  DealSubmission subs[3];
+  for (int i = 0; i < 3; i++) {
+    memset(&subs[i], 0, sizeof(subs[i]));
+    subs[i].deal = deals[i];
+    subs[i].done = record_deal_result;
+    subs[i].ctx = &results[i];
+    assert_int_equal(deal_writer_submit(writer, &subs[i]), 0);
+  }
+  // Queued behind the first batch, so that one is done when this returns
+  DealInput rest = ok;
+  rest.quantity = 3;
+  assert_int_equal(deal_writer_insert(writer, &rest), DEAL_RESULT_OK);
+  assert_int_equal(results[0], DEAL_RESULT_OK);
+  assert_int_equal(results[1], DEAL_RESULT_NO_STOCK); // Only this one failed
+  assert_int_equal(results[2], DEAL_RESULT_ERROR);
+  DealWriterStats stats;
+  deal_writer_get_stats(writer, &stats);
+  assert_int_equal(stats.deals, 4);
+  assert_int_equal(stats.batches, 2);
+  assert_int_equal(stats.largest_batch, 3);
+  deal_writer_destroy(writer);
+
+  DbCursor cur;
+  assert_int_equal(db_cursor_open(&cur,
+                                  "SELECT quantity FROM Goods "
+                                  "WHERE name = 'WriterGood';",
+                                  NULL, 0),
+                   SQLITE_OK);
+  assert_int_equal(db_cursor_next(&cur), SQLITE_ROW);
+  assert_int_equal(db_cursor_int64(&cur, 0), 0);
+  db_cursor_close(&cur);
+  assert_int_equal(aggregates_verify(0, stdout), 0);
+}
+
+static int open_buyer_count_job(DbCursor *cur, const void *arg) {
+  (void)arg;
+  return db_cursor_open(cur, "SELECT COUNT(*) AS Buyers FROM Buyers;", NULL, 0);
+}
+
+static void test_report_pool_snapshot(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  ReportJob serial[1] = {{"buyers", open_buyer_count_job, NULL, NULL, 0, 0, 0}};
+  assert_int_equal(report_pool_run(NULL, serial, 1), SQLITE_OK);
+  assert_non_null(serial[0].output);
+
+  ReportPool *pool = report_pool_create(TEST_DB_FILE, 3);
+  assert_non_null(pool);
+  assert_int_equal(report_pool_size(pool), 3);
+  ReportJob jobs[4];
+  for (int i = 0; i < 4; i++) {
+    jobs[i] = serial[0];
+  }
+
+  // A commit after start() must not be visible to the jobs of that run
+  assert_int_equal(report_pool_start(pool, jobs, 4), 0);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('PoolBuyer');"),
+                   SQLITE_OK);
+  assert_int_equal(report_pool_wait(pool), SQLITE_OK);
+  for (int i = 0; i < 4; i++) {
+    assert_string_equal(jobs[i].output, serial[0].output);
+  }
+  report_jobs_release(jobs, 4);
+
+  // The next run sees the new row
+  assert_int_equal(report_pool_run(pool, jobs, 1), SQLITE_OK);
+  assert_true(strcmp(jobs[0].output, serial[0].output) != 0);
+  report_jobs_release(jobs, 1);
+  report_jobs_release(serial, 1);
+  report_pool_destroy(pool);
+}
+
+// Slow enough that every worker of the pool gets a job
+static int open_tick_job(DbCursor *cur, const void *arg) {
+  (void)arg;
+  nanosleep(&(struct timespec){0, 1000000}, NULL);
+  return db_cursor_open(cur, "SELECT n FROM PoolTick;", NULL, 0);
+}
+
+// Commits from its own connection as fast as it can until told to stop
+static void *tick_committer(void *arg) {
+  atomic_int *stop = arg;
+  if (open_db(TEST_DB_FILE) != 0) {
+    return NULL;
+  }
+  execute_non_query("PRAGMA synchronous = OFF;");
+  while (!atomic_load(stop)) {
+    execute_non_query("UPDATE PoolTick SET n = n + 1;");
+  }
+  close_db();
+  return arg;
+}
+
+static void test_report_pool_concurrent_commits(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("CREATE TABLE PoolTick (n INTEGER);"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO PoolTick VALUES (0);"),
+                   SQLITE_OK);
+  ReportPool *pool = report_pool_create(TEST_DB_FILE, 4);
+  assert_non_null(pool);
+  atomic_int stop = 0;
+  pthread_t committer;
+  assert_int_equal(pthread_create(&committer, NULL, tick_committer, &stop), 0);
+
+  // Another connection keeps committing while the workers begin: every job
+  // of one run must still read the same value
+  ReportJob jobs[8];
+  int disagreements = 0;
+  for (int run = 0; run < 300; run++) {
+    for (int i = 0; i < 8; i++) {
+      jobs[i] = (ReportJob){NULL, open_tick_job, NULL, NULL, 0, 0, 0};
+    }
+    assert_int_equal(report_pool_run(pool, jobs, 8), SQLITE_OK);
+    for (int i = 1; i < 8; i++) {
+      disagreements += strcmp(jobs[i].output, jobs[0].output) != 0;
+    }
+    report_jobs_release(jobs, 8);
+  }
+  atomic_store(&stop, 1);
+  void *committed = NULL;
+  pthread_join(committer, &committed);
+  assert_non_null(committed);
+  report_pool_destroy(pool);
+  assert_int_equal(disagreements, 0);
+  assert_int_equal(execute_non_query("DROP TABLE PoolTick;"), SQLITE_OK);
+}
+
+static void test_analytics_matches_sql(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Suppliers (supplier_name) "
+                                     "VALUES ('AnaSupA'), ('AnaSupB');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('AnaBuyerA'), ('AnaBuyerB');"),
+                   SQLITE_OK);
+  assert_int_equal(execute_non_query("INSERT INTO Brokers (surname, address) "
+                                     "VALUES ('AnaBroker', 'Ana St');"),
+                   SQLITE_OK);
+  // One name from two suppliers: a single row in the name-grouped reports
+  assert_int_equal(insert_good("AnaGood", "Духи", 3.0, "AnaSupA", NULL, 100),
+                   SQLITE_OK);
+  assert_int_equal(insert_good("AnaGood", "Духи", 4.5, "AnaSupB", NULL, 100),
+                   SQLITE_OK);
+  DealInput deal = {"2024-07-01", "AnaGood",   "AnaSupA", "Духи",
+                    4,            "AnaBroker", "AnaBuyerA"};
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  deal.supplier = "AnaSupB";
+  deal.buyer = "AnaBuyerB";
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  deal.type = NULL; // Untyped deals stay out of the most popular type
+  deal.date = "2024-08-15";
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+
+  AnalyticsStore *store = analytics_create();
+  assert_non_null(store);
+  assert_int_equal(
+      analytics_cross_check(store, "2024-01-01", "2024-07-31", stdout), 0);
+  size_t loaded = analytics_deal_count(store);
+  assert_true(loaded >= 3);
+
+  // New deals are appended, deleted ones force a reload
+  deal.quantity = 7;
+  assert_int_equal(insert_deal(&deal), DEAL_RESULT_OK);
+  sqlite3_int64 last_id = sqlite3_last_insert_rowid(db);
+  assert_int_equal(
+      analytics_cross_check(store, "2024-08-01", "2024-08-31", stdout), 0);
+  assert_int_equal(analytics_deal_count(store), loaded + 1);
+  assert_int_equal(remove_deal((int)last_id), 1);
+  assert_int_equal(
+      analytics_cross_check(store, "2020-01-01", "2030-12-31", stdout), 0);
+  assert_int_equal(analytics_deal_count(store), loaded);
+
+  assert_int_equal(analytics_sales_summary(store, "2024-13-01", "2024-12-31",
+                                           stdout),
+                   SQLITE_MISMATCH);
+  analytics_destroy(store);
+}
+
+static void test_sql_profiler(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  assert_int_equal(execute_non_query("INSERT INTO Buyers (buyer_name) "
+                                     "VALUES ('ProfiledBuyer');"),
+                   SQLITE_OK);
+  db_profiler_reset();
+  db_profiler_enable(1);
+  assert_int_equal(execute_select_query("SELECT buyer_name FROM Buyers "
+                                        "WHERE buyer_name = 'ProfiledBuyer';"),
+                   SQLITE_OK);
+  assert_int_equal(execute_select_query("SELECT buyer_name FROM Buyers "
+                                        "WHERE buyer_name = 'Nobody';"),
+                   SQLITE_OK);
+  db_profiler_enable(0);
+
+  const char *path = "test_sql_profile.txt";
+  assert_int_equal(db_profiler_dump(path), 0);
+  FILE *in = fopen(path, "r");
+  assert_non_null(in);
+  static char text[16384];
+  size_t len = fread(text, 1, sizeof(text) - 1, in);
+  text[len] = '\0';
+  fclose(in);
+  remove(path);
+  // Both runs share one normalized entry with 2 calls and 1 row
+  const char *line =
+      strstr(text, "SELECT buyer_name FROM Buyers WHERE buyer_name = ?");
+  assert_non_null(line);
+  while (line > text && line[-1] != '\n') {
+    line--;
+  }
+  long calls = -1;
+  double total = 0, mean = 0, p99 = 0;
+  long rows = -1;
+  assert_int_equal(sscanf(line, "%ld %lf %lf %lf %ld", &calls, &total, &mean,
+                          &p99, &rows),
+                   5);
+  assert_int_equal(calls, 2);
+  assert_int_equal(rows, 1);
+
+  db_profiler_reset();
+}
+
 // --- Placeholder tests for auth.c ---
 // These should be moved to test_auth.c and implemented fully
 
 static void test_auth_login_success(void **state) {
   (void)state;
-  printf("--- Running test: %s (Placeholder) ---\n", __func__);
-  assert_true(1);
+  printf("--- Running test: %s ---\n", __func__);
+  UserSession session;
+  assert_int_equal(login_user("testuser", "testpass", &session), 0);
+  assert_int_equal(session.is_authenticated, 1);
+  assert_string_equal(session.role, "admin");
 }
 static void test_auth_login_fail_password(void **state) {
   (void)state;
-  printf("--- Running test: %s (Placeholder) ---\n", __func__);
-  assert_true(1);
+  printf("--- Running test: %s ---\n", __func__);
+  UserSession session;
+  assert_int_equal(login_user("testuser", "wrongpass", &session), 1);
+  assert_int_equal(session.is_authenticated, 0);
 }
 static void test_auth_login_fail_user(void **state) {
   (void)state;
-  printf("--- Running test: %s (Placeholder) ---\n", __func__);
-  assert_true(1);
+  printf("--- Running test: %s ---\n", __func__);
+  UserSession session;
+  // Injection attempt is just an unknown username with bound parameters
+  assert_int_equal(login_user("nobody' OR '1'='1", "x", &session), 1);
+  assert_int_equal(session.is_authenticated, 0);
+}
+
+static void test_pbkdf2_vectors(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  char hex[2 * 64 + 1];
+  unsigned char out[64];
+  Sha256 ctx;
+  sha256_init(&ctx);
+  sha256_update(&ctx, "abc", 3);
+  sha256_final(&ctx, out);
+  for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+    sprintf(hex + 2 * i, "%02x", out[i]);
+  }
+  assert_string_equal(hex, "ba7816bf8f01cfea414140de5dae2223"
+                           "b00361a396177a9cb410ff61f20015ad");
+  // RFC 7914, section 11
+  pbkdf2_hmac_sha256("passwd", 6, "salt", 4, 1, out, 64);
+  for (int i = 0; i < 64; i++) {
+    sprintf(hex + 2 * i, "%02x", out[i]);
+  }
+  assert_string_equal(hex,
+                      "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d5"
+                      "7c20dacbc49ca9cccf179b645991664b39d77ef317c71b845b1e30b"
+                      "d509112041d3a19783");
+  pbkdf2_hmac_sha256("Password", 8, "NaCl", 4, 80000, out, 64);
+  for (int i = 0; i < 64; i++) {
+    sprintf(hex + 2 * i, "%02x", out[i]);
+  }
+  assert_string_equal(hex,
+                      "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff088"
+                      "76b34ab56a1d425a1225833549adb841b51c9b3176a272bdebba1d0"
+                      "78478f62b397f33c8d");
+}
+
+// Stored hash of a user, or "" if none
+static void stored_password_hash(const char *user, char *out, size_t size) {
+  DbCursor cur;
+  DbParam params[] = {DB_TEXT(user)};
+  out[0] = '\0';
+  if (db_cursor_open(&cur,
+                     "SELECT password_hash FROM Users WHERE username = ?;",
+                     params, 1) == SQLITE_OK &&
+      db_cursor_next(&cur) == SQLITE_ROW) {
+    snprintf(out, size, "%s", db_cursor_text(&cur, 0, NULL));
+  }
+  db_cursor_close(&cur);
+}
+
+static void set_password_hash(const char *user, const char *hash) {
+  DbParam params[] = {DB_TEXT(hash), DB_TEXT(user)};
+  assert_int_equal(
+      execute_non_query_params(
+          "UPDATE Users SET password_hash = ? WHERE username = ?;", params, 2),
+      0);
+}
+
+static void test_auth_password_hashes(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  char hash[AUTH_HASH_SIZE], other[AUTH_HASH_SIZE];
+  // Migration 9 replaced the legacy value of the schema script
+  stored_password_hash("testuser", hash, sizeof(hash));
+  assert_int_equal(strncmp(hash, "pbkdf2-sha256$", 14), 0);
+  assert_int_equal(password_needs_rehash(hash), 0);
+
+  // Salted: the same password hashes differently, both verify
+  hash_password("secret", hash, sizeof(hash));
+  hash_password("secret", other, sizeof(other));
+  assert_string_not_equal(hash, other);
+  assert_int_equal(verify_password("secret", hash), 1);
+  assert_int_equal(verify_password("secret", other), 1);
+  assert_int_equal(verify_password("Secret", hash), 0);
+  hash[strlen(hash) - 1] ^= 1; // Corrupt the last hex digit
+  assert_int_equal(verify_password("secret", hash), 0);
+  assert_int_equal(verify_password("secret", "hashed_secret"), 1);
+  assert_int_equal(verify_password("secre", "hashed_secret"), 0);
+  assert_int_equal(verify_password("secret", "pbkdf2-sha256$0$00$00"), 0);
+  assert_int_equal(password_needs_rehash("hashed_secret"), 1);
+
+  // A legacy hash and one of another cost are replaced on login
+  AuthStats before, after;
+  UserSession session;
+  auth_login_cache_clear();
+  set_password_hash("testuser", "hashed_legacypass");
+  auth_get_stats(&before);
+  assert_int_equal(login_user("testuser", "legacypass", &session), 0);
+  auth_get_stats(&after);
+  assert_int_equal(after.rehashes - before.rehashes, 1);
+  stored_password_hash("testuser", hash, sizeof(hash));
+  assert_int_equal(strncmp(hash, "pbkdf2-sha256$", 14), 0);
+  assert_int_equal(verify_password("legacypass", hash), 1);
+
+  AuthSettings settings = *auth_get_settings();
+  AuthSettings costly = settings;
+  costly.password_iterations = settings.password_iterations * 2;
+  auth_set_settings(&costly);
+  assert_int_equal(password_needs_rehash(hash), 1);
+  auth_login_cache_clear();
+  assert_int_equal(login_user("testuser", "legacypass", &session), 0);
+  stored_password_hash("testuser", other, sizeof(other));
+  assert_string_not_equal(hash, other);
+  assert_int_equal(password_needs_rehash(other), 0);
+  auth_set_settings(&settings);
+
+  hash_password("testpass", hash, sizeof(hash));
+  set_password_hash("testuser", hash);
+  auth_login_cache_clear();
+}
+
+static void test_auth_login_cache(void **state) {
+  (void)state;
+  printf("--- Running test: %s ---\n", __func__);
+  AuthStats before, after;
+  UserSession session;
+  auth_login_cache_clear();
+  auth_get_stats(&before);
+  assert_int_equal(login_user("testuser", "testpass", &session), 0);
+  assert_int_equal(login_user("testuser", "testpass", &session), 0);
+  assert_string_equal(session.role, "admin");
+  auth_get_stats(&after);
+  assert_int_equal(after.hashes - before.hashes, 1); // Second one cached
+  assert_int_equal(after.cache_hits - before.cache_hits, 1);
+
+  // A wrong password is never answered from the cache
+  before = after;
+  assert_int_equal(login_user("testuser", "testpasS", &session), 1);
+  auth_get_stats(&after);
+  assert_int_equal(after.hashes - before.hashes, 1);
+  assert_int_equal(after.cache_hits, before.cache_hits);
+
+  // An unknown user costs the same hash as a wrong password
+  before = after;
+  assert_int_equal(login_user("nosuchuser", "testpass", &session), 1);
+  auth_get_stats(&after);
+  assert_int_equal(after.hashes - before.hashes, 1);
+
+  // Changing the stored password invalidates the remembered login
+  char hash[AUTH_HASH_SIZE];
+  hash_password("newpass", hash, sizeof(hash));
+  set_password_hash("testuser", hash);
+  assert_int_equal(login_user("testuser", "testpass", &session), 1);
+  assert_int_equal(login_user("testuser", "newpass", &session), 0);
+
+  // Off with login_cache_ttl_s = 0
+  AuthSettings settings = *auth_get_settings();
+  AuthSettings uncached = settings;
+  uncached.login_cache_ttl_s = 0;
+  auth_set_settings(&uncached);
+  auth_get_stats(&before);
+  assert_int_equal(login_user("testuser", "newpass", &session), 0);
+  auth_get_stats(&after);
+  assert_int_equal(after.cache_hits, before.cache_hits);
+  auth_set_settings(&settings);
+
+  hash_password("testpass", hash, sizeof(hash));
+  set_password_hash("testuser", hash);
+  auth_login_cache_clear();
 }
 
 // --- Main Test Runner ---
@@ -293,29 +2006,63 @@ int main(void) {
   const struct CMUnitTest db_tests[] = {
       cmocka_unit_test(test_open_close_db_success),
       cmocka_unit_test(test_init_tables_run_once),
+      cmocka_unit_test(test_schema_migrations),
+      cmocka_unit_test(test_init_tables_embedded),
       cmocka_unit_test(test_execute_non_query_success),
       cmocka_unit_test(test_execute_non_query_fail_syntax),
       cmocka_unit_test(test_execute_select_query_found),
       cmocka_unit_test(test_execute_select_query_not_found),
+      cmocka_unit_test(test_execute_non_query_params_binds_text),
+      cmocka_unit_test(test_stmt_cache_reuses_statement),
+      cmocka_unit_test(test_cursor_typed_columns),
+      cmocka_unit_test(test_profile_keys),
+      cmocka_unit_test(test_query_budgets),
+      cmocka_unit_test(test_db_memory),
       // Add more tests specifically validating db.c logic here
   };
 
   // Group for tests primarily exercising queries.c functions (Placeholders)
   const struct CMUnitTest query_tests[] = {
       cmocka_unit_test(test_query_sales_summary),
+      cmocka_unit_test(test_date_encoding),
       cmocka_unit_test(test_query_buyers_by_good),
       cmocka_unit_test(test_query_most_popular),
+      cmocka_unit_test(test_broker_stats_incremental),
+      cmocka_unit_test(test_import_deals),
+      cmocka_unit_test(test_leaderboards),
+      cmocka_unit_test(test_archive_deals),
+      cmocka_unit_test(test_deal_pages),
+      cmocka_unit_test(test_report_cache),
+      cmocka_unit_test(test_cli_batch),
+      cmocka_unit_test(test_server_mode),
+      cmocka_unit_test(test_deal_writer),
+      cmocka_unit_test(test_report_pool_snapshot),
+      cmocka_unit_test(test_report_pool_concurrent_commits),
+      cmocka_unit_test(test_analytics_matches_sql),
+      cmocka_unit_test(test_sql_profiler),
       // Add more tests specifically validating queries.c logic here
   };
 
-  // Group for tests primarily exercising auth.c functions (Placeholders)
+  // Group for tests primarily exercising auth.c functions
   const struct CMUnitTest auth_tests[] = {
       cmocka_unit_test(test_auth_login_success),
       cmocka_unit_test(test_auth_login_fail_password),
       cmocka_unit_test(test_auth_login_fail_user),
+      cmocka_unit_test(test_pbkdf2_vectors),
+      cmocka_unit_test(test_auth_password_hashes),
+      cmocka_unit_test(test_auth_login_cache),
       // Add more tests specifically validating auth.c logic here
   };
 
+  // The whole suite runs over the page cache arena and the small-block pool
+  DbMemorySettings memory = *db_memory_get_settings();
+  memory.page_cache_kb = 512;
+  memory.mem_pool_kb = 1024;
+  db_memory_set_settings(&memory);
+  AuthSettings auth = *auth_get_settings();
+  auth.password_iterations = 1000; // Logins stay cheap in the tests
+  auth_set_settings(&auth);
+
   // Run tests with setup/teardown for each group
   int failed = 0;
   printf("\n--- Running DB Tests ---\n");
@@ -324,7 +2071,7 @@ int main(void) {
   printf("\n--- Running Query Tests (Placeholders) ---\n");
   failed += cmocka_run_group_tests(query_tests, setup_db, teardown_db);
 
-  printf("\n--- Running Auth Tests (Placeholders) ---\n");
+  printf("\n--- Running Auth Tests ---\n");
   failed += cmocka_run_group_tests(auth_tests, setup_db, teardown_db);
 
   // You might have other test groups or standalone tests here
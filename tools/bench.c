@@ -0,0 +1,1136 @@
+// tools/bench.c
+// Benchmark suite: generates a deterministic synthetic dataset (Zipf-
+// distributed goods, brokers and buyers) and times every public operation of
+// queries.c, the analytics engine and login_user, with SQLite allocator calls
+// per operation (db_memory.h). Prints a table and, with
+// --json, a JSON document meant to be diffed between builds. Usage:
+//   bench [--deals N] [--goods N] [--brokers N] [--buyers N] [--suppliers N]
+//         [--zipf S] [--seed N] [--iterations N] [--max-seconds S]
+//         [--ops NAME,...] [--db FILE] [--schema FILE] [--reuse]
+//         [--login-costs N,...] [--json FILE|-]
+// Counts accept K and M suffixes (e.g. --deals 10M). --login-costs repeats the
+// login operations with each PBKDF2 iteration count, as "login_user_ok@N".
+
+#define _POSIX_C_SOURCE 200809L // dup, dup2, fdopen, clock_gettime
+
+#include "../includes/aggregates.h"
+#include "../includes/analytics.h"
+#include "../includes/auth.h"
+#include "../includes/dates.h"
+#include "../includes/db.h"
+#include "../includes/db_memory.h"
+#include "../includes/migrations.h"
+#include "../includes/queries.h"
+#include "../includes/report_cache.h"
+#include "../includes/report_pool.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_COMMIT_EVERY 100000
+#define BENCH_DAYS 2192         // 2020-01-01 .. 2025-12-31
+#define BENCH_EPOCH_DAYS 18262  // 2020-01-01 as days since 1970-01-01
+#define BENCH_PURGE_YEAR 1999   // Deals written by the write benchmarks
+#define BENCH_USER "bench_user"
+#define BENCH_PASSWORD "benchpass"
+#define BENCH_MAX_LOGIN_COSTS 8
+
+static const char *const good_types[] = {"Eau de Parfum", "Eau de Toilette",
+                                         "Parfum", "Cologne", "Body Mist"};
+#define BENCH_TYPE_COUNT 5
+
+typedef struct {
+  long long deals;
+  int goods;
+  int brokers;
+  int buyers;
+  int suppliers;
+  double zipf_s;
+  unsigned long long seed;
+  int iterations;
+  double max_seconds;
+  const char *ops;
+  const char *db_path;
+  const char *schema_path;
+  int reuse;
+  const char *json_path;
+  int login_costs[BENCH_MAX_LOGIN_COSTS]; // --login-costs
+  int login_cost_count;
+} BenchConfig;
+
+typedef struct {
+  char name[40];
+  int iterations;
+  int failures;
+  double total_s;
+  double min_us, p50_us, p99_us, max_us;
+  long peak_rss_kb;
+  double allocs_per_op;      // SQLite malloc + realloc calls
+  double alloc_bytes_per_op; // Bytes they asked for
+  double heap_calls_per_op;  // Allocator calls that reached the system heap
+} OpResult;
+
+// --- Deterministic generator (xorshift64*) ---
+typedef struct {
+  unsigned long long state;
+} BenchRng;
+
+static void rng_seed(BenchRng *rng, unsigned long long seed) {
+  rng->state = seed * 0x9E3779B97F4A7C15ULL + 1; // Never zero
+}
+
+static unsigned long long rng_next(BenchRng *rng) {
+  rng->state ^= rng->state >> 12;
+  rng->state ^= rng->state << 25;
+  rng->state ^= rng->state >> 27;
+  return rng->state * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_unit(BenchRng *rng) {
+  return (double)(rng_next(rng) >> 11) / 9007199254740992.0; // [0, 1)
+}
+
+// --- Zipf sampler: rank k (0-based) has weight 1 / (k + 1)^s ---
+typedef struct {
+  double *cdf;
+  int n;
+} Zipf;
+
+static int zipf_init(Zipf *z, int n, double s) {
+  z->cdf = malloc(sizeof(double) * (size_t)n);
+  z->n = n;
+  if (!z->cdf) {
+    return -1;
+  }
+  double sum = 0.0;
+  for (int k = 0; k < n; k++) {
+    sum += 1.0 / pow((double)k + 1.0, s);
+    z->cdf[k] = sum;
+  }
+  return 0;
+}
+
+static int zipf_sample(const Zipf *z, BenchRng *rng) {
+  double u = rng_unit(rng) * z->cdf[z->n - 1];
+  int lo = 0, hi = z->n - 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (z->cdf[mid] < u) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// --- Names and dates ---
+static char **make_names(const char *format, int count) {
+  char **names = calloc((size_t)count, sizeof(char *));
+  char buffer[64];
+  for (int i = 0; names && i < count; i++) {
+    int len = snprintf(buffer, sizeof(buffer), format, i);
+    names[i] = malloc((size_t)len + 1);
+    if (!names[i]) {
+      return names; // Caller checks the last entry
+    }
+    memcpy(names[i], buffer, (size_t)len + 1);
+  }
+  return names;
+}
+
+static void free_names(char **names, int count) {
+  for (int i = 0; names && i < count; i++) {
+    free(names[i]);
+  }
+  free(names);
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return -1;
+  }
+  return usage.ru_maxrss; // KiB on Linux
+}
+
+static void remove_db_files(const char *path) {
+  char extra[512];
+  remove(path);
+  snprintf(extra, sizeof(extra), "%s-wal", path);
+  remove(extra);
+  snprintf(extra, sizeof(extra), "%s-shm", path);
+  remove(extra);
+  snprintf(extra, sizeof(extra), "%s-journal", path);
+  remove(extra);
+}
+
+// --- Dataset ---
+typedef struct {
+  char **goods;      // "Good 000042"
+  char **suppliers;  // "Supplier 0007"
+  char **brokers;    // "Broker000123"
+  char **buyers;     // "Buyer 000456"
+  Zipf good_zipf;
+  Zipf broker_zipf;
+  Zipf buyer_zipf;
+  double load_seconds;
+  int reused;
+} Dataset;
+
+static const char *good_supplier(const BenchConfig *cfg, const Dataset *ds,
+                                 int good) {
+  return ds->suppliers[good % cfg->suppliers];
+}
+
+static const char *good_type(int good) {
+  return good_types[good % BENCH_TYPE_COUNT];
+}
+
+// Parameters of the generated data, compared by --reuse
+static void dataset_signature(const BenchConfig *cfg, char *out, size_t size) {
+  snprintf(out, size, "deals=%lld goods=%d brokers=%d buyers=%d suppliers=%d "
+                      "zipf=%.3f seed=%llu",
+           cfg->deals, cfg->goods, cfg->brokers, cfg->buyers, cfg->suppliers,
+           cfg->zipf_s, cfg->seed);
+}
+
+static int dataset_matches(const char *signature) {
+  DbCursor cur;
+  int match = 0;
+  if (table_exists("BenchMeta") != 1) {
+    return 0;
+  }
+  if (db_cursor_open(&cur, "SELECT value FROM BenchMeta WHERE key = 'dataset';",
+                     NULL, 0) == SQLITE_OK &&
+      db_cursor_next(&cur) == SQLITE_ROW) {
+    match = strcmp(db_cursor_text(&cur, 0, NULL), signature) == 0;
+  }
+  db_cursor_close(&cur);
+  return match;
+}
+
+static int load_reference_data(const BenchConfig *cfg, const Dataset *ds) {
+  char hash[AUTH_HASH_SIZE];
+  int rc = SQLITE_OK;
+  for (int i = 0; i < cfg->suppliers && rc == SQLITE_OK; i++) {
+    DbParam params[] = {DB_TEXT(ds->suppliers[i])};
+    rc = execute_non_query_params(
+        "INSERT INTO Suppliers (supplier_name) VALUES (?);", params, 1);
+  }
+  for (int i = 0; i < cfg->brokers && rc == SQLITE_OK; i++) {
+    rc = insert_broker(ds->brokers[i], "Bench St", 1950 + i % 50);
+  }
+  for (int i = 0; i < cfg->buyers && rc == SQLITE_OK; i++) {
+    DbParam params[] = {DB_TEXT(ds->buyers[i])};
+    rc = execute_non_query_params("INSERT INTO Buyers (buyer_name) VALUES (?);",
+                                  params, 1);
+  }
+  for (int i = 0; i < BENCH_TYPE_COUNT && rc == SQLITE_OK; i++) {
+    DbParam params[] = {DB_TEXT(good_types[i])};
+    rc = execute_non_query_params("INSERT INTO GoodTypes (name) VALUES (?);",
+                                  params, 1);
+  }
+  for (int i = 0; i < cfg->goods && rc == SQLITE_OK; i++) {
+    rc = insert_good(ds->goods[i], good_type(i), 5.0 + (i * 7) % 200,
+                     good_supplier(cfg, ds, i), "2030-12-31", 2000000000);
+  }
+  if (rc == SQLITE_OK) {
+    hash_password(BENCH_PASSWORD, hash, sizeof(hash));
+    DbParam params[] = {DB_TEXT(BENCH_USER), DB_TEXT(hash)};
+    rc = execute_non_query_params("INSERT INTO Users (username, password_hash, "
+                                  "role) VALUES (?, ?, 'admin');",
+                                  params, DB_PARAM_COUNT(params));
+  }
+  return rc;
+}
+
+// Bulk load straight through one prepared statement; BrokerStats is rebuilt
+// once at the end instead of per deal.
+static int load_deals(const BenchConfig *cfg, Dataset *ds) {
+  BenchRng rng;
+  sqlite3_stmt *stmt = NULL;
+  rng_seed(&rng, cfg->seed);
+
+  int rc = db_prepare_cached(
+      "INSERT INTO Deals (deal_date, good_id, type_id, sell_quantity, "
+      "unit_price, broker_id, buyer_id) VALUES (?1, "
+      "(SELECT good_id FROM Goods WHERE name = ?2 AND supplier_name_fk = ?3), "
+      "(SELECT type_id FROM GoodTypes WHERE name = ?4), ?5, "
+      "(SELECT price FROM Goods WHERE name = ?2 AND supplier_name_fk = ?3), "
+      "(SELECT broker_id FROM Brokers WHERE surname = ?6), "
+      "(SELECT buyer_id FROM Buyers WHERE buyer_name = ?7));",
+      &stmt);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  rc = execute_non_query("BEGIN;");
+  for (long long i = 0; i < cfg->deals && rc == SQLITE_OK; i++) {
+    int good = zipf_sample(&ds->good_zipf, &rng);
+    int broker = zipf_sample(&ds->broker_zipf, &rng);
+    int buyer = zipf_sample(&ds->buyer_zipf, &rng);
+    sqlite3_bind_int(stmt, 1,
+                     BENCH_EPOCH_DAYS + (int)(rng_next(&rng) % BENCH_DAYS));
+    sqlite3_bind_text(stmt, 2, ds->goods[good], -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, good_supplier(cfg, ds, good), -1,
+                      SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, good_type(good), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 5, 1 + (int)(rng_next(&rng) % 5));
+    sqlite3_bind_text(stmt, 6, ds->brokers[broker], -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 7, ds->buyers[buyer], -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+      fprintf(stderr, "!!! bench: insert failed: %s\n", sqlite3_errmsg(db));
+      rc = SQLITE_ERROR;
+    }
+    sqlite3_reset(stmt);
+    if (rc == SQLITE_OK && (i + 1) % BENCH_COMMIT_EVERY == 0) {
+      rc = execute_non_query("COMMIT;");
+      if (rc == SQLITE_OK) {
+        rc = execute_non_query("BEGIN;");
+      }
+      if ((i + 1) % 1000000 == 0) {
+        fprintf(stderr, "bench: %lld deals generated\n", i + 1);
+      }
+    }
+  }
+  db_release_stmt(stmt);
+  if (rc != SQLITE_OK) {
+    execute_non_query("ROLLBACK;");
+    return rc;
+  }
+  return execute_non_query("COMMIT;");
+}
+
+static int dataset_prepare(const BenchConfig *cfg, Dataset *ds) {
+  char signature[256];
+  dataset_signature(cfg, signature, sizeof(signature));
+  memset(ds, 0, sizeof(*ds));
+  ds->goods = make_names("Good %06d", cfg->goods);
+  ds->suppliers = make_names("Supplier %04d", cfg->suppliers);
+  ds->brokers = make_names("Broker%06d", cfg->brokers);
+  ds->buyers = make_names("Buyer %06d", cfg->buyers);
+  if (!ds->goods || !ds->goods[cfg->goods - 1] || !ds->suppliers ||
+      !ds->suppliers[cfg->suppliers - 1] || !ds->brokers ||
+      !ds->brokers[cfg->brokers - 1] || !ds->buyers ||
+      !ds->buyers[cfg->buyers - 1] ||
+      zipf_init(&ds->good_zipf, cfg->goods, cfg->zipf_s) != 0 ||
+      zipf_init(&ds->broker_zipf, cfg->brokers, cfg->zipf_s) != 0 ||
+      zipf_init(&ds->buyer_zipf, cfg->buyers, cfg->zipf_s) != 0) {
+    fprintf(stderr, "!!! bench: out of memory\n");
+    return -1;
+  }
+
+  if (!cfg->reuse) {
+    remove_db_files(cfg->db_path);
+  }
+  if (open_db(cfg->db_path) != 0) {
+    return -1;
+  }
+  if (cfg->reuse && dataset_matches(signature)) {
+    ds->reused = 1;
+    // A file from an older build is upgraded in place
+    return migrations_apply(cfg->schema_path, 0) == 0 ? 0 : -1;
+  }
+  if (cfg->reuse) {
+    close_db(); // Different parameters: start from an empty file
+    remove_db_files(cfg->db_path);
+    if (open_db(cfg->db_path) != 0) {
+      return -1;
+    }
+  }
+
+  // Schema only: the seed data would make the dataset depend on the cwd
+  double start = now_seconds();
+  int rc = migrations_apply(cfg->schema_path, 0);
+  if (rc == SQLITE_OK) {
+    execute_non_query("PRAGMA foreign_keys = OFF;"); // Names are valid
+    rc = execute_non_query("BEGIN;");
+    if (rc == SQLITE_OK) {
+      rc = load_reference_data(cfg, ds);
+    }
+    if (rc == SQLITE_OK) {
+      rc = execute_non_query("COMMIT;");
+    } else {
+      execute_non_query("ROLLBACK;");
+    }
+  }
+  if (rc == SQLITE_OK) {
+    rc = load_deals(cfg, ds);
+    execute_non_query("PRAGMA foreign_keys = ON;");
+  }
+  if (rc == SQLITE_OK) {
+    rc = aggregates_rebuild();
+  }
+  if (rc == SQLITE_OK) {
+    rc = execute_non_query("ANALYZE;");
+  }
+  if (rc == SQLITE_OK) {
+    DbParam params[] = {DB_TEXT(signature)};
+    rc = execute_non_query("CREATE TABLE IF NOT EXISTS BenchMeta "
+                           "(key TEXT PRIMARY KEY, value TEXT);");
+    if (rc == SQLITE_OK) {
+      rc = execute_non_query_params("INSERT OR REPLACE INTO BenchMeta "
+                                    "VALUES ('dataset', ?);",
+                                    params, 1);
+    }
+  }
+  ds->load_seconds = now_seconds() - start;
+  if (rc != SQLITE_OK) {
+    fprintf(stderr, "!!! bench: dataset generation failed (rc=%d)\n", rc);
+    return -1;
+  }
+  return 0;
+}
+
+static void dataset_free(const BenchConfig *cfg, Dataset *ds) {
+  free_names(ds->goods, cfg->goods);
+  free_names(ds->suppliers, cfg->suppliers);
+  free_names(ds->brokers, cfg->brokers);
+  free_names(ds->buyers, cfg->buyers);
+  free(ds->good_zipf.cdf);
+  free(ds->broker_zipf.cdf);
+  free(ds->buyer_zipf.cdf);
+}
+
+// --- Operations ---
+// Each operation runs one call with arguments drawn from its own generator,
+// so the arguments do not depend on which other operations are selected.
+// Returns 0 on success, -1 on failure, OP_EXHAUSTED when there is nothing
+// left to do (the call is not counted).
+#define OP_EXHAUSTED 1
+typedef struct {
+  const BenchConfig *cfg;
+  Dataset *ds;
+  BenchRng rng;
+  int iteration;
+  ReportPool *pool;
+  AnalyticsStore *analytics;
+  sqlite3_int64 *deal_ids; // Written by insert_deal, read by remove_deal
+  int deal_id_count;
+} OpContext;
+
+typedef int (*OpFn)(OpContext *ctx);
+
+static void random_period(OpContext *ctx, long length_days, char start[11],
+                          char end[11]) {
+  long first = (long)(rng_next(&ctx->rng) % (BENCH_DAYS - length_days));
+  date_format(BENCH_EPOCH_DAYS + (int)first, start);
+  date_format(BENCH_EPOCH_DAYS + (int)(first + length_days - 1), end);
+}
+
+static int op_sales_summary_month(OpContext *ctx) {
+  char start[11], end[11];
+  random_period(ctx, 30, start, end);
+  return query_sales_summary_by_period(start, end, stdout);
+}
+
+static int op_sales_summary_year(OpContext *ctx) {
+  char start[11], end[11];
+  random_period(ctx, 365, start, end);
+  return query_sales_summary_by_period(start, end, stdout);
+}
+
+static int op_buyers_by_good_all(OpContext *ctx) {
+  (void)ctx;
+  return query_buyers_by_good(NULL, stdout);
+}
+
+static int op_buyers_by_good_one(OpContext *ctx) {
+  int good = zipf_sample(&ctx->ds->good_zipf, &ctx->rng);
+  return query_buyers_by_good(ctx->ds->goods[good], stdout);
+}
+
+static int op_most_popular_type(OpContext *ctx) {
+  (void)ctx;
+  return query_most_popular_type_info(stdout);
+}
+
+static int op_top_broker(OpContext *ctx) {
+  (void)ctx;
+  return query_top_broker_info(stdout);
+}
+
+// The report cache is off for the other ops, so they time the queries; these
+// turn it on (report_cache_kb of the loaded settings) for their own calls
+static int report_cache_kb = 0;
+
+static void set_report_cache_kb(int kb) {
+  ReportCacheSettings settings = {kb};
+  report_cache_set_settings(&settings);
+}
+
+static int op_most_popular_type_cached(OpContext *ctx) {
+  (void)ctx;
+  set_report_cache_kb(report_cache_kb);
+  int rc = query_most_popular_type_info(stdout);
+  set_report_cache_kb(0);
+  return rc;
+}
+
+static int op_top_broker_cached(OpContext *ctx) {
+  (void)ctx;
+  set_report_cache_kb(report_cache_kb);
+  int rc = query_top_broker_info(stdout);
+  set_report_cache_kb(0);
+  return rc;
+}
+
+static int op_supplier_brokers_all(OpContext *ctx) {
+  (void)ctx;
+  return query_supplier_brokers_info(NULL, stdout);
+}
+
+static int op_supplier_brokers_one(OpContext *ctx) {
+  int supplier = (int)(rng_next(&ctx->rng) % ctx->cfg->suppliers);
+  return query_supplier_brokers_info(ctx->ds->suppliers[supplier], stdout);
+}
+
+static int op_deals_on_date(OpContext *ctx) {
+  char day[11];
+  date_format(BENCH_EPOCH_DAYS + (int)(rng_next(&ctx->rng) % BENCH_DAYS), day);
+  return query_deals_on_date(day, stdout);
+}
+
+// The whole listing, as before pagination
+static int op_broker_deals(OpContext *ctx) {
+  int broker = zipf_sample(&ctx->ds->broker_zipf, &ctx->rng);
+  DbCursor cur;
+  int rc = open_broker_deals_cursor(&cur, ctx->ds->brokers[broker]);
+  if (rc == SQLITE_OK) {
+    rc = db_cursor_print(&cur, stdout);
+  }
+  db_cursor_close(&cur);
+  return rc;
+}
+
+static int op_broker_deals_page(OpContext *ctx) {
+  int broker = zipf_sample(&ctx->ds->broker_zipf, &ctx->rng);
+  DealPage page;
+  return query_broker_deals_page(ctx->ds->brokers[broker], NULL,
+                                 query_get_settings()->list_page_size, &page,
+                                 stdout);
+}
+
+// A page from a random point of the history: costs the same as the first
+static int op_broker_deals_page_deep(OpContext *ctx) {
+  int broker = zipf_sample(&ctx->ds->broker_zipf, &ctx->rng);
+  DealKey after = {
+      BENCH_EPOCH_DAYS + (int)(rng_next(&ctx->rng) % BENCH_DAYS), 0};
+  DealPage page;
+  return query_broker_deals_page(ctx->ds->brokers[broker], &after,
+                                 query_get_settings()->list_page_size, &page,
+                                 stdout);
+}
+
+static int op_leaderboard_brokers(OpContext *ctx) {
+  (void)ctx;
+  return query_leaderboard(LEADERBOARD_BROKERS_BY_DEALS, 10, stdout);
+}
+
+static int op_leaderboard_goods(OpContext *ctx) {
+  (void)ctx;
+  return query_leaderboard(LEADERBOARD_GOODS_BY_UNITS, 10, stdout);
+}
+
+static int op_leaderboard_types(OpContext *ctx) {
+  (void)ctx;
+  return query_leaderboard(LEADERBOARD_TYPES_BY_UNITS, 10, stdout);
+}
+
+static int op_report_bundle_serial(OpContext *ctx) {
+  char start[11], end[11];
+  random_period(ctx, 30, start, end);
+  return query_report_bundle(NULL, start, end, stdout);
+}
+
+static int op_report_bundle_pool(OpContext *ctx) {
+  char start[11], end[11];
+  random_period(ctx, 30, start, end);
+  return query_report_bundle(ctx->pool, start, end, stdout);
+}
+
+// Full load of a fresh store; the report ops below reuse ctx->analytics
+static int op_analytics_load(OpContext *ctx) {
+  (void)ctx;
+  AnalyticsStore *store = analytics_create();
+  int rc = store ? analytics_sync(store) : SQLITE_NOMEM;
+  analytics_destroy(store);
+  return rc;
+}
+
+static int op_analytics_sync(OpContext *ctx) {
+  return analytics_sync(ctx->analytics);
+}
+
+static int op_analytics_sales_summary_year(OpContext *ctx) {
+  char start[11], end[11];
+  random_period(ctx, 365, start, end);
+  return analytics_sales_summary(ctx->analytics, start, end, stdout);
+}
+
+static int op_analytics_buyers_by_good_all(OpContext *ctx) {
+  return analytics_buyers_by_good(ctx->analytics, NULL, stdout);
+}
+
+static int op_analytics_most_popular_type(OpContext *ctx) {
+  return analytics_most_popular_type(ctx->analytics, stdout);
+}
+
+static int op_analytics_top_broker(OpContext *ctx) {
+  return analytics_top_broker(ctx->analytics, stdout);
+}
+
+static int op_analytics_supplier_brokers_all(OpContext *ctx) {
+  return analytics_supplier_brokers(ctx->analytics, NULL, stdout);
+}
+
+static int op_analytics_bundle(OpContext *ctx) {
+  char start[11], end[11];
+  random_period(ctx, 30, start, end);
+  return analytics_report_bundle(ctx->analytics, start, end, stdout);
+}
+
+// Deals dated in BENCH_PURGE_YEAR: outside the generated range, removed again
+// by remove_deal and clear_deals_up_to
+static int op_insert_deal(OpContext *ctx) {
+  char date[11];
+  int good = zipf_sample(&ctx->ds->good_zipf, &ctx->rng);
+  int broker = zipf_sample(&ctx->ds->broker_zipf, &ctx->rng);
+  int buyer = zipf_sample(&ctx->ds->buyer_zipf, &ctx->rng);
+  snprintf(date, sizeof(date), "%d-%02u-%02u", BENCH_PURGE_YEAR,
+           1 + (unsigned)ctx->iteration / 28 % 12,
+           1 + (unsigned)ctx->iteration % 28);
+  DealInput deal = {date,
+                    ctx->ds->goods[good],
+                    good_supplier(ctx->cfg, ctx->ds, good),
+                    good_type(good),
+                    1 + (int)(rng_next(&ctx->rng) % 5),
+                    ctx->ds->brokers[broker],
+                    ctx->ds->buyers[buyer]};
+  if (insert_deal(&deal) != DEAL_RESULT_OK) {
+    return -1;
+  }
+  if (ctx->deal_ids) {
+    ctx->deal_ids[ctx->deal_id_count++] = sqlite3_last_insert_rowid(db);
+  }
+  return 0;
+}
+
+// Every second inserted deal; the rest is left for clear_deals_up_to
+static int op_remove_deal(OpContext *ctx) {
+  int index = 2 * ctx->iteration + 1;
+  if (index >= ctx->deal_id_count) {
+    return OP_EXHAUSTED;
+  }
+  return remove_deal((int)ctx->deal_ids[index]) == 1 ? 0 : -1;
+}
+
+static int op_clear_deals_up_to(OpContext *ctx) {
+  char date[11];
+  snprintf(date, sizeof(date), "%d-%02u-%02u", BENCH_PURGE_YEAR,
+           1 + (unsigned)ctx->iteration / 28 % 12,
+           1 + (unsigned)ctx->iteration % 28);
+  return clear_deals_up_to(date, NULL, NULL);
+}
+
+// Same days as op_clear_deals_up_to; run it instead of that op, not after
+static int op_archive_deals_up_to(OpContext *ctx) {
+  char date[11];
+  snprintf(date, sizeof(date), "%d-%02u-%02u", BENCH_PURGE_YEAR,
+           1 + (unsigned)ctx->iteration / 28 % 12,
+           1 + (unsigned)ctx->iteration % 28);
+  return archive_deals_up_to(date, 0, NULL, NULL);
+}
+
+static int op_set_good_price(OpContext *ctx) {
+  int good = zipf_sample(&ctx->ds->good_zipf, &ctx->rng);
+  double price = 5.0 + (double)(rng_next(&ctx->rng) % 20000) / 100.0;
+  return set_good_price(ctx->ds->goods[good],
+                        good_supplier(ctx->cfg, ctx->ds, good), price) == 1
+             ? 0
+             : -1;
+}
+
+static int op_insert_broker(OpContext *ctx) {
+  char name[64];
+  snprintf(name, sizeof(name), "BenchNewBroker%06d", ctx->iteration);
+  return insert_broker(name, "Bench St", 1990);
+}
+
+static int op_insert_good(OpContext *ctx) {
+  char name[64];
+  snprintf(name, sizeof(name), "Bench New Good %06d", ctx->iteration);
+  return insert_good(name, good_type(ctx->iteration), 42.0,
+                     ctx->ds->suppliers[0], "2030-12-31", 100);
+}
+
+static int op_verify_broker_stats(OpContext *ctx) {
+  (void)ctx;
+  return aggregates_verify(0, NULL) == 0 ? 0 : -1;
+}
+
+static int op_rebuild_broker_stats(OpContext *ctx) {
+  (void)ctx;
+  return aggregates_rebuild();
+}
+
+// Every login pays the full password hash
+static int op_login_ok(OpContext *ctx) {
+  UserSession session;
+  (void)ctx;
+  auth_login_cache_clear();
+  return login_user(BENCH_USER, BENCH_PASSWORD, &session);
+}
+
+// Repeat logins, answered by the login cache that login_user_ok leaves warm
+static int op_login_cached(OpContext *ctx) {
+  UserSession session;
+  (void)ctx;
+  return login_user(BENCH_USER, BENCH_PASSWORD, &session);
+}
+
+static int op_login_bad(OpContext *ctx) {
+  UserSession session;
+  (void)ctx;
+  return login_user(BENCH_USER, "wrong-password", &session) == 1 ? 0 : -1;
+}
+
+static int op_login_unknown(OpContext *ctx) {
+  UserSession session;
+  (void)ctx;
+  return login_user("bench_nobody", BENCH_PASSWORD, &session) == 1 ? 0 : -1;
+}
+
+typedef struct {
+  const char *name;
+  OpFn fn;
+} OpSpec;
+
+// Order matters for the write operations: insert_deal provides the deals that
+// remove_deal and clear_deals_up_to take away again.
+static const OpSpec op_specs[] = {
+    {"sales_summary_month", op_sales_summary_month},
+    {"sales_summary_year", op_sales_summary_year},
+    {"buyers_by_good_all", op_buyers_by_good_all},
+    {"buyers_by_good_one", op_buyers_by_good_one},
+    {"most_popular_type", op_most_popular_type},
+    {"top_broker", op_top_broker},
+    {"most_popular_type_cached", op_most_popular_type_cached},
+    {"top_broker_cached", op_top_broker_cached},
+    {"supplier_brokers_all", op_supplier_brokers_all},
+    {"supplier_brokers_one", op_supplier_brokers_one},
+    {"deals_on_date", op_deals_on_date},
+    {"broker_deals", op_broker_deals},
+    {"broker_deals_page", op_broker_deals_page},
+    {"broker_deals_page_deep", op_broker_deals_page_deep},
+    {"leaderboard_brokers", op_leaderboard_brokers},
+    {"leaderboard_goods", op_leaderboard_goods},
+    {"leaderboard_types", op_leaderboard_types},
+    {"report_bundle_serial", op_report_bundle_serial},
+    {"report_bundle_pool", op_report_bundle_pool},
+    {"analytics_load", op_analytics_load},
+    {"analytics_sync", op_analytics_sync},
+    {"analytics_sales_summary_year", op_analytics_sales_summary_year},
+    {"analytics_buyers_by_good_all", op_analytics_buyers_by_good_all},
+    {"analytics_most_popular_type", op_analytics_most_popular_type},
+    {"analytics_top_broker", op_analytics_top_broker},
+    {"analytics_supplier_brokers_all", op_analytics_supplier_brokers_all},
+    {"analytics_bundle", op_analytics_bundle},
+    {"insert_deal", op_insert_deal},
+    {"remove_deal", op_remove_deal},
+    {"clear_deals_up_to", op_clear_deals_up_to},
+    {"archive_deals_up_to", op_archive_deals_up_to},
+    {"set_good_price", op_set_good_price},
+    {"insert_broker", op_insert_broker},
+    {"insert_good", op_insert_good},
+    {"verify_broker_stats", op_verify_broker_stats},
+    {"rebuild_broker_stats", op_rebuild_broker_stats},
+    {"login_user_ok", op_login_ok},
+    {"login_user_cached", op_login_cached},
+    {"login_user_bad", op_login_bad},
+    {"login_user_unknown", op_login_unknown},
+};
+#define OP_COUNT (sizeof(op_specs) / sizeof(op_specs[0]))
+#define LOGIN_OP_COUNT 4 // The last entries of op_specs
+
+static int op_selected(const char *list, const char *name) {
+  if (!list) {
+    return 1;
+  }
+  size_t len = strlen(name);
+  for (const char *p = list; (p = strstr(p, name)) != NULL; p += len) {
+    if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0')) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, int n, double p) {
+  int rank = (int)ceil(p / 100.0 * n);
+  if (rank < 1) {
+    rank = 1;
+  }
+  return sorted[rank - 1];
+}
+
+static void run_op(const OpSpec *spec, size_t index, OpContext *ctx,
+                   double *samples, OpResult *result) {
+  memset(result, 0, sizeof(*result));
+  snprintf(result->name, sizeof(result->name), "%s", spec->name);
+  rng_seed(&ctx->rng, ctx->cfg->seed ^ (0x1000 + index));
+
+  DbMemoryStats mem_before, mem_after;
+  db_memory_get_stats(&mem_before);
+  double op_start = now_seconds();
+  int n = 0;
+  while (n < ctx->cfg->iterations) {
+    ctx->iteration = n;
+    double t0 = now_seconds();
+    int rc = spec->fn(ctx);
+    double elapsed_us = (now_seconds() - t0) * 1e6;
+    if (rc == OP_EXHAUSTED) {
+      break;
+    }
+    if (rc != 0) {
+      result->failures++;
+    }
+    samples[n++] = elapsed_us;
+    if (now_seconds() - op_start > ctx->cfg->max_seconds) {
+      break; // Slow operation at this scale: keep the samples we have
+    }
+  }
+  result->total_s = now_seconds() - op_start;
+  result->iterations = n;
+  result->peak_rss_kb = peak_rss_kb();
+  if (n == 0) {
+    return;
+  }
+  db_memory_get_stats(&mem_after);
+  result->allocs_per_op =
+      (double)(mem_after.mallocs + mem_after.reallocs - mem_before.mallocs -
+               mem_before.reallocs) /
+      n;
+  result->alloc_bytes_per_op =
+      (double)(mem_after.bytes_requested - mem_before.bytes_requested) / n;
+  result->heap_calls_per_op =
+      (double)(mem_after.heap_calls - mem_before.heap_calls) / n;
+  qsort(samples, (size_t)n, sizeof(double), compare_doubles);
+  result->min_us = samples[0];
+  result->p50_us = percentile(samples, n, 50.0);
+  result->p99_us = percentile(samples, n, 99.0);
+  result->max_us = samples[n - 1];
+}
+
+// --- Output ---
+static void print_table(FILE *out, const OpResult *results, size_t count) {
+  fprintf(out, "%-30s %6s %12s %12s %12s %10s %10s %10s\n", "operation",
+          "iters", "ops/s", "p50_us", "p99_us", "rss_kb", "allocs/op",
+          "heap/op");
+  for (size_t i = 0; i < count; i++) {
+    const OpResult *r = &results[i];
+    fprintf(out, "%-30s %6d %12.1f %12.1f %12.1f %10ld %10.1f %10.1f%s\n",
+            r->name, r->iterations,
+            r->total_s > 0 ? r->iterations / r->total_s : 0.0, r->p50_us,
+            r->p99_us, r->peak_rss_kb, r->allocs_per_op, r->heap_calls_per_op,
+            r->failures ? "  FAILED" : "");
+  }
+}
+
+static void write_json(FILE *out, const BenchConfig *cfg, const Dataset *ds,
+                       const OpResult *results, size_t count) {
+  fprintf(out, "{\n");
+  fprintf(out, "  \"schema\": 1,\n");
+#ifdef NDEBUG
+  fprintf(out, "  \"build\": \"release\",\n");
+#else
+  fprintf(out, "  \"build\": \"debug\",\n");
+#endif
+  fprintf(out, "  \"sqlite_version\": \"%s\",\n", sqlite3_libversion());
+  fprintf(out, "  \"dataset\": {\n");
+  fprintf(out, "    \"deals\": %lld,\n", cfg->deals);
+  fprintf(out, "    \"goods\": %d,\n", cfg->goods);
+  fprintf(out, "    \"brokers\": %d,\n", cfg->brokers);
+  fprintf(out, "    \"buyers\": %d,\n", cfg->buyers);
+  fprintf(out, "    \"suppliers\": %d,\n", cfg->suppliers);
+  fprintf(out, "    \"zipf_s\": %.3f,\n", cfg->zipf_s);
+  fprintf(out, "    \"seed\": %llu,\n", cfg->seed);
+  fprintf(out, "    \"reused\": %s,\n", ds->reused ? "true" : "false");
+  fprintf(out, "    \"load_seconds\": %.3f,\n", ds->load_seconds);
+  fprintf(out, "    \"load_deals_per_s\": %.1f\n",
+          ds->load_seconds > 0 ? cfg->deals / ds->load_seconds : 0.0);
+  fprintf(out, "  },\n");
+  fprintf(out, "  \"operations\": [\n");
+  for (size_t i = 0; i < count; i++) {
+    const OpResult *r = &results[i];
+    fprintf(out,
+            "    {\"name\": \"%s\", \"iterations\": %d, \"failures\": %d, "
+            "\"total_s\": %.6f, \"ops_per_s\": %.3f, \"min_us\": %.1f, "
+            "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+            "\"peak_rss_kb\": %ld, \"sqlite_allocs_per_op\": %.1f, "
+            "\"sqlite_alloc_bytes_per_op\": %.0f, "
+            "\"sqlite_heap_calls_per_op\": %.1f}%s\n",
+            r->name, r->iterations, r->failures, r->total_s,
+            r->total_s > 0 ? r->iterations / r->total_s : 0.0, r->min_us,
+            r->p50_us, r->p99_us, r->max_us, r->peak_rss_kb, r->allocs_per_op,
+            r->alloc_bytes_per_op, r->heap_calls_per_op,
+            i + 1 < count ? "," : "");
+  }
+  fprintf(out, "  ],\n");
+  DbMemoryStats mem;
+  db_memory_get_stats(&mem);
+  fprintf(out, "  \"sqlite_heap_peak_kb\": %lld,\n",
+          (long long)(mem.heap_peak + 1023) / 1024);
+  fprintf(out, "  \"peak_rss_kb\": %ld\n", peak_rss_kb());
+  fprintf(out, "}\n");
+}
+
+// --- Command line ---
+static int parse_count(const char *text, long long min, long long max,
+                       long long *out) {
+  char *end;
+  long long v = strtoll(text, &end, 10);
+  if (end == text) {
+    return -1;
+  }
+  if (*end == 'K' || *end == 'k') {
+    v *= 1000;
+    end++;
+  } else if (*end == 'M' || *end == 'm') {
+    v *= 1000000;
+    end++;
+  }
+  if (*end != '\0' || v < min || v > max) {
+    return -1;
+  }
+  *out = v;
+  return 0;
+}
+
+// Comma-separated PBKDF2 iteration counts
+static int parse_login_costs(const char *text, BenchConfig *cfg) {
+  cfg->login_cost_count = 0;
+  while (*text) {
+    char *end;
+    long v = strtol(text, &end, 10);
+    if (end == text || v < 1000 || v > 100000000 ||
+        cfg->login_cost_count == BENCH_MAX_LOGIN_COSTS) {
+      return -1;
+    }
+    cfg->login_costs[cfg->login_cost_count++] = (int)v;
+    text = *end == ',' ? end + 1 : end;
+    if (*end != ',' && *end != '\0') {
+      return -1;
+    }
+  }
+  return cfg->login_cost_count > 0 ? 0 : -1;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [--deals N] [--goods N] [--brokers N] [--buyers N]\n"
+          "          [--suppliers N] [--zipf S] [--seed N] [--iterations N]\n"
+          "          [--max-seconds S] [--ops NAME,...] [--db FILE]\n"
+          "          [--schema FILE] [--reuse] [--login-costs N,...]\n"
+          "          [--json FILE|-]\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  BenchConfig cfg = {100000, 2000, 200, 5000, 50, 1.1, 42, 50, 10.0,
+                     NULL,   "bench.db", NULL, 0, NULL, {0}, 0};
+
+  for (int i = 1; i < argc; i++) {
+    long long v = 0;
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    int ok = 1;
+    if (strcmp(arg, "--reuse") == 0) {
+      cfg.reuse = 1;
+      continue;
+    }
+    if (!value) {
+      ok = 0;
+    } else if (strcmp(arg, "--deals") == 0) {
+      ok = parse_count(value, 1, 1000000000LL, &cfg.deals) == 0;
+    } else if (strcmp(arg, "--goods") == 0 || strcmp(arg, "--brokers") == 0 ||
+               strcmp(arg, "--buyers") == 0 ||
+               strcmp(arg, "--suppliers") == 0 ||
+               strcmp(arg, "--iterations") == 0) {
+      ok = parse_count(value, 1, 10000000, &v) == 0;
+      int *target = strcmp(arg, "--goods") == 0     ? &cfg.goods
+                    : strcmp(arg, "--brokers") == 0 ? &cfg.brokers
+                    : strcmp(arg, "--buyers") == 0  ? &cfg.buyers
+                    : strcmp(arg, "--suppliers") == 0
+                        ? &cfg.suppliers
+                        : &cfg.iterations;
+      *target = (int)v;
+    } else if (strcmp(arg, "--seed") == 0) {
+      ok = parse_count(value, 0, 0x7fffffffffffffffLL, &v) == 0;
+      cfg.seed = (unsigned long long)v;
+    } else if (strcmp(arg, "--zipf") == 0) {
+      cfg.zipf_s = atof(value);
+      ok = cfg.zipf_s >= 0.0;
+    } else if (strcmp(arg, "--max-seconds") == 0) {
+      cfg.max_seconds = atof(value);
+      ok = cfg.max_seconds > 0.0;
+    } else if (strcmp(arg, "--ops") == 0) {
+      cfg.ops = value;
+    } else if (strcmp(arg, "--db") == 0) {
+      cfg.db_path = value;
+    } else if (strcmp(arg, "--schema") == 0) {
+      cfg.schema_path = value;
+    } else if (strcmp(arg, "--json") == 0) {
+      cfg.json_path = value;
+    } else if (strcmp(arg, "--login-costs") == 0) {
+      ok = parse_login_costs(value, &cfg) == 0;
+    } else {
+      ok = 0;
+    }
+    if (!ok) {
+      usage(argv[0]);
+      return 1;
+    }
+    i++;
+  }
+
+  // Connection profile (and SQL profiler) as in the application
+  DbProfile profile;
+  if (db_profile_load(&profile) != 0) {
+    return 1;
+  }
+  db_set_profile(&profile);
+  report_cache_kb = report_cache_get_settings()->size_kb;
+  set_report_cache_kb(0);
+
+  // Library DEBUG output and report rows go to /dev/null; results go to the
+  // original stdout.
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  if (saved_stdout < 0 || devnull < 0) {
+    perror("bench");
+    return 1;
+  }
+  FILE *out = fdopen(saved_stdout, "w");
+  dup2(devnull, STDOUT_FILENO);
+  close(devnull);
+
+  Dataset ds;
+  if (dataset_prepare(&cfg, &ds) != 0) {
+    close_db();
+    dataset_free(&cfg, &ds);
+    return 1;
+  }
+  fprintf(out, "dataset: %lld deals, %d goods, %d brokers, %d buyers, "
+               "zipf %.2f, %s in %.2f s\n",
+          cfg.deals, cfg.goods, cfg.brokers, cfg.buyers, cfg.zipf_s,
+          ds.reused ? "reused" : "generated", ds.load_seconds);
+
+  OpResult results[OP_COUNT + LOGIN_OP_COUNT * BENCH_MAX_LOGIN_COSTS];
+  size_t result_count = 0;
+  double *samples = malloc(sizeof(double) * (size_t)cfg.iterations);
+  OpContext ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.cfg = &cfg;
+  ctx.ds = &ds;
+  ctx.deal_ids = malloc(sizeof(sqlite3_int64) * (size_t)cfg.iterations);
+  if (op_selected(cfg.ops, "report_bundle_pool")) {
+    ctx.pool = report_pool_create(cfg.db_path,
+                                  db_get_profile()->read_pool_size);
+  }
+  // Loaded up front, so the analytics report timings exclude the first load
+  ctx.analytics = analytics_create();
+  if (ctx.analytics && (!cfg.ops || strstr(cfg.ops, "analytics_"))) {
+    analytics_sync(ctx.analytics);
+  }
+  int failures = 0;
+  for (size_t i = 0; samples && ctx.deal_ids && ctx.analytics && i < OP_COUNT;
+       i++) {
+    if (!op_selected(cfg.ops, op_specs[i].name)) {
+      continue;
+    }
+    OpResult *result = &results[result_count++];
+    run_op(&op_specs[i], i, &ctx, samples, result);
+    failures += result->failures;
+    fprintf(stderr, "bench: %-30s done (%d iterations)\n", result->name,
+            result->iterations);
+  }
+  // Login operations again at each password hash cost
+  AuthSettings auth = *auth_get_settings();
+  AuthSettings login_auth = auth;
+  for (int c = 0; samples && c < cfg.login_cost_count; c++) {
+    login_auth.password_iterations = cfg.login_costs[c];
+    auth_set_settings(&login_auth);
+    UserSession session;
+    auth_login_cache_clear();
+    login_user(BENCH_USER, BENCH_PASSWORD, &session); // Rehash at this cost
+    for (size_t i = OP_COUNT - LOGIN_OP_COUNT; i < OP_COUNT; i++) {
+      if (!op_selected(cfg.ops, op_specs[i].name)) {
+        continue;
+      }
+      OpResult *result = &results[result_count++];
+      run_op(&op_specs[i], i, &ctx, samples, result);
+      snprintf(result->name, sizeof(result->name), "%s@%d", op_specs[i].name,
+               cfg.login_costs[c]);
+      failures += result->failures;
+      fprintf(stderr, "bench: %-30s done (%d iterations)\n", result->name,
+              result->iterations);
+    }
+  }
+  if (cfg.login_cost_count > 0) {
+    // Leave the stored hash at the configured cost
+    auth_set_settings(&auth);
+    UserSession session;
+    auth_login_cache_clear();
+    login_user(BENCH_USER, BENCH_PASSWORD, &session);
+  }
+  // Leave a reusable dataset behind: drop rows added by the write benchmarks
+  char purge_date[11];
+  snprintf(purge_date, sizeof(purge_date), "%d-12-31", BENCH_PURGE_YEAR);
+  clear_deals_up_to(purge_date, NULL, NULL);
+  execute_non_query("DELETE FROM Goods WHERE name LIKE 'Bench New Good %';");
+  execute_non_query("DELETE FROM Brokers WHERE surname LIKE "
+                    "'BenchNewBroker%';");
+
+  report_pool_destroy(ctx.pool);
+  analytics_destroy(ctx.analytics);
+  close_db();
+
+  print_table(out, results, result_count);
+  if (cfg.json_path) {
+    FILE *json = strcmp(cfg.json_path, "-") == 0 ? out
+                                                 : fopen(cfg.json_path, "w");
+    if (!json) {
+      perror("bench: cannot write JSON");
+      failures++;
+    } else {
+      write_json(json, &cfg, &ds, results, result_count);
+      if (json != out) {
+        fclose(json);
+      }
+    }
+  }
+  free(samples);
+  free(ctx.deal_ids);
+  dataset_free(&cfg, &ds);
+  fclose(out);
+  return failures == 0 ? 0 : 1;
+}
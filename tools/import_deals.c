@@ -0,0 +1,99 @@
+// tools/import_deals.c
+// Non-interactive bulk ingest of broker feeds into Deals. Usage:
+//   import_deals [--db FILE] [--format csv|jsonl] [--batch N]
+//                [--rejects FILE] [--max-rejects N] [--progress N] INPUT|-
+
+#include "../includes/db.h"
+#include "../includes/importer.h"
+#include "../includes/migrations.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [--db FILE] [--format csv|jsonl] [--batch N]\n"
+          "          [--rejects FILE] [--max-rejects N] [--progress N] "
+          "INPUT|-\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  const char *db_path = "ParfumeMarket.db";
+  const char *input = NULL;
+  ImportOptions options;
+  import_options_defaults(&options);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+      db_path = argv[++i];
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "csv") == 0) {
+        options.format = IMPORT_FORMAT_CSV;
+      } else if (strcmp(argv[i], "jsonl") == 0) {
+        options.format = IMPORT_FORMAT_JSONL;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      options.batch_size = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rejects") == 0 && i + 1 < argc) {
+      options.reject_path = argv[++i];
+    } else if (strcmp(argv[i], "--max-rejects") == 0 && i + 1 < argc) {
+      options.max_rejects = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--progress") == 0 && i + 1 < argc) {
+      options.progress_every = atol(argv[++i]);
+    } else if (!input && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)) {
+      input = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!input) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (strcmp(input, "-") == 0 && options.format == IMPORT_FORMAT_AUTO) {
+    options.format = IMPORT_FORMAT_CSV;
+  }
+
+  DbProfile profile;
+  if (db_profile_load(&profile) != 0) {
+    fprintf(stderr, "Invalid database connection profile.\n");
+    return 1;
+  }
+  db_set_profile(&profile);
+  if (open_db(db_path) != 0) {
+    fprintf(stderr, "Failed to open database '%s'.\n", db_path);
+    return 1;
+  }
+  if (table_exists("Deals") != 1) {
+    fprintf(stderr, "Database '%s' has no Deals table. Run PerfumeBazaar "
+                    "once to create the schema.\n",
+            db_path);
+    close_db();
+    return 1;
+  }
+  if (migrations_current_version() != migrations_latest_version()) {
+    fprintf(stderr, "Database '%s' has an older schema. Run migrate --db %s "
+                    "first.\n",
+            db_path, db_path);
+    close_db();
+    return 1;
+  }
+
+  ImportStats stats;
+  int rc = import_deals_file(input, &options, &stats);
+  close_db();
+
+  fprintf(stderr,
+          "import: %ld rows read, %ld imported, %ld rejected, %ld batches, "
+          "%ld stock updates in %.2f s (%.0f rows/s)\n",
+          stats.rows_read, stats.rows_imported, stats.rows_rejected,
+          stats.batches, stats.goods_updates, stats.seconds,
+          stats.seconds > 0 ? stats.rows_read / stats.seconds : 0.0);
+  return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,283 @@
+// tools/loadgen.c
+// Load generator for the server mode (PerfumeBazaar --serve SOCKET): N client
+// threads each connect, log in, and send their requests one at a time,
+// cycling through the given commands. Prints throughput, error count and
+// latency percentiles. Usage:
+//   loadgen --socket PATH --user NAME --password SECRET [--clients N]
+//           [--requests N] [--command "report popular-type"]...
+// --requests is per client. Without --command the clients alternate between
+// "report popular-type" and "report leaderboard --board brokers-deals".
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOADGEN_MAX_COMMANDS 32
+
+static const char *default_commands[] = {
+    "report popular-type", "report leaderboard --board brokers-deals"};
+
+typedef struct {
+  const char *socket_path;
+  const char *user;
+  const char *password;
+  int clients;
+  int requests;
+  const char *commands[LOADGEN_MAX_COMMANDS];
+  int command_count;
+} LoadConfig;
+
+typedef struct {
+  const LoadConfig *config;
+  int index;
+  double *latencies; // Seconds, one per request sent
+  int done;
+  int errors;        // Non-zero response codes
+  int failed;        // Lost connection or protocol error
+  size_t bytes;      // Response bodies received
+} ClientRun;
+
+typedef struct {
+  int fd;
+  char buf[8192];
+  size_t len, pos;
+} Reader;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+static int refill(Reader *r) {
+  ssize_t n;
+  do {
+    n = recv(r->fd, r->buf, sizeof(r->buf), 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    return -1;
+  }
+  r->len = (size_t)n;
+  r->pos = 0;
+  return 0;
+}
+
+static int read_byte(Reader *r) {
+  if (r->pos == r->len && refill(r) != 0) {
+    return -1;
+  }
+  return (unsigned char)r->buf[r->pos++];
+}
+
+// Reads one "<code> <length>\n" response and skips its body.
+// Returns the code, or -1 if the connection broke.
+static int read_response(Reader *r, size_t *body_len) {
+  char header[32];
+  size_t n = 0;
+  int c;
+  while ((c = read_byte(r)) >= 0 && c != '\n') {
+    if (n + 1 >= sizeof(header)) {
+      return -1;
+    }
+    header[n++] = (char)c;
+  }
+  header[n] = '\0';
+  int code;
+  unsigned long long len;
+  if (c < 0 || sscanf(header, "%d %llu", &code, &len) != 2) {
+    return -1;
+  }
+  *body_len = (size_t)len;
+  while (len > 0) {
+    if (r->pos == r->len && refill(r) != 0) {
+      return -1;
+    }
+    size_t take = r->len - r->pos;
+    take = take < len ? take : (size_t)len;
+    r->pos += take;
+    len -= take;
+  }
+  return code;
+}
+
+static int connect_socket(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static void *client_thread(void *arg) {
+  ClientRun *run = arg;
+  const LoadConfig *config = run->config;
+  Reader reader = {0};
+  reader.fd = connect_socket(config->socket_path);
+  if (reader.fd < 0) {
+    run->failed = 1;
+    return NULL;
+  }
+  char line[4096];
+  size_t body_len;
+  // Passwords with spaces or quotes are not supported here
+  snprintf(line, sizeof(line), "login %s %s\n", config->user,
+           config->password);
+  if (send_all(reader.fd, line, strlen(line)) != 0 ||
+      read_response(&reader, &body_len) != 0) {
+    fprintf(stderr, "!!! loadgen: client %d: login failed\n", run->index);
+    run->failed = 1;
+    close(reader.fd);
+    return NULL;
+  }
+  for (int i = 0; i < config->requests; i++) {
+    const char *command =
+        config->commands[(run->index + i) % config->command_count];
+    snprintf(line, sizeof(line), "%s\n", command);
+    double start = now_seconds();
+    int code = send_all(reader.fd, line, strlen(line)) == 0
+                   ? read_response(&reader, &body_len)
+                   : -1;
+    if (code < 0) {
+      run->failed = 1;
+      break;
+    }
+    run->latencies[run->done++] = now_seconds() - start;
+    run->bytes += body_len;
+    run->errors += code != 0;
+  }
+  send_all(reader.fd, "quit\n", 5);
+  close(reader.fd);
+  return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void usage(void) {
+  fprintf(stderr, "Usage: loadgen --socket PATH --user NAME --password SECRET "
+                  "[--clients N] [--requests N] [--command TEXT]...\n");
+}
+
+int main(int argc, char **argv) {
+  LoadConfig config = {0};
+  config.clients = 8;
+  config.requests = 100;
+  for (int i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!value) {
+      usage();
+      return 2;
+    }
+    if (strcmp(argv[i], "--socket") == 0) {
+      config.socket_path = value;
+    } else if (strcmp(argv[i], "--user") == 0) {
+      config.user = value;
+    } else if (strcmp(argv[i], "--password") == 0) {
+      config.password = value;
+    } else if (strcmp(argv[i], "--clients") == 0) {
+      config.clients = atoi(value);
+    } else if (strcmp(argv[i], "--requests") == 0) {
+      config.requests = atoi(value);
+    } else if (strcmp(argv[i], "--command") == 0 &&
+               config.command_count < LOADGEN_MAX_COMMANDS) {
+      config.commands[config.command_count++] = value;
+    } else {
+      usage();
+      return 2;
+    }
+    i++;
+  }
+  if (!config.socket_path || !config.user || !config.password ||
+      config.clients < 1 || config.requests < 1) {
+    usage();
+    return 2;
+  }
+  if (config.command_count == 0) {
+    config.commands[0] = default_commands[0];
+    config.commands[1] = default_commands[1];
+    config.command_count = 2;
+  }
+
+  ClientRun *runs = calloc((size_t)config.clients, sizeof(*runs));
+  pthread_t *threads = calloc((size_t)config.clients, sizeof(*threads));
+  double *latencies =
+      malloc((size_t)config.clients * config.requests * sizeof(*latencies));
+  if (!runs || !threads || !latencies) {
+    fprintf(stderr, "!!! loadgen: out of memory\n");
+    return 1;
+  }
+  double start = now_seconds();
+  int started = 0;
+  for (; started < config.clients; started++) {
+    runs[started].config = &config;
+    runs[started].index = started;
+    runs[started].latencies = latencies + (size_t)started * config.requests;
+    if (pthread_create(&threads[started], NULL, client_thread,
+                       &runs[started]) != 0) {
+      fprintf(stderr, "!!! loadgen: cannot start client %d\n", started);
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = now_seconds() - start;
+
+  // Gather the latencies of all clients at the front of the array
+  size_t total = 0, bytes = 0;
+  int errors = 0, failed = 0;
+  for (int i = 0; i < started; i++) {
+    memmove(latencies + total, runs[i].latencies,
+            (size_t)runs[i].done * sizeof(*latencies));
+    total += (size_t)runs[i].done;
+    bytes += runs[i].bytes;
+    errors += runs[i].errors;
+    failed += runs[i].failed;
+  }
+  qsort(latencies, total, sizeof(*latencies), compare_doubles);
+  printf("clients %d, requests %zu in %.3f s: %.1f req/s, %zu bytes\n",
+         started, total, elapsed, total / elapsed, bytes);
+  printf("errors %d, failed clients %d\n", errors, failed);
+  if (total > 0) {
+    printf("latency ms: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           latencies[total / 2] * 1e3, latencies[total * 9 / 10] * 1e3,
+           latencies[total * 99 / 100] * 1e3, latencies[total - 1] * 1e3);
+  }
+  free(latencies);
+  free(threads);
+  free(runs);
+  return errors || failed || started < config.clients ? 1 : 0;
+}
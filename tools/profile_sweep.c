@@ -0,0 +1,241 @@
+// tools/profile_sweep.c
+// Runs the deal-insert and report workload against a fresh database for each
+// combination of connection-profile settings and prints throughput per
+// profile. Settings that are not swept are taken from perfume.conf and the
+// PERFUME_DB_* environment. Usage:
+//   profile_sweep [--deals N] [--reports N] [--schema FILE] [--dir DIR]
+
+#define _POSIX_C_SOURCE 200809L // dup, dup2, fdopen, clock_gettime
+
+#include "../includes/db.h"
+#include "../includes/queries.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SWEEP_BROKERS 20
+#define SWEEP_BUYERS 50
+#define SWEEP_SUPPLIERS 10
+#define SWEEP_GOODS 200
+
+static const char *const journal_modes[] = {"DELETE", "WAL"};
+static const char *const sync_levels[] = {"FULL", "NORMAL", "OFF"};
+static const int cache_sizes[] = {-2000, -65536}; // 2 MiB, 64 MiB
+static const long long mmap_sizes[] = {0, 268435456LL};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Deterministic generator so every profile sees the same workload
+static unsigned long sweep_rand_state;
+static unsigned long sweep_rand(void) {
+  sweep_rand_state =
+      sweep_rand_state * 6364136223846793005UL + 1442695040888963407UL;
+  return (sweep_rand_state >> 33) & 0x7fffffffUL;
+}
+
+static void remove_db_files(const char *path) {
+  char extra[512 + sizeof("-journal")];
+  remove(path);
+  snprintf(extra, sizeof(extra), "%s-wal", path);
+  remove(extra);
+  snprintf(extra, sizeof(extra), "%s-shm", path);
+  remove(extra);
+  snprintf(extra, sizeof(extra), "%s-journal", path);
+  remove(extra);
+}
+
+// Reference data: brokers, buyers, suppliers and well-stocked goods
+static int populate_reference_data(void) {
+  char name[64], other[64];
+  int rc = execute_non_query("BEGIN TRANSACTION;");
+  for (int i = 0; i < SWEEP_SUPPLIERS && rc == SQLITE_OK; i++) {
+    snprintf(name, sizeof(name), "Supplier %02d", i);
+    DbParam params[] = {DB_TEXT(name)};
+    rc = execute_non_query_params(
+        "INSERT INTO Suppliers (supplier_name) VALUES (?);", params, 1);
+  }
+  for (int i = 0; i < SWEEP_BROKERS && rc == SQLITE_OK; i++) {
+    snprintf(name, sizeof(name), "Broker%02d", i);
+    rc = insert_broker(name, "Sweep St", 1970 + i);
+  }
+  for (int i = 0; i < SWEEP_BUYERS && rc == SQLITE_OK; i++) {
+    snprintf(name, sizeof(name), "Buyer %02d", i);
+    DbParam params[] = {DB_TEXT(name)};
+    rc = execute_non_query_params("INSERT INTO Buyers (buyer_name) VALUES (?);",
+                                  params, 1);
+  }
+  for (int i = 0; i < SWEEP_GOODS && rc == SQLITE_OK; i++) {
+    snprintf(name, sizeof(name), "Good %03d", i);
+    snprintf(other, sizeof(other), "Supplier %02d", i % SWEEP_SUPPLIERS);
+    rc = insert_good(name, i % 3 == 0 ? "Eau de Parfum" : "Eau de Toilette",
+                     10.0 + i, other, NULL, 1000000000);
+  }
+  if (rc != SQLITE_OK) {
+    execute_non_query("ROLLBACK;");
+    return rc;
+  }
+  return execute_non_query("COMMIT;");
+}
+
+// One interactive-style deal per transaction, as add_new_deal does
+static int run_insert_workload(int deal_count) {
+  char date[11], good[64], supplier[64], broker[64], buyer[64];
+  for (int i = 0; i < deal_count; i++) {
+    int g = (int)(sweep_rand() % SWEEP_GOODS);
+    snprintf(date, sizeof(date), "2025-%02d-%02d", 1 + (int)(sweep_rand() % 12),
+             1 + (int)(sweep_rand() % 28));
+    snprintf(good, sizeof(good), "Good %03d", g);
+    snprintf(supplier, sizeof(supplier), "Supplier %02d", g % SWEEP_SUPPLIERS);
+    snprintf(broker, sizeof(broker), "Broker%02d",
+             (int)(sweep_rand() % SWEEP_BROKERS));
+    snprintf(buyer, sizeof(buyer), "Buyer %02d",
+             (int)(sweep_rand() % SWEEP_BUYERS));
+    DealInput deal = {date,  good, supplier, g % 3 == 0 ? "Eau de Parfum"
+                                                        : "Eau de Toilette",
+                      1 + (int)(sweep_rand() % 5), broker, buyer};
+    if (insert_deal(&deal) != DEAL_RESULT_OK) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Drains a report cursor (consumes every typed column, prints nothing)
+static int drain_report(DbCursor *cur, int rc_open) {
+  int rc = rc_open;
+  double checksum = 0;
+  while (rc == SQLITE_OK && (rc = db_cursor_next(cur)) == SQLITE_ROW) {
+    for (int i = 0; i < cur->column_count; i++) {
+      checksum += db_cursor_double(cur, i);
+    }
+    rc = SQLITE_OK;
+  }
+  db_cursor_close(cur);
+  (void)checksum;
+  return rc == SQLITE_DONE ? 0 : -1;
+}
+
+static int run_report_workload(int rounds) {
+  DbCursor cur;
+  for (int i = 0; i < rounds; i++) {
+    if (drain_report(&cur, open_sales_summary_cursor(&cur, "2025-03-01",
+                                                     "2025-09-30")) != 0 ||
+        drain_report(&cur, open_buyers_by_good_cursor(&cur, NULL)) != 0 ||
+        drain_report(&cur, open_most_popular_type_cursor(&cur)) != 0 ||
+        drain_report(&cur, open_top_broker_cursor(&cur)) != 0 ||
+        drain_report(&cur, open_supplier_brokers_cursor(&cur, NULL)) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Measures one profile combination; returns 0 on success, 1 on failure
+static int sweep_profile(FILE *out, const char *db_path,
+                         const char *schema_path, const char *journal,
+                         const char *sync, int cache_size, long long mmap_size,
+                         int deal_count, int report_rounds) {
+  DbProfile profile;
+  char value[32];
+  // Settings that are not swept (temp_store, page_size, busy_timeout) come
+  // from perfume.conf / PERFUME_DB_* like in the application.
+  db_profile_load(&profile);
+  db_profile_set(&profile, "journal_mode", journal);
+  db_profile_set(&profile, "synchronous", sync);
+  snprintf(value, sizeof(value), "%d", cache_size);
+  db_profile_set(&profile, "cache_size", value);
+  snprintf(value, sizeof(value), "%lld", mmap_size);
+  db_profile_set(&profile, "mmap_size", value);
+  db_set_profile(&profile);
+
+  remove_db_files(db_path);
+  sweep_rand_state = 42;
+  if (open_db(db_path) != 0 || init_tables_if_needed(schema_path) != 0 ||
+      populate_reference_data() != SQLITE_OK) {
+    fprintf(out, "%-8s %-7s setup failed\n", journal, sync);
+    close_db();
+    return 1;
+  }
+
+  double t0 = now_seconds();
+  int rc_insert = run_insert_workload(deal_count);
+  double t1 = now_seconds();
+  int rc_reports = run_report_workload(report_rounds);
+  double t2 = now_seconds();
+  close_db();
+
+  if (rc_insert != 0 || rc_reports != 0) {
+    fprintf(out, "%-8s %-7s workload failed\n", journal, sync);
+    return 1;
+  }
+  fprintf(out, "%-8s %-7s %10d %12lld %12.0f %12.1f\n", journal, sync,
+          cache_size, mmap_size, deal_count / (t1 - t0),
+          report_rounds * 5 / (t2 - t1));
+  fflush(out);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int deal_count = 2000;
+  int report_rounds = 20;
+  const char *schema_path = NULL; // Embedded schema
+  const char *dir = ".";
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--deals") == 0 && i + 1 < argc) {
+      deal_count = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--reports") == 0 && i + 1 < argc) {
+      report_rounds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--schema") == 0 && i + 1 < argc) {
+      schema_path = argv[++i];
+    } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+      dir = argv[++i];
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--deals N] [--reports N] [--schema FILE] "
+              "[--dir DIR]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  // Library DEBUG output and report rows go to /dev/null; results go to the
+  // original stdout.
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  if (saved_stdout < 0 || devnull < 0) {
+    perror("profile_sweep");
+    return 1;
+  }
+  FILE *out = fdopen(saved_stdout, "w");
+  dup2(devnull, STDOUT_FILENO);
+  close(devnull);
+
+  char db_path[512];
+  snprintf(db_path, sizeof(db_path), "%s/profile_sweep.db", dir);
+
+  fprintf(out, "%-8s %-7s %10s %12s %12s %12s\n", "journal", "sync",
+          "cache_size", "mmap_size", "deals/s", "reports/s");
+  int failures = 0;
+  size_t combos = 2 * 3 * 2 * 2;
+  for (size_t k = 0; k < combos; k++) {
+    const char *journal = journal_modes[k / 12];
+    const char *sync = sync_levels[(k / 4) % 3];
+    int cache_size = cache_sizes[(k / 2) % 2];
+    long long mmap_size = mmap_sizes[k % 2];
+    failures += sweep_profile(out, db_path, schema_path, journal, sync,
+                              cache_size, mmap_size, deal_count, report_rounds);
+  }
+
+  remove_db_files(db_path);
+  fclose(out);
+  return failures == 0 ? 0 : 1;
+}